@@ -178,7 +178,7 @@ main(int argc, char **argv)
 
     gtk_main();
 
-    ret = 0;
+    ret = virt_viewer_app_get_exit_status(app);
 
  cleanup:
     g_free(uri);
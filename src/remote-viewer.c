@@ -597,7 +597,7 @@ spice_ctrl_listen_async_cb(GObject *object,
                                               _("Controller connection failed: %s"),
                                               error->message);
         g_clear_error(&error);
-        exit(EXIT_FAILURE); /* TODO: make start async? */
+        virt_viewer_app_main_quit(app, EXIT_FAILURE);
     }
 }
 
@@ -690,10 +690,7 @@ authenticate_cb(RestProxy *proxy, G_GNUC_UNUSED RestProxyAuth *auth,
 {
     gchar *username;
     gchar *password;
-    VirtViewerWindow *window;
-
-    window = virt_viewer_app_get_main_window(VIRT_VIEWER_APP(user_data));
-    int ret = virt_viewer_auth_collect_credentials(virt_viewer_window_get_window(window),
+    int ret = virt_viewer_auth_collect_credentials(VIRT_VIEWER_APP(user_data),
                                                    "oVirt",
                                                    NULL,
                                                    &username, &password);
@@ -978,6 +975,11 @@ remote_viewer_start(VirtViewerApp *app)
 #endif
 retry_dialog:
         if (priv->open_recent_dialog) {
+            if (virt_viewer_app_get_headless(app)) {
+                virt_viewer_app_simple_message_dialog(app, _("No URI to connect to, and the connection "
+                                                             "dialog can't be shown in headless mode"));
+                return FALSE;
+            }
             if (connect_dialog(&guri) != 0)
                 return FALSE;
             g_object_set(app, "guri", guri, NULL);
@@ -17,6 +17,26 @@
 
 #include "virt-glib-compat.h"
 
+#if !GLIB_CHECK_VERSION(2,28,0)
+#include <time.h>
+
+gint64 g_get_monotonic_time (void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+    return ((gint64) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+  {
+    GTimeVal tv;
+
+    g_get_current_time (&tv);
+    return ((gint64) tv.tv_sec) * 1000000 + tv.tv_usec;
+  }
+}
+#endif
+
 #if !GLIB_CHECK_VERSION(2,32,0)
 GByteArray *g_byte_array_new_take (guint8 *data, gsize len)
 {
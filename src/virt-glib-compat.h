@@ -52,6 +52,8 @@ G_BEGIN_DECLS
 #endif
 
 #if !GLIB_CHECK_VERSION(2,28,0)
+#define g_get_user_runtime_dir() g_get_user_cache_dir()
+gint64 g_get_monotonic_time (void);
 #define g_clear_object(object_ptr) \
   G_STMT_START {                                                             \
     /* Only one access, please */                                            \
@@ -69,6 +71,9 @@ G_BEGIN_DECLS
 
 #if !GLIB_CHECK_VERSION(2,32,0)
 GByteArray *g_byte_array_new_take (guint8 *data, gsize len);
+#define g_thread_new(name, func, data) g_thread_create(func, data, FALSE, NULL)
+/* threads created above are not joinable and own their GThread */
+#define g_thread_unref(thread) G_STMT_START { (void)(thread); } G_STMT_END
 #endif
 
 G_END_DECLS
@@ -28,6 +28,7 @@
 #include <gtk/gtk.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -50,11 +51,24 @@
 #include <windows.h>
 #endif
 
+#if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
+#include <sys/wait.h>
+#endif
+
 #include "virt-gtk-compat.h"
 #include "virt-viewer-app.h"
 #include "virt-viewer-auth.h"
+#include "virt-viewer-capture.h"
+#include "virt-viewer-channel-pool.h"
+#include "virt-viewer-display-menu.h"
 #include "virt-viewer-window.h"
 #include "virt-viewer-session.h"
+#include "virt-viewer-connect.h"
+#include "virt-viewer-screenshot.h"
+#include "virt-viewer-timeline.h"
+#include "virt-viewer-trace.h"
+#include "virt-viewer-tunnel.h"
+#include "virt-viewer-watchdog.h"
 #ifdef HAVE_GTK_VNC
 #include "virt-viewer-session-vnc.h"
 #endif
@@ -120,12 +134,20 @@ struct _VirtViewerAppPrivate {
     gboolean attach;
     gboolean quitting;
     gboolean kiosk;
+    gboolean headless; /* windows are never shown */
+    VirtViewerCapture *capture;
+    gboolean direct_tcp; /* sockets are connected by us, not the session */
 
     VirtViewerSession *session;
     gboolean active;
     gboolean connected;
     gboolean cancelled;
+    gboolean connecting; /* an asynchronous connection attempt is in flight */
     guint reconnect_poll; /* source id */
+    guint reconnect_delay; /* ms, before jitter */
+    gboolean reconnect_reset; /* next failure restarts from the shortest delay */
+    guint reconnect_attempts;
+    GTimer *reconnect_timer; /* since the display went away */
     char *unixsock;
     char *guri; /* prefered over ghost:gport */
     char *ghost;
@@ -135,6 +157,11 @@ struct _VirtViewerAppPrivate {
     int port;/* ssh */
     char *user; /* ssh */
     char *transport;
+    gchar **ssh_master_exit; /* argv stopping the shared ssh connection */
+    GSList *tunnels; /* VirtViewerTunnel, running ssh children */
+    VirtViewerChannelPool *channel_pool; /* provisions channel fds concurrently */
+    guint connect_timeout; /* seconds, 0 for none */
+    gchar *timeline_file; /* connection timelines are appended to it */
     char *pretty_address;
     gchar *guest_name;
     gboolean grabbed;
@@ -149,9 +176,23 @@ struct _VirtViewerAppPrivate {
     guint remove_smartcard_accel_key;
     GdkModifierType remove_smartcard_accel_mods;
     gboolean quit_on_disconnect;
+
+    guint menu_displays_idle; /* pending display menus update */
+
+    guint message_dialogs; /* error dialogs still open */
+    gboolean quit_pending; /* until they are dismissed */
+    gint exit_status;
+    GtkWidget *quit_dialog;
+    GtkWidget *auth_refused_dialog;
+    gboolean deactivate_pending; /* until auth_refused_dialog is answered */
+    gboolean deactivate_error;
 };
 
 
+/* Bounds of the exponential backoff between reconnect attempts */
+#define VIRT_VIEWER_APP_RECONNECT_MIN_DELAY 500
+#define VIRT_VIEWER_APP_RECONNECT_MAX_DELAY 30000
+
 G_DEFINE_ABSTRACT_TYPE(VirtViewerApp, virt_viewer_app, G_TYPE_OBJECT)
 #define GET_PRIVATE(o)                                                        \
     (G_TYPE_INSTANCE_GET_PRIVATE ((o), VIRT_VIEWER_TYPE_APP, VirtViewerAppPrivate))
@@ -197,6 +238,73 @@ virt_viewer_app_set_debug(gboolean debug)
     doDebug = debug;
 }
 
+static gboolean
+virt_viewer_app_main_quit_idle(gpointer opaque G_GNUC_UNUSED)
+{
+    gtk_main_quit();
+    return FALSE;
+}
+
+static void
+virt_viewer_app_do_main_quit(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+
+    priv->quit_pending = FALSE;
+    /* Failures found while starting up come before gtk_main() */
+    if (gtk_main_level() == 0)
+        g_idle_add(virt_viewer_app_main_quit_idle, NULL);
+    else
+        gtk_main_quit();
+}
+
+static void
+virt_viewer_app_message_dialog_destroy(GtkWidget *dialog G_GNUC_UNUSED,
+                                       VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+
+    g_return_if_fail(priv->message_dialogs > 0);
+
+    priv->message_dialogs--;
+    if (priv->message_dialogs == 0 && priv->quit_pending)
+        virt_viewer_app_do_main_quit(self);
+}
+
+/*
+ * Leaves the main loop, once the error dialogs explaining why have been
+ * dismissed. A @status other than EXIT_SUCCESS is kept as the exit status,
+ * see virt_viewer_app_get_exit_status().
+ */
+void
+virt_viewer_app_main_quit(VirtViewerApp *self, gint status)
+{
+    VirtViewerAppPrivate *priv;
+
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+    priv = self->priv;
+
+    if (status != EXIT_SUCCESS)
+        priv->exit_status = status;
+
+    if (priv->message_dialogs > 0) {
+        DEBUG_LOG("Quitting once %u dialog(s) are dismissed", priv->message_dialogs);
+        priv->quit_pending = TRUE;
+        return;
+    }
+
+    virt_viewer_app_do_main_quit(self);
+}
+
+/* What main() should return once the main loop is left */
+gint
+virt_viewer_app_get_exit_status(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), EXIT_FAILURE);
+
+    return self->priv->exit_status;
+}
+
 void
 virt_viewer_app_simple_message_dialog(VirtViewerApp *self,
                                       const char *fmt, ...)
@@ -213,6 +321,12 @@ virt_viewer_app_simple_message_dialog(VirtViewerApp *self,
 
     va_end(vargs);
 
+    if (self->priv->headless) {
+        g_printerr("%s\n", msg);
+        g_free(msg);
+        return;
+    }
+
     dialog = gtk_message_dialog_new(window,
                                     GTK_DIALOG_MODAL |
                                     GTK_DIALOG_DESTROY_WITH_PARENT,
@@ -221,9 +335,18 @@ virt_viewer_app_simple_message_dialog(VirtViewerApp *self,
                                     "%s",
                                     msg);
 
-    gtk_dialog_run(GTK_DIALOG(dialog));
-
-    gtk_widget_destroy(dialog);
+    if (gtk_main_level() == 0) {
+        /* Nothing would show it before the main loop runs */
+        gtk_dialog_run(GTK_DIALOG(dialog));
+        gtk_widget_destroy(dialog);
+    } else {
+        self->priv->message_dialogs++;
+        g_signal_connect_swapped(dialog, "response",
+                                 G_CALLBACK(gtk_widget_destroy), dialog);
+        g_signal_connect(dialog, "destroy",
+                         G_CALLBACK(virt_viewer_app_message_dialog_destroy), self);
+        gtk_widget_show(dialog);
+    }
 
     g_free(msg);
 }
@@ -362,6 +485,29 @@ void virt_viewer_app_set_uuid_string(VirtViewerApp* self, const gchar* uuid_stri
     }
 }
 
+static void
+virt_viewer_app_quit_response(GtkDialog *dialog,
+                              gint response,
+                              VirtViewerApp *self)
+{
+    GtkWidget *check = g_object_get_data(G_OBJECT(dialog), "dont-ask");
+    gboolean dont_ask = FALSE;
+
+    g_object_get(check, "active", &dont_ask, NULL);
+    if (dont_ask)
+        g_key_file_set_boolean(self->priv->config,
+                "virt-viewer", "ask-quit", FALSE);
+
+    gtk_widget_destroy(GTK_WIDGET(dialog));
+    switch (response) {
+        case GTK_RESPONSE_OK:
+            virt_viewer_app_quit(self);
+            break;
+        default:
+            break;
+    }
+}
+
 void
 virt_viewer_app_maybe_quit(VirtViewerApp *self, VirtViewerWindow *window)
 {
@@ -374,6 +520,11 @@ virt_viewer_app_maybe_quit(VirtViewerApp *self, VirtViewerWindow *window)
         g_clear_error(&error);
     }
 
+    if (self->priv->quit_dialog) {
+        gtk_window_present(GTK_WINDOW(self->priv->quit_dialog));
+        return;
+    }
+
     if (ask) {
         GtkWidget *dialog =
             gtk_message_dialog_new (virt_viewer_window_get_window(window),
@@ -385,24 +536,15 @@ virt_viewer_app_maybe_quit(VirtViewerApp *self, VirtViewerWindow *window)
         GtkWidget *check = gtk_check_button_new_with_label(_("Do not ask me again"));
         gtk_container_add(GTK_CONTAINER(gtk_dialog_get_content_area(GTK_DIALOG(dialog))), check);
         gtk_widget_show(check);
+        g_object_set_data(G_OBJECT(dialog), "dont-ask", check);
 
         gtk_dialog_set_default_response (GTK_DIALOG(dialog), GTK_RESPONSE_CANCEL);
-        gint result = gtk_dialog_run(GTK_DIALOG(dialog));
-
-        gboolean dont_ask = FALSE;
-        g_object_get(check, "active", &dont_ask, NULL);
-        if (dont_ask)
-            g_key_file_set_boolean(self->priv->config,
-                    "virt-viewer", "ask-quit", FALSE);
-
-        gtk_widget_destroy(dialog);
-        switch (result) {
-            case GTK_RESPONSE_OK:
-                virt_viewer_app_quit(self);
-                break;
-            default:
-                break;
-        }
+        g_signal_connect(dialog, "response",
+                         G_CALLBACK(virt_viewer_app_quit_response), self);
+        g_signal_connect(dialog, "destroy",
+                         G_CALLBACK(gtk_widget_destroyed), &self->priv->quit_dialog);
+        self->priv->quit_dialog = dialog;
+        gtk_widget_show(dialog);
     } else {
         virt_viewer_app_quit(self);
     }
@@ -483,52 +625,145 @@ virt_viewer_app_about_delete(GtkWidget *dialog,
 
 #if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
 
-static int
-virt_viewer_app_open_tunnel(const char **cmd)
+/* An ssh child exited by itself, taking its display connection along */
+static void
+virt_viewer_app_tunnel_exited(VirtViewerTunnel *tunnel,
+                              gint status,
+                              const gchar *errors,
+                              gpointer opaque)
 {
-    int fd[2];
-    pid_t pid;
+    VirtViewerApp *self = opaque;
 
-    if (socketpair(PF_UNIX, SOCK_STREAM, 0, fd) < 0)
-        return -1;
+    self->priv->tunnels = g_slist_remove(self->priv->tunnels, tunnel);
 
-    pid = fork();
-    if (pid == -1) {
-        close(fd[0]);
-        close(fd[1]);
-        return -1;
-    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        virt_viewer_app_trace(self, "SSH tunnel exited with status %d after %.3f seconds%s%s",
+                              WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+                              virt_viewer_tunnel_get_elapsed(tunnel),
+                              *errors ? ": " : "", errors);
+}
+
+/* Kills the tunnels, their child watches still reap them */
+static void
+virt_viewer_app_stop_tunnels(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    GSList *l;
+
+    for (l = priv->tunnels; l; l = l->next)
+        virt_viewer_tunnel_kill(l->data);
+
+    g_slist_free(priv->tunnels);
+    priv->tunnels = NULL;
+}
+
+
+/*
+ * All tunnels to the same ssh host go through a single ssh
+ * connection: the first ssh started becomes the master and later ones
+ * only open a new channel over its control socket. The master lingers
+ * for a while after its last user is gone, so that a reconnect can
+ * still use it, and is stopped when the app goes away by
+ * virt_viewer_app_stop_ssh_master().
+ */
+#define VIRT_VIEWER_APP_SSH_PERSIST "ControlPersist=60"
 
-    if (pid == 0) { /* child */
-        close(fd[0]);
-        close(0);
-        close(1);
-        if (dup(fd[1]) < 0)
-            _exit(1);
-        if (dup(fd[1]) < 0)
-            _exit(1);
-        close(fd[1]);
-        execvp("ssh", (char *const*)cmd);
-        _exit(1);
+/*
+ * ControlPersist needs OpenSSH 5.6, other ssh clients reject the
+ * options altogether. ssh reads -o before acting on -V, so asking for
+ * the version with the option set tells without going anywhere.
+ */
+static gboolean
+virt_viewer_app_ssh_can_share(void)
+{
+    static gint supported = -1;
+    gchar *argv[] = { (gchar *)"ssh", (gchar *)"-o",
+                      (gchar *)VIRT_VIEWER_APP_SSH_PERSIST, (gchar *)"-V", NULL };
+    GError *error = NULL;
+    gint status;
+
+    if (supported >= 0)
+        return supported;
+
+    if (g_spawn_sync(NULL, argv, NULL,
+                     G_SPAWN_SEARCH_PATH |
+                     G_SPAWN_STDOUT_TO_DEV_NULL |
+                     G_SPAWN_STDERR_TO_DEV_NULL,
+                     NULL, NULL, NULL, NULL, &status, &error)) {
+        supported = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    } else {
+        DEBUG_LOG("Unable to run ssh: %s", error->message);
+        g_clear_error(&error);
+        supported = FALSE;
     }
-    close(fd[1]);
-    return fd[0];
+    DEBUG_LOG("ssh %s connection sharing", supported ? "supports" : "lacks");
+
+    return supported;
 }
 
+/* NULL if ssh can't share a connection between tunnels */
+static gchar *
+virt_viewer_app_ssh_control_path(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    GPtrArray *argv;
+    gchar *target, *hash, *name, *path;
+
+    if (!virt_viewer_app_ssh_can_share())
+        return NULL;
+
+    /* Keep it short, unix socket paths are limited to ~100 bytes */
+    target = g_strdup_printf("%s@%s:%d", priv->user ? priv->user : "",
+                             priv->host, priv->port);
+    hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, target, -1);
+    name = g_strdup_printf("virt-viewer-%d-%.12s", (int)getpid(), hash);
+    path = g_build_filename(g_get_user_runtime_dir(), name, NULL);
+    g_free(name);
+    g_free(hash);
+    g_free(target);
+
+    if (!priv->ssh_master_exit) {
+        argv = g_ptr_array_new();
+        g_ptr_array_add(argv, g_strdup("ssh"));
+        g_ptr_array_add(argv, g_strdup("-o"));
+        g_ptr_array_add(argv, g_strdup_printf("ControlPath=%s", path));
+        g_ptr_array_add(argv, g_strdup("-O"));
+        g_ptr_array_add(argv, g_strdup("exit"));
+        g_ptr_array_add(argv, g_strdup(priv->host));
+        g_ptr_array_add(argv, NULL);
+        priv->ssh_master_exit = (gchar **)g_ptr_array_free(argv, FALSE);
+    }
+
+    return path;
+}
 
 static int
-virt_viewer_app_open_tunnel_ssh(const char *sshhost,
+virt_viewer_app_open_tunnel_ssh(VirtViewerApp *self,
+                                const char *sshhost,
                                 int sshport,
                                 const char *sshuser,
                                 const char *host,
                                 const char *port,
-                                const char *unixsock)
+                                const char *unixsock,
+                                const char *controlpath)
 {
-    const char *cmd[10];
+    VirtViewerTunnel *tunnel;
+    const char *cmd[16];
     char portstr[50];
+    gchar *controlopt = NULL;
     int n = 0;
+    int fd;
 
     cmd[n++] = "ssh";
+    if (controlpath) {
+        controlopt = g_strdup_printf("ControlPath=%s", controlpath);
+        cmd[n++] = "-o";
+        cmd[n++] = "ControlMaster=auto";
+        cmd[n++] = "-o";
+        cmd[n++] = controlopt;
+        cmd[n++] = "-o";
+        cmd[n++] = VIRT_VIEWER_APP_SSH_PERSIST;
+    }
     if (sshport) {
         cmd[n++] = "-p";
         sprintf(portstr, "%d", sshport);
@@ -549,7 +784,14 @@ virt_viewer_app_open_tunnel_ssh(const char *sshhost,
     }
     cmd[n++] = NULL;
 
-    return virt_viewer_app_open_tunnel(cmd);
+    tunnel = virt_viewer_tunnel_open(cmd, &fd, virt_viewer_app_tunnel_exited, self);
+    g_free(controlopt);
+    if (!tunnel)
+        return -1;
+
+    virt_viewer_timeline_begin(VIRT_VIEWER_PHASE_SSH);
+    self->priv->tunnels = g_slist_prepend(self->priv->tunnels, tunnel);
+    return fd;
 }
 
 static int
@@ -575,6 +817,44 @@ virt_viewer_app_open_unix_sock(const char *unixsock)
 
 #endif /* defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK) */
 
+static void
+virt_viewer_app_ssh_master_exited(GPid pid,
+                                  gint status,
+                                  gpointer opaque G_GNUC_UNUSED)
+{
+    DEBUG_LOG("Shared ssh connection stop request exited with status %d", status);
+    g_spawn_close_pid(pid);
+}
+
+/* Doesn't wait for ssh to reach the master, it may be across the world */
+static void
+virt_viewer_app_stop_ssh_master(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    GError *error = NULL;
+    GPid pid;
+
+    if (!priv->ssh_master_exit)
+        return;
+
+    DEBUG_LOG("Stopping shared ssh connection to %s",
+              priv->ssh_master_exit[g_strv_length(priv->ssh_master_exit) - 1]);
+    if (g_spawn_async(NULL, priv->ssh_master_exit, NULL,
+                      G_SPAWN_SEARCH_PATH |
+                      G_SPAWN_DO_NOT_REAP_CHILD |
+                      G_SPAWN_STDOUT_TO_DEV_NULL |
+                      G_SPAWN_STDERR_TO_DEV_NULL,
+                      NULL, NULL, &pid, &error)) {
+        g_child_watch_add(pid, virt_viewer_app_ssh_master_exited, NULL);
+    } else {
+        DEBUG_LOG("Unable to stop shared ssh connection: %s", error->message);
+        g_clear_error(&error);
+    }
+
+    g_strfreev(priv->ssh_master_exit);
+    priv->ssh_master_exit = NULL;
+}
+
 void
 virt_viewer_app_trace(VirtViewerApp *self,
                       const char *fmt, ...)
@@ -597,6 +877,40 @@ virt_viewer_app_trace(VirtViewerApp *self,
     }
 }
 
+/*
+ * Ends the timeline of the current connection attempt, if it is still
+ * being recorded, and reports it
+ */
+static void
+virt_viewer_app_report_timeline(VirtViewerApp *self,
+                                const gchar *result)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    gchar *str;
+    FILE *fp;
+
+    if (!virt_viewer_timeline_finish())
+        return;
+
+    if (doDebug || priv->verbose) {
+        str = virt_viewer_timeline_summary();
+        virt_viewer_app_trace(self, "%s", str);
+        g_free(str);
+    }
+
+    if (!priv->timeline_file)
+        return;
+
+    if (!(fp = fopen(priv->timeline_file, "a"))) {
+        g_warning("Unable to open %s: %s", priv->timeline_file, g_strerror(errno));
+        return;
+    }
+    str = virt_viewer_timeline_to_json(result);
+    fprintf(fp, "%s\n", str);
+    fclose(fp);
+    g_free(str);
+}
+
 static void
 virt_viewer_app_set_window_subtitle(VirtViewerApp *app,
                                     VirtViewerWindow *window,
@@ -801,6 +1115,7 @@ display_show_hint(VirtViewerDisplay *display,
     } else if (hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY) {
         virt_viewer_notebook_show_display(nb);
         virt_viewer_window_show(win);
+        virt_viewer_app_report_timeline(self, "connected");
     } else {
         if (!self->priv->kiosk)
             virt_viewer_notebook_show_status(nb, _("Waiting for display %d..."), nth + 1);
@@ -837,7 +1152,6 @@ virt_viewer_app_display_added(VirtViewerSession *session G_GNUC_UNUSED,
     }
 
     virt_viewer_window_set_display(window, display);
-    virt_viewer_app_update_menu_displays(self);
     virt_viewer_signal_connect_object(display, "notify::show-hint",
                                       G_CALLBACK(display_show_hint), window, 0);
     g_object_notify(G_OBJECT(display), "show-hint"); /* call display_show_hint */
@@ -936,6 +1250,8 @@ virt_viewer_app_create_session(VirtViewerApp *self, const gchar *type)
                      G_CALLBACK(virt_viewer_app_display_removed), self);
     g_signal_connect(priv->session, "session-display-updated",
                      G_CALLBACK(virt_viewer_app_display_updated), self);
+    g_signal_connect(priv->session, "session-displays-changed",
+                     G_CALLBACK(virt_viewer_app_display_updated), self);
     g_signal_connect(priv->session, "notify::has-usbredir",
                      G_CALLBACK(virt_viewer_app_has_usbredir_updated), self);
 
@@ -972,33 +1288,189 @@ virt_viewer_app_open_connection(VirtViewerApp *self, int *fd)
 
 
 #if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
+typedef struct {
+    VirtViewerApp *self;
+    VirtViewerSession *session;
+    VirtViewerSessionChannel *channel; /* NULL for the main connection */
+} VirtViewerAppConnectTcp;
+
 static void
-virt_viewer_app_channel_open(VirtViewerSession *session,
-                             VirtViewerSessionChannel *channel,
-                             VirtViewerApp *self)
+virt_viewer_app_tcp_connected(int fd, const GError *error, gpointer opaque)
 {
-    VirtViewerAppPrivate *priv;
-    int fd = -1;
+    VirtViewerAppConnectTcp *data = opaque;
+    VirtViewerApp *self = data->self;
 
-    g_return_if_fail(self != NULL);
+    if (self->priv->session != data->session) {
+        DEBUG_LOG("Session went away while connecting");
+        if (fd >= 0)
+            close(fd);
+        goto cleanup;
+    }
 
-    if (!virt_viewer_app_open_connection(self, &fd))
-        return;
+    if (fd < 0) {
+        virt_viewer_app_trace(self, "%s", error->message);
+        if (!data->channel)
+            virt_viewer_app_disconnected(data->session, self);
+        goto cleanup;
+    }
+
+    if (data->channel)
+        virt_viewer_session_channel_open_fd(data->session, data->channel, fd);
+    else if (!virt_viewer_session_open_fd(data->session, fd))
+        virt_viewer_app_disconnected(data->session, self);
+
+ cleanup:
+    if (data->channel)
+        g_object_unref(data->channel);
+    g_object_unref(data->session);
+    g_object_unref(data->self);
+    g_free(data);
+}
+
+/*
+ * Connects to the display ourselves, racing the host's addresses,
+ * and hands the socket to the session or to @channel
+ */
+static void
+virt_viewer_app_connect_tcp(VirtViewerApp *self,
+                            VirtViewerSessionChannel *channel)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    VirtViewerAppConnectTcp *data = g_new0(VirtViewerAppConnectTcp, 1);
+
+    data->self = g_object_ref(self);
+    data->session = g_object_ref(priv->session);
+    data->channel = channel ? g_object_ref(channel) : NULL;
+
+    virt_viewer_connect_tcp_async(priv->ghost, priv->gport,
+                                  priv->connect_timeout,
+                                  virt_viewer_app_tcp_connected, data);
+}
+
+static gboolean
+virt_viewer_app_can_connect_tcp(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+
+    /* TLS needs the session to know about the second port */
+    return priv->ghost && priv->gport && !priv->gtlsport;
+}
+
+/*
+ * A spice:// or vnc:// URI naming nothing more than a host and a plain
+ * port is connected to directly, racing the host's addresses, rather
+ * than handed to the session as is.
+ */
+static gboolean
+virt_viewer_app_uri_to_host(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    gchar *host = NULL, *port = NULL;
+
+    if (virt_viewer_session_get_file(priv->session) ||
+        !virt_viewer_connect_parse_uri(priv->guri, &host, &port))
+        return FALSE;
+
+    g_free(priv->ghost);
+    g_free(priv->gport);
+    g_free(priv->gtlsport);
+    priv->ghost = host;
+    priv->gport = port;
+    priv->gtlsport = NULL;
+    virt_viewer_session_set_uri(priv->session, priv->guri);
+
+    return TRUE;
+}
+
+/* Number of channel fds asked to open_connection at the same time */
+#define VIRT_VIEWER_APP_CHANNEL_OPEN_THREADS 4
+
+typedef struct {
+    VirtViewerApp *self;
+    VirtViewerSession *session;
+    VirtViewerSessionChannel *channel;
+} VirtViewerAppChannelOpen;
+
+static void
+virt_viewer_app_channel_open_done(gpointer request,
+                                  gboolean ret,
+                                  int fd,
+                                  gpointer opaque G_GNUC_UNUSED)
+{
+    VirtViewerAppChannelOpen *data = request;
+    VirtViewerApp *self = data->self;
+    VirtViewerAppPrivate *priv = self->priv;
 
     DEBUG_LOG("After open connection callback fd=%d", fd);
 
-    priv = self->priv;
+    if (priv->session != data->session) {
+        DEBUG_LOG("Session went away while opening channel");
+        if (fd >= 0)
+            close(fd);
+        goto cleanup;
+    }
+    if (!ret)
+        goto cleanup;
+
     if (priv->transport && g_ascii_strcasecmp(priv->transport, "ssh") == 0 &&
         !priv->direct && fd == -1) {
-        if ((fd = virt_viewer_app_open_tunnel_ssh(priv->host, priv->port, priv->user,
-                                                  priv->ghost, priv->gport, NULL)) < 0)
+        gchar *controlpath = virt_viewer_app_ssh_control_path(self);
+
+        fd = virt_viewer_app_open_tunnel_ssh(self, priv->host, priv->port, priv->user,
+                                             priv->ghost, priv->gport, NULL,
+                                             controlpath);
+        g_free(controlpath);
+        if (fd < 0)
             virt_viewer_app_simple_message_dialog(self, _("Connect to ssh failed."));
+    } else if (fd == -1 && priv->direct_tcp) {
+        virt_viewer_app_connect_tcp(self, data->channel);
     } else if (fd == -1) {
         virt_viewer_app_simple_message_dialog(self, _("Can't connect to channel, SSH only supported."));
     }
 
     if (fd >= 0)
-        virt_viewer_session_channel_open_fd(session, channel, fd);
+        virt_viewer_session_channel_open_fd(data->session, data->channel, fd);
+
+ cleanup:
+    g_object_unref(data->channel);
+    g_object_unref(data->session);
+    g_object_unref(data->self);
+    g_free(data);
+}
+
+static gboolean
+virt_viewer_app_channel_open_thread(int *fd, gpointer opaque)
+{
+    return virt_viewer_app_open_connection(opaque, fd);
+}
+
+/*
+ * Requests are taken by channel priority (main, display, inputs,
+ * cursor, then the others for SPICE) by the channel pool
+ */
+static void
+virt_viewer_app_channel_open(VirtViewerSession *session,
+                             VirtViewerSessionChannel *channel,
+                             VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv;
+    VirtViewerAppChannelOpen *data;
+
+    g_return_if_fail(self != NULL);
+
+    priv = self->priv;
+    if (!priv->channel_pool)
+        priv->channel_pool = virt_viewer_channel_pool_new(VIRT_VIEWER_APP_CHANNEL_OPEN_THREADS,
+                                                          virt_viewer_app_channel_open_thread,
+                                                          virt_viewer_app_channel_open_done,
+                                                          self);
+
+    data = g_new0(VirtViewerAppChannelOpen, 1);
+    data->self = g_object_ref(self);
+    data->session = g_object_ref(session);
+    data->channel = g_object_ref(channel);
+    virt_viewer_channel_pool_push(priv->channel_pool, data,
+                                  virt_viewer_session_channel_priority(session, channel));
 }
 #else
 static void
@@ -1014,12 +1486,14 @@ static gboolean
 virt_viewer_app_default_activate(VirtViewerApp *self, GError **error)
 {
     VirtViewerAppPrivate *priv = self->priv;
+    const gchar *uri = priv->guri;
     int fd = -1;
 
     if (!virt_viewer_app_open_connection(self, &fd))
         return FALSE;
 
     DEBUG_LOG("After open connection callback fd=%d", fd);
+    priv->direct_tcp = FALSE;
 
 #if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
     if (priv->transport &&
@@ -1027,6 +1501,7 @@ virt_viewer_app_default_activate(VirtViewerApp *self, GError **error)
         !priv->direct &&
         fd == -1) {
         gchar *p = NULL;
+        gchar *controlpath;
 
         if (priv->gport) {
             virt_viewer_app_trace(self, "Opening indirect TCP connection to display at %s:%s",
@@ -1044,26 +1519,39 @@ virt_viewer_app_default_activate(VirtViewerApp *self, GError **error)
                               priv->host, p ? p : "");
         g_free(p);
 
-        if ((fd = virt_viewer_app_open_tunnel_ssh(priv->host, priv->port,
-                                                  priv->user, priv->ghost,
-                                                  priv->gport, priv->unixsock)) < 0)
+        controlpath = virt_viewer_app_ssh_control_path(self);
+        fd = virt_viewer_app_open_tunnel_ssh(self, priv->host, priv->port,
+                                             priv->user, priv->ghost,
+                                             priv->gport, priv->unixsock,
+                                             controlpath);
+        g_free(controlpath);
+        if (fd < 0)
             return FALSE;
     } else if (priv->unixsock && fd == -1) {
         virt_viewer_app_trace(self, "Opening direct UNIX connection to display at %s",
                               priv->unixsock);
         if ((fd = virt_viewer_app_open_unix_sock(priv->unixsock)) < 0)
             return FALSE;
+    } else if (uri && fd == -1 && virt_viewer_app_uri_to_host(self)) {
+        uri = NULL;
     }
 #endif
 
     if (fd >= 0) {
         return virt_viewer_session_open_fd(VIRT_VIEWER_SESSION(priv->session), fd);
-    } else if (priv->guri) {
-        virt_viewer_app_trace(self, "Opening connection to display at %s", priv->guri);
-        return virt_viewer_session_open_uri(VIRT_VIEWER_SESSION(priv->session), priv->guri, error);
+    } else if (uri) {
+        virt_viewer_app_trace(self, "Opening connection to display at %s", uri);
+        return virt_viewer_session_open_uri(VIRT_VIEWER_SESSION(priv->session), uri, error);
     } else {
         virt_viewer_app_trace(self, "Opening direct TCP connection to display at %s:%s:%s",
                               priv->ghost, priv->gport, priv->gtlsport ? priv->gtlsport : "-1");
+#if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
+        if (virt_viewer_app_can_connect_tcp(self)) {
+            priv->direct_tcp = TRUE;
+            virt_viewer_app_connect_tcp(self, NULL);
+            return TRUE;
+        }
+#endif
         return virt_viewer_session_open_host(VIRT_VIEWER_SESSION(priv->session),
                                              priv->ghost, priv->gport, priv->gtlsport);
     }
@@ -1168,6 +1656,7 @@ virt_viewer_app_initial_connect(VirtViewerApp *self, GError **error)
     g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
     klass = VIRT_VIEWER_APP_GET_CLASS(self);
 
+    virt_viewer_timeline_start();
     return klass->initial_connect(self, error);
 }
 
@@ -1181,38 +1670,158 @@ virt_viewer_app_retryauth(gpointer opaque)
     return FALSE;
 }
 
+static gboolean virt_viewer_app_connect_timer(void *opaque);
+
+static void
+virt_viewer_app_schedule_reconnect(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    guint delay;
+
+    /* Spread retries of many idle viewers over the second half of the
+     * interval, so they don't all hit libvirtd at once */
+    delay = priv->reconnect_delay / 2 +
+        g_random_int_range(0, priv->reconnect_delay / 2 + 1);
+
+    DEBUG_LOG("Next reconnect attempt in %u ms", delay);
+    priv->reconnect_poll = g_timeout_add(delay, virt_viewer_app_connect_timer, self);
+}
+
 static gboolean
 virt_viewer_app_connect_timer(void *opaque)
 {
     VirtViewerApp *self = opaque;
     VirtViewerAppPrivate *priv = self->priv;
 
-    DEBUG_LOG("Connect timer fired");
+    priv->reconnect_poll = 0;
+    if (priv->active)
+        return FALSE;
 
-    if (!priv->active &&
-        virt_viewer_app_initial_connect(self, NULL) < 0)
-        gtk_main_quit();
+    /* The attempt in flight asks for the next one if it fails */
+    if (priv->connecting) {
+        DEBUG_LOG("Connect timer fired while connecting, waiting for the result");
+        return FALSE;
+    }
 
-    if (priv->active) {
-        priv->reconnect_poll = 0;
+    priv->reconnect_attempts++;
+    virt_viewer_trace(VIRT_VIEWER_TRACE_RECONNECT, priv->reconnect_attempts, 0);
+    DEBUG_LOG("Connect timer fired, attempt %u", priv->reconnect_attempts);
+
+    if (!virt_viewer_app_initial_connect(self, NULL)) {
+        virt_viewer_app_main_quit(self, EXIT_FAILURE);
         return FALSE;
     }
 
-    return TRUE;
+    /* Synchronous connections have failed already */
+    if (!priv->connecting && !priv->active)
+        virt_viewer_app_reconnect_failed(self);
+
+    return FALSE;
+}
+
+/*
+ * Reports the end of a connection attempt which left the app inactive:
+ * while polling for the guest, the next attempt is scheduled with a
+ * longer delay.
+ */
+void
+virt_viewer_app_reconnect_failed(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv;
+
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+    priv = self->priv;
+
+    if (!priv->reconnect_timer || priv->reconnect_poll != 0 || priv->active)
+        return;
+
+    if (priv->reconnect_reset) {
+        priv->reconnect_reset = FALSE;
+        priv->reconnect_delay = VIRT_VIEWER_APP_RECONNECT_MIN_DELAY;
+    } else {
+        priv->reconnect_delay = MIN(priv->reconnect_delay * 2,
+                                    VIRT_VIEWER_APP_RECONNECT_MAX_DELAY);
+    }
+    virt_viewer_app_schedule_reconnect(self);
+}
+
+/* Subclasses connecting asynchronously tell when an attempt is in flight */
+void
+virt_viewer_app_set_connecting(VirtViewerApp *self, gboolean connecting)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+
+    self->priv->connecting = connecting;
+}
+
+gboolean
+virt_viewer_app_get_connecting(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
+
+    return self->priv->connecting;
 }
 
 void
 virt_viewer_app_start_reconnect_poll(VirtViewerApp *self)
 {
+    VirtViewerAppPrivate *priv;
+
     g_return_if_fail(VIRT_VIEWER_IS_APP(self));
-    VirtViewerAppPrivate *priv = self->priv;
+    priv = self->priv;
 
     DEBUG_LOG("reconnect_poll: %d", priv->reconnect_poll);
 
     if (priv->reconnect_poll != 0)
         return;
 
-    priv->reconnect_poll = g_timeout_add(500, virt_viewer_app_connect_timer, self);
+    if (!priv->reconnect_timer) {
+        priv->reconnect_timer = g_timer_new();
+        priv->reconnect_attempts = 0;
+    }
+    priv->reconnect_delay = VIRT_VIEWER_APP_RECONNECT_MIN_DELAY;
+    priv->reconnect_reset = FALSE;
+    virt_viewer_app_schedule_reconnect(self);
+}
+
+/*
+ * Called when something suggests the guest is about to become
+ * reachable, e.g. a domain start event: retry right away and restart
+ * the backoff from its shortest interval.
+ */
+void
+virt_viewer_app_wake_reconnect_poll(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv;
+
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+    priv = self->priv;
+
+    if (!priv->reconnect_timer)
+        return;
+
+    /* Whichever attempt fails next schedules the shortest interval */
+    priv->reconnect_reset = TRUE;
+
+    /* An attempt is in flight */
+    if (priv->reconnect_poll == 0)
+        return;
+
+    DEBUG_LOG("Waking up reconnect poll");
+    g_source_remove(priv->reconnect_poll);
+    priv->reconnect_poll = g_idle_add(virt_viewer_app_connect_timer, self);
+}
+
+static void
+virt_viewer_app_stop_reconnect_poll(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+
+    if (priv->reconnect_poll != 0) {
+        g_source_remove(priv->reconnect_poll);
+        priv->reconnect_poll = 0;
+    }
+    g_clear_pointer(&priv->reconnect_timer, g_timer_destroy);
 }
 
 static void
@@ -1227,7 +1836,7 @@ virt_viewer_app_default_deactivated(VirtViewerApp *self, gboolean connect_error)
     }
 
     if (self->priv->quit_on_disconnect)
-        gtk_main_quit();
+        virt_viewer_app_main_quit(self, EXIT_SUCCESS);
 }
 
 static void
@@ -1239,6 +1848,18 @@ virt_viewer_app_deactivated(VirtViewerApp *self, gboolean connect_error)
     klass->deactivated(self, connect_error);
 }
 
+static void
+virt_viewer_app_finish_deactivate(VirtViewerApp *self, gboolean connect_error)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+
+    if (priv->authretry) {
+        priv->authretry = FALSE;
+        g_idle_add(virt_viewer_app_retryauth, self);
+    } else
+        virt_viewer_app_deactivated(self, connect_error);
+}
+
 static void
 virt_viewer_app_deactivate(VirtViewerApp *self, gboolean connect_error)
 {
@@ -1251,6 +1872,11 @@ virt_viewer_app_deactivate(VirtViewerApp *self, gboolean connect_error)
         virt_viewer_session_close(VIRT_VIEWER_SESSION(priv->session));
         g_clear_object(&priv->session);
     }
+#if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
+    virt_viewer_app_stop_tunnels(self);
+#endif
+    /* The ssh master outlives the session for a reconnect to use it,
+     * ControlPersist stops it eventually */
 
     priv->connected = FALSE;
     priv->active = FALSE;
@@ -1262,12 +1888,14 @@ virt_viewer_app_deactivate(VirtViewerApp *self, gboolean connect_error)
     priv->grabbed = FALSE;
     virt_viewer_app_update_title(self);
 
-    if (priv->authretry) {
-        priv->authretry = FALSE;
-        g_idle_add(virt_viewer_app_retryauth, self);
-    } else
-        virt_viewer_app_deactivated(self, connect_error);
+    /* Whether to retry is only known once the user answered */
+    if (priv->auth_refused_dialog) {
+        priv->deactivate_pending = TRUE;
+        priv->deactivate_error = connect_error;
+        return;
+    }
 
+    virt_viewer_app_finish_deactivate(self, connect_error);
 }
 
 static void
@@ -1277,6 +1905,22 @@ virt_viewer_app_connected(VirtViewerSession *session G_GNUC_UNUSED,
     VirtViewerAppPrivate *priv = self->priv;
 
     priv->connected = TRUE;
+    virt_viewer_trace(VIRT_VIEWER_TRACE_SESSION_CONNECTED, 0, 0);
+
+#if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
+    if (priv->tunnels) {
+        virt_viewer_timeline_end(VIRT_VIEWER_PHASE_SSH);
+        virt_viewer_app_trace(self, "Connected through SSH tunnel in %.3f seconds",
+                              virt_viewer_tunnel_get_elapsed(priv->tunnels->data));
+    }
+#endif
+
+    if (priv->reconnect_timer) {
+        virt_viewer_app_trace(self, "Reconnected to guest %s after %u attempt(s) in %.3f seconds",
+                              priv->guest_name, priv->reconnect_attempts,
+                              g_timer_elapsed(priv->reconnect_timer, NULL));
+        virt_viewer_app_stop_reconnect_poll(self);
+    }
 
     if (self->priv->kiosk)
         virt_viewer_app_show_status(self, "");
@@ -1300,6 +1944,9 @@ virt_viewer_app_disconnected(VirtViewerSession *session G_GNUC_UNUSED,
     VirtViewerAppPrivate *priv = self->priv;
     gboolean connect_error = !priv->connected && !priv->cancelled;
 
+    virt_viewer_trace(VIRT_VIEWER_TRACE_SESSION_DISCONNECTED, 0, 0);
+    virt_viewer_app_report_timeline(self, priv->connected ? "disconnected" :
+                                    priv->cancelled ? "cancelled" : "failed");
     virt_viewer_app_hide_all_windows(self);
     if (priv->quitting)
         gtk_main_quit();
@@ -1322,14 +1969,41 @@ static void virt_viewer_app_cancelled(VirtViewerSession *session,
 }
 
 
+static void
+virt_viewer_app_auth_refused_response(GtkDialog *dialog,
+                                      gint response,
+                                      VirtViewerApp *self)
+{
+    self->priv->authretry = response == GTK_RESPONSE_YES;
+    gtk_widget_destroy(GTK_WIDGET(dialog));
+}
+
+static void
+virt_viewer_app_auth_refused_destroy(GtkWidget *dialog G_GNUC_UNUSED,
+                                     VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+
+    priv->auth_refused_dialog = NULL;
+
+    /* The session went away while the question was open */
+    if (priv->deactivate_pending) {
+        priv->deactivate_pending = FALSE;
+        if (!priv->active)
+            virt_viewer_app_finish_deactivate(self, priv->deactivate_error);
+    }
+}
+
 static void virt_viewer_app_auth_refused(VirtViewerSession *session G_GNUC_UNUSED,
                                          const char *msg,
                                          VirtViewerApp *self)
 {
     GtkWidget *dialog;
-    int ret;
     VirtViewerAppPrivate *priv = self->priv;
 
+    if (priv->auth_refused_dialog)
+        gtk_widget_destroy(priv->auth_refused_dialog);
+
     dialog = gtk_message_dialog_new(virt_viewer_window_get_window(priv->main_window),
                                     GTK_DIALOG_MODAL |
                                     GTK_DIALOG_DESTROY_WITH_PARENT,
@@ -1339,14 +2013,13 @@ static void virt_viewer_app_auth_refused(VirtViewerSession *session G_GNUC_UNUSE
                                       "Retry connection again?"),
                                     priv->pretty_address, msg);
 
-    ret = gtk_dialog_run(GTK_DIALOG(dialog));
-
-    gtk_widget_destroy(dialog);
-
-    if (ret == GTK_RESPONSE_YES)
-        priv->authretry = TRUE;
-    else
-        priv->authretry = FALSE;
+    priv->authretry = FALSE;
+    g_signal_connect(dialog, "response",
+                     G_CALLBACK(virt_viewer_app_auth_refused_response), self);
+    g_signal_connect(dialog, "destroy",
+                     G_CALLBACK(virt_viewer_app_auth_refused_destroy), self);
+    priv->auth_refused_dialog = dialog;
+    gtk_widget_show(dialog);
 }
 
 
@@ -1508,7 +2181,19 @@ virt_viewer_app_dispose (GObject *object)
         g_hash_table_unref(tmp);
     }
 
+    if (priv->menu_displays_idle) {
+        g_source_remove(priv->menu_displays_idle);
+        priv->menu_displays_idle = 0;
+    }
+    virt_viewer_app_stop_reconnect_poll(self);
+    virt_viewer_watchdog_stop();
+    g_clear_pointer(&priv->capture, virt_viewer_capture_free);
+    g_clear_pointer(&priv->channel_pool, virt_viewer_channel_pool_free);
     g_clear_object(&priv->session);
+#if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
+    virt_viewer_app_stop_tunnels(self);
+#endif
+    virt_viewer_app_stop_ssh_master(self);
     g_free(priv->title);
     priv->title = NULL;
     g_free(priv->guest_name);
@@ -1521,6 +2206,8 @@ virt_viewer_app_dispose (GObject *object)
     priv->title = NULL;
     g_free(priv->config_file);
     priv->config_file = NULL;
+    g_free(priv->timeline_file);
+    priv->timeline_file = NULL;
     g_clear_pointer(&priv->config, g_key_file_free);
     g_clear_pointer(&priv->initial_display_map, g_array_unref);
 
@@ -1556,6 +2243,13 @@ static gboolean opt_debug = FALSE;
 static gboolean opt_fullscreen = FALSE;
 static gboolean opt_kiosk = FALSE;
 static gboolean opt_kiosk_quit = FALSE;
+static gint opt_connect_timeout = 30;
+static gchar *opt_timeline = NULL;
+static gint opt_watchdog = 0;
+static gboolean opt_headless = FALSE;
+static gchar *opt_capture_dir = NULL;
+static gchar *opt_capture_format = NULL;
+static gint opt_capture_interval = 0;
 
 static void
 virt_viewer_app_init (VirtViewerApp *self)
@@ -1585,7 +2279,31 @@ virt_viewer_app_init (VirtViewerApp *self)
         opt_zoom = 100;
     }
 
+    if (opt_connect_timeout < 0) {
+        g_printerr(_("Connection timeout must not be negative\n"));
+        opt_connect_timeout = 0;
+    }
+
+    if (opt_watchdog < 0) {
+        g_printerr(_("Main loop watchdog threshold must be positive\n"));
+        opt_watchdog = 0;
+    }
+    if (opt_watchdog > 0)
+        virt_viewer_watchdog_start(opt_watchdog);
+
+    if (opt_capture_interval < 0) {
+        g_printerr(_("Capture interval must be positive\n"));
+        opt_capture_interval = 0;
+    }
+    if (opt_capture_dir)
+        self->priv->capture = virt_viewer_capture_new(self, opt_capture_dir,
+                                                      opt_capture_format ? opt_capture_format : "png",
+                                                      opt_capture_interval);
+    self->priv->headless = opt_headless;
+
     self->priv->verbose = opt_verbose;
+    self->priv->connect_timeout = opt_connect_timeout;
+    self->priv->timeline_file = g_strdup(opt_timeline);
     self->priv->quit_on_disconnect = opt_kiosk ? opt_kiosk_quit : TRUE;
 
     virt_viewer_window_set_zoom_level(self->priv->main_window, opt_zoom);
@@ -1993,17 +2711,22 @@ virt_viewer_app_set_fullscreen(VirtViewerApp *self, gboolean fullscreen)
 
 static void
 menu_display_visible_toggled_cb(GtkCheckMenuItem *checkmenuitem,
-                                VirtViewerWindow *vwin)
+                                VirtViewerApp *self)
 {
-    VirtViewerApp *self;
+    VirtViewerWindow *vwin;
     gboolean visible;
+    gint nth = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(checkmenuitem), "nth"));
     static gboolean reentering = FALSE;
 
     if (reentering) /* do not reenter if I switch you back */
         return;
 
+    vwin = virt_viewer_app_get_nth_window(self, nth);
+    if (vwin == NULL)
+        return;
+
     reentering = TRUE;
-    g_object_get(vwin, "app", &self, NULL);
+    g_object_ref(self);
     visible = virt_viewer_app_window_set_visible(self, vwin,
                                                  gtk_check_menu_item_get_active(checkmenuitem));
     gtk_check_menu_item_set_active(checkmenuitem, /* will be toggled again */ !visible);
@@ -2011,22 +2734,20 @@ menu_display_visible_toggled_cb(GtkCheckMenuItem *checkmenuitem,
     reentering = FALSE;
 }
 
-static gint
-update_menu_displays_sort(gconstpointer a, gconstpointer b)
+static void
+menu_displays_model_add(gpointer key,
+                        gpointer value,
+                        gpointer user_data)
 {
-    const int *ai = a;
-    const int *bi = b;
+    VirtViewerWindow *vwin = VIRT_VIEWER_WINDOW(value);
 
-    if (*ai > *bi)
-        return 1;
-    else if (*ai < *bi)
-        return -1;
-    else
-        return 0;
+    virt_viewer_display_menu_model_add(user_data, *(gint *)key,
+                                       gtk_widget_get_visible(GTK_WIDGET(virt_viewer_window_get_window(vwin))),
+                                       virt_viewer_window_get_display(vwin));
 }
 
 static GtkMenuShell *
-window_empty_display_submenu(VirtViewerWindow *window)
+window_get_display_submenu(VirtViewerWindow *window)
 {
     /* Because of what apparently is a gtk+2 bug (rhbz#922712), we
      * cannot recreate the submenu every time we need to refresh it,
@@ -2036,82 +2757,54 @@ window_empty_display_submenu(VirtViewerWindow *window)
      * works around this issue.
      */
     GtkMenuItem *menu = virt_viewer_window_get_menu_displays(window);
-    GtkMenuShell *submenu;
-
-    submenu = GTK_MENU_SHELL(gtk_menu_item_get_submenu(menu));
-    if (submenu) {
-        GList *subitems;
-        GList *it;
-        subitems = gtk_container_get_children(GTK_CONTAINER(submenu));
-        for (it = subitems; it != NULL; it = it->next) {
-            gtk_container_remove(GTK_CONTAINER(submenu), GTK_WIDGET(it->data));
-        }
-        g_list_free(subitems);
-    } else {
-        submenu = GTK_MENU_SHELL(gtk_menu_new());
-        gtk_menu_item_set_submenu(menu, GTK_WIDGET(submenu));
+    GtkWidget *submenu;
+
+    submenu = gtk_menu_item_get_submenu(menu);
+    if (submenu == NULL) {
+        submenu = gtk_menu_new();
+        gtk_menu_item_set_submenu(menu, submenu);
     }
 
-    return submenu;
+    return GTK_MENU_SHELL(submenu);
 }
 
-static void
-window_update_menu_displays_cb(gpointer key G_GNUC_UNUSED,
-                               gpointer value,
-                               gpointer user_data)
-{
-    VirtViewerApp *self = VIRT_VIEWER_APP(user_data);
-    GtkMenuShell *submenu;
-    GList *keys = g_hash_table_get_keys(self->priv->windows);
-    GList *tmp;
-
-    keys = g_list_sort(keys, update_menu_displays_sort);
-    submenu = window_empty_display_submenu(VIRT_VIEWER_WINDOW(value));
-
-    tmp = keys;
-    while (tmp) {
-        int *nth = tmp->data;
-        VirtViewerWindow *vwin = VIRT_VIEWER_WINDOW(g_hash_table_lookup(self->priv->windows, nth));
-        VirtViewerDisplay *display = virt_viewer_window_get_display(vwin);
-        GtkWidget *item;
-        gboolean visible, sensitive;
-        gchar *label;
-
-        label = g_strdup_printf(_("Display %d"), *nth + 1);
-        item = gtk_check_menu_item_new_with_label(label);
-        g_free(label);
-
-        visible = gtk_widget_get_visible(GTK_WIDGET(virt_viewer_window_get_window(vwin)));
-        gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item), visible);
-
-        sensitive = visible;
-        if (display) {
-            guint hint = virt_viewer_display_get_show_hint(display);
-
-            if (hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY)
-                sensitive = TRUE;
-
-            if (virt_viewer_display_get_selectable(display))
-                sensitive = TRUE;
-        }
-        gtk_widget_set_sensitive(item, sensitive);
+static gboolean
+virt_viewer_app_update_menu_displays_idle(gpointer opaque)
+{
+    VirtViewerApp *self = VIRT_VIEWER_APP(opaque);
+    GHashTableIter iter;
+    gpointer value;
+    GArray *model;
 
-        g_signal_connect(G_OBJECT(item),
-                         "toggled", G_CALLBACK(menu_display_visible_toggled_cb), vwin);
-        gtk_menu_shell_append(submenu, item);
-        tmp = tmp->next;
-    }
+    self->priv->menu_displays_idle = 0;
+    if (!self->priv->windows)
+        return FALSE;
 
-    gtk_widget_show_all(GTK_WIDGET(submenu));
-    g_list_free(keys);
+    model = virt_viewer_display_menu_model_new();
+    g_hash_table_foreach(self->priv->windows, menu_displays_model_add, model);
+    virt_viewer_display_menu_model_sort(model);
+
+    g_hash_table_iter_init(&iter, self->priv->windows);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+        virt_viewer_display_menu_update(window_get_display_submenu(VIRT_VIEWER_WINDOW(value)),
+                                        model, G_CALLBACK(menu_display_visible_toggled_cb),
+                                        self);
+
+    g_array_unref(model);
+    return FALSE;
 }
 
+/* Coalesced, the menus are updated at most once before the next redraw */
 static void
 virt_viewer_app_update_menu_displays(VirtViewerApp *self)
 {
-    if (!self->priv->windows)
+    if (!self->priv->windows || self->priv->menu_displays_idle)
         return;
-    g_hash_table_foreach(self->priv->windows, window_update_menu_displays_cb, self);
+
+    self->priv->menu_displays_idle =
+        virt_viewer_watchdog_idle_add_full(GDK_PRIORITY_REDRAW, "menu displays",
+                                           virt_viewer_app_update_menu_displays_idle,
+                                           self, NULL);
 }
 
 void
@@ -2231,6 +2924,13 @@ virt_viewer_app_get_session(VirtViewerApp *self)
     return self->priv->session;
 }
 
+gboolean
+virt_viewer_app_get_headless(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
+    return self->priv->headless;
+}
+
 GHashTable*
 virt_viewer_app_get_windows(VirtViewerApp *self)
 {
@@ -2256,6 +2956,22 @@ option_kiosk_quit(G_GNUC_UNUSED const gchar *option_name,
     return FALSE;
 }
 
+static gboolean
+option_capture_format(G_GNUC_UNUSED const gchar *option_name,
+                      const gchar *value,
+                      G_GNUC_UNUSED gpointer data, GError **error)
+{
+    if (!virt_viewer_screenshot_has_format(value)) {
+        g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                    _("Unknown capture format: %s"), value);
+        return FALSE;
+    }
+
+    g_free(opt_capture_format);
+    opt_capture_format = g_strdup(value);
+    return TRUE;
+}
+
 const GOptionEntry *
 virt_viewer_app_get_options(void)
 {
@@ -2270,6 +2986,20 @@ virt_viewer_app_get_options(void)
           N_("Enable kiosk mode"), NULL },
         { "kiosk-quit", '\0', 0, G_OPTION_ARG_CALLBACK, option_kiosk_quit,
           N_("Quit on given condition in kiosk mode"), N_("<never|on-disconnect>") },
+        { "connect-timeout", '\0', 0, G_OPTION_ARG_INT, &opt_connect_timeout,
+          N_("Seconds to wait for a direct connection to the display, 0 for no limit"), N_("SECONDS") },
+        { "timeline", '\0', 0, G_OPTION_ARG_FILENAME, &opt_timeline,
+          N_("Append the timeline of each connection to FILE, as JSON"), N_("FILE") },
+        { "main-loop-watchdog", '\0', 0, G_OPTION_ARG_INT, &opt_watchdog,
+          N_("Report main loop iterations longer than MS and profile callbacks"), N_("MS") },
+        { "headless", '\0', 0, G_OPTION_ARG_NONE, &opt_headless,
+          N_("Connect without ever showing a window"), NULL },
+        { "capture-dir", '\0', 0, G_OPTION_ARG_FILENAME, &opt_capture_dir,
+          N_("Write display captures to DIR, on SIGUSR2 and at the capture interval"), N_("DIR") },
+        { "capture-interval", '\0', 0, G_OPTION_ARG_INT, &opt_capture_interval,
+          N_("Capture the displays every SECONDS"), N_("SECONDS") },
+        { "capture-format", '\0', 0, G_OPTION_ARG_CALLBACK, option_capture_format,
+          N_("Image format of the captures: png (default), ppm, pam, bgrx, qoi..."), N_("FORMAT") },
         { "verbose", 'v', 0, G_OPTION_ARG_NONE, &opt_verbose,
           N_("Display verbose information"), NULL },
         { "debug", '\0', 0, G_OPTION_ARG_NONE, &opt_debug,
@@ -65,6 +65,8 @@ void virt_viewer_app_set_title(VirtViewerApp *app, const char *title);
 void virt_viewer_app_set_debug(gboolean debug);
 gboolean virt_viewer_app_start(VirtViewerApp *app);
 void virt_viewer_app_maybe_quit(VirtViewerApp *self, VirtViewerWindow *window);
+void virt_viewer_app_main_quit(VirtViewerApp *self, gint status);
+gint virt_viewer_app_get_exit_status(VirtViewerApp *self);
 VirtViewerWindow* virt_viewer_app_get_main_window(VirtViewerApp *self);
 void virt_viewer_app_trace(VirtViewerApp *self, const char *fmt, ...);
 void virt_viewer_app_simple_message_dialog(VirtViewerApp *self, const char *fmt, ...);
@@ -74,6 +76,10 @@ int virt_viewer_app_create_session(VirtViewerApp *self, const gchar *type);
 gboolean virt_viewer_app_activate(VirtViewerApp *self, GError **error);
 gboolean virt_viewer_app_initial_connect(VirtViewerApp *self, GError **error);
 void virt_viewer_app_start_reconnect_poll(VirtViewerApp *self);
+void virt_viewer_app_wake_reconnect_poll(VirtViewerApp *self);
+void virt_viewer_app_reconnect_failed(VirtViewerApp *self);
+void virt_viewer_app_set_connecting(VirtViewerApp *self, gboolean connecting);
+gboolean virt_viewer_app_get_connecting(VirtViewerApp *self);
 void virt_viewer_app_set_zoom_level(VirtViewerApp *self, gint zoom_level);
 void virt_viewer_app_set_direct(VirtViewerApp *self, gboolean direct);
 void virt_viewer_app_set_hotkeys(VirtViewerApp *self, const gchar *hotkeys);
@@ -94,6 +100,7 @@ gboolean virt_viewer_app_window_set_visible(VirtViewerApp *self, VirtViewerWindo
 void virt_viewer_app_show_status(VirtViewerApp *self, const gchar *fmt, ...);
 void virt_viewer_app_show_display(VirtViewerApp *self);
 GHashTable* virt_viewer_app_get_windows(VirtViewerApp *self);
+gboolean virt_viewer_app_get_headless(VirtViewerApp *self);
 gboolean virt_viewer_app_get_enable_accel(VirtViewerApp *self);
 VirtViewerSession* virt_viewer_app_get_session(VirtViewerApp *self);
 gboolean virt_viewer_app_get_fullscreen(VirtViewerApp *app);
@@ -23,6 +23,8 @@
 #include <config.h>
 
 #include <gtk/gtk.h>
+#include <glib/gi18n.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifdef HAVE_GTK_VNC
@@ -30,39 +32,143 @@
 #endif
 
 #include "virt-viewer-auth.h"
+#include "virt-viewer-timeline.h"
+#include "virt-viewer-window.h"
 
 
-int
-virt_viewer_auth_collect_credentials(GtkWindow *window,
-                                     const char *type,
-                                     const char *address,
-                                     char **username,
-                                     char **password)
+typedef struct {
+    GtkBuilder *creds;
+    VirtViewerAuthCallback callback;
+    gpointer opaque;
+} VirtViewerAuthPrompt;
+
+static void
+virt_viewer_auth_prompt_finish(VirtViewerAuthPrompt *prompt,
+                               gboolean ok)
+{
+    const gchar *username = NULL, *password = NULL;
+    VirtViewerAuthCallback callback = prompt->callback;
+
+    if (callback == NULL)
+        return;
+    prompt->callback = NULL;
+
+    virt_viewer_timeline_end(VIRT_VIEWER_PHASE_AUTH);
+
+    if (ok) {
+        GtkWidget *credUsername = GTK_WIDGET(gtk_builder_get_object(prompt->creds, "cred-username"));
+        GtkWidget *credPassword = GTK_WIDGET(gtk_builder_get_object(prompt->creds, "cred-password"));
+
+        if (gtk_widget_get_sensitive(credUsername))
+            username = gtk_entry_get_text(GTK_ENTRY(credUsername));
+        if (gtk_widget_get_sensitive(credPassword))
+            password = gtk_entry_get_text(GTK_ENTRY(credPassword));
+    }
+
+    callback(ok, username, password, prompt->opaque);
+}
+
+static void
+virt_viewer_auth_prompt_response(GtkDialog *dialog,
+                                 gint response,
+                                 gpointer opaque)
 {
-    GtkWidget *dialog = NULL;
-    GtkBuilder *creds = virt_viewer_util_load_ui("virt-viewer-auth.xml");
+    VirtViewerAuthPrompt *prompt = opaque;
+
+    virt_viewer_auth_prompt_finish(prompt, response == GTK_RESPONSE_OK);
+    gtk_widget_destroy(GTK_WIDGET(dialog));
+}
+
+/* Also covers the dialog going away with its parent, unanswered */
+static void
+virt_viewer_auth_prompt_destroy(GtkWidget *dialog G_GNUC_UNUSED,
+                                gpointer opaque)
+{
+    VirtViewerAuthPrompt *prompt = opaque;
+
+    virt_viewer_auth_prompt_finish(prompt, FALSE);
+    g_object_unref(prompt->creds);
+    g_free(prompt);
+}
+
+/* Headless, nobody can answer: the prompt fails */
+static gboolean
+virt_viewer_auth_prompt_refused(gpointer opaque)
+{
+    VirtViewerAuthPrompt *prompt = opaque;
+
+    prompt->callback(FALSE, NULL, NULL, prompt->opaque);
+    g_free(prompt);
+
+    return FALSE;
+}
+
+/*
+ * Shows the credentials dialog over the main window of @app and returns
+ * straight away, the main loop keeps running underneath. @callback is
+ * called exactly once, from the main loop, with the entered values which
+ * are only valid during the call. In headless mode no dialog is shown,
+ * the error goes to stderr, the app quits with a failure status and
+ * @callback is told the prompt was cancelled.
+ */
+void
+virt_viewer_auth_collect_credentials_async(VirtViewerApp *app,
+                                           const char *type,
+                                           const char *address,
+                                           gboolean want_username,
+                                           gboolean want_password,
+                                           VirtViewerAuthCallback callback,
+                                           gpointer opaque)
+{
+    VirtViewerAuthPrompt *prompt;
+    GtkWindow *window;
+    GtkWidget *dialog;
     GtkWidget *credUsername;
     GtkWidget *credPassword;
     GtkWidget *promptUsername;
     GtkWidget *promptPassword;
     GtkWidget *labelMessage;
-    int response;
     char *message;
 
-    dialog = GTK_WIDGET(gtk_builder_get_object(creds, "auth"));
+    g_return_if_fail(VIRT_VIEWER_IS_APP(app));
+    g_return_if_fail(callback != NULL);
+
+    prompt = g_new0(VirtViewerAuthPrompt, 1);
+    prompt->callback = callback;
+    prompt->opaque = opaque;
+
+    if (virt_viewer_app_get_headless(app)) {
+        if (address)
+            virt_viewer_app_simple_message_dialog(app,
+                                                  _("Authentication is required for the %s connection to %s, "
+                                                    "which can't be asked for in headless mode"),
+                                                  type, address);
+        else
+            virt_viewer_app_simple_message_dialog(app,
+                                                  _("Authentication is required for the %s connection, "
+                                                    "which can't be asked for in headless mode"),
+                                                  type);
+        virt_viewer_app_main_quit(app, EXIT_FAILURE);
+        g_idle_add(virt_viewer_auth_prompt_refused, prompt);
+        return;
+    }
+
+    window = virt_viewer_window_get_window(virt_viewer_app_get_main_window(app));
+    prompt->creds = virt_viewer_util_load_ui("virt-viewer-auth.xml");
+    dialog = GTK_WIDGET(gtk_builder_get_object(prompt->creds, "auth"));
     gtk_dialog_set_default_response(GTK_DIALOG(dialog), GTK_RESPONSE_OK);
     gtk_window_set_transient_for(GTK_WINDOW(dialog), window);
 
-    labelMessage = GTK_WIDGET(gtk_builder_get_object(creds, "message"));
-    credUsername = GTK_WIDGET(gtk_builder_get_object(creds, "cred-username"));
-    promptUsername = GTK_WIDGET(gtk_builder_get_object(creds, "prompt-username"));
-    credPassword = GTK_WIDGET(gtk_builder_get_object(creds, "cred-password"));
-    promptPassword = GTK_WIDGET(gtk_builder_get_object(creds, "prompt-password"));
+    labelMessage = GTK_WIDGET(gtk_builder_get_object(prompt->creds, "message"));
+    credUsername = GTK_WIDGET(gtk_builder_get_object(prompt->creds, "cred-username"));
+    promptUsername = GTK_WIDGET(gtk_builder_get_object(prompt->creds, "prompt-username"));
+    credPassword = GTK_WIDGET(gtk_builder_get_object(prompt->creds, "cred-password"));
+    promptPassword = GTK_WIDGET(gtk_builder_get_object(prompt->creds, "prompt-password"));
 
-    gtk_widget_set_sensitive(credUsername, username != NULL);
-    gtk_widget_set_sensitive(promptUsername, username != NULL);
-    gtk_widget_set_sensitive(credPassword, password != NULL);
-    gtk_widget_set_sensitive(promptPassword, password != NULL);
+    gtk_widget_set_sensitive(credUsername, want_username);
+    gtk_widget_set_sensitive(promptUsername, want_username);
+    gtk_widget_set_sensitive(credPassword, want_password);
+    gtk_widget_set_sensitive(promptPassword, want_password);
 
     if (address) {
         message = g_strdup_printf("Authentication is required for the %s connection to:\n\n"
@@ -77,27 +183,150 @@ virt_viewer_auth_collect_credentials(GtkWindow *window,
     gtk_label_set_markup(GTK_LABEL(labelMessage), message);
     g_free(message);
 
+    g_signal_connect(dialog, "response",
+                     G_CALLBACK(virt_viewer_auth_prompt_response), prompt);
+    g_signal_connect(dialog, "destroy",
+                     G_CALLBACK(virt_viewer_auth_prompt_destroy), prompt);
+
+    virt_viewer_timeline_begin(VIRT_VIEWER_PHASE_AUTH);
     gtk_widget_show_all(dialog);
-    response = gtk_dialog_run(GTK_DIALOG(dialog));
-    gtk_widget_hide(dialog);
-
-    if (response == GTK_RESPONSE_OK) {
-        if (username)
-            *username = g_strdup(gtk_entry_get_text(GTK_ENTRY(credUsername)));
-        if (password)
-            *password = g_strdup(gtk_entry_get_text(GTK_ENTRY(credPassword)));
-    }
+}
 
-    gtk_widget_destroy(GTK_WIDGET(dialog));
-    g_object_unref(G_OBJECT(creds));
+typedef struct {
+    GMainLoop *loop;
+    gboolean ok;
+    char **username;
+    char **password;
+} VirtViewerAuthWait;
 
-    return response == GTK_RESPONSE_OK ? 0 : -1;
+static void
+virt_viewer_auth_collect_credentials_cb(gboolean ok,
+                                        const gchar *username,
+                                        const gchar *password,
+                                        gpointer opaque)
+{
+    VirtViewerAuthWait *wait = opaque;
+
+    wait->ok = ok;
+    if (ok && wait->username)
+        *wait->username = g_strdup(username);
+    if (ok && wait->password)
+        *wait->password = g_strdup(password);
+    g_main_loop_quit(wait->loop);
+}
+
+/*
+ * Blocking variant, for callers which have to answer before returning.
+ * It runs a nested main loop, prefer the _async() version.
+ */
+int
+virt_viewer_auth_collect_credentials(VirtViewerApp *app,
+                                     const char *type,
+                                     const char *address,
+                                     char **username,
+                                     char **password)
+{
+    VirtViewerAuthWait wait = {
+        .loop = g_main_loop_new(NULL, FALSE),
+        .ok = FALSE,
+        .username = username,
+        .password = password,
+    };
+
+    virt_viewer_auth_collect_credentials_async(app, type, address,
+                                               username != NULL,
+                                               password != NULL,
+                                               virt_viewer_auth_collect_credentials_cb,
+                                               &wait);
+    g_main_loop_run(wait.loop);
+    g_main_loop_unref(wait.loop);
+
+    return wait.ok ? 0 : -1;
 }
 
 #ifdef HAVE_GTK_VNC
+static void
+virt_viewer_auth_vnc_set_credentials(GtkWidget *vnc,
+                                     GValueArray *credList,
+                                     const char *username,
+                                     const char *password)
+{
+    int i;
+
+    for (i = 0 ; i < credList->n_values ; i++) {
+        GValue *cred = g_value_array_get_nth(credList, i);
+        switch (g_value_get_enum(cred)) {
+        case VNC_DISPLAY_CREDENTIAL_USERNAME:
+            if (!username ||
+                vnc_display_set_credential(VNC_DISPLAY(vnc),
+                                           g_value_get_enum(cred),
+                                           username)) {
+                DEBUG_LOG("Failed to set credential type %d", g_value_get_enum(cred));
+                vnc_display_close(VNC_DISPLAY(vnc));
+            }
+            break;
+        case VNC_DISPLAY_CREDENTIAL_PASSWORD:
+            if (!password ||
+                vnc_display_set_credential(VNC_DISPLAY(vnc),
+                                           g_value_get_enum(cred),
+                                           password)) {
+                DEBUG_LOG("Failed to set credential type %d", g_value_get_enum(cred));
+                vnc_display_close(VNC_DISPLAY(vnc));
+            }
+            break;
+        case VNC_DISPLAY_CREDENTIAL_CLIENTNAME:
+            if (vnc_display_set_credential(VNC_DISPLAY(vnc),
+                                           g_value_get_enum(cred),
+                                           "libvirt")) {
+                DEBUG_LOG("Failed to set credential type %d", g_value_get_enum(cred));
+                vnc_display_close(VNC_DISPLAY(vnc));
+            }
+            break;
+        default:
+            DEBUG_LOG("Unsupported credential type %d", g_value_get_enum(cred));
+            vnc_display_close(VNC_DISPLAY(vnc));
+        }
+    }
+}
+
+typedef struct {
+    GtkWidget *vnc;
+    GValueArray *credList;
+    char *username;
+    char *password;
+} VirtViewerAuthVncRequest;
+
+static void
+virt_viewer_auth_vnc_credentials_cb(gboolean ok,
+                                    const gchar *username,
+                                    const gchar *password,
+                                    gpointer opaque)
+{
+    VirtViewerAuthVncRequest *req = opaque;
+
+    if (!vnc_display_is_open(VNC_DISPLAY(req->vnc))) {
+        DEBUG_LOG("VNC display closed while prompting for credentials");
+    } else if (!ok) {
+        vnc_display_close(VNC_DISPLAY(req->vnc));
+    } else {
+        virt_viewer_auth_vnc_set_credentials(req->vnc, req->credList,
+                                             username ? username : req->username,
+                                             password ? password : req->password);
+    }
+
+    g_object_unref(req->vnc);
+    g_value_array_free(req->credList);
+    g_free(req->username);
+    g_free(req->password);
+    g_free(req);
+}
+
+/*
+ * gtk-vnc waits for the credentials it asked for, so the answer can be
+ * given once the prompt is dismissed, while the display keeps running.
+ */
 void
 virt_viewer_auth_vnc_credentials(VirtViewerSession *session,
-                                 GtkWindow *window,
                                  GtkWidget *vnc,
                                  GValueArray *credList,
                                  char *vncAddress)
@@ -122,7 +351,7 @@ virt_viewer_auth_vnc_credentials(VirtViewerSession *session,
         default:
             DEBUG_LOG("Unsupported credential type %d", g_value_get_enum(cred));
             vnc_display_close(VNC_DISPLAY(vnc));
-            goto cleanup;
+            return;
         }
     }
 
@@ -139,53 +368,22 @@ virt_viewer_auth_vnc_credentials(VirtViewerSession *session,
     }
 
     if (wantUsername || wantPassword) {
-        int ret = virt_viewer_auth_collect_credentials(window,
-                                                       "VNC", vncAddress,
-                                                       wantUsername ? &username : NULL,
-                                                       wantPassword ? &password : NULL);
+        VirtViewerAuthVncRequest *req = g_new0(VirtViewerAuthVncRequest, 1);
 
-        if (ret < 0) {
-            vnc_display_close(VNC_DISPLAY(vnc));
-            goto cleanup;
-        }
+        req->vnc = g_object_ref(vnc);
+        req->credList = g_value_array_copy(credList);
+        req->username = username;
+        req->password = password;
+        virt_viewer_auth_collect_credentials_async(virt_viewer_session_get_app(session),
+                                                   "VNC", vncAddress,
+                                                   wantUsername, wantPassword,
+                                                   virt_viewer_auth_vnc_credentials_cb,
+                                                   req);
+        return;
     }
 
-    for (i = 0 ; i < credList->n_values ; i++) {
-        GValue *cred = g_value_array_get_nth(credList, i);
-        switch (g_value_get_enum(cred)) {
-        case VNC_DISPLAY_CREDENTIAL_USERNAME:
-            if (!username ||
-                vnc_display_set_credential(VNC_DISPLAY(vnc),
-                                           g_value_get_enum(cred),
-                                           username)) {
-                DEBUG_LOG("Failed to set credential type %d", g_value_get_enum(cred));
-                vnc_display_close(VNC_DISPLAY(vnc));
-            }
-            break;
-        case VNC_DISPLAY_CREDENTIAL_PASSWORD:
-            if (!password ||
-                vnc_display_set_credential(VNC_DISPLAY(vnc),
-                                           g_value_get_enum(cred),
-                                           password)) {
-                DEBUG_LOG("Failed to set credential type %d", g_value_get_enum(cred));
-                vnc_display_close(VNC_DISPLAY(vnc));
-            }
-            break;
-        case VNC_DISPLAY_CREDENTIAL_CLIENTNAME:
-            if (vnc_display_set_credential(VNC_DISPLAY(vnc),
-                                           g_value_get_enum(cred),
-                                           "libvirt")) {
-                DEBUG_LOG("Failed to set credential type %d", g_value_get_enum(cred));
-                vnc_display_close(VNC_DISPLAY(vnc));
-            }
-            break;
-        default:
-            DEBUG_LOG("Unsupported credential type %d", g_value_get_enum(cred));
-            vnc_display_close(VNC_DISPLAY(vnc));
-        }
-    }
+    virt_viewer_auth_vnc_set_credentials(vnc, credList, username, password);
 
- cleanup:
     g_free(username);
     g_free(password);
 }
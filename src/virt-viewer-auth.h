@@ -33,12 +33,24 @@
 #include "virt-viewer-util.h"
 
 void virt_viewer_auth_vnc_credentials(VirtViewerSession *session,
-                                      GtkWindow *window,
                                       GtkWidget *vnc,
                                       GValueArray *credList,
                                       char *vncAddress);
 
-int virt_viewer_auth_collect_credentials(GtkWindow *window,
+typedef void (*VirtViewerAuthCallback)(gboolean ok,
+                                       const gchar *username,
+                                       const gchar *password,
+                                       gpointer opaque);
+
+void virt_viewer_auth_collect_credentials_async(VirtViewerApp *app,
+                                                const char *type,
+                                                const char *address,
+                                                gboolean want_username,
+                                                gboolean want_password,
+                                                VirtViewerAuthCallback callback,
+                                                gpointer opaque);
+
+int virt_viewer_auth_collect_credentials(VirtViewerApp *app,
                                          const char *type,
                                          const char *address,
                                          char **username,
@@ -0,0 +1,257 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "virt-viewer-capture.h"
+#include "virt-viewer-screenshot.h"
+#include "virt-viewer-session.h"
+#include "virt-viewer-util.h"
+
+/*
+ * Writes the frame buffer of every shown display to files, every few
+ * seconds and on SIGUSR2. The displays don't need to be mapped for
+ * this, so it works along with --headless. A round is skipped while
+ * the previous one is still being encoded, so that at most one copy of
+ * each frame buffer is alive.
+ */
+
+struct _VirtViewerCapture {
+    VirtViewerApp *app;
+    gchar *dir;
+    gchar *format;
+    guint timer;
+    guint sequence;
+    guint pending;      /* frames being encoded */
+    gboolean freed;     /* by the owner, while frames were pending */
+#ifdef G_OS_UNIX
+    guint signal_watch;
+#endif
+};
+
+#ifdef G_OS_UNIX
+static int capture_pipe[2] = { -1, -1 };
+
+static void
+virt_viewer_capture_signal_handler(int signum G_GNUC_UNUSED)
+{
+    int saved_errno = errno;
+    char c = 0;
+
+    if (write(capture_pipe[1], &c, 1) < 0) {
+        /* a capture is already due */
+    }
+    errno = saved_errno;
+}
+
+static gboolean
+virt_viewer_capture_signal_cb(GIOChannel *source G_GNUC_UNUSED,
+                              GIOCondition condition G_GNUC_UNUSED,
+                              gpointer opaque)
+{
+    char buf[16];
+
+    while (read(capture_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+
+    virt_viewer_capture_frames(opaque);
+    return TRUE;
+}
+
+static guint
+virt_viewer_capture_watch_signal(VirtViewerCapture *capture)
+{
+    struct sigaction action;
+    GIOChannel *channel;
+    guint watch;
+
+    if (capture_pipe[0] == -1) {
+        if (pipe(capture_pipe) < 0) {
+            g_warning("Unable to create the capture signal pipe: %s", g_strerror(errno));
+            return 0;
+        }
+        fcntl(capture_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(capture_pipe[1], F_SETFL, O_NONBLOCK);
+    }
+
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    action.sa_handler = virt_viewer_capture_signal_handler;
+    sigaction(SIGUSR2, &action, NULL);
+
+    channel = g_io_channel_unix_new(capture_pipe[0]);
+    watch = g_io_add_watch(channel, G_IO_IN, virt_viewer_capture_signal_cb, capture);
+    g_io_channel_unref(channel);
+
+    return watch;
+}
+#endif
+
+static gboolean
+virt_viewer_capture_timer_cb(gpointer opaque)
+{
+    virt_viewer_capture_frames(opaque);
+    return TRUE;
+}
+
+/*
+ * Frames go to DIR/displayN-SEQUENCE.FORMAT, any format a screenshot
+ * can be saved in; an interval of 0 only captures on demand.
+ */
+VirtViewerCapture *
+virt_viewer_capture_new(VirtViewerApp *app,
+                        const gchar *dir,
+                        const gchar *format,
+                        guint interval)
+{
+    VirtViewerCapture *capture;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(app), NULL);
+    g_return_val_if_fail(dir != NULL, NULL);
+    g_return_val_if_fail(format != NULL, NULL);
+
+    if (g_mkdir_with_parents(dir, 0755) < 0)
+        g_warning("Unable to create capture directory %s: %s", dir, g_strerror(errno));
+
+    capture = g_new0(VirtViewerCapture, 1);
+    capture->app = app;
+    capture->dir = g_strdup(dir);
+    capture->format = g_ascii_strdown(format, -1);
+
+    if (interval > 0)
+        capture->timer = g_timeout_add_seconds(interval, virt_viewer_capture_timer_cb, capture);
+#ifdef G_OS_UNIX
+    capture->signal_watch = virt_viewer_capture_watch_signal(capture);
+#endif
+
+    return capture;
+}
+
+static void
+virt_viewer_capture_destroy(VirtViewerCapture *capture)
+{
+    g_free(capture->dir);
+    g_free(capture->format);
+    g_free(capture);
+}
+
+void
+virt_viewer_capture_free(VirtViewerCapture *capture)
+{
+    if (capture == NULL)
+        return;
+
+    if (capture->timer)
+        g_source_remove(capture->timer);
+#ifdef G_OS_UNIX
+    if (capture->signal_watch) {
+        signal(SIGUSR2, SIG_DFL);
+        g_source_remove(capture->signal_watch);
+    }
+#endif
+
+    capture->app = NULL;
+    capture->freed = TRUE;
+    /* the last frame being encoded finishes the job */
+    if (capture->pending == 0)
+        virt_viewer_capture_destroy(capture);
+}
+
+static void
+virt_viewer_capture_done(const gchar *filename,
+                         const GError *error,
+                         gpointer opaque)
+{
+    VirtViewerCapture *capture = opaque;
+
+    if (error)
+        g_warning("Unable to capture %s: %s", filename, error->message);
+    else if (capture->app)
+        virt_viewer_app_trace(capture->app, "Captured %s", filename);
+
+    capture->pending--;
+    if (capture->freed && capture->pending == 0)
+        virt_viewer_capture_destroy(capture);
+}
+
+void
+virt_viewer_capture_frames(VirtViewerCapture *capture)
+{
+    VirtViewerSession *session;
+    guint nth;
+
+    g_return_if_fail(capture != NULL);
+    g_return_if_fail(!capture->freed);
+
+    if (capture->pending > 0) {
+        DEBUG_LOG("capture: %u frame(s) still being written, skipping", capture->pending);
+        return;
+    }
+
+    session = virt_viewer_app_get_session(capture->app);
+    if (session == NULL)
+        return;
+
+    capture->sequence++;
+    for (nth = 0; nth < virt_viewer_session_get_max_nth(session); nth++) {
+        VirtViewerDisplay *display = virt_viewer_session_get_display(session, nth);
+        GdkPixbuf *pixbuf;
+        gchar *name, *path;
+        guint hint;
+
+        if (display == NULL)
+            continue;
+
+        hint = virt_viewer_display_get_show_hint(display);
+        if (!(hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY) ||
+            (hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_DISABLED))
+            continue;
+
+        pixbuf = virt_viewer_display_get_pixbuf(display);
+        if (pixbuf == NULL)
+            continue;
+
+        name = g_strdup_printf("display%u-%06u.%s", nth + 1, capture->sequence, capture->format);
+        path = g_build_filename(capture->dir, name, NULL);
+        capture->pending++;
+        virt_viewer_screenshot_save_async(pixbuf, path, capture->format, NULL,
+                                          virt_viewer_capture_done, capture);
+        g_object_unref(pixbuf);
+        g_free(path);
+        g_free(name);
+    }
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,48 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_CAPTURE_H
+#define VIRT_VIEWER_CAPTURE_H
+
+#include "virt-viewer-app.h"
+
+G_BEGIN_DECLS
+
+typedef struct _VirtViewerCapture VirtViewerCapture;
+
+VirtViewerCapture *virt_viewer_capture_new(VirtViewerApp *app,
+                                           const gchar *dir,
+                                           const gchar *format,
+                                           guint interval);
+void virt_viewer_capture_free(VirtViewerCapture *capture);
+void virt_viewer_capture_frames(VirtViewerCapture *capture);
+
+G_END_DECLS
+
+#endif /* VIRT_VIEWER_CAPTURE_H */
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,159 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "virt-viewer-util.h"
+#include "virt-viewer-channel-pool.h"
+
+/*
+ * Channel fd requests are serviced by a few threads so that a slow
+ * open for one channel doesn't hold up the next ones. Requests waiting
+ * for a thread are taken by priority, lower first, then in the order
+ * they came in.
+ */
+
+struct _VirtViewerChannelPool {
+    GThreadPool *threads; /* NULL if they can't be created */
+    VirtViewerChannelPoolOpenFunc open_func;
+    VirtViewerChannelPoolDoneFunc done_func;
+    gpointer opaque;
+    guint serial;
+};
+
+typedef struct {
+    VirtViewerChannelPoolOpenFunc open_func;
+    VirtViewerChannelPoolDoneFunc done_func;
+    gpointer opaque;
+    gpointer request;
+    gint priority;
+    guint serial; /* request order, among equal priorities */
+    gboolean ret;
+    int fd;
+} VirtViewerChannelPoolJob;
+
+static gint
+virt_viewer_channel_pool_cmp(gconstpointer a,
+                             gconstpointer b,
+                             gpointer user_data G_GNUC_UNUSED)
+{
+    const VirtViewerChannelPoolJob *ja = a;
+    const VirtViewerChannelPoolJob *jb = b;
+
+    if (ja->priority != jb->priority)
+        return ja->priority < jb->priority ? -1 : 1;
+    if (ja->serial != jb->serial)
+        return ja->serial < jb->serial ? -1 : 1;
+    return 0;
+}
+
+/* The job outlives the pool, until it is handed back */
+static gboolean
+virt_viewer_channel_pool_done(gpointer opaque)
+{
+    VirtViewerChannelPoolJob *job = opaque;
+
+    job->done_func(job->request, job->ret, job->fd, job->opaque);
+    g_free(job);
+    return FALSE;
+}
+
+static void
+virt_viewer_channel_pool_run(gpointer opaque,
+                             gpointer userdata G_GNUC_UNUSED)
+{
+    VirtViewerChannelPoolJob *job = opaque;
+
+    job->ret = job->open_func(&job->fd, job->opaque);
+    g_idle_add(virt_viewer_channel_pool_done, job);
+}
+
+VirtViewerChannelPool *
+virt_viewer_channel_pool_new(guint threads,
+                             VirtViewerChannelPoolOpenFunc open_func,
+                             VirtViewerChannelPoolDoneFunc done_func,
+                             gpointer opaque)
+{
+    VirtViewerChannelPool *pool;
+
+    g_return_val_if_fail(threads > 0, NULL);
+    g_return_val_if_fail(open_func != NULL, NULL);
+    g_return_val_if_fail(done_func != NULL, NULL);
+
+    pool = g_new0(VirtViewerChannelPool, 1);
+    pool->open_func = open_func;
+    pool->done_func = done_func;
+    pool->opaque = opaque;
+    pool->threads = g_thread_pool_new(virt_viewer_channel_pool_run, NULL,
+                                      threads, FALSE, NULL);
+    if (pool->threads)
+        g_thread_pool_set_sort_function(pool->threads,
+                                        virt_viewer_channel_pool_cmp, NULL);
+    else
+        DEBUG_LOG("No channel pool threads, opening channels one at a time");
+
+    return pool;
+}
+
+void
+virt_viewer_channel_pool_push(VirtViewerChannelPool *pool,
+                              gpointer request,
+                              gint priority)
+{
+    VirtViewerChannelPoolJob *job;
+
+    g_return_if_fail(pool != NULL);
+
+    job = g_new0(VirtViewerChannelPoolJob, 1);
+    job->open_func = pool->open_func;
+    job->done_func = pool->done_func;
+    job->opaque = pool->opaque;
+    job->request = request;
+    job->priority = priority;
+    job->serial = pool->serial++;
+    job->fd = -1;
+
+    if (!pool->threads) {
+        virt_viewer_channel_pool_run(job, NULL);
+        return;
+    }
+    g_thread_pool_push(pool->threads, job, NULL);
+}
+
+/* Waits for the requests already pushed, their results still come back */
+void
+virt_viewer_channel_pool_free(VirtViewerChannelPool *pool)
+{
+    if (!pool)
+        return;
+
+    if (pool->threads)
+        g_thread_pool_free(pool->threads, FALSE, TRUE);
+    g_free(pool);
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
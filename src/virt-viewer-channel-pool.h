@@ -0,0 +1,58 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_CHANNEL_POOL_H
+#define VIRT_VIEWER_CHANNEL_POOL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _VirtViewerChannelPool VirtViewerChannelPool;
+
+/* Called in a pool thread, sets @fd, possibly to -1, unless it fails */
+typedef gboolean (*VirtViewerChannelPoolOpenFunc)(int *fd, gpointer opaque);
+/* Called from the main loop with the outcome for @request */
+typedef void (*VirtViewerChannelPoolDoneFunc)(gpointer request,
+                                              gboolean ret,
+                                              int fd,
+                                              gpointer opaque);
+
+VirtViewerChannelPool *virt_viewer_channel_pool_new(guint threads,
+                                                    VirtViewerChannelPoolOpenFunc open_func,
+                                                    VirtViewerChannelPoolDoneFunc done_func,
+                                                    gpointer opaque);
+void virt_viewer_channel_pool_push(VirtViewerChannelPool *pool,
+                                   gpointer request,
+                                   gint priority);
+void virt_viewer_channel_pool_free(VirtViewerChannelPool *pool);
+
+G_END_DECLS
+
+#endif /* VIRT_VIEWER_CHANNEL_POOL_H */
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
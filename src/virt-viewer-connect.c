@@ -0,0 +1,459 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <gio/gio.h>
+#include <glib/gi18n.h>
+#include <libxml/uri.h>
+
+#include "virt-viewer-util.h"
+#include "virt-viewer-connect.h"
+#include "virt-viewer-timeline.h"
+
+/*
+ * Dual stack connection establishment, along the lines of RFC 8305
+ * ("Happy Eyeballs"): the resolved addresses are tried alternating
+ * between address families, and a new attempt is started whenever the
+ * previous one has neither succeeded nor failed within
+ * VIRT_VIEWER_CONNECT_ATTEMPT_DELAY, without giving up on it. The
+ * first connection to be established wins, so a host with a broken
+ * IPv6 route no longer stalls until the kernel gives up on it.
+ */
+
+/* ms, the recommended "Connection Attempt Delay" */
+#define VIRT_VIEWER_CONNECT_ATTEMPT_DELAY 250
+
+typedef struct _VirtViewerConnectState VirtViewerConnectState;
+
+typedef struct {
+    VirtViewerConnectState *state;
+    GSocket *socket;
+    GSource *source;
+    gchar *address;
+} VirtViewerConnectAttempt;
+
+struct _VirtViewerConnectState {
+    gchar *host;
+    guint16 port;
+    GList *addresses; /* GInetAddress, in the order they are tried */
+    GList *next;
+    GSList *attempts; /* in progress */
+    gboolean resolving;
+    guint delay_timer;
+    guint timeout_timer;
+    GError *error; /* of the last failed attempt */
+    GTimer *timer;
+    VirtViewerConnectFunc func;
+    gpointer opaque;
+};
+
+static gboolean virt_viewer_connect_start_next(VirtViewerConnectState *state);
+
+static void
+virt_viewer_connect_attempt_free(VirtViewerConnectAttempt *attempt)
+{
+    if (attempt->source) {
+        g_source_destroy(attempt->source);
+        g_source_unref(attempt->source);
+    }
+    g_object_unref(attempt->socket);
+    g_free(attempt->address);
+    g_free(attempt);
+}
+
+static void
+virt_viewer_connect_state_free(VirtViewerConnectState *state)
+{
+    g_list_foreach(state->addresses, (GFunc)g_object_unref, NULL);
+    g_list_free(state->addresses);
+    g_clear_error(&state->error);
+    g_timer_destroy(state->timer);
+    g_free(state->host);
+    g_free(state);
+}
+
+static void
+virt_viewer_connect_finish(VirtViewerConnectState *state,
+                           int fd)
+{
+    if (state->delay_timer)
+        g_source_remove(state->delay_timer);
+    if (state->timeout_timer)
+        g_source_remove(state->timeout_timer);
+    g_slist_foreach(state->attempts, (GFunc)virt_viewer_connect_attempt_free, NULL);
+    g_slist_free(state->attempts);
+    state->attempts = NULL;
+
+    if (fd < 0 && !state->error)
+        g_set_error(&state->error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    _("Unable to connect to %s"), state->host);
+
+    state->func(fd, fd < 0 ? state->error : NULL, state->opaque);
+    state->func = NULL;
+
+    /* A pending lookup still refers to the state */
+    if (!state->resolving)
+        virt_viewer_connect_state_free(state);
+}
+
+static void
+virt_viewer_connect_succeeded(VirtViewerConnectState *state,
+                              VirtViewerConnectAttempt *attempt)
+{
+    /* The socket is closed along with its GSocket, the caller gets
+     * a descriptor of its own */
+    int fd = dup(g_socket_get_fd(attempt->socket));
+
+    DEBUG_LOG("Connected to %s after %.3f seconds", attempt->address,
+              g_timer_elapsed(state->timer, NULL));
+    virt_viewer_timeline_end(VIRT_VIEWER_PHASE_TCP);
+
+    if (fd < 0) {
+        g_clear_error(&state->error);
+        g_set_error(&state->error, G_IO_ERROR, g_io_error_from_errno(errno),
+                    "%s", g_strerror(errno));
+    }
+    virt_viewer_connect_finish(state, fd);
+}
+
+static gboolean
+virt_viewer_connect_attempt_ready(GSocket *socket,
+                                  GIOCondition condition G_GNUC_UNUSED,
+                                  gpointer opaque)
+{
+    VirtViewerConnectAttempt *attempt = opaque;
+    VirtViewerConnectState *state = attempt->state;
+    GError *error = NULL;
+
+    if (g_socket_check_connect_result(socket, &error)) {
+        virt_viewer_connect_succeeded(state, attempt);
+        return FALSE;
+    }
+
+    DEBUG_LOG("Connection to %s failed: %s", attempt->address, error->message);
+    g_clear_error(&state->error);
+    state->error = error;
+
+    state->attempts = g_slist_remove(state->attempts, attempt);
+    virt_viewer_connect_attempt_free(attempt);
+
+    /* Don't wait for the delay when an attempt fails */
+    if (state->delay_timer) {
+        g_source_remove(state->delay_timer);
+        state->delay_timer = 0;
+    }
+    virt_viewer_connect_start_next(state);
+
+    return FALSE;
+}
+
+static gboolean
+virt_viewer_connect_delay_expired(gpointer opaque)
+{
+    VirtViewerConnectState *state = opaque;
+
+    state->delay_timer = 0;
+    virt_viewer_connect_start_next(state);
+
+    return FALSE;
+}
+
+static gboolean
+virt_viewer_connect_timed_out(gpointer opaque)
+{
+    VirtViewerConnectState *state = opaque;
+
+    state->timeout_timer = 0;
+    g_clear_error(&state->error);
+    g_set_error(&state->error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                _("Timed out connecting to %s"), state->host);
+    virt_viewer_connect_finish(state, -1);
+
+    return FALSE;
+}
+
+/*
+ * Starts connecting to the next address. Returns FALSE if the state
+ * was finished, and freed, in the process.
+ */
+static gboolean
+virt_viewer_connect_start_next(VirtViewerConnectState *state)
+{
+    while (state->next) {
+        GInetAddress *address = state->next->data;
+        GSocketAddress *sockaddr;
+        VirtViewerConnectAttempt *attempt;
+        GError *error = NULL;
+        gboolean connected;
+
+        state->next = state->next->next;
+
+        attempt = g_new0(VirtViewerConnectAttempt, 1);
+        attempt->state = state;
+        attempt->address = g_inet_address_to_string(address);
+        attempt->socket = g_socket_new(g_inet_address_get_family(address),
+                                       G_SOCKET_TYPE_STREAM,
+                                       G_SOCKET_PROTOCOL_TCP,
+                                       &error);
+        if (!attempt->socket) {
+            DEBUG_LOG("Unable to create socket for %s: %s", attempt->address, error->message);
+            g_clear_error(&state->error);
+            state->error = error;
+            g_free(attempt->address);
+            g_free(attempt);
+            continue;
+        }
+        g_socket_set_blocking(attempt->socket, FALSE);
+
+        DEBUG_LOG("Connecting to %s port %d", attempt->address, state->port);
+        sockaddr = g_inet_socket_address_new(address, state->port);
+        connected = g_socket_connect(attempt->socket, sockaddr, NULL, &error);
+        g_object_unref(sockaddr);
+
+        if (connected) {
+            virt_viewer_connect_succeeded(state, attempt);
+            virt_viewer_connect_attempt_free(attempt);
+            return FALSE;
+        }
+
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_PENDING)) {
+            DEBUG_LOG("Connection to %s failed: %s", attempt->address, error->message);
+            g_clear_error(&state->error);
+            state->error = error;
+            virt_viewer_connect_attempt_free(attempt);
+            continue;
+        }
+        g_clear_error(&error);
+
+        attempt->source = g_socket_create_source(attempt->socket, G_IO_OUT, NULL);
+        g_source_set_callback(attempt->source,
+                              (GSourceFunc)virt_viewer_connect_attempt_ready,
+                              attempt, NULL);
+        g_source_attach(attempt->source, NULL);
+        state->attempts = g_slist_prepend(state->attempts, attempt);
+
+        if (state->next)
+            state->delay_timer = g_timeout_add(VIRT_VIEWER_CONNECT_ATTEMPT_DELAY,
+                                               virt_viewer_connect_delay_expired,
+                                               state);
+        return TRUE;
+    }
+
+    if (state->attempts)
+        return TRUE;
+
+    virt_viewer_connect_finish(state, -1);
+    return FALSE;
+}
+
+/*
+ * Reorders the addresses so that families alternate, starting with
+ * the one the resolver preferred
+ */
+static GList *
+virt_viewer_connect_interleave(GList *addresses)
+{
+    GList *first = NULL, *other = NULL, *ret = NULL, *l;
+    GSocketFamily family;
+
+    if (!addresses)
+        return NULL;
+
+    family = g_inet_address_get_family(addresses->data);
+    for (l = addresses; l; l = l->next) {
+        if (g_inet_address_get_family(l->data) == family)
+            first = g_list_prepend(first, l->data);
+        else
+            other = g_list_prepend(other, l->data);
+    }
+    g_list_free(addresses);
+    first = g_list_reverse(first);
+    other = g_list_reverse(other);
+
+    for (l = first; l || other; l = l ? l->next : NULL) {
+        if (l)
+            ret = g_list_prepend(ret, l->data);
+        if (other) {
+            ret = g_list_prepend(ret, other->data);
+            other = g_list_delete_link(other, other);
+        }
+    }
+    g_list_free(first);
+
+    return g_list_reverse(ret);
+}
+
+static void
+virt_viewer_connect_resolved(GObject *source,
+                             GAsyncResult *result,
+                             gpointer opaque)
+{
+    VirtViewerConnectState *state = opaque;
+    GList *addresses;
+    GError *error = NULL;
+
+    state->resolving = FALSE;
+    addresses = g_resolver_lookup_by_name_finish(G_RESOLVER(source), result, &error);
+    virt_viewer_timeline_end(VIRT_VIEWER_PHASE_DNS);
+
+    /* The timeout may have fired while the lookup was in progress */
+    if (!state->func) {
+        g_resolver_free_addresses(addresses);
+        g_clear_error(&error);
+        virt_viewer_connect_state_free(state);
+        return;
+    }
+
+    if (!addresses) {
+        DEBUG_LOG("Unable to resolve %s: %s", state->host, error->message);
+        state->error = error;
+        virt_viewer_connect_finish(state, -1);
+        return;
+    }
+
+    DEBUG_LOG("Resolved %s to %u address(es) in %.3f seconds", state->host,
+              g_list_length(addresses), g_timer_elapsed(state->timer, NULL));
+
+    state->addresses = virt_viewer_connect_interleave(addresses);
+    state->next = state->addresses;
+    virt_viewer_timeline_begin(VIRT_VIEWER_PHASE_TCP);
+    virt_viewer_connect_start_next(state);
+}
+
+/*
+ * Connects to @host on TCP @port, giving up after @timeout seconds if
+ * it is not 0. @func is always called from the main loop.
+ */
+void
+virt_viewer_connect_tcp_async(const gchar *host,
+                              const gchar *port,
+                              guint timeout,
+                              VirtViewerConnectFunc func,
+                              gpointer opaque)
+{
+    VirtViewerConnectState *state;
+    GResolver *resolver;
+
+    g_return_if_fail(host != NULL);
+    g_return_if_fail(port != NULL);
+    g_return_if_fail(func != NULL);
+
+    state = g_new0(VirtViewerConnectState, 1);
+    state->host = g_strdup(host);
+    state->port = strtol(port, NULL, 10);
+    state->func = func;
+    state->opaque = opaque;
+    state->timer = g_timer_new();
+
+    if (timeout)
+        state->timeout_timer = g_timeout_add_seconds(timeout,
+                                                     virt_viewer_connect_timed_out,
+                                                     state);
+
+    state->resolving = TRUE;
+    virt_viewer_timeline_begin(VIRT_VIEWER_PHASE_DNS);
+    resolver = g_resolver_get_default();
+    g_resolver_lookup_by_name_async(resolver, host, NULL,
+                                    virt_viewer_connect_resolved, state);
+    g_object_unref(resolver);
+}
+
+/*
+ * Splits a spice:// or vnc:// @uri that only names a host and a plain
+ * TCP port, the way a direct connection would reach it. Anything else
+ * the session has to make sense of (a TLS port, a password, a user,
+ * some other query) makes it return FALSE and leaves @host and @port
+ * alone.
+ */
+gboolean
+virt_viewer_connect_parse_uri(const gchar *uri,
+                              gchar **host,
+                              gchar **port)
+{
+    xmlURIPtr xuri;
+    gchar *server = NULL;
+    gint64 portnum = 0;
+    gboolean ret = FALSE;
+
+    g_return_val_if_fail(uri != NULL, FALSE);
+    g_return_val_if_fail(host != NULL, FALSE);
+    g_return_val_if_fail(port != NULL, FALSE);
+
+    if (!(xuri = xmlParseURI(uri)))
+        return FALSE;
+
+    if (!xuri->scheme ||
+        (g_ascii_strcasecmp(xuri->scheme, "spice") != 0 &&
+         g_ascii_strcasecmp(xuri->scheme, "vnc") != 0))
+        goto cleanup;
+    if (!xuri->server || !xuri->server[0] || xuri->user || xuri->fragment)
+        goto cleanup;
+    if (xuri->path && g_strcmp0(xuri->path, "/") != 0)
+        goto cleanup;
+
+    if (xuri->query && xuri->query[0]) {
+        gchar *end;
+
+        /* Only spice:// carries its port in the query */
+        if (xuri->port ||
+            g_ascii_strcasecmp(xuri->scheme, "spice") != 0 ||
+            !g_str_has_prefix(xuri->query, "port="))
+            goto cleanup;
+        portnum = g_ascii_strtoll(xuri->query + 5, &end, 10);
+        if (end == xuri->query + 5 || *end)
+            goto cleanup;
+    } else {
+        portnum = xuri->port;
+    }
+    if (portnum <= 0 || portnum > 65535)
+        goto cleanup;
+
+    if (xuri->server[0] == '[') {
+        gchar *tmp;
+
+        server = g_strdup(xuri->server + 1);
+        if ((tmp = strchr(server, ']')))
+            *tmp = '\0';
+    } else {
+        server = g_strdup(xuri->server);
+    }
+
+    *host = server;
+    *port = g_strdup_printf("%" G_GINT64_FORMAT, portnum);
+    ret = TRUE;
+
+cleanup:
+    xmlFreeURI(xuri);
+    return ret;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,47 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_CONNECT_H
+#define VIRT_VIEWER_CONNECT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Called once with either a connected socket, owned by the callee,
+ * or -1 and the reason the connection failed.
+ */
+typedef void (*VirtViewerConnectFunc)(int fd, const GError *error, gpointer opaque);
+
+void virt_viewer_connect_tcp_async(const gchar *host,
+                                   const gchar *port,
+                                   guint timeout,
+                                   VirtViewerConnectFunc func,
+                                   gpointer opaque);
+
+gboolean virt_viewer_connect_parse_uri(const gchar *uri,
+                                       gchar **host,
+                                       gchar **port);
+
+G_END_DECLS
+
+#endif /* VIRT_VIEWER_CONNECT_H */
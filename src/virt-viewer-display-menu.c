@@ -0,0 +1,176 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <glib/gi18n.h>
+
+#include "virt-viewer-display-menu.h"
+
+/*
+ * The "Displays" submenus of the windows are kept in line with a model
+ * built once for all of them. Items keep their guest monitor number in
+ * "nth" and are only created, removed or changed when the model says
+ * so, which keeps updates cheap with many monitors.
+ */
+
+GArray *
+virt_viewer_display_menu_model_new(void)
+{
+    return g_array_new(FALSE, FALSE, sizeof(VirtViewerDisplayMenuEntry));
+}
+
+/* The window of monitor @nth, showing @display if any */
+void
+virt_viewer_display_menu_model_add(GArray *model,
+                                   gint nth,
+                                   gboolean visible,
+                                   VirtViewerDisplay *display)
+{
+    VirtViewerDisplayMenuEntry entry;
+
+    entry.nth = nth;
+    entry.visible = visible;
+    entry.sensitive = entry.visible;
+    if (display) {
+        guint hint = virt_viewer_display_get_show_hint(display);
+
+        if (hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY)
+            entry.sensitive = TRUE;
+
+        if (virt_viewer_display_get_selectable(display))
+            entry.sensitive = TRUE;
+    }
+
+    g_array_append_val(model, entry);
+}
+
+static gint
+virt_viewer_display_menu_model_cmp(gconstpointer a, gconstpointer b)
+{
+    const VirtViewerDisplayMenuEntry *ai = a;
+    const VirtViewerDisplayMenuEntry *bi = b;
+
+    if (ai->nth > bi->nth)
+        return 1;
+    else if (ai->nth < bi->nth)
+        return -1;
+    else
+        return 0;
+}
+
+void
+virt_viewer_display_menu_model_sort(GArray *model)
+{
+    g_array_sort(model, virt_viewer_display_menu_model_cmp);
+}
+
+static void
+virt_viewer_display_menu_item_update(GtkWidget *item,
+                                     const VirtViewerDisplayMenuEntry *entry,
+                                     GCallback toggled,
+                                     gpointer data)
+{
+    GtkCheckMenuItem *check = GTK_CHECK_MENU_ITEM(item);
+
+    if (gtk_check_menu_item_get_active(check) != entry->visible) {
+        g_signal_handlers_block_by_func(item, toggled, data);
+        gtk_check_menu_item_set_active(check, entry->visible);
+        g_signal_handlers_unblock_by_func(item, toggled, data);
+    }
+
+    if (gtk_widget_get_sensitive(item) != entry->sensitive)
+        gtk_widget_set_sensitive(item, entry->sensitive);
+}
+
+static GtkWidget *
+virt_viewer_display_menu_item_new(const VirtViewerDisplayMenuEntry *entry,
+                                  GCallback toggled,
+                                  gpointer data)
+{
+    GtkWidget *item;
+    gchar *label;
+
+    label = g_strdup_printf(_("Display %d"), entry->nth + 1);
+    item = gtk_check_menu_item_new_with_label(label);
+    g_free(label);
+
+    g_object_set_data(G_OBJECT(item), "nth", GINT_TO_POINTER(entry->nth));
+    g_signal_connect(G_OBJECT(item), "toggled", toggled, data);
+    virt_viewer_display_menu_item_update(item, entry, toggled, data);
+    gtk_widget_show(item);
+
+    return item;
+}
+
+/* Brings the items of @menu, kept sorted like the sorted @model, in
+ * line with it: only the items which differ are touched */
+void
+virt_viewer_display_menu_update(GtkMenuShell *menu,
+                                GArray *model,
+                                GCallback toggled,
+                                gpointer data)
+{
+    GList *items, *it;
+    guint i;
+
+    g_return_if_fail(GTK_IS_MENU_SHELL(menu));
+    g_return_if_fail(model != NULL);
+
+    items = gtk_container_get_children(GTK_CONTAINER(menu));
+    it = items;
+    for (i = 0; i < model->len; i++) {
+        const VirtViewerDisplayMenuEntry *entry = &g_array_index(model, VirtViewerDisplayMenuEntry, i);
+        GtkWidget *item = NULL;
+
+        for (; it != NULL; it = it->next) {
+            gint nth = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(it->data), "nth"));
+
+            if (nth > entry->nth)
+                break;
+            if (nth == entry->nth) {
+                item = it->data;
+                it = it->next;
+                break;
+            }
+            /* its window went away */
+            gtk_container_remove(GTK_CONTAINER(menu), GTK_WIDGET(it->data));
+        }
+
+        if (item)
+            virt_viewer_display_menu_item_update(item, entry, toggled, data);
+        else
+            gtk_menu_shell_insert(menu, virt_viewer_display_menu_item_new(entry, toggled, data), i);
+    }
+
+    for (; it != NULL; it = it->next)
+        gtk_container_remove(GTK_CONTAINER(menu), GTK_WIDGET(it->data));
+
+    g_list_free(items);
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,60 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_DISPLAY_MENU_H
+#define VIRT_VIEWER_DISPLAY_MENU_H
+
+#include <gtk/gtk.h>
+
+#include "virt-viewer-display.h"
+
+G_BEGIN_DECLS
+
+/* What the display menus of all windows show, one entry per window */
+typedef struct {
+    gint nth;
+    gboolean visible;
+    gboolean sensitive;
+} VirtViewerDisplayMenuEntry;
+
+GArray *virt_viewer_display_menu_model_new(void);
+void virt_viewer_display_menu_model_add(GArray *model,
+                                        gint nth,
+                                        gboolean visible,
+                                        VirtViewerDisplay *display);
+void virt_viewer_display_menu_model_sort(GArray *model);
+
+void virt_viewer_display_menu_update(GtkMenuShell *menu,
+                                     GArray *model,
+                                     GCallback toggled,
+                                     gpointer data);
+
+G_END_DECLS
+
+#endif /* VIRT_VIEWER_DISPLAY_MENU_H */
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
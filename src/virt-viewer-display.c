@@ -30,6 +30,9 @@
 #include "virt-gtk-compat.h"
 #include "virt-viewer-session.h"
 #include "virt-viewer-display.h"
+#include "virt-viewer-timeline.h"
+#include "virt-viewer-trace.h"
+#include "virt-viewer-watchdog.h"
 #include "virt-viewer-util.h"
 
 #define VIRT_VIEWER_DISPLAY_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE((o), VIRT_VIEWER_TYPE_DISPLAY, VirtViewerDisplayPrivate))
@@ -49,8 +52,28 @@ struct _VirtViewerDisplayPrivate
     VirtViewerSession *session;
     gboolean auto_resize;
     gboolean fullscreen;
+
+    /* Hint and size changes are announced once, before the next relayout */
+    guint changes;
+    guint changes_requested;
+    guint changes_source;
+    guint notified_hint;
+    guint notified_width;
+    guint notified_height;
 };
 
+typedef enum {
+    VIRT_VIEWER_DISPLAY_CHANGED_HINT = 1 << 0,
+    VIRT_VIEWER_DISPLAY_CHANGED_SIZE = 1 << 1,
+} VirtViewerDisplayChanges;
+
+/* Ahead of GTK+ resizing (G_PRIORITY_HIGH_IDLE + 10) and redrawing */
+#define VIRT_VIEWER_DISPLAY_CHANGES_PRIORITY G_PRIORITY_HIGH_IDLE
+
+/* Process wide, to tell how much coalescing saves */
+static guint64 display_changes_requested;
+static guint64 display_changes_flushed;
+
 #if !GTK_CHECK_VERSION(3, 0, 0)
 static void virt_viewer_display_size_request(GtkWidget *widget,
                                              GtkRequisition *requisition);
@@ -74,6 +97,7 @@ static void virt_viewer_display_get_property(GObject *object,
                                              GValue *value,
                                              GParamSpec *pspec);
 static void virt_viewer_display_grab_focus(GtkWidget *widget);
+static void virt_viewer_display_dispose(GObject *object);
 
 G_DEFINE_ABSTRACT_TYPE(VirtViewerDisplay, virt_viewer_display, GTK_TYPE_BIN)
 
@@ -100,6 +124,7 @@ virt_viewer_display_class_init(VirtViewerDisplayClass *class)
 
     object_class->set_property = virt_viewer_display_set_property;
     object_class->get_property = virt_viewer_display_get_property;
+    object_class->dispose = virt_viewer_display_dispose;
 
 #if GTK_CHECK_VERSION(3, 0, 0)
     widget_class->get_preferred_width = virt_viewer_display_get_preferred_width;
@@ -281,11 +306,26 @@ virt_viewer_display_init(VirtViewerDisplay *display)
     display->priv->zoom_level = 100;
     display->priv->zoom = TRUE;
     display->priv->auto_resize = TRUE;
+    display->priv->notified_width = 100;
+    display->priv->notified_height = 100;
 #if !GTK_CHECK_VERSION(3, 0, 0)
     display->priv->dirty = TRUE;
 #endif
 }
 
+static void
+virt_viewer_display_dispose(GObject *object)
+{
+    VirtViewerDisplay *display = VIRT_VIEWER_DISPLAY(object);
+
+    if (display->priv->changes_source) {
+        g_source_remove(display->priv->changes_source);
+        display->priv->changes_source = 0;
+    }
+
+    G_OBJECT_CLASS(virt_viewer_display_parent_class)->dispose(object);
+}
+
 GtkWidget*
 virt_viewer_display_new(void)
 {
@@ -416,9 +456,8 @@ virt_viewer_display_size_request(GtkWidget *widget,
         requisition->height += 50;
     }
 
-    DEBUG_LOG("Display size request %dx%d (desktop %dx%d)",
-              requisition->width, requisition->height,
-              priv->desktopWidth, priv->desktopHeight);
+    virt_viewer_trace(VIRT_VIEWER_TRACE_DISPLAY_REQUEST,
+                      requisition->width, requisition->height);
 }
 
 static void
@@ -499,7 +538,8 @@ virt_viewer_display_size_allocate(GtkWidget *widget,
     double actualAspect;
     GtkWidget *child = gtk_bin_get_child(bin);
 
-    DEBUG_LOG("Allocated %dx%d", allocation->width, allocation->height);
+    virt_viewer_trace(VIRT_VIEWER_TRACE_DISPLAY_ALLOCATE,
+                      allocation->width, allocation->height);
     gtk_widget_set_allocation(widget, allocation);
 
     if (priv->desktopWidth == 0 ||
@@ -530,7 +570,8 @@ virt_viewer_display_size_allocate(GtkWidget *widget,
         child_allocation.x = 0.5 * (width - child_allocation.width) + allocation->x + border_width;
         child_allocation.y = 0.5 * (height - child_allocation.height) + allocation->y + border_width;
 
-        DEBUG_LOG("Child allocate %dx%d", child_allocation.width, child_allocation.height);
+        virt_viewer_trace(VIRT_VIEWER_TRACE_DISPLAY_CHILD,
+                          child_allocation.width, child_allocation.height);
         gtk_widget_size_allocate(child, &child_allocation);
     }
 
@@ -541,6 +582,76 @@ end:
 }
 
 
+static gboolean
+virt_viewer_display_flush_changes(gpointer opaque)
+{
+    VirtViewerDisplay *display = VIRT_VIEWER_DISPLAY(opaque);
+    VirtViewerDisplayPrivate *priv = display->priv;
+    guint changes = priv->changes;
+    guint requested = priv->changes_requested;
+
+    priv->changes_source = 0;
+    priv->changes = 0;
+    priv->changes_requested = 0;
+
+    /* Nothing to say about values which went back to what was announced */
+    if (priv->notified_hint == priv->show_hint)
+        changes &= ~VIRT_VIEWER_DISPLAY_CHANGED_HINT;
+    if (priv->notified_width == priv->desktopWidth &&
+        priv->notified_height == priv->desktopHeight)
+        changes &= ~VIRT_VIEWER_DISPLAY_CHANGED_SIZE;
+
+    display_changes_requested += requested;
+    if (changes)
+        display_changes_flushed++;
+    virt_viewer_trace(VIRT_VIEWER_TRACE_DISPLAY_FLUSH, priv->nth_display, requested);
+    DEBUG_LOG("display %d: %u change(s) flushed as 0x%x, %" G_GUINT64_FORMAT
+              " requested / %" G_GUINT64_FORMAT " flushed overall",
+              priv->nth_display, requested, changes,
+              display_changes_requested, display_changes_flushed);
+
+    g_object_ref(display);
+    if (changes & VIRT_VIEWER_DISPLAY_CHANGED_SIZE) {
+        priv->notified_width = priv->desktopWidth;
+        priv->notified_height = priv->desktopHeight;
+        virt_viewer_display_queue_resize(display);
+        g_signal_emit_by_name(display, "display-desktop-resize");
+    }
+    if (changes & VIRT_VIEWER_DISPLAY_CHANGED_HINT) {
+        priv->notified_hint = priv->show_hint;
+        g_object_notify(G_OBJECT(display), "show-hint");
+    }
+    g_object_unref(display);
+
+    return FALSE;
+}
+
+/*
+ * A single guest monitor configuration sets the hint and the size of
+ * a display several times in a row; the signals they cascade into
+ * (window show/hide, page switches, menus, resizes) are only emitted
+ * once all of it has been applied.
+ */
+static void
+virt_viewer_display_queue_changes(VirtViewerDisplay *display,
+                                  VirtViewerDisplayChanges changes)
+{
+    VirtViewerDisplayPrivate *priv = display->priv;
+
+    priv->changes |= changes;
+    priv->changes_requested++;
+
+    if (priv->changes_source)
+        return;
+
+    priv->changes_source =
+        virt_viewer_watchdog_idle_add_full(VIRT_VIEWER_DISPLAY_CHANGES_PRIORITY,
+                                           "display changes",
+                                           virt_viewer_display_flush_changes,
+                                           display, NULL);
+}
+
+
 void virt_viewer_display_set_desktop_size(VirtViewerDisplay *display,
                                           guint width,
                                           guint height)
@@ -552,10 +663,9 @@ void virt_viewer_display_set_desktop_size(VirtViewerDisplay *display,
 
     priv->desktopWidth = width;
     priv->desktopHeight = height;
+    virt_viewer_trace(VIRT_VIEWER_TRACE_DISPLAY_DESKTOP, width, height);
 
-    virt_viewer_display_queue_resize(display);
-
-    g_signal_emit_by_name(display, "display-desktop-resize");
+    virt_viewer_display_queue_changes(display, VIRT_VIEWER_DISPLAY_CHANGED_SIZE);
 }
 
 
@@ -666,7 +776,10 @@ void virt_viewer_display_set_show_hint(VirtViewerDisplay *self, guint mask, gboo
         return;
 
     priv->show_hint = hint;
-    g_object_notify(G_OBJECT(self), "show-hint");
+    virt_viewer_trace(VIRT_VIEWER_TRACE_DISPLAY_HINT, priv->nth_display, hint);
+    if (hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY)
+        virt_viewer_timeline_mark(VIRT_VIEWER_PHASE_FIRST_FRAME);
+    virt_viewer_display_queue_changes(self, VIRT_VIEWER_DISPLAY_CHANGED_HINT);
 }
 
 void virt_viewer_display_set_enabled(VirtViewerDisplay *self, gboolean enabled)
@@ -768,6 +881,13 @@ void virt_viewer_display_set_fullscreen(VirtViewerDisplay *self, gboolean fullsc
     g_object_notify(G_OBJECT(self), "fullscreen");
 }
 
+gint virt_viewer_display_get_nth(VirtViewerDisplay *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), -1);
+
+    return self->priv->nth_display;
+}
+
 gboolean virt_viewer_display_get_fullscreen(VirtViewerDisplay *self)
 {
     g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), FALSE);
@@ -25,34 +25,104 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
 #include <glib.h>
 #include <libvirt/libvirt.h>
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+#include "virt-glib-compat.h"
 #include "virt-viewer-events.h"
+#include "virt-viewer-trace.h"
 
 struct virt_viewer_events_handle
 {
     int watch;
     int fd;
     int events;
-    int enabled;
+    gboolean epoll; /* fd is part of the source's epoll set */
+    gboolean polled; /* pollfd is attached to the source */
+    GPollFD pollfd;
+#ifdef G_OS_WIN32
     GIOChannel *channel;
-    guint source;
+#endif
     virEventHandleCallback cb;
     void *opaque;
     virFreeCallback ff;
 };
 
+/* A single source multiplexes all libvirt handles. Where epoll is
+ * available, only the epoll fd is part of the main loop poll array
+ * and interest changes are applied in place with EPOLL_CTL_MOD.
+ * Handles epoll refuses (or all handles, on other platforms) get
+ * their own GPollFD on the same source instead */
+typedef struct {
+    GSource source;
+    GPollFD epollfd;
+    guint npolled;
+} VirtViewerEventsSource;
+
+#define VIRT_VIEWER_EVENTS_MAX_READY 64
+
+/* The libvirt sources are attached to events_context, which is NULL
+ * (the default context) unless a dedicated event thread was started.
+ * libvirt registers, updates and removes handles and timeouts from
+ * whichever thread issues an RPC, so the registry is protected by the
+ * events lock. It is never held while calling back into libvirt */
+static GMainContext *events_context = NULL;
+static GThread *events_thread = NULL;
+G_LOCK_DEFINE_STATIC(events);
+
+/* Timers are dispatched ahead of input and redraw so the keepalive
+ * timer can't be starved by a busy display. Socket traffic runs at
+ * the same priority as input, still ahead of redraws */
+static gint priorities[VIRT_VIEWER_EVENTS_PRIORITY_LAST] = {
+    [VIRT_VIEWER_EVENTS_PRIORITY_CONTROL] = G_PRIORITY_HIGH,
+    [VIRT_VIEWER_EVENTS_PRIORITY_IO] = G_PRIORITY_DEFAULT,
+};
+
 static int nextwatch = 1;
-static unsigned int nhandles = 0;
-static struct virt_viewer_events_handle **handles = NULL;
+static GHashTable *handles = NULL;
+static VirtViewerEventsSource *handle_source = NULL;
 
-static gboolean
-virt_viewer_events_dispatch_handle(GIOChannel *source G_GNUC_UNUSED,
-                                   GIOCondition condition,
-                                   gpointer opaque)
+struct virt_viewer_events_timeout;
+
+/* Records removed by libvirt cannot be freed immediately, since the
+ * remove callback may be invoked from within their own dispatch
+ * function. They are queued here and released in batches by a single
+ * idle source, rather than one idle source per removal */
+static GSList *pending_handles = NULL;
+static GSList *pending_timeouts = NULL;
+static gboolean pending_cleanup = FALSE;
+
+static void virt_viewer_events_queue_cleanup(struct virt_viewer_events_handle *handle,
+                                             struct virt_viewer_events_timeout *timeout);
+
+static struct virt_viewer_events_handle *
+virt_viewer_events_find_handle(int watch)
+{
+    return g_hash_table_lookup(handles, GINT_TO_POINTER(watch));
+}
+
+static GIOCondition
+virt_viewer_events_to_condition(int events)
+{
+    GIOCondition cond = 0;
+
+    if (events & VIR_EVENT_HANDLE_READABLE)
+        cond |= G_IO_IN;
+    if (events & VIR_EVENT_HANDLE_WRITABLE)
+        cond |= G_IO_OUT;
+
+    return cond;
+}
+
+static int
+virt_viewer_events_from_condition(GIOCondition condition)
 {
-    struct virt_viewer_events_handle *data = opaque;
     int events = 0;
 
     if (condition & G_IO_IN)
@@ -64,13 +134,251 @@ virt_viewer_events_dispatch_handle(GIOChannel *source G_GNUC_UNUSED,
     if (condition & G_IO_ERR)
         events |= VIR_EVENT_HANDLE_ERROR;
 
-    DEBUG_LOG("Dispatch handler %d %d %p", data->fd, events, data->opaque);
+    return events;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static int
+virt_viewer_events_from_epoll(uint32_t epevents)
+{
+    int events = 0;
+
+    if (epevents & EPOLLIN)
+        events |= VIR_EVENT_HANDLE_READABLE;
+    if (epevents & EPOLLOUT)
+        events |= VIR_EVENT_HANDLE_WRITABLE;
+    if (epevents & EPOLLHUP)
+        events |= VIR_EVENT_HANDLE_HANGUP;
+    if (epevents & EPOLLERR)
+        events |= VIR_EVENT_HANDLE_ERROR;
+
+    return events;
+}
+
+static int
+virt_viewer_events_epoll_ctl(struct virt_viewer_events_handle *data, int op)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    if (data->events & VIR_EVENT_HANDLE_READABLE)
+        ev.events |= EPOLLIN;
+    if (data->events & VIR_EVENT_HANDLE_WRITABLE)
+        ev.events |= EPOLLOUT;
+    /* Events are matched back by watch rather than by record, so
+     * that events for handles removed during dispatch are dropped */
+    ev.data.u64 = (guint)data->watch;
+
+    return epoll_ctl(handle_source->epollfd.fd, op, data->fd, &ev);
+}
+#endif
+
+static void
+virt_viewer_events_disarm_handle(struct virt_viewer_events_handle *data)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (data->epoll) {
+        /* The fd may already be closed, in which case the kernel
+         * already dropped it from the set */
+        virt_viewer_events_epoll_ctl(data, EPOLL_CTL_DEL);
+        data->epoll = FALSE;
+    }
+#endif
+
+    if (data->polled) {
+        g_source_remove_poll(&handle_source->source, &data->pollfd);
+        data->polled = FALSE;
+        handle_source->npolled--;
+    }
+}
+
+static void
+virt_viewer_events_arm_handle(struct virt_viewer_events_handle *data)
+{
+    GIOCondition cond = virt_viewer_events_to_condition(data->events);
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (handle_source->epollfd.fd >= 0 && !data->polled) {
+        if (virt_viewer_events_epoll_ctl(data, data->epoll ?
+                                         EPOLL_CTL_MOD : EPOLL_CTL_ADD) == 0) {
+            data->epoll = TRUE;
+            return;
+        }
+
+        DEBUG_LOG("Cannot watch fd %d with epoll, falling back to poll: %s",
+                  data->fd, g_strerror(errno));
+        virt_viewer_events_disarm_handle(data);
+    }
+#endif
+
+#ifdef G_OS_WIN32
+    g_io_channel_win32_make_pollfd(data->channel, cond, &data->pollfd);
+#else
+    data->pollfd.fd = data->fd;
+    data->pollfd.events = cond;
+#endif
+
+    if (!data->polled) {
+        g_source_add_poll(&handle_source->source, &data->pollfd);
+        data->polled = TRUE;
+        handle_source->npolled++;
+    } else if (events_thread) {
+        /* The event thread may be sleeping in poll() with the old
+         * interest set */
+        g_main_context_wakeup(events_context);
+    }
+}
+
+static gboolean
+virt_viewer_events_source_prepare(GSource *source G_GNUC_UNUSED,
+                                  gint *timeout)
+{
+    *timeout = -1;
+    return FALSE;
+}
+
+static gboolean
+virt_viewer_events_source_check(GSource *source)
+{
+    VirtViewerEventsSource *src = (VirtViewerEventsSource *)source;
+    GHashTableIter iter;
+    gpointer value;
+    gboolean ready = FALSE;
+
+    if (src->epollfd.revents & G_IO_IN)
+        return TRUE;
+
+    G_LOCK(events);
+    if (src->npolled) {
+        g_hash_table_iter_init(&iter, handles);
+        while (!ready && g_hash_table_iter_next(&iter, NULL, &value)) {
+            struct virt_viewer_events_handle *data = value;
+            if (data->polled && data->pollfd.revents)
+                ready = TRUE;
+        }
+    }
+    G_UNLOCK(events);
+
+    return ready;
+}
 
-    (data->cb)(data->watch, data->fd, events, data->opaque);
+static gboolean
+virt_viewer_events_source_dispatch(GSource *source,
+                                   GSourceFunc callback G_GNUC_UNUSED,
+                                   gpointer user_data G_GNUC_UNUSED)
+{
+    VirtViewerEventsSource *src = (VirtViewerEventsSource *)source;
+    int watches[VIRT_VIEWER_EVENTS_MAX_READY];
+    int events[VIRT_VIEWER_EVENTS_MAX_READY];
+    guint nready = 0;
+    guint i;
+
+    /* Collect all ready handles first, since callbacks are free to
+     * add, update and remove handles */
+#ifdef HAVE_SYS_EPOLL_H
+    if (src->epollfd.revents & G_IO_IN) {
+        struct epoll_event ready[VIRT_VIEWER_EVENTS_MAX_READY];
+        int n = epoll_wait(src->epollfd.fd, ready, VIRT_VIEWER_EVENTS_MAX_READY, 0);
+        int j;
+
+        for (j = 0; j < n; j++) {
+            watches[nready] = (int)ready[j].data.u64;
+            events[nready] = virt_viewer_events_from_epoll(ready[j].events);
+            nready++;
+        }
+    }
+#endif
+
+    G_LOCK(events);
+    if (src->npolled) {
+        GHashTableIter iter;
+        gpointer value;
+
+        g_hash_table_iter_init(&iter, handles);
+        while (nready < VIRT_VIEWER_EVENTS_MAX_READY &&
+               g_hash_table_iter_next(&iter, NULL, &value)) {
+            struct virt_viewer_events_handle *data = value;
+            if (!data->polled || !data->pollfd.revents)
+                continue;
+
+            watches[nready] = data->watch;
+            events[nready] = virt_viewer_events_from_condition(data->pollfd.revents);
+            data->pollfd.revents = 0;
+            nready++;
+        }
+    }
+    G_UNLOCK(events);
+
+    for (i = 0; i < nready; i++) {
+        struct virt_viewer_events_handle *data;
+        virEventHandleCallback cb;
+        void *opaque;
+        int fd;
+
+        G_LOCK(events);
+        data = virt_viewer_events_find_handle(watches[i]);
+        /* Removed or disabled by an earlier callback in this batch */
+        if (!data || !data->events) {
+            G_UNLOCK(events);
+            continue;
+        }
+        cb = data->cb;
+        opaque = data->opaque;
+        fd = data->fd;
+        G_UNLOCK(events);
+
+        virt_viewer_trace(VIRT_VIEWER_TRACE_EVENTS_HANDLE, fd, events[i]);
+
+        /* The record itself is only freed from events_context, so
+         * opaque stays valid for the duration of the callback */
+        (cb)(watches[i], fd, events[i], opaque);
+    }
 
     return TRUE;
 }
 
+static void
+virt_viewer_events_source_finalize(GSource *source)
+{
+    VirtViewerEventsSource *src = (VirtViewerEventsSource *)source;
+
+    if (src->epollfd.fd >= 0)
+        close(src->epollfd.fd);
+}
+
+static GSourceFuncs virt_viewer_events_source_funcs = {
+    virt_viewer_events_source_prepare,
+    virt_viewer_events_source_check,
+    virt_viewer_events_source_dispatch,
+    virt_viewer_events_source_finalize,
+    NULL,
+    NULL
+};
+
+static void
+virt_viewer_events_create_source(void)
+{
+    GSource *source = g_source_new(&virt_viewer_events_source_funcs,
+                                   sizeof(VirtViewerEventsSource));
+
+    handle_source = (VirtViewerEventsSource *)source;
+    handle_source->epollfd.fd = -1;
+
+#ifdef HAVE_SYS_EPOLL_H
+    handle_source->epollfd.fd = epoll_create1(EPOLL_CLOEXEC);
+    if (handle_source->epollfd.fd >= 0) {
+        handle_source->epollfd.events = G_IO_IN;
+        g_source_add_poll(source, &handle_source->epollfd);
+    } else {
+        DEBUG_LOG("Cannot create epoll set, falling back to poll: %s",
+                  g_strerror(errno));
+    }
+#endif
+
+    g_source_set_priority(source, priorities[VIRT_VIEWER_EVENTS_PRIORITY_IO]);
+    g_source_attach(source, events_context);
+}
+
 
 static
 int virt_viewer_events_add_handle(int fd,
@@ -80,124 +388,98 @@ int virt_viewer_events_add_handle(int fd,
                                   virFreeCallback ff)
 {
     struct virt_viewer_events_handle *data;
-    GIOCondition cond = 0;
+    int watch;
 
-    handles = g_realloc(handles, sizeof(*handles)*(nhandles+1));
-    data = g_malloc(sizeof(*data));
-    memset(data, 0, sizeof(*data));
+    data = g_slice_new0(struct virt_viewer_events_handle);
 
-    if (events & VIR_EVENT_HANDLE_READABLE)
-        cond |= G_IO_IN;
-    if (events & VIR_EVENT_HANDLE_WRITABLE)
-        cond |= G_IO_OUT;
-
-    data->watch = nextwatch++;
     data->fd = fd;
     data->events = events;
     data->cb = cb;
     data->opaque = opaque;
+#ifdef G_OS_WIN32
     data->channel = g_io_channel_unix_new(fd);
+#endif
     data->ff = ff;
 
     DEBUG_LOG("Add handle %d %d %p", data->fd, events, data->opaque);
 
-    data->source = g_io_add_watch(data->channel,
-                                  cond,
-                                  virt_viewer_events_dispatch_handle,
-                                  data);
-
-    handles[nhandles++] = data;
-
-    return data->watch;
-}
+    G_LOCK(events);
+    data->watch = nextwatch++;
+    if (events)
+        virt_viewer_events_arm_handle(data);
 
-static struct virt_viewer_events_handle *
-virt_viewer_events_find_handle(int watch)
-{
-    unsigned int i;
-    for (i = 0 ; i < nhandles ; i++)
-        if (handles[i]->watch == watch)
-            return handles[i];
+    g_hash_table_insert(handles, GINT_TO_POINTER(data->watch), data);
+    watch = data->watch;
+    G_UNLOCK(events);
 
-    return NULL;
+    return watch;
 }
 
 static void
 virt_viewer_events_update_handle(int watch,
                                  int events)
 {
-    struct virt_viewer_events_handle *data = virt_viewer_events_find_handle(watch);
+    struct virt_viewer_events_handle *data;
 
+    G_LOCK(events);
+    data = virt_viewer_events_find_handle(watch);
     if (!data) {
         DEBUG_LOG("Update for missing handle watch %d", watch);
-        return;
+        goto cleanup;
     }
 
-    if (events) {
-        GIOCondition cond = 0;
-        if (events == data->events)
-            return;
+    if (events == data->events)
+        goto cleanup;
 
-        if (data->source)
-            g_source_remove(data->source);
-
-        cond |= G_IO_HUP;
-        if (events & VIR_EVENT_HANDLE_READABLE)
-            cond |= G_IO_IN;
-        if (events & VIR_EVENT_HANDLE_WRITABLE)
-            cond |= G_IO_OUT;
-        data->source = g_io_add_watch(data->channel,
-                                      cond,
-                                      virt_viewer_events_dispatch_handle,
-                                      data);
-        data->events = events;
-    } else {
-        if (!data->source)
-            return;
+    data->events = events;
+    if (events)
+        virt_viewer_events_arm_handle(data);
+    else
+        virt_viewer_events_disarm_handle(data);
 
-        g_source_remove(data->source);
-        data->source = 0;
-        data->events = 0;
-    }
+ cleanup:
+    G_UNLOCK(events);
 }
 
 
-static gboolean
-virt_viewer_events_cleanup_handle(gpointer user_data)
+static void
+virt_viewer_events_cleanup_handle(struct virt_viewer_events_handle *data)
 {
-    struct virt_viewer_events_handle *data = user_data;
-
     DEBUG_LOG("Cleanup of handle %p", data);
-    g_return_val_if_fail(data != NULL, FALSE);
+    g_return_if_fail(data != NULL);
 
     if (data->ff)
         (data->ff)(data->opaque);
 
-    free(data);
-    return FALSE;
+#ifdef G_OS_WIN32
+    g_io_channel_unref(data->channel);
+#endif
+    g_slice_free(struct virt_viewer_events_handle, data);
 }
 
 
 static int
 virt_viewer_events_remove_handle(int watch)
 {
-    struct virt_viewer_events_handle *data = virt_viewer_events_find_handle(watch);
+    struct virt_viewer_events_handle *data;
 
+    G_LOCK(events);
+    data = virt_viewer_events_find_handle(watch);
     if (!data) {
+        G_UNLOCK(events);
         DEBUG_LOG("Remove of missing watch %d", watch);
         return -1;
     }
 
     DEBUG_LOG("Remove handle %d %d", watch, data->fd);
 
-    if (!data->source)
-        return -1;
-
-    g_source_remove(data->source);
-    data->source = 0;
+    virt_viewer_events_disarm_handle(data);
     data->events = 0;
 
-    g_idle_add(virt_viewer_events_cleanup_handle, data);
+    g_hash_table_remove(handles, GINT_TO_POINTER(watch));
+    virt_viewer_events_queue_cleanup(data, NULL);
+    G_UNLOCK(events);
+
     return 0;
 }
 
@@ -205,7 +487,7 @@ struct virt_viewer_events_timeout
 {
     int timer;
     int interval;
-    guint source;
+    GSource *source;
     virEventTimeoutCallback cb;
     void *opaque;
     virFreeCallback ff;
@@ -213,19 +495,61 @@ struct virt_viewer_events_timeout
 
 
 static int nexttimer = 1;
-static unsigned int ntimeouts = 0;
-static struct virt_viewer_events_timeout **timeouts = NULL;
+static GHashTable *timeouts = NULL;
+
+static struct virt_viewer_events_timeout *
+virt_viewer_events_find_timeout(int timer)
+{
+    return g_hash_table_lookup(timeouts, GINT_TO_POINTER(timer));
+}
 
 static gboolean
 virt_viewer_events_dispatch_timeout(void *opaque)
 {
-    struct virt_viewer_events_timeout *data = opaque;
-    DEBUG_LOG("Dispatch timeout %p %p %d %p", data, data->cb, data->timer, data->opaque);
-    (data->cb)(data->timer, data->opaque);
+    int timer = GPOINTER_TO_INT(opaque);
+    struct virt_viewer_events_timeout *data;
+    virEventTimeoutCallback cb;
+
+    G_LOCK(events);
+    data = virt_viewer_events_find_timeout(timer);
+    /* Removed from another thread while this dispatch was pending */
+    if (!data || !data->source) {
+        G_UNLOCK(events);
+        return FALSE;
+    }
+    cb = data->cb;
+    opaque = data->opaque;
+    G_UNLOCK(events);
+
+    virt_viewer_trace(VIRT_VIEWER_TRACE_EVENTS_TIMEOUT, timer, 0);
+    (cb)(timer, opaque);
 
     return TRUE;
 }
 
+static void
+virt_viewer_events_start_timeout(struct virt_viewer_events_timeout *data)
+{
+    data->source = g_timeout_source_new(data->interval);
+    g_source_set_priority(data->source, priorities[VIRT_VIEWER_EVENTS_PRIORITY_CONTROL]);
+    g_source_set_callback(data->source,
+                          virt_viewer_events_dispatch_timeout,
+                          GINT_TO_POINTER(data->timer),
+                          NULL);
+    g_source_attach(data->source, events_context);
+}
+
+static void
+virt_viewer_events_stop_timeout(struct virt_viewer_events_timeout *data)
+{
+    if (!data->source)
+        return;
+
+    g_source_destroy(data->source);
+    g_source_unref(data->source);
+    data->source = NULL;
+}
+
 static int
 virt_viewer_events_add_timeout(int interval,
                                virEventTimeoutCallback cb,
@@ -234,37 +558,26 @@ virt_viewer_events_add_timeout(int interval,
 {
     struct virt_viewer_events_timeout *data;
 
-    timeouts = g_realloc(timeouts, sizeof(*timeouts)*(ntimeouts+1));
-    data = g_malloc(sizeof(*data));
-    memset(data, 0, sizeof(*data));
+    int timer;
+
+    data = g_slice_new0(struct virt_viewer_events_timeout);
 
-    data->timer = nexttimer++;
     data->interval = interval;
     data->cb = cb;
     data->opaque = opaque;
     data->ff = ff;
-    if (interval >= 0)
-        data->source = g_timeout_add(interval,
-                                     virt_viewer_events_dispatch_timeout,
-                                     data);
 
-    timeouts[ntimeouts++] = data;
-
-    DEBUG_LOG("Add timeout %p %d %p %p %d", data, interval, cb, opaque, data->timer);
-
-    return data->timer;
-}
+    G_LOCK(events);
+    timer = data->timer = nexttimer++;
+    if (interval >= 0)
+        virt_viewer_events_start_timeout(data);
 
+    g_hash_table_insert(timeouts, GINT_TO_POINTER(data->timer), data);
+    G_UNLOCK(events);
 
-static struct virt_viewer_events_timeout *
-virt_viewer_events_find_timeout(int timer)
-{
-    unsigned int i;
-    for (i = 0 ; i < ntimeouts ; i++)
-        if (timeouts[i]->timer == timer)
-            return timeouts[i];
+    DEBUG_LOG("Add timeout %p %d %p %p %d", data, interval, cb, opaque, timer);
 
-    return NULL;
+    return timer;
 }
 
 
@@ -272,73 +585,209 @@ static void
 virt_viewer_events_update_timeout(int timer,
                                   int interval)
 {
-    struct virt_viewer_events_timeout *data = virt_viewer_events_find_timeout(timer);
+    struct virt_viewer_events_timeout *data;
 
+    G_LOCK(events);
+    data = virt_viewer_events_find_timeout(timer);
     if (!data) {
         DEBUG_LOG("Update of missing timer %d", timer);
-        return;
+        goto cleanup;
     }
 
     DEBUG_LOG("Update timeout %p %d %d", data, timer, interval);
 
     if (interval >= 0) {
         if (data->source)
-            return;
+            goto cleanup;
 
         data->interval = interval;
-        data->source = g_timeout_add(data->interval,
-                                     virt_viewer_events_dispatch_timeout,
-                                     data);
+        virt_viewer_events_start_timeout(data);
     } else {
-        if (!data->source)
-            return;
-
-        g_source_remove(data->source);
-        data->source = 0;
+        virt_viewer_events_stop_timeout(data);
     }
+
+ cleanup:
+    G_UNLOCK(events);
 }
 
 
-static gboolean
-virt_viewer_events_cleanup_timeout(gpointer user_data)
+static void
+virt_viewer_events_cleanup_timeout(struct virt_viewer_events_timeout *data)
 {
-    struct virt_viewer_events_timeout *data = user_data;
-
     DEBUG_LOG("Cleanup of timeout %p", data);
-    g_return_val_if_fail(data != NULL, FALSE);
+    g_return_if_fail(data != NULL);
 
     if (data->ff)
         (data->ff)(data->opaque);
 
-    free(data);
-    return FALSE;
+    g_slice_free(struct virt_viewer_events_timeout, data);
 }
 
 
 static int
 virt_viewer_events_remove_timeout(int timer)
 {
-    struct virt_viewer_events_timeout *data = virt_viewer_events_find_timeout(timer);
+    struct virt_viewer_events_timeout *data;
 
+    G_LOCK(events);
+    data = virt_viewer_events_find_timeout(timer);
     if (!data) {
+        G_UNLOCK(events);
         DEBUG_LOG("Remove of missing timer %d", timer);
         return -1;
     }
 
     DEBUG_LOG("Remove timeout %p %d", data, timer);
 
-    if (!data->source)
-        return -1;
+    virt_viewer_events_stop_timeout(data);
 
-    g_source_remove(data->source);
-    data->source = 0;
+    g_hash_table_remove(timeouts, GINT_TO_POINTER(timer));
+    virt_viewer_events_queue_cleanup(NULL, data);
+    G_UNLOCK(events);
 
-    g_idle_add(virt_viewer_events_cleanup_timeout, data);
     return 0;
 }
 
 
-void virt_viewer_events_register(void) {
+static gboolean
+virt_viewer_events_cleanup(gpointer user_data G_GNUC_UNUSED)
+{
+    GSList *handles_list, *timeouts_list, *it;
+
+    /* Free callbacks may remove further handles/timeouts, which
+     * will then be queued up for the next batch */
+    G_LOCK(events);
+    pending_cleanup = FALSE;
+    handles_list = g_slist_reverse(pending_handles);
+    pending_handles = NULL;
+    timeouts_list = g_slist_reverse(pending_timeouts);
+    pending_timeouts = NULL;
+    G_UNLOCK(events);
+
+    for (it = handles_list; it != NULL; it = it->next)
+        virt_viewer_events_cleanup_handle(it->data);
+    g_slist_free(handles_list);
+
+    for (it = timeouts_list; it != NULL; it = it->next)
+        virt_viewer_events_cleanup_timeout(it->data);
+    g_slist_free(timeouts_list);
+
+    return FALSE;
+}
+
+
+/* Must be called with the events lock held */
+static void
+virt_viewer_events_queue_cleanup(struct virt_viewer_events_handle *handle,
+                                 struct virt_viewer_events_timeout *timeout)
+{
+    GSource *source;
+
+    if (handle)
+        pending_handles = g_slist_prepend(pending_handles, handle);
+    if (timeout)
+        pending_timeouts = g_slist_prepend(pending_timeouts, timeout);
+
+    if (pending_cleanup)
+        return;
+
+    /* Run on events_context so that records are never freed while
+     * the event thread is dispatching them */
+    source = g_idle_source_new();
+    g_source_set_callback(source, virt_viewer_events_cleanup, NULL, NULL);
+    g_source_attach(source, events_context);
+    g_source_unref(source);
+    pending_cleanup = TRUE;
+}
+
+
+static gpointer
+virt_viewer_events_thread(gpointer opaque G_GNUC_UNUSED)
+{
+    GMainLoop *loop = g_main_loop_new(events_context, FALSE);
+
+    DEBUG_LOG("libvirt event thread running");
+    g_main_loop_run(loop);
+    g_main_loop_unref(loop);
+
+    return NULL;
+}
+
+
+gboolean
+virt_viewer_events_is_threaded(void)
+{
+    return events_thread != NULL;
+}
+
+
+void
+virt_viewer_events_set_priority(VirtViewerEventsPriority klass,
+                                gint priority)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    g_return_if_fail(klass < VIRT_VIEWER_EVENTS_PRIORITY_LAST);
+
+    DEBUG_LOG("Set event priority class %d to %d", klass, priority);
+
+    G_LOCK(events);
+    priorities[klass] = priority;
+
+    /* Apply to sources that already exist */
+    switch (klass) {
+    case VIRT_VIEWER_EVENTS_PRIORITY_CONTROL:
+        if (!timeouts)
+            break;
+        g_hash_table_iter_init(&iter, timeouts);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            struct virt_viewer_events_timeout *data = value;
+            if (data->source)
+                g_source_set_priority(data->source, priority);
+        }
+        break;
+
+    case VIRT_VIEWER_EVENTS_PRIORITY_IO:
+        if (handle_source)
+            g_source_set_priority(&handle_source->source, priority);
+        break;
+
+    default:
+        break;
+    }
+    G_UNLOCK(events);
+}
+
+
+gint
+virt_viewer_events_get_priority(VirtViewerEventsPriority klass)
+{
+    g_return_val_if_fail(klass < VIRT_VIEWER_EVENTS_PRIORITY_LAST, G_PRIORITY_DEFAULT);
+
+    return priorities[klass];
+}
+
+
+void virt_viewer_events_register(gboolean threaded) {
+    if (!handles)
+        handles = g_hash_table_new(g_direct_hash, g_direct_equal);
+    if (!timeouts)
+        timeouts = g_hash_table_new(g_direct_hash, g_direct_equal);
+    if (threaded && !handle_source) {
+        events_context = g_main_context_new();
+        events_thread = g_thread_new("libvirt-events",
+                                     virt_viewer_events_thread,
+                                     NULL);
+        if (!events_thread) {
+            g_warning("Unable to start the libvirt event thread");
+            g_main_context_unref(events_context);
+            events_context = NULL;
+        }
+    }
+    if (!handle_source)
+        virt_viewer_events_create_source();
+
     virEventRegisterImpl(virt_viewer_events_add_handle,
                          virt_viewer_events_update_handle,
                          virt_viewer_events_remove_handle,
@@ -25,7 +25,20 @@
 
 #include "virt-viewer-util.h"
 
-void virt_viewer_events_register(void);
+/* Main loop priority classes for libvirt sources */
+typedef enum {
+    /* Timers, including the keepalive timer */
+    VIRT_VIEWER_EVENTS_PRIORITY_CONTROL,
+    /* RPC and stream traffic on libvirt sockets */
+    VIRT_VIEWER_EVENTS_PRIORITY_IO,
+
+    VIRT_VIEWER_EVENTS_PRIORITY_LAST
+} VirtViewerEventsPriority;
+
+void virt_viewer_events_register(gboolean threaded);
+gboolean virt_viewer_events_is_threaded(void);
+void virt_viewer_events_set_priority(VirtViewerEventsPriority klass, gint priority);
+gint virt_viewer_events_get_priority(VirtViewerEventsPriority klass);
 
 #endif
 /*
@@ -0,0 +1,126 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+#include "virt-viewer-graphics.h"
+
+static void
+virt_viewer_graphics_free(VirtViewerGraphics *graphics)
+{
+    g_free(graphics->type);
+    g_free(graphics->port);
+    g_free(graphics->tlsport);
+    g_free(graphics->listen);
+    g_free(graphics->socket);
+    g_free(graphics);
+}
+
+void
+virt_viewer_graphics_list_free(GSList *list)
+{
+    g_slist_foreach(list, (GFunc)virt_viewer_graphics_free, NULL);
+    g_slist_free(list);
+}
+
+static gchar *
+virt_viewer_graphics_attr(xmlNodePtr node, const char *name)
+{
+    xmlChar *prop = xmlGetProp(node, (const xmlChar *)name);
+    gchar *value = NULL;
+
+    /* Unallocated ports are reported as -1 */
+    if (prop && prop[0] && strcmp((const char *)prop, "-1") != 0)
+        value = g_strdup((const char *)prop);
+
+    xmlFree(prop);
+    return value;
+}
+
+/*
+ * Parses the domain XML once and returns the attributes of every
+ * <graphics> device, in document order
+ */
+GSList *
+virt_viewer_graphics_extract(const gchar *xmldesc)
+{
+    xmlDocPtr xml = NULL;
+    xmlParserCtxtPtr pctxt = NULL;
+    xmlNodePtr root, devices, node;
+    GSList *list = NULL;
+
+    if (!xmldesc)
+        return NULL;
+
+    pctxt = xmlNewParserCtxt();
+    if (!pctxt || !pctxt->sax)
+        goto error;
+
+    xml = xmlCtxtReadDoc(pctxt, (const xmlChar *)xmldesc, "domain.xml", NULL,
+                         XML_PARSE_NOENT | XML_PARSE_NONET |
+                         XML_PARSE_NOWARNING);
+    if (!xml)
+        goto error;
+
+    root = xmlDocGetRootElement(xml);
+    if (!root || !xmlStrEqual(root->name, (const xmlChar *)"domain"))
+        goto error;
+
+    for (devices = root->children; devices; devices = devices->next) {
+        if (devices->type != XML_ELEMENT_NODE ||
+            !xmlStrEqual(devices->name, (const xmlChar *)"devices"))
+            continue;
+
+        for (node = devices->children; node; node = node->next) {
+            VirtViewerGraphics *graphics;
+
+            if (node->type != XML_ELEMENT_NODE ||
+                !xmlStrEqual(node->name, (const xmlChar *)"graphics"))
+                continue;
+
+            graphics = g_new0(VirtViewerGraphics, 1);
+            graphics->type = virt_viewer_graphics_attr(node, "type");
+            graphics->port = virt_viewer_graphics_attr(node, "port");
+            graphics->tlsport = virt_viewer_graphics_attr(node, "tlsPort");
+            graphics->listen = virt_viewer_graphics_attr(node, "listen");
+            graphics->socket = virt_viewer_graphics_attr(node, "socket");
+            list = g_slist_prepend(list, graphics);
+        }
+    }
+    list = g_slist_reverse(list);
+
+ error:
+    xmlFreeDoc(xml);
+    xmlFreeParserCtxt(pctxt);
+    return list;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,329 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "virt-viewer-layout.h"
+
+/*
+ * Guest monitor layout: keeps the client geometry of each guest monitor,
+ * turns it into a gapless guest arrangement and tells which monitors
+ * changed since the previous update. The arrangement is only recomputed
+ * when some client geometry changed.
+ */
+
+typedef struct {
+    gboolean present;           /* a display uses this monitor */
+    GdkRectangle preferred;     /* client geometry: window or physical monitor */
+    GdkRectangle layout;        /* guest geometry, from the last update */
+    GdkRectangle applied;       /* as last reported changed, width -1 if never */
+} VirtViewerLayoutEntry;
+
+struct _VirtViewerLayout {
+    GArray *entries;            /* VirtViewerLayoutEntry, indexed by nth */
+    GArray *changes;            /* VirtViewerLayoutMonitor, of the last update */
+    GArray *order;              /* guint, scratch space for aligning */
+    gboolean dirty;             /* preferred geometry changed since the last update */
+    gboolean aligned;           /* whether the last update aligned */
+};
+
+#define ENTRY(layout, nth) (&g_array_index((layout)->entries, VirtViewerLayoutEntry, (nth)))
+
+static gboolean
+rect_equal(const GdkRectangle *r1, const GdkRectangle *r2)
+{
+    return r1->x == r2->x && r1->y == r2->y &&
+        r1->width == r2->width && r1->height == r2->height;
+}
+
+static gboolean
+rect_empty(const GdkRectangle *r)
+{
+    return r->width <= 0 || r->height <= 0;
+}
+
+VirtViewerLayout *
+virt_viewer_layout_new(void)
+{
+    VirtViewerLayout *layout = g_new0(VirtViewerLayout, 1);
+
+    layout->entries = g_array_new(FALSE, TRUE, sizeof(VirtViewerLayoutEntry));
+    layout->changes = g_array_new(FALSE, FALSE, sizeof(VirtViewerLayoutMonitor));
+    layout->order = g_array_new(FALSE, FALSE, sizeof(guint));
+
+    return layout;
+}
+
+void
+virt_viewer_layout_free(VirtViewerLayout *layout)
+{
+    if (layout == NULL)
+        return;
+
+    g_array_unref(layout->entries);
+    g_array_unref(layout->changes);
+    g_array_unref(layout->order);
+    g_free(layout);
+}
+
+static VirtViewerLayoutEntry *
+virt_viewer_layout_get_entry(VirtViewerLayout *layout, guint nth)
+{
+    guint i = layout->entries->len;
+
+    if (nth >= i) {
+        g_array_set_size(layout->entries, nth + 1);
+        for (; i <= nth; i++)
+            ENTRY(layout, i)->applied.width = -1;
+    }
+
+    return ENTRY(layout, nth);
+}
+
+void
+virt_viewer_layout_set_preferred(VirtViewerLayout *layout,
+                                 guint nth,
+                                 const GdkRectangle *preferred)
+{
+    VirtViewerLayoutEntry *entry;
+
+    g_return_if_fail(layout != NULL);
+    g_return_if_fail(preferred != NULL);
+
+    entry = virt_viewer_layout_get_entry(layout, nth);
+    if (entry->present && rect_equal(&entry->preferred, preferred))
+        return;
+
+    entry->present = TRUE;
+    entry->preferred = *preferred;
+    layout->dirty = TRUE;
+}
+
+void
+virt_viewer_layout_remove(VirtViewerLayout *layout, guint nth)
+{
+    VirtViewerLayoutEntry *entry;
+
+    g_return_if_fail(layout != NULL);
+
+    if (nth >= layout->entries->len || !ENTRY(layout, nth)->present)
+        return;
+
+    entry = ENTRY(layout, nth);
+    memset(entry, 0, sizeof(*entry));
+    entry->applied.width = -1;
+    layout->dirty = TRUE;
+}
+
+/* The receiving end lost track of the geometry, report all of it again */
+void
+virt_viewer_layout_forget_applied(VirtViewerLayout *layout)
+{
+    guint i;
+
+    g_return_if_fail(layout != NULL);
+
+    for (i = 0; i < layout->entries->len; i++)
+        ENTRY(layout, i)->applied.width = -1;
+}
+
+/* The guest geometry of @nth as last reported changed, if any */
+gboolean
+virt_viewer_layout_get_applied(VirtViewerLayout *layout,
+                               guint nth,
+                               GdkRectangle *geometry)
+{
+    VirtViewerLayoutEntry *entry;
+
+    g_return_val_if_fail(layout != NULL, FALSE);
+    g_return_val_if_fail(geometry != NULL, FALSE);
+
+    if (nth >= layout->entries->len)
+        return FALSE;
+
+    entry = ENTRY(layout, nth);
+    if (!entry->present || rect_empty(&entry->applied))
+        return FALSE;
+
+    *geometry = entry->applied;
+    return TRUE;
+}
+
+static gint
+compare_int(gint a, gint b)
+{
+    return a < b ? -1 : a > b;
+}
+
+/* Top to bottom, then left to right, finally by monitor id */
+static gint
+layout_cmp_rows(gconstpointer p1, gconstpointer p2, gpointer user_data)
+{
+    VirtViewerLayout *layout = user_data;
+    guint i = *(const guint *)p1;
+    guint j = *(const guint *)p2;
+    const GdkRectangle *m1 = &ENTRY(layout, i)->layout;
+    const GdkRectangle *m2 = &ENTRY(layout, j)->layout;
+    gint diff;
+
+    if ((diff = compare_int(m1->y, m2->y)) != 0)
+        return diff;
+    if ((diff = compare_int(m1->x, m2->x)) != 0)
+        return diff;
+    return compare_int(i, j);
+}
+
+/* Left to right, then top to bottom, finally by monitor id */
+static gint
+layout_cmp_columns(gconstpointer p1, gconstpointer p2, gpointer user_data)
+{
+    VirtViewerLayout *layout = user_data;
+    guint i = *(const guint *)p1;
+    guint j = *(const guint *)p2;
+    const GdkRectangle *m1 = &ENTRY(layout, i)->layout;
+    const GdkRectangle *m2 = &ENTRY(layout, j)->layout;
+    gint diff;
+
+    if ((diff = compare_int(m1->x, m2->x)) != 0)
+        return diff;
+    if ((diff = compare_int(m1->y, m2->y)) != 0)
+        return diff;
+    return compare_int(i, j);
+}
+
+/*
+ * Removes gaps and overlaps while keeping the client arrangement:
+ * monitors overlapping vertically form a row, laid out left to right,
+ * and rows are stacked top to bottom. Side by side windows or monitors
+ * give a single row, as they always used to.
+ */
+static void
+virt_viewer_layout_align(VirtViewerLayout *layout, guint nmonitors)
+{
+    guint *order;
+    guint i, start, end;
+    gint y = 0;
+
+    g_array_set_size(layout->order, 0);
+    for (i = 0; i < nmonitors; i++) {
+        if (!rect_empty(&ENTRY(layout, i)->layout))
+            g_array_append_val(layout->order, i);
+    }
+    if (layout->order->len == 0)
+        return;
+
+    order = (guint *)layout->order->data;
+    g_qsort_with_data(order, layout->order->len, sizeof(guint),
+                      layout_cmp_rows, layout);
+
+    for (start = 0; start < layout->order->len; start = end) {
+        const GdkRectangle *first = &ENTRY(layout, order[start])->layout;
+        gint bottom = first->y + first->height;
+        gint x = 0, height = 0;
+
+        for (end = start + 1; end < layout->order->len; end++) {
+            const GdkRectangle *rect = &ENTRY(layout, order[end])->layout;
+            if (rect->y >= bottom)
+                break;
+            bottom = MAX(bottom, rect->y + rect->height);
+        }
+
+        g_qsort_with_data(order + start, end - start, sizeof(guint),
+                          layout_cmp_columns, layout);
+
+        for (i = start; i < end; i++) {
+            GdkRectangle *rect = &ENTRY(layout, order[i])->layout;
+            rect->x = x;
+            rect->y = y;
+            x += rect->width;
+            height = MAX(height, rect->height);
+        }
+        y += height;
+    }
+}
+
+/*
+ * Lays out the monitors below the highest one in use, the others being
+ * disabled, and returns those whose guest geometry differs from what the
+ * previous updates returned. The array is owned by @layout and valid
+ * until its next update.
+ */
+const VirtViewerLayoutMonitor *
+virt_viewer_layout_update(VirtViewerLayout *layout,
+                          gboolean align,
+                          guint *nchanges)
+{
+    guint i, nmonitors = 0;
+
+    g_return_val_if_fail(layout != NULL, NULL);
+    g_return_val_if_fail(nchanges != NULL, NULL);
+
+    for (i = layout->entries->len; i > 0; i--) {
+        if (ENTRY(layout, i - 1)->present) {
+            nmonitors = i;
+            break;
+        }
+    }
+
+    if (layout->dirty || layout->aligned != align) {
+        for (i = 0; i < nmonitors; i++) {
+            VirtViewerLayoutEntry *entry = ENTRY(layout, i);
+
+            if (entry->present && !rect_empty(&entry->preferred))
+                entry->layout = entry->preferred;
+            else
+                memset(&entry->layout, 0, sizeof(entry->layout));
+        }
+
+        if (align)
+            virt_viewer_layout_align(layout, nmonitors);
+
+        layout->dirty = FALSE;
+        layout->aligned = align;
+    }
+
+    g_array_set_size(layout->changes, 0);
+    for (i = 0; i < nmonitors; i++) {
+        VirtViewerLayoutEntry *entry = ENTRY(layout, i);
+        VirtViewerLayoutMonitor change;
+
+        if (rect_equal(&entry->layout, &entry->applied))
+            continue;
+
+        change.nth = i;
+        change.geometry = entry->layout;
+        g_array_append_val(layout->changes, change);
+        entry->applied = entry->layout;
+    }
+
+    *nchanges = layout->changes->len;
+    return (const VirtViewerLayoutMonitor *)layout->changes->data;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,63 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_LAYOUT_H
+#define VIRT_VIEWER_LAYOUT_H
+
+#include <gdk/gdk.h>
+
+G_BEGIN_DECLS
+
+typedef struct _VirtViewerLayout VirtViewerLayout;
+
+/* The geometry of a guest monitor */
+typedef struct {
+    guint nth;
+    GdkRectangle geometry;
+} VirtViewerLayoutMonitor;
+
+VirtViewerLayout *virt_viewer_layout_new(void);
+void virt_viewer_layout_free(VirtViewerLayout *layout);
+
+void virt_viewer_layout_set_preferred(VirtViewerLayout *layout,
+                                      guint nth,
+                                      const GdkRectangle *preferred);
+void virt_viewer_layout_remove(VirtViewerLayout *layout, guint nth);
+void virt_viewer_layout_forget_applied(VirtViewerLayout *layout);
+gboolean virt_viewer_layout_get_applied(VirtViewerLayout *layout,
+                                        guint nth,
+                                        GdkRectangle *geometry);
+
+const VirtViewerLayoutMonitor *virt_viewer_layout_update(VirtViewerLayout *layout,
+                                                         gboolean align,
+                                                         guint *nchanges);
+
+G_END_DECLS
+
+#endif /* VIRT_VIEWER_LAYOUT_H */
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -25,6 +25,7 @@
 #include <gtk/gtk.h>
 #include <glib/gi18n.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef HAVE_GTK_VNC
 #include <vncdisplay.h>
 #endif
@@ -32,6 +33,7 @@
 #include <spice-option.h>
 #endif
 #include "virt-viewer.h"
+#include "virt-viewer-events.h"
 
 static void virt_viewer_version(void)
 {
@@ -40,6 +42,46 @@ static void virt_viewer_version(void)
     exit(EXIT_SUCCESS);
 }
 
+static gboolean
+option_event_priority(G_GNUC_UNUSED const gchar *option_name,
+                      const gchar *value,
+                      G_GNUC_UNUSED gpointer data, GError **error)
+{
+    gchar **classes = g_strsplit(value, ",", -1);
+    gchar **klass;
+    gboolean ret = FALSE;
+
+    for (klass = classes; *klass != NULL; klass++) {
+        gchar *prio = strchr(*klass, '=');
+        gchar *end = NULL;
+        gint priority;
+
+        if (prio == NULL)
+            goto error;
+        *prio++ = '\0';
+
+        priority = strtol(prio, &end, 10);
+        if (end == prio || *end != '\0')
+            goto error;
+
+        if (g_str_equal(*klass, "control"))
+            virt_viewer_events_set_priority(VIRT_VIEWER_EVENTS_PRIORITY_CONTROL, priority);
+        else if (g_str_equal(*klass, "io"))
+            virt_viewer_events_set_priority(VIRT_VIEWER_EVENTS_PRIORITY_IO, priority);
+        else
+            goto error;
+    }
+
+    ret = TRUE;
+
+ error:
+    if (!ret)
+        g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED,
+                    _("Invalid event-priority argument: %s"), value);
+    g_strfreev(classes);
+    return ret;
+}
+
 
 int main(int argc, char **argv)
 {
@@ -52,6 +94,7 @@ int main(int argc, char **argv)
     gboolean attach = FALSE;
     gboolean waitvm = FALSE;
     gboolean reconnect = FALSE;
+    gboolean eventthread = FALSE;
     VirtViewer *viewer = NULL;
     char *base_name;
     char *help_msg = NULL;
@@ -68,6 +111,10 @@ int main(int argc, char **argv)
           N_("Wait for domain to start"), NULL },
         { "reconnect", 'r', 0, G_OPTION_ARG_NONE, &reconnect,
           N_("Reconnect to domain upon restart"), NULL },
+        { "event-thread", '\0', 0, G_OPTION_ARG_NONE, &eventthread,
+          N_("Dispatch libvirt events from a separate thread"), NULL },
+        { "event-priority", '\0', 0, G_OPTION_ARG_CALLBACK, option_event_priority,
+          N_("Main loop priority of libvirt events"), N_("control=PRIORITY,io=PRIORITY") },
         { G_OPTION_REMAINING, '\0', 0, G_OPTION_ARG_STRING_ARRAY, &args,
           NULL, "-- DOMAIN-NAME|ID|UUID" },
         { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
@@ -106,7 +153,7 @@ int main(int argc, char **argv)
         goto cleanup;
     }
 
-    viewer = virt_viewer_new(uri, args[0], direct, attach, waitvm, reconnect);
+    viewer = virt_viewer_new(uri, args[0], direct, attach, waitvm, reconnect, eventthread);
     if (viewer == NULL)
         goto cleanup;
 
@@ -115,7 +162,7 @@ int main(int argc, char **argv)
 
     gtk_main();
 
-    ret = 0;
+    ret = virt_viewer_app_get_exit_status(VIRT_VIEWER_APP(viewer));
 
  cleanup:
     if (viewer)
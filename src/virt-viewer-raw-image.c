@@ -0,0 +1,361 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdarg.h>
+#include <string.h>
+
+#include "virt-viewer-raw-image.h"
+
+/*
+ * Image formats written straight from the pixbuf rows, for automation
+ * which grabs frames often and can't afford zlib: PPM and PAM, raw BGRx,
+ * and QOI (https://qoiformat.org), which is lossless and about as fast
+ * to write as raw data while much smaller.
+ */
+
+/* Row by row output through the save callback */
+typedef struct {
+    GdkPixbufSaveFunc write;
+    gpointer opaque;
+    guchar *data;
+    gsize len;
+} VirtViewerRawImageRow;
+
+static gboolean
+row_flush(VirtViewerRawImageRow *row, GError **error)
+{
+    gboolean ok = row->len == 0 ||
+        row->write((const gchar *)row->data, row->len, error, row->opaque);
+
+    row->len = 0;
+    return ok;
+}
+
+static gboolean
+save_header(GdkPixbufSaveFunc write, gpointer opaque, GError **error,
+            const gchar *fmt, ...) G_GNUC_PRINTF(4, 5);
+
+static gboolean
+save_header(GdkPixbufSaveFunc write, gpointer opaque, GError **error,
+            const gchar *fmt, ...)
+{
+    gchar *header;
+    gboolean ok;
+    va_list args;
+
+    va_start(args, fmt);
+    header = g_strdup_vprintf(fmt, args);
+    va_end(args);
+
+    ok = write(header, strlen(header), error, opaque);
+    g_free(header);
+
+    return ok;
+}
+
+/* Rows in the pixbuf layout, minus the row padding */
+static gboolean
+save_rows(GdkPixbuf *pixbuf, GdkPixbufSaveFunc write, gpointer opaque,
+          GError **error)
+{
+    const guchar *pixels = gdk_pixbuf_get_pixels(pixbuf);
+    gint rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+    gint width = gdk_pixbuf_get_width(pixbuf);
+    gint height = gdk_pixbuf_get_height(pixbuf);
+    gsize len = (gsize)width * gdk_pixbuf_get_n_channels(pixbuf);
+    gint y;
+
+    if (len == (gsize)rowstride)
+        return write((const gchar *)pixels, len * height, error, opaque);
+
+    for (y = 0; y < height; y++) {
+        if (!write((const gchar *)pixels + (gsize)y * rowstride, len, error, opaque))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Binary PPM: RGB, any alpha is dropped */
+static gboolean
+save_ppm(GdkPixbuf *pixbuf, GdkPixbufSaveFunc write, gpointer opaque,
+         GError **error)
+{
+    const guchar *pixels = gdk_pixbuf_get_pixels(pixbuf);
+    gint rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+    gint width = gdk_pixbuf_get_width(pixbuf);
+    gint height = gdk_pixbuf_get_height(pixbuf);
+    VirtViewerRawImageRow row = { write, opaque, NULL, 0 };
+    gboolean ok = TRUE;
+    gint x, y;
+
+    if (!save_header(write, opaque, error, "P6\n%d %d\n255\n", width, height))
+        return FALSE;
+
+    if (gdk_pixbuf_get_n_channels(pixbuf) == 3)
+        return save_rows(pixbuf, write, opaque, error);
+
+    row.data = g_malloc((gsize)width * 3);
+    for (y = 0; ok && y < height; y++) {
+        const guchar *p = pixels + (gsize)y * rowstride;
+
+        for (x = 0; x < width; x++, p += 4) {
+            row.data[row.len++] = p[0];
+            row.data[row.len++] = p[1];
+            row.data[row.len++] = p[2];
+        }
+        ok = row_flush(&row, error);
+    }
+    g_free(row.data);
+
+    return ok;
+}
+
+/* PAM keeps the alpha channel, if any, so rows go out as they are */
+static gboolean
+save_pam(GdkPixbuf *pixbuf, GdkPixbufSaveFunc write, gpointer opaque,
+         GError **error)
+{
+    gboolean alpha = gdk_pixbuf_get_n_channels(pixbuf) == 4;
+
+    if (!save_header(write, opaque, error,
+                     "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+                     gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf),
+                     alpha ? 4 : 3, alpha ? "RGB_ALPHA" : "RGB"))
+        return FALSE;
+
+    return save_rows(pixbuf, write, opaque, error);
+}
+
+/*
+ * Raw BGRx, the layout of most frame buffers, after a 16 bytes header:
+ * "BGRx" then the width, height and stride as little endian 32 bits
+ * integers. Rows are not padded, the stride is width * 4.
+ */
+static gboolean
+save_bgrx(GdkPixbuf *pixbuf, GdkPixbufSaveFunc write, gpointer opaque,
+          GError **error)
+{
+    const guchar *pixels = gdk_pixbuf_get_pixels(pixbuf);
+    gint rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+    gint n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+    gint width = gdk_pixbuf_get_width(pixbuf);
+    gint height = gdk_pixbuf_get_height(pixbuf);
+    VirtViewerRawImageRow row = { write, opaque, NULL, 0 };
+    guint32 header[4];
+    gboolean ok;
+    gint x, y;
+
+    memcpy(&header[0], "BGRx", 4);
+    header[1] = GUINT32_TO_LE(width);
+    header[2] = GUINT32_TO_LE(height);
+    header[3] = GUINT32_TO_LE(width * 4);
+    if (!write((const gchar *)header, sizeof(header), error, opaque))
+        return FALSE;
+
+    row.data = g_malloc((gsize)width * 4);
+    for (y = 0, ok = TRUE; ok && y < height; y++) {
+        const guchar *p = pixels + (gsize)y * rowstride;
+
+        for (x = 0; x < width; x++, p += n_channels) {
+            row.data[row.len++] = p[2];
+            row.data[row.len++] = p[1];
+            row.data[row.len++] = p[0];
+            row.data[row.len++] = 0xff;
+        }
+        ok = row_flush(&row, error);
+    }
+    g_free(row.data);
+
+    return ok;
+}
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+#define QOI_HASH(px) (((px)[0] * 3 + (px)[1] * 5 + (px)[2] * 7 + (px)[3] * 11) % 64)
+
+static gboolean
+save_qoi(GdkPixbuf *pixbuf, GdkPixbufSaveFunc write, gpointer opaque,
+         GError **error)
+{
+    static const guchar padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    const guchar *pixels = gdk_pixbuf_get_pixels(pixbuf);
+    gint rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+    gint n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+    gint width = gdk_pixbuf_get_width(pixbuf);
+    gint height = gdk_pixbuf_get_height(pixbuf);
+    VirtViewerRawImageRow row = { write, opaque, NULL, 0 };
+    guchar index[64][4];
+    guchar prev[4] = { 0, 0, 0, 255 };
+    guchar header[14];
+    guint32 be;
+    guint run = 0;
+    gboolean ok;
+    gint x, y;
+
+    memcpy(header, "qoif", 4);
+    be = GUINT32_TO_BE(width);
+    memcpy(header + 4, &be, 4);
+    be = GUINT32_TO_BE(height);
+    memcpy(header + 8, &be, 4);
+    header[12] = n_channels;
+    header[13] = 0; /* sRGB with linear alpha */
+    if (!write((const gchar *)header, sizeof(header), error, opaque))
+        return FALSE;
+
+    memset(index, 0, sizeof(index));
+    /* 5 bytes per pixel at worst, plus a run carried over */
+    row.data = g_malloc((gsize)width * 5 + 1);
+    for (y = 0, ok = TRUE; ok && y < height; y++) {
+        const guchar *p = pixels + (gsize)y * rowstride;
+
+        for (x = 0; x < width; x++, p += n_channels) {
+            guchar px[4] = { p[0], p[1], p[2], n_channels == 4 ? p[3] : 255 };
+            guchar *slot;
+
+            if (memcmp(px, prev, 4) == 0) {
+                if (++run == 62) {
+                    row.data[row.len++] = QOI_OP_RUN | (run - 1);
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0) {
+                row.data[row.len++] = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+
+            slot = index[QOI_HASH(px)];
+            if (memcmp(slot, px, 4) == 0) {
+                row.data[row.len++] = QOI_OP_INDEX | QOI_HASH(px);
+            } else if (px[3] == prev[3]) {
+                gint8 vr = (gint8)(px[0] - prev[0]);
+                gint8 vg = (gint8)(px[1] - prev[1]);
+                gint8 vb = (gint8)(px[2] - prev[2]);
+                gint8 vg_r = vr - vg;
+                gint8 vg_b = vb - vg;
+
+                memcpy(slot, px, 4);
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                    row.data[row.len++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                    row.data[row.len++] = QOI_OP_LUMA | (vg + 32);
+                    row.data[row.len++] = (vg_r + 8) << 4 | (vg_b + 8);
+                } else {
+                    row.data[row.len++] = QOI_OP_RGB;
+                    row.data[row.len++] = px[0];
+                    row.data[row.len++] = px[1];
+                    row.data[row.len++] = px[2];
+                }
+            } else {
+                memcpy(slot, px, 4);
+                row.data[row.len++] = QOI_OP_RGBA;
+                row.data[row.len++] = px[0];
+                row.data[row.len++] = px[1];
+                row.data[row.len++] = px[2];
+                row.data[row.len++] = px[3];
+            }
+            memcpy(prev, px, 4);
+        }
+        ok = row_flush(&row, error);
+    }
+    if (ok && run > 0) {
+        row.data[row.len++] = QOI_OP_RUN | (run - 1);
+        ok = row_flush(&row, error);
+    }
+    g_free(row.data);
+
+    return ok && write((const gchar *)padding, sizeof(padding), error, opaque);
+}
+
+typedef gboolean (*VirtViewerRawImageSaveFunc)(GdkPixbuf *pixbuf,
+                                               GdkPixbufSaveFunc write,
+                                               gpointer opaque,
+                                               GError **error);
+
+static const struct {
+    const gchar *type;
+    VirtViewerRawImageSaveFunc save;
+} raw_formats[] = {
+    { "ppm", save_ppm },
+    { "pam", save_pam },
+    { "bgrx", save_bgrx },
+    { "qoi", save_qoi },
+};
+
+/* The type name for a file @extension, NULL if it isn't one of ours */
+const gchar *
+virt_viewer_raw_image_lookup(const gchar *extension)
+{
+    guint i;
+
+    g_return_val_if_fail(extension != NULL, NULL);
+
+    for (i = 0; i < G_N_ELEMENTS(raw_formats); i++) {
+        if (g_ascii_strcasecmp(raw_formats[i].type, extension) == 0)
+            return raw_formats[i].type;
+    }
+
+    return NULL;
+}
+
+/*
+ * Like gdk_pixbuf_save_to_callback(), for the types above. @pixbuf must
+ * have 8 bits per sample, and may be read from any thread.
+ */
+gboolean
+virt_viewer_raw_image_save_to_callback(GdkPixbuf *pixbuf,
+                                       GdkPixbufSaveFunc save_func,
+                                       gpointer user_data,
+                                       const gchar *type,
+                                       GError **error)
+{
+    guint i;
+
+    g_return_val_if_fail(GDK_IS_PIXBUF(pixbuf), FALSE);
+    g_return_val_if_fail(gdk_pixbuf_get_bits_per_sample(pixbuf) == 8, FALSE);
+    g_return_val_if_fail(save_func != NULL, FALSE);
+    g_return_val_if_fail(type != NULL, FALSE);
+
+    for (i = 0; i < G_N_ELEMENTS(raw_formats); i++) {
+        if (g_ascii_strcasecmp(raw_formats[i].type, type) == 0)
+            return raw_formats[i].save(pixbuf, save_func, user_data, error);
+    }
+
+    g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_UNKNOWN_TYPE,
+                "Image type '%s' is not supported", type);
+    return FALSE;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,385 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "virt-glib-compat.h"
+#include "virt-viewer-raw-image.h"
+#include "virt-viewer-screenshot.h"
+#include "virt-viewer-trace.h"
+#include "virt-viewer-watchdog.h"
+#include "virt-viewer-util.h"
+
+/*
+ * Screenshots are taken on the main loop, which only costs a copy of
+ * the frame buffer, and encoded by a worker thread which owns the
+ * pixbuf until it is done.
+ */
+
+/* How often the progress callback runs */
+#define VIRT_VIEWER_SCREENSHOT_PROGRESS_INTERVAL 100
+
+typedef struct {
+    GdkPixbuf *pixbuf;
+    gchar *filename;
+    gchar *type;
+    gboolean raw; /* written by virt_viewer_raw_image_save_to_callback() */
+    FILE *fp;
+    volatile gint written;
+    gint64 encode_time;
+    GError *error;
+
+    guint progress_source;
+    VirtViewerScreenshotProgress progress;
+    VirtViewerScreenshotDone done;
+    gpointer opaque;
+} VirtViewerScreenshotJob;
+
+static void add_if_writable (GdkPixbufFormat *data, GHashTable *formats)
+{
+    if (gdk_pixbuf_format_is_writable(data)) {
+        gchar **extensions;
+        gchar **it;
+        extensions = gdk_pixbuf_format_get_extensions(data);
+        for (it = extensions; *it != NULL; it++) {
+            g_hash_table_insert(formats, g_strdup(*it), data);
+        }
+        g_strfreev(extensions);
+    }
+}
+
+static GHashTable *init_image_formats(void)
+{
+    GHashTable *format_map;
+    GSList *formats = gdk_pixbuf_get_formats();
+
+    format_map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_slist_foreach(formats, (GFunc)add_if_writable, format_map);
+    g_slist_free (formats);
+
+    return format_map;
+}
+
+static GdkPixbufFormat *get_image_format(const char *ext)
+{
+    static GOnce image_formats_once = G_ONCE_INIT;
+
+    g_once(&image_formats_once, (GThreadFunc)init_image_formats, NULL);
+
+    return g_hash_table_lookup(image_formats_once.retval, ext);
+}
+
+/* Displays which would show up in a screenshot */
+static gboolean
+virt_viewer_screenshot_display_shown(VirtViewerDisplay *display)
+{
+    guint hint;
+
+    if (display == NULL)
+        return FALSE;
+
+    hint = virt_viewer_display_get_show_hint(display);
+    return (hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY) &&
+        !(hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_DISABLED);
+}
+
+guint
+virt_viewer_screenshot_get_n_displays(VirtViewerSession *session)
+{
+    guint nth, n = 0;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_SESSION(session), 0);
+
+    for (nth = 0; nth < virt_viewer_session_get_max_nth(session); nth++) {
+        if (virt_viewer_screenshot_display_shown(virt_viewer_session_get_display(session, nth)))
+            n++;
+    }
+
+    return n;
+}
+
+typedef struct {
+    GdkPixbuf *pixbuf;
+    GdkRectangle rect;
+} VirtViewerScreenshotPart;
+
+/*
+ * All the enabled displays of @session in one image, each where the
+ * guest was told its monitor is. Displays without a known position
+ * are put to the right of the others.
+ */
+GdkPixbuf *
+virt_viewer_screenshot_stitch(VirtViewerSession *session)
+{
+    GArray *parts;
+    GdkRectangle bounds = { 0, 0, 0, 0 };
+    GdkPixbuf *image = NULL;
+    guint nth, i;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_SESSION(session), NULL);
+
+    parts = g_array_new(FALSE, FALSE, sizeof(VirtViewerScreenshotPart));
+    for (nth = 0; nth < virt_viewer_session_get_max_nth(session); nth++) {
+        VirtViewerDisplay *display = virt_viewer_session_get_display(session, nth);
+        VirtViewerScreenshotPart part;
+
+        if (!virt_viewer_screenshot_display_shown(display))
+            continue;
+
+        part.pixbuf = virt_viewer_display_get_pixbuf(display);
+        if (part.pixbuf == NULL)
+            continue;
+
+        if (!virt_viewer_session_get_monitor_geometry(session, nth, &part.rect)) {
+            part.rect.x = bounds.x + bounds.width;
+            part.rect.y = bounds.y;
+        }
+        /* what the guest actually shows, which may lag the request */
+        part.rect.width = gdk_pixbuf_get_width(part.pixbuf);
+        part.rect.height = gdk_pixbuf_get_height(part.pixbuf);
+
+        if (parts->len == 0)
+            bounds = part.rect;
+        else
+            gdk_rectangle_union(&bounds, &part.rect, &bounds);
+        g_array_append_val(parts, part);
+    }
+
+    if (parts->len > 0)
+        image = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8,
+                               bounds.width, bounds.height);
+    if (image)
+        gdk_pixbuf_fill(image, 0x000000ff);
+
+    for (i = 0; i < parts->len; i++) {
+        VirtViewerScreenshotPart *part = &g_array_index(parts, VirtViewerScreenshotPart, i);
+
+        if (image)
+            gdk_pixbuf_copy_area(part->pixbuf, 0, 0,
+                                 part->rect.width, part->rect.height, image,
+                                 part->rect.x - bounds.x, part->rect.y - bounds.y);
+        g_object_unref(part->pixbuf);
+    }
+    g_array_unref(parts);
+
+    return image;
+}
+
+static void
+virt_viewer_screenshot_job_free(VirtViewerScreenshotJob *job)
+{
+    g_object_unref(job->pixbuf);
+    g_free(job->filename);
+    g_free(job->type);
+    g_clear_error(&job->error);
+    g_free(job);
+}
+
+static gboolean
+virt_viewer_screenshot_progress_cb(gpointer opaque)
+{
+    VirtViewerScreenshotJob *job = opaque;
+
+    job->progress(g_atomic_int_get(&job->written), job->opaque);
+
+    return TRUE;
+}
+
+static gboolean
+virt_viewer_screenshot_done_cb(gpointer opaque)
+{
+    VirtViewerScreenshotJob *job = opaque;
+
+    if (job->progress_source)
+        g_source_remove(job->progress_source);
+
+    virt_viewer_trace(VIRT_VIEWER_TRACE_SCREENSHOT, job->encode_time,
+                      g_atomic_int_get(&job->written));
+    DEBUG_LOG("screenshot %s: %d bytes of %s, encoded in %.1f ms off the main loop",
+              job->filename, g_atomic_int_get(&job->written), job->type,
+              job->encode_time / 1000.0);
+
+    if (job->done)
+        job->done(job->filename, job->error, job->opaque);
+    virt_viewer_screenshot_job_free(job);
+
+    return FALSE;
+}
+
+static gboolean
+virt_viewer_screenshot_write(const gchar *buf,
+                             gsize count,
+                             GError **error,
+                             gpointer opaque)
+{
+    VirtViewerScreenshotJob *job = opaque;
+
+    if (fwrite(buf, 1, count, job->fp) != count) {
+        int saved_errno = errno;
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+                    "%s", g_strerror(saved_errno));
+        return FALSE;
+    }
+    g_atomic_int_add(&job->written, (gint)count);
+
+    return TRUE;
+}
+
+static gpointer
+virt_viewer_screenshot_thread(gpointer opaque)
+{
+    VirtViewerScreenshotJob *job = opaque;
+    gint64 start = g_get_monotonic_time();
+    gchar *keys[] = { (gchar *)"tEXt::Generator App", NULL };
+    gchar *values[] = { (gchar *)PACKAGE, NULL };
+    gboolean png = g_str_equal(job->type, "png");
+    gboolean ok;
+
+    job->fp = g_fopen(job->filename, "wb");
+    if (job->fp == NULL) {
+        int saved_errno = errno;
+        g_set_error(&job->error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+                    "%s: %s", job->filename, g_strerror(saved_errno));
+        goto end;
+    }
+
+    if (job->raw)
+        ok = virt_viewer_raw_image_save_to_callback(job->pixbuf, virt_viewer_screenshot_write,
+                                                    job, job->type, &job->error);
+    else
+        ok = gdk_pixbuf_save_to_callbackv(job->pixbuf, virt_viewer_screenshot_write, job,
+                                          job->type, png ? keys : NULL, png ? values : NULL,
+                                          &job->error);
+    if (fclose(job->fp) != 0 && ok) {
+        int saved_errno = errno;
+        g_set_error(&job->error, G_FILE_ERROR, g_file_error_from_errno(saved_errno),
+                    "%s: %s", job->filename, g_strerror(saved_errno));
+        ok = FALSE;
+    }
+    job->fp = NULL;
+    if (!ok)
+        g_unlink(job->filename);
+
+end:
+    job->encode_time = g_get_monotonic_time() - start;
+    g_idle_add(virt_viewer_screenshot_done_cb, job);
+    return NULL;
+}
+
+/* Whether @format can be written, rather than falling back to PNG */
+gboolean
+virt_viewer_screenshot_has_format(const gchar *format)
+{
+    gchar *lower;
+    gboolean found;
+
+    g_return_val_if_fail(format != NULL, FALSE);
+
+    if (virt_viewer_raw_image_lookup(format) != NULL)
+        return TRUE;
+
+    lower = g_ascii_strdown(format, -1);
+    found = get_image_format(lower) != NULL;
+    g_free(lower);
+
+    return found;
+}
+
+/*
+ * Encodes @pixbuf to @filename in @format, or if it is NULL in the
+ * format the extension of @filename names. An unknown format falls
+ * back to PNG, with ".png" appended to @filename. @pixbuf must not be
+ * modified until @done runs.
+ */
+void
+virt_viewer_screenshot_save_async(GdkPixbuf *pixbuf,
+                                  const gchar *filename,
+                                  const gchar *format,
+                                  VirtViewerScreenshotProgress progress,
+                                  VirtViewerScreenshotDone done,
+                                  gpointer opaque)
+{
+    VirtViewerScreenshotJob *job;
+    GdkPixbufFormat *pixbuf_format = NULL;
+    const gchar *ext = format;
+    const gchar *raw_type;
+    GThread *thread;
+
+    g_return_if_fail(GDK_IS_PIXBUF(pixbuf));
+    g_return_if_fail(gdk_pixbuf_get_bits_per_sample(pixbuf) == 8);
+    g_return_if_fail(filename != NULL);
+
+    job = g_new0(VirtViewerScreenshotJob, 1);
+    job->pixbuf = g_object_ref(pixbuf);
+    job->progress = progress;
+    job->done = done;
+    job->opaque = opaque;
+
+    if (ext == NULL && (ext = strrchr(filename, '.')) != NULL)
+        ext++; /* skip '.' */
+
+    if (ext && (raw_type = virt_viewer_raw_image_lookup(ext)) != NULL) {
+        job->filename = g_strdup(filename);
+        job->type = g_strdup(raw_type);
+        job->raw = TRUE;
+    } else if (ext && (pixbuf_format = get_image_format(ext)) != NULL) {
+        job->filename = g_strdup(filename);
+        job->type = gdk_pixbuf_format_get_name(pixbuf_format);
+    } else {
+        g_debug("unknown file extension, falling back to png");
+        if (!g_str_has_suffix(filename, ".png"))
+            job->filename = g_strconcat(filename, ".png", NULL);
+        else
+            job->filename = g_strdup(filename);
+        job->type = g_strdup("png");
+    }
+    g_debug("saving to %s", job->type);
+
+    if (progress)
+        job->progress_source =
+            virt_viewer_watchdog_timeout_add_full(G_PRIORITY_DEFAULT,
+                                                  VIRT_VIEWER_SCREENSHOT_PROGRESS_INTERVAL,
+                                                  "screenshot progress",
+                                                  virt_viewer_screenshot_progress_cb,
+                                                  job, NULL);
+
+    thread = g_thread_new("screenshot", virt_viewer_screenshot_thread, job);
+    if (!thread) {
+        g_warning("Unable to start the screenshot thread, saving in place");
+        virt_viewer_screenshot_thread(job);
+        return;
+    }
+    /* Nothing ever joins the worker */
+    g_thread_unref(thread);
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
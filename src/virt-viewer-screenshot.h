@@ -0,0 +1,59 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_SCREENSHOT_H
+#define VIRT_VIEWER_SCREENSHOT_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "virt-viewer-session.h"
+
+G_BEGIN_DECLS
+
+/* Called from the main loop while the image is being written */
+typedef void (*VirtViewerScreenshotProgress)(goffset written, gpointer opaque);
+/* @filename is where the image went, @error is set on failure */
+typedef void (*VirtViewerScreenshotDone)(const gchar *filename,
+                                         const GError *error,
+                                         gpointer opaque);
+
+guint virt_viewer_screenshot_get_n_displays(VirtViewerSession *session);
+GdkPixbuf *virt_viewer_screenshot_stitch(VirtViewerSession *session);
+gboolean virt_viewer_screenshot_has_format(const gchar *format);
+
+void virt_viewer_screenshot_save_async(GdkPixbuf *pixbuf,
+                                       const gchar *filename,
+                                       const gchar *format,
+                                       VirtViewerScreenshotProgress progress,
+                                       VirtViewerScreenshotDone done,
+                                       gpointer opaque);
+
+G_END_DECLS
+
+#endif /* VIRT_VIEWER_SCREENSHOT_H */
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -35,6 +35,8 @@
 #include "virt-viewer-session-spice.h"
 #include "virt-viewer-display-spice.h"
 #include "virt-viewer-auth.h"
+#include "virt-viewer-timeline.h"
+#include "virt-viewer-trace.h"
 #include "virt-glib-compat.h"
 
 #if !GLIB_CHECK_VERSION(2, 26, 0)
@@ -56,6 +58,8 @@ struct _VirtViewerSessionSpicePrivate {
     gboolean has_sw_smartcard_reader;
     guint pass_try;
     gboolean did_auto_conf;
+    GTimer *timer; /* since the session was opened */
+    GtkWidget *usb_dialog;
 };
 
 #define VIRT_VIEWER_SESSION_SPICE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE((o), VIRT_VIEWER_TYPE_SESSION_SPICE, VirtViewerSessionSpicePrivate))
@@ -72,6 +76,7 @@ static gboolean virt_viewer_session_spice_open_fd(VirtViewerSession *session, in
 static gboolean virt_viewer_session_spice_open_host(VirtViewerSession *session, const gchar *host, const gchar *port, const gchar *tlsport);
 static gboolean virt_viewer_session_spice_open_uri(VirtViewerSession *session, const gchar *uri, GError **error);
 static gboolean virt_viewer_session_spice_channel_open_fd(VirtViewerSession *session, VirtViewerSessionChannel *channel, int fd);
+static gint virt_viewer_session_spice_get_channel_priority(VirtViewerSession *session, VirtViewerSessionChannel *channel);
 static void virt_viewer_session_spice_usb_device_selection(VirtViewerSession *session, GtkWindow *parent);
 static void virt_viewer_session_spice_channel_new(SpiceSession *s,
                                                   SpiceChannel *channel,
@@ -82,7 +87,8 @@ static void virt_viewer_session_spice_channel_destroy(SpiceSession *s,
 static void virt_viewer_session_spice_smartcard_insert(VirtViewerSession *session);
 static void virt_viewer_session_spice_smartcard_remove(VirtViewerSession *session);
 static gboolean virt_viewer_session_spice_fullscreen_auto_conf(VirtViewerSessionSpice *self);
-static void virt_viewer_session_spice_apply_monitor_geometry(VirtViewerSession *self, GdkRectangle *monitors, guint nmonitors);
+static void virt_viewer_session_spice_apply_monitor_geometry(VirtViewerSession *self, const VirtViewerLayoutMonitor *monitors, guint nmonitors);
+static void virt_viewer_session_spice_start_timer(VirtViewerSessionSpice *self);
 
 static void
 virt_viewer_session_spice_get_property(GObject *object, guint property_id,
@@ -118,6 +124,10 @@ virt_viewer_session_spice_dispose(GObject *obj)
 {
     VirtViewerSessionSpice *spice = VIRT_VIEWER_SESSION_SPICE(obj);
 
+    g_clear_pointer(&spice->priv->timer, g_timer_destroy);
+    if (spice->priv->usb_dialog)
+        gtk_widget_destroy(spice->priv->usb_dialog);
+
     if (spice->priv->session) {
         spice_session_disconnect(spice->priv->session);
         g_object_unref(spice->priv->session);
@@ -154,6 +164,7 @@ virt_viewer_session_spice_class_init(VirtViewerSessionSpiceClass *klass)
     dclass->open_host = virt_viewer_session_spice_open_host;
     dclass->open_uri = virt_viewer_session_spice_open_uri;
     dclass->channel_open_fd = virt_viewer_session_spice_channel_open_fd;
+    dclass->channel_priority = virt_viewer_session_spice_get_channel_priority;
     dclass->usb_device_selection = virt_viewer_session_spice_usb_device_selection;
     dclass->smartcard_insert = virt_viewer_session_spice_smartcard_insert;
     dclass->smartcard_remove = virt_viewer_session_spice_smartcard_remove;
@@ -287,6 +298,8 @@ virt_viewer_session_spice_close(VirtViewerSession *session)
     g_return_if_fail(self != NULL);
 
     virt_viewer_session_clear_displays(session);
+    if (self->priv->usb_dialog)
+        gtk_widget_destroy(self->priv->usb_dialog);
 
     if (self->priv->session) {
         spice_session_disconnect(self->priv->session);
@@ -317,6 +330,7 @@ virt_viewer_session_spice_open_host(VirtViewerSession *session,
                  "tls-port", tlsport,
                  NULL);
 
+    virt_viewer_session_spice_start_timer(self);
     return spice_session_connect(self->priv->session);
 }
 
@@ -432,6 +446,7 @@ virt_viewer_session_spice_open_uri(VirtViewerSession *session,
         g_object_set(self->priv->session, "uri", uri, NULL);
     }
 
+    virt_viewer_session_spice_start_timer(self);
     return spice_session_connect(self->priv->session);
 }
 
@@ -443,6 +458,7 @@ virt_viewer_session_spice_open_fd(VirtViewerSession *session,
 
     g_return_val_if_fail(self != NULL, FALSE);
 
+    virt_viewer_session_spice_start_timer(self);
     return spice_session_open_fd(self->priv->session, fd);
 }
 
@@ -458,12 +474,124 @@ virt_viewer_session_spice_channel_open_fd(VirtViewerSession *session,
     return spice_channel_open_fd(SPICE_CHANNEL(channel), fd);
 }
 
+/* Lower is more urgent: what is needed for the first frame and for
+ * input goes first, audio, usbredir and smartcard last */
+static gint
+virt_viewer_session_spice_channel_priority(SpiceChannel *channel)
+{
+    if (SPICE_IS_MAIN_CHANNEL(channel))
+        return 0;
+    if (SPICE_IS_DISPLAY_CHANNEL(channel))
+        return 1;
+    if (SPICE_IS_INPUTS_CHANNEL(channel))
+        return 2;
+    if (SPICE_IS_CURSOR_CHANNEL(channel))
+        return 3;
+    return 4;
+}
+
+static gint
+virt_viewer_session_spice_get_channel_priority(VirtViewerSession *session G_GNUC_UNUSED,
+                                               VirtViewerSessionChannel *channel)
+{
+    return virt_viewer_session_spice_channel_priority(SPICE_CHANNEL(channel));
+}
+
+static gdouble
+virt_viewer_session_spice_elapsed(VirtViewerSessionSpice *self)
+{
+    return self->priv->timer ? g_timer_elapsed(self->priv->timer, NULL) : 0;
+}
+
+static void
+virt_viewer_session_spice_start_timer(VirtViewerSessionSpice *self)
+{
+    if (!self->priv->timer)
+        self->priv->timer = g_timer_new();
+    g_timer_start(self->priv->timer);
+}
+
+/*
+ * The app queues requests by virt_viewer_session_channel_priority(), so
+ * they are handed over as they come
+ */
 static void
 virt_viewer_session_spice_channel_open_fd_request(SpiceChannel *channel,
                                                   gint tls G_GNUC_UNUSED,
                                                   VirtViewerSession *session)
 {
-    g_signal_emit_by_name(session, "session-channel-open", channel);
+    VirtViewerSessionSpice *self = VIRT_VIEWER_SESSION_SPICE(session);
+    gint type, id;
+
+    g_object_get(channel, "channel-type", &type, "channel-id", &id, NULL);
+    virt_viewer_trace(VIRT_VIEWER_TRACE_CHANNEL_REQUEST, type, id);
+    DEBUG_LOG("%s: fd requested at %.3f s", g_type_name(G_OBJECT_TYPE(channel)),
+              virt_viewer_session_spice_elapsed(self));
+
+    g_signal_emit_by_name(self, "session-channel-open", channel);
+}
+
+static void
+virt_viewer_session_spice_channel_event(SpiceChannel *channel,
+                                        SpiceChannelEvent event,
+                                        VirtViewerSessionSpice *self)
+{
+    gint type, id;
+
+    if (event != SPICE_CHANNEL_OPENED)
+        return;
+
+    g_object_get(channel, "channel-type", &type, "channel-id", &id, NULL);
+    virt_viewer_trace(VIRT_VIEWER_TRACE_CHANNEL_OPENED, type, id);
+    DEBUG_LOG("%s: opened at %.3f s", g_type_name(G_OBJECT_TYPE(channel)),
+              virt_viewer_session_spice_elapsed(self));
+    if (SPICE_IS_DISPLAY_CHANNEL(channel))
+        virt_viewer_timeline_end(VIRT_VIEWER_PHASE_CHANNELS);
+}
+
+typedef struct {
+    VirtViewerSessionSpice *self;
+    SpiceSession *session; /* the one which asked, it is replaced on close */
+} VirtViewerSessionSpiceAuth;
+
+static VirtViewerSessionSpiceAuth *
+virt_viewer_session_spice_auth_new(VirtViewerSessionSpice *self)
+{
+    VirtViewerSessionSpiceAuth *auth = g_new0(VirtViewerSessionSpiceAuth, 1);
+
+    auth->self = g_object_ref(self);
+    auth->session = g_object_ref(self->priv->session);
+    return auth;
+}
+
+static void
+virt_viewer_session_spice_password_cb(gboolean ok,
+                                      const gchar *username G_GNUC_UNUSED,
+                                      const gchar *password,
+                                      gpointer opaque)
+{
+    VirtViewerSessionSpiceAuth *auth = opaque;
+    VirtViewerSessionSpice *self = auth->self;
+
+    if (self->priv->session != auth->session) {
+        DEBUG_LOG("session closed while prompting for the password");
+    } else if (!ok) {
+        g_signal_emit_by_name(self, "session-cancelled");
+    } else {
+        gboolean openfd;
+
+        g_object_set(self->priv->session, "password", password, NULL);
+        g_object_get(self->priv->session, "client-sockets", &openfd, NULL);
+
+        if (openfd)
+            spice_session_open_fd(self->priv->session, -1);
+        else
+            spice_session_connect(self->priv->session);
+    }
+
+    g_object_unref(auth->session);
+    g_object_unref(auth->self);
+    g_free(auth);
 }
 
 static void
@@ -472,13 +600,14 @@ virt_viewer_session_spice_main_channel_event(SpiceChannel *channel G_GNUC_UNUSED
                                              VirtViewerSession *session)
 {
     VirtViewerSessionSpice *self = VIRT_VIEWER_SESSION_SPICE(session);
-    gchar *password = NULL;
 
     g_return_if_fail(self != NULL);
 
     switch (event) {
     case SPICE_CHANNEL_OPENED:
         DEBUG_LOG("main channel: opened");
+        virt_viewer_timeline_end(VIRT_VIEWER_PHASE_HANDSHAKE);
+        virt_viewer_timeline_begin(VIRT_VIEWER_PHASE_CHANNELS);
         g_signal_emit_by_name(session, "session-connected");
         break;
     case SPICE_CHANNEL_CLOSED:
@@ -499,23 +628,12 @@ virt_viewer_session_spice_main_channel_event(SpiceChannel *channel G_GNUC_UNUSED
                                   _("invalid password"));
         self->priv->pass_try++;
 
-        int ret = virt_viewer_auth_collect_credentials(self->priv->main_window,
-                                                       "SPICE",
-                                                       NULL,
-                                                       NULL, &password);
-        if (ret < 0) {
-            g_signal_emit_by_name(session, "session-cancelled");
-        } else {
-            gboolean openfd;
-
-            g_object_set(self->priv->session, "password", password, NULL);
-            g_object_get(self->priv->session, "client-sockets", &openfd, NULL);
-
-            if (openfd)
-                spice_session_open_fd(self->priv->session, -1);
-            else
-                spice_session_connect(self->priv->session);
-        }
+        virt_viewer_auth_collect_credentials_async(virt_viewer_session_get_app(session),
+                                                   "SPICE",
+                                                   NULL,
+                                                   FALSE, TRUE,
+                                                   virt_viewer_session_spice_password_cb,
+                                                   virt_viewer_session_spice_auth_new(self));
         break;
     case SPICE_CHANNEL_ERROR_CONNECT:
         DEBUG_LOG("main channel: failed to connect");
@@ -530,8 +648,6 @@ virt_viewer_session_spice_main_channel_event(SpiceChannel *channel G_GNUC_UNUSED
         g_warning("unhandled spice main channel event: %d", event);
         break;
     }
-
-    g_free(password);
 }
 
 static void remove_cb(GtkContainer   *container G_GNUC_UNUSED,
@@ -549,6 +665,11 @@ virt_viewer_session_spice_usb_device_selection(VirtViewerSession *session,
     VirtViewerSessionSpicePrivate *priv = self->priv;
     GtkWidget *dialog, *area, *usb_device_widget;
 
+    if (priv->usb_dialog != NULL) {
+        gtk_window_present(GTK_WINDOW(priv->usb_dialog));
+        return;
+    }
+
     /* Create the widgets */
     dialog = gtk_dialog_new_with_buttons(_("Select USB devices for redirection"), parent,
                                          GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
@@ -570,10 +691,14 @@ virt_viewer_session_spice_usb_device_selection(VirtViewerSession *session,
     g_signal_connect(usb_device_widget, "remove",
                      G_CALLBACK(remove_cb), dialog);
 
-    /* show and run */
+    /* Any response just closes it */
+    g_signal_connect_swapped(dialog, "response",
+                             G_CALLBACK(gtk_widget_destroy), dialog);
+    priv->usb_dialog = dialog;
+    g_signal_connect(dialog, "destroy",
+                     G_CALLBACK(gtk_widget_destroyed), &priv->usb_dialog);
+
     gtk_widget_show_all(dialog);
-    gtk_dialog_run(GTK_DIALOG(dialog));
-    gtk_widget_destroy(dialog);
 }
 
 static void
@@ -623,6 +748,8 @@ virt_viewer_session_spice_display_monitors(SpiceChannel *channel,
 
     g_ptr_array_set_size(displays, monitors_max);
 
+    /* one notification for all the displays this message adds */
+    virt_viewer_session_freeze_displays(VIRT_VIEWER_SESSION(self));
     for (i = 0; i < monitors_max; i++) {
         display = g_ptr_array_index(displays, i);
         if (display == NULL) {
@@ -634,6 +761,7 @@ virt_viewer_session_spice_display_monitors(SpiceChannel *channel,
         virt_viewer_session_add_display(VIRT_VIEWER_SESSION(self),
                                         VIRT_VIEWER_DISPLAY(display));
     }
+    virt_viewer_session_thaw_displays(VIRT_VIEWER_SESSION(self));
 
     for (i = 0; i < monitors->len; i++) {
         SpiceDisplayMonitorConfig *monitor = &g_array_index(monitors, SpiceDisplayMonitorConfig, i);
@@ -664,6 +792,8 @@ virt_viewer_session_spice_channel_new(SpiceSession *s,
 
     g_signal_connect(channel, "open-fd",
                      G_CALLBACK(virt_viewer_session_spice_channel_open_fd_request), self);
+    g_signal_connect(channel, "channel-event",
+                     G_CALLBACK(virt_viewer_session_spice_channel_event), self);
 
     g_object_get(channel, "channel-id", &id, NULL);
 
@@ -677,6 +807,8 @@ virt_viewer_session_spice_channel_new(SpiceSession *s,
         g_signal_connect(channel, "channel-event",
                          G_CALLBACK(virt_viewer_session_spice_main_channel_event), self);
         self->priv->main_channel = SPICE_MAIN_CHANNEL(channel);
+        /* a new connection knows nothing of what was sent before */
+        virt_viewer_session_reset_monitor_config(VIRT_VIEWER_SESSION(self));
         g_object_set(G_OBJECT(channel),
                      "disable-display-position", FALSE,
                      "disable-display-align", TRUE,
@@ -889,17 +1021,24 @@ virt_viewer_session_spice_smartcard_remove(VirtViewerSession *session G_GNUC_UNU
 }
 
 void
-virt_viewer_session_spice_apply_monitor_geometry(VirtViewerSession *session, GdkRectangle *monitors, guint nmonitors)
+virt_viewer_session_spice_apply_monitor_geometry(VirtViewerSession *session,
+                                                 const VirtViewerLayoutMonitor *monitors,
+                                                 guint nmonitors)
 {
     guint i;
     VirtViewerSessionSpice *self = VIRT_VIEWER_SESSION_SPICE(session);
 
+    if (self->priv->main_channel == NULL)
+        return;
+
     for (i = 0; i < nmonitors; i++) {
-        GdkRectangle* rect = &monitors[i];
+        const GdkRectangle* rect = &monitors[i].geometry;
 
-        spice_main_set_display(self->priv->main_channel, i, rect->x,
+        spice_main_set_display(self->priv->main_channel, monitors[i].nth, rect->x,
                                rect->y, rect->width, rect->height);
     }
+
+    DEBUG_LOG("monitor config: %u monitor(s) changed", nmonitors);
 }
 
 /*
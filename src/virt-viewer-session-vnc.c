@@ -27,6 +27,7 @@
 #include "virt-viewer-auth.h"
 #include "virt-viewer-session-vnc.h"
 #include "virt-viewer-display-vnc.h"
+#include "virt-viewer-timeline.h"
 
 #include <glib/gi18n.h>
 #include <libxml/uri.h>
@@ -124,6 +125,7 @@ static void
 virt_viewer_session_vnc_initialized(VncDisplay *vnc G_GNUC_UNUSED,
                                     VirtViewerSessionVnc *session)
 {
+    virt_viewer_timeline_end(VIRT_VIEWER_PHASE_HANDSHAKE);
     g_signal_emit_by_name(session, "session-initialized");
 }
 
@@ -258,10 +260,7 @@ virt_viewer_session_vnc_auth_credential(GtkWidget *src,
                                         GValueArray *credList,
                                         VirtViewerSession *session)
 {
-    VirtViewerSessionVnc *self = VIRT_VIEWER_SESSION_VNC(session);
-
     virt_viewer_auth_vnc_credentials(session,
-                                     self->priv->main_window,
                                      src,
                                      credList,
                                      NULL);
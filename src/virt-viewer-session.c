@@ -27,7 +27,11 @@
 #include <locale.h>
 #include <math.h>
 
+#include "virt-glib-compat.h"
 #include "virt-viewer-session.h"
+#include "virt-viewer-timeline.h"
+#include "virt-viewer-trace.h"
+#include "virt-viewer-watchdog.h"
 #include "virt-viewer-util.h"
 
 #define VIRT_VIEWER_SESSION_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE((o), VIRT_VIEWER_TYPE_SESSION, VirtViewerSessionPrivate))
@@ -35,14 +39,23 @@
 
 struct _VirtViewerSessionPrivate
 {
-    GList *displays;
+    GPtrArray *displays; /* VirtViewerDisplay indexed by nth-display, or NULL */
+    guint displays_freeze;
+    gboolean displays_changed; /* while frozen */
     VirtViewerApp *app;
     gboolean auto_usbredir;
     gboolean has_usbredir;
     gchar *uri;
     VirtViewerFile *file;
+    VirtViewerLayout *layout; /* of the guest monitors */
+    guint monitor_config_source; /* pending coalesced update */
+    gint64 monitor_config_time; /* when it was last applied */
 };
 
+/* Resizing a window allocates its displays many times per second, the
+ * guest is only sent the resulting monitor geometry this often */
+#define VIRT_VIEWER_SESSION_MONITOR_CONFIG_INTERVAL 250 /* ms */
+
 G_DEFINE_ABSTRACT_TYPE(VirtViewerSession, virt_viewer_session, G_TYPE_OBJECT)
 
 enum {
@@ -59,16 +72,21 @@ static void
 virt_viewer_session_finalize(GObject *obj)
 {
     VirtViewerSession *session = VIRT_VIEWER_SESSION(obj);
-    GList *tmp = session->priv->displays;
+    guint i;
+
+    if (session->priv->monitor_config_source)
+        g_source_remove(session->priv->monitor_config_source);
 
-    while (tmp) {
-        g_object_unref(tmp->data);
-        tmp = tmp->next;
+    for (i = 0; i < session->priv->displays->len; i++) {
+        gpointer display = g_ptr_array_index(session->priv->displays, i);
+        if (display)
+            g_object_unref(display);
     }
-    g_list_free(session->priv->displays);
+    g_ptr_array_free(session->priv->displays, TRUE);
 
     g_free(session->priv->uri);
     g_clear_object(&session->priv->file);
+    virt_viewer_layout_free(session->priv->layout);
 
     G_OBJECT_CLASS(virt_viewer_session_parent_class)->finalize(obj);
 }
@@ -299,6 +317,16 @@ virt_viewer_session_class_init(VirtViewerSessionClass *class)
                  G_TYPE_NONE,
                  0);
 
+    g_signal_new("session-displays-changed",
+                 G_OBJECT_CLASS_TYPE(object_class),
+                 G_SIGNAL_RUN_LAST | G_SIGNAL_NO_HOOKS,
+                 G_STRUCT_OFFSET(VirtViewerSessionClass, session_displays_changed),
+                 NULL,
+                 NULL,
+                 g_cclosure_marshal_VOID__VOID,
+                 G_TYPE_NONE,
+                 0);
+
     g_signal_new("session-cut-text",
                  G_OBJECT_CLASS_TYPE(object_class),
                  G_SIGNAL_RUN_LAST | G_SIGNAL_NO_HOOKS,
@@ -336,142 +364,246 @@ static void
 virt_viewer_session_init(VirtViewerSession *session)
 {
     session->priv = VIRT_VIEWER_SESSION_GET_PRIVATE(session);
+    session->priv->layout = virt_viewer_layout_new();
+    session->priv->displays = g_ptr_array_new();
 }
 
-/* simple sorting of monitors. Primary sort left-to-right, secondary sort from
- * top-to-bottom, finally by monitor id */
-static int
-displays_cmp(const void *p1, const void *p2, gpointer user_data)
+static void
+virt_viewer_session_apply_monitor_config(VirtViewerSession* self)
 {
-    guint diff;
-    GdkRectangle *displays = user_data;
-    guint i = *(guint*)p1;
-    guint j = *(guint*)p2;
-    GdkRectangle *m1 = &displays[i];
-    GdkRectangle *m2 = &displays[j];
-    diff = m1->x - m2->x;
-    if (diff == 0)
-        diff = m1->y - m2->y;
-    if (diff == 0)
-        diff = i - j;
+    VirtViewerSessionClass *klass;
+    const VirtViewerLayoutMonitor *changes;
+    gboolean all_fullscreen = TRUE;
+    guint i, ndisplays = 0, nchanges = 0;
 
-    return diff;
-}
+    klass = VIRT_VIEWER_SESSION_GET_CLASS(self);
+    if (!klass->apply_monitor_geometry)
+        return;
 
-static void
-virt_viewer_session_align_monitors_linear(GdkRectangle *displays, guint ndisplays)
-{
-    gint i, x = 0;
-    guint *sorted_displays;
+    for (i = 0; i < self->priv->displays->len; i++) {
+        VirtViewerDisplay *d = g_ptr_array_index(self->priv->displays, i);
+        GdkRectangle rect;
 
-    g_return_if_fail(displays != NULL);
+        if (d == NULL)
+            continue;
 
-    if (ndisplays == 0)
-        return;
+        virt_viewer_display_get_preferred_monitor_geometry(d, &rect);
+        virt_viewer_layout_set_preferred(self->priv->layout,
+                                         virt_viewer_display_get_nth(d), &rect);
+        ndisplays++;
 
-    sorted_displays = g_new0(guint, ndisplays);
-    for (i = 0; i < ndisplays; i++)
-        sorted_displays[i] = i;
-    g_qsort_with_data(sorted_displays, ndisplays, sizeof(guint), displays_cmp, displays);
-
-    /* adjust monitor positions so that there's no gaps or overlap between
-     * monitors */
-    for (i = 0; i < ndisplays; i++) {
-        guint nth = sorted_displays[i];
-        g_assert(nth < ndisplays);
-        GdkRectangle *rect = &displays[nth];
-        rect->x = x;
-        rect->y = 0;
-        x += rect->width;
+        if (virt_viewer_display_get_enabled(d) &&
+            !virt_viewer_display_get_fullscreen(d))
+            all_fullscreen = FALSE;
     }
-    g_free(sorted_displays);
+
+    changes = virt_viewer_layout_update(self->priv->layout, !all_fullscreen, &nchanges);
+    virt_viewer_trace(VIRT_VIEWER_TRACE_MONITOR_CONFIG, ndisplays, nchanges);
+    if (nchanges > 0)
+        klass->apply_monitor_geometry(self, changes, nchanges);
+}
+
+static gboolean
+virt_viewer_session_monitor_config_cb(gpointer opaque)
+{
+    VirtViewerSession *self = opaque;
+
+    self->priv->monitor_config_source = 0;
+    self->priv->monitor_config_time = g_get_monotonic_time();
+    virt_viewer_session_apply_monitor_config(self);
+
+    return FALSE;
 }
 
+/* Coalesces changes: at most one update per interval, reflecting the
+ * geometry of all displays at the time it is applied */
 static void
 virt_viewer_session_on_monitor_geometry_changed(VirtViewerSession* self,
                                                 VirtViewerDisplay* display G_GNUC_UNUSED)
 {
-    VirtViewerSessionClass *klass;
-    gboolean all_fullscreen = TRUE;
-    guint nmonitors = 0;
-    GdkRectangle *monitors = NULL;
+    VirtViewerSessionPrivate *priv = self->priv;
+    gint64 elapsed;
 
-    klass = VIRT_VIEWER_SESSION_GET_CLASS(self);
-    if (!klass->apply_monitor_geometry)
+    if (priv->monitor_config_source)
         return;
 
-    /* find highest monitor ID so we can create the sparse array */
-    for (GList *l = self->priv->displays; l; l = l->next) {
-        VirtViewerDisplay *d = VIRT_VIEWER_DISPLAY(l->data);
-        guint nth = 0;
-        g_object_get(d, "nth-display", &nth, NULL);
+    elapsed = (g_get_monotonic_time() - priv->monitor_config_time) / 1000;
+    if (elapsed >= VIRT_VIEWER_SESSION_MONITOR_CONFIG_INTERVAL)
+        priv->monitor_config_source =
+            virt_viewer_watchdog_idle_add_full(G_PRIORITY_DEFAULT_IDLE, "monitor config",
+                                               virt_viewer_session_monitor_config_cb,
+                                               self, NULL);
+    else
+        priv->monitor_config_source =
+            virt_viewer_watchdog_timeout_add_full(G_PRIORITY_DEFAULT,
+                                                  VIRT_VIEWER_SESSION_MONITOR_CONFIG_INTERVAL - elapsed,
+                                                  "monitor config",
+                                                  virt_viewer_session_monitor_config_cb,
+                                                  self, NULL);
+}
 
-        nmonitors = MAX(nth + 1, nmonitors);
+static void
+virt_viewer_session_displays_changed(VirtViewerSession *session)
+{
+    if (session->priv->displays_freeze > 0) {
+        session->priv->displays_changed = TRUE;
+        return;
     }
 
-    monitors = g_new0(GdkRectangle, nmonitors);
-    for (GList *l = self->priv->displays; l; l = l->next) {
-        VirtViewerDisplay *d = VIRT_VIEWER_DISPLAY(l->data);
-        guint nth = 0;
-        GdkRectangle *rect = NULL;
+    g_signal_emit_by_name(session, "session-displays-changed");
+}
+
+/*
+ * Batches the "session-displays-changed" notifications of the additions
+ * and removals made until the matching thaw into at most one.
+ */
+void virt_viewer_session_freeze_displays(VirtViewerSession *session)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_SESSION(session));
 
-        g_object_get(d, "nth-display", &nth, NULL);
-        g_return_if_fail(nth < nmonitors);
-        rect = &monitors[nth];
-        virt_viewer_display_get_preferred_monitor_geometry(d, rect);
+    session->priv->displays_freeze++;
+}
 
-        if (virt_viewer_display_get_enabled(d) &&
-            !virt_viewer_display_get_fullscreen(d))
-            all_fullscreen = FALSE;
-    }
+void virt_viewer_session_thaw_displays(VirtViewerSession *session)
+{
+    VirtViewerSessionPrivate *priv;
+
+    g_return_if_fail(VIRT_VIEWER_IS_SESSION(session));
+    priv = session->priv;
+    g_return_if_fail(priv->displays_freeze > 0);
+
+    if (--priv->displays_freeze > 0 || !priv->displays_changed)
+        return;
+
+    priv->displays_changed = FALSE;
+    g_signal_emit_by_name(session, "session-displays-changed");
+}
+
+VirtViewerDisplay *virt_viewer_session_get_display(VirtViewerSession *session,
+                                                   guint nth)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_SESSION(session), NULL);
+
+    if (nth >= session->priv->displays->len)
+        return NULL;
+
+    return g_ptr_array_index(session->priv->displays, nth);
+}
+
+/*
+ * Displays are indexed by monitor id and there may be holes, iterate
+ * nth up to this and skip NULL displays rather than up to the count.
+ */
+guint virt_viewer_session_get_max_nth(VirtViewerSession *session)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_SESSION(session), 0);
+
+    return session->priv->displays->len;
+}
 
-    if (!all_fullscreen)
-        virt_viewer_session_align_monitors_linear(monitors, nmonitors);
+static void
+virt_viewer_session_take_display(VirtViewerSession *session, guint nth)
+{
+    VirtViewerDisplay *display = g_ptr_array_index(session->priv->displays, nth);
 
-    klass->apply_monitor_geometry(self, monitors, nmonitors);
-    g_free(monitors);
+    g_ptr_array_index(session->priv->displays, nth) = NULL;
+    virt_viewer_layout_remove(session->priv->layout, nth);
+    g_signal_emit_by_name(session, "session-display-removed", display);
+    g_object_unref(display);
 }
 
 void virt_viewer_session_add_display(VirtViewerSession *session,
                                      VirtViewerDisplay *display)
 {
-    if (g_list_find(session->priv->displays, display))
-        return;
+    GPtrArray *displays = session->priv->displays;
+    gint nth = virt_viewer_display_get_nth(display);
+
+    g_return_if_fail(nth >= 0);
+
+    if ((guint)nth < displays->len) {
+        VirtViewerDisplay *old = g_ptr_array_index(displays, nth);
+
+        if (old == display)
+            return;
+        if (old != NULL) {
+            g_warning("Replacing display %d", nth);
+            virt_viewer_session_take_display(session, nth);
+        }
+    } else {
+        g_ptr_array_set_size(displays, nth + 1);
+    }
 
-    session->priv->displays = g_list_append(session->priv->displays, display);
-    g_object_ref(display);
+    g_ptr_array_index(displays, nth) = g_object_ref(display);
     g_signal_emit_by_name(session, "session-display-added", display);
 
     virt_viewer_signal_connect_object(display, "monitor-geometry-changed",
                                       G_CALLBACK(virt_viewer_session_on_monitor_geometry_changed), session,
                                       G_CONNECT_SWAPPED);
+    virt_viewer_session_displays_changed(session);
 }
 
 
 void virt_viewer_session_remove_display(VirtViewerSession *session,
                                         VirtViewerDisplay *display)
 {
-    if (!g_list_find(session->priv->displays, display))
+    gint nth = virt_viewer_display_get_nth(display);
+
+    if (virt_viewer_session_get_display(session, nth) != display)
         return;
 
-    session->priv->displays = g_list_remove(session->priv->displays, display);
-    g_signal_emit_by_name(session, "session-display-removed", display);
-    g_object_unref(display);
+    virt_viewer_session_take_display(session, nth);
+    virt_viewer_session_displays_changed(session);
 }
 
 void virt_viewer_session_clear_displays(VirtViewerSession *session)
 {
-    GList *tmp = session->priv->displays;
+    GPtrArray *displays = session->priv->displays;
+    gboolean changed = FALSE;
+    guint i;
+
+    if (session->priv->monitor_config_source) {
+        g_source_remove(session->priv->monitor_config_source);
+        session->priv->monitor_config_source = 0;
+    }
+
+    for (i = 0; i < displays->len; i++) {
+        VirtViewerDisplay *display = g_ptr_array_index(displays, i);
 
-    while (tmp) {
-        VirtViewerDisplay *display = VIRT_VIEWER_DISPLAY(tmp->data);
+        if (display == NULL)
+            continue;
+        g_ptr_array_index(displays, i) = NULL;
+        changed = TRUE;
         g_signal_emit_by_name(session, "session-display-removed", display);
         virt_viewer_display_close(display);
         g_object_unref(display);
-        tmp = tmp->next;
     }
-    g_list_free(session->priv->displays);
-    session->priv->displays = NULL;
+    g_ptr_array_set_size(displays, 0);
+
+    virt_viewer_layout_free(session->priv->layout);
+    session->priv->layout = virt_viewer_layout_new();
+
+    if (changed)
+        virt_viewer_session_displays_changed(session);
+}
+
+/* The monitor geometry is sent again in full, for instance to a new
+ * connection */
+void virt_viewer_session_reset_monitor_config(VirtViewerSession *session)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_SESSION(session));
+
+    virt_viewer_layout_forget_applied(session->priv->layout);
+}
+
+/* Where the guest was last told to put monitor @nth, FALSE if it never
+ * was, as with protocols which don't configure guest monitors */
+gboolean virt_viewer_session_get_monitor_geometry(VirtViewerSession *session,
+                                                  guint nth,
+                                                  GdkRectangle *geometry)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_SESSION(session), FALSE);
+
+    return virt_viewer_layout_get_applied(session->priv->layout, nth, geometry);
 }
 
 
@@ -487,6 +619,7 @@ gboolean virt_viewer_session_open_fd(VirtViewerSession *session, int fd)
 {
     g_return_val_if_fail(VIRT_VIEWER_IS_SESSION(session), FALSE);
 
+    virt_viewer_timeline_begin(VIRT_VIEWER_PHASE_HANDSHAKE);
     return VIRT_VIEWER_SESSION_GET_CLASS(session)->open_fd(session, fd);
 }
 
@@ -497,6 +630,7 @@ gboolean virt_viewer_session_open_host(VirtViewerSession *session, const gchar *
     g_return_val_if_fail(VIRT_VIEWER_IS_SESSION(session), FALSE);
 
     klass = VIRT_VIEWER_SESSION_GET_CLASS(session);
+    virt_viewer_timeline_begin(VIRT_VIEWER_PHASE_HANDSHAKE);
     return klass->open_host(session, host, port, tlsport);
 }
 
@@ -509,8 +643,10 @@ gboolean virt_viewer_session_open_uri(VirtViewerSession *session, const gchar *u
     klass = VIRT_VIEWER_SESSION_GET_CLASS(session);
     g_return_val_if_fail(klass->open_uri != NULL, FALSE);
 
+    g_free(session->priv->uri);
     session->priv->uri = g_strdup(uri);
 
+    virt_viewer_timeline_begin(VIRT_VIEWER_PHASE_HANDSHAKE);
     return klass->open_uri(session, uri, error);
 }
 
@@ -537,6 +673,21 @@ gboolean virt_viewer_session_channel_open_fd(VirtViewerSession *session,
     return VIRT_VIEWER_SESSION_GET_CLASS(session)->channel_open_fd(session, channel, fd);
 }
 
+/* How soon @channel needs its fd, lower is sooner */
+gint virt_viewer_session_channel_priority(VirtViewerSession *session,
+                                          VirtViewerSessionChannel *channel)
+{
+    VirtViewerSessionClass *klass;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_SESSION(session), 0);
+
+    klass = VIRT_VIEWER_SESSION_GET_CLASS(session);
+    if (!klass->channel_priority)
+        return 0;
+
+    return klass->channel_priority(session, channel);
+}
+
 void virt_viewer_session_set_auto_usbredir(VirtViewerSession *self, gboolean auto_usbredir)
 {
     g_return_if_fail(VIRT_VIEWER_IS_SESSION(self));
@@ -630,6 +781,15 @@ gchar* virt_viewer_session_get_uri(VirtViewerSession *self)
     return g_strdup(self->priv->uri);
 }
 
+/* For a session opened from @uri by other means than open_uri() */
+void virt_viewer_session_set_uri(VirtViewerSession *self, const gchar *uri)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_SESSION(self));
+
+    g_free(self->priv->uri);
+    self->priv->uri = g_strdup(uri);
+}
+
 void virt_viewer_session_set_file(VirtViewerSession *self, VirtViewerFile *file)
 {
     g_return_if_fail(VIRT_VIEWER_IS_SESSION(self));
@@ -29,6 +29,7 @@
 #include "virt-viewer-app.h"
 #include "virt-viewer-file.h"
 #include "virt-viewer-display.h"
+#include "virt-viewer-layout.h"
 
 G_BEGIN_DECLS
 
@@ -70,6 +71,8 @@ struct _VirtViewerSessionClass {
     gboolean (* open_host) (VirtViewerSession* session, const gchar *host, const gchar *port, const gchar *tlsport);
     gboolean (* open_uri) (VirtViewerSession* session, const gchar *uri, GError **error);
     gboolean (* channel_open_fd) (VirtViewerSession* session, VirtViewerSessionChannel *channel, int fd);
+    /* lower is more urgent */
+    gint (* channel_priority) (VirtViewerSession* session, VirtViewerSessionChannel *channel);
     void (* usb_device_selection) (VirtViewerSession* session, GtkWindow *parent);
     void (* smartcard_insert) (VirtViewerSession* session);
     void (* smartcard_remove) (VirtViewerSession* session);
@@ -90,11 +93,13 @@ struct _VirtViewerSessionClass {
     void (*session_display_removed)(VirtViewerSession *session,
                                     VirtViewerDisplay *display);
     void (*session_display_updated)(VirtViewerSession *session);
+    void (*session_displays_changed)(VirtViewerSession *session);
 
     void (*session_cut_text)(VirtViewerSession *session, const gchar *str);
     void (*session_bell)(VirtViewerSession *session);
     void (*session_cancelled)(VirtViewerSession *session);
-    void (*apply_monitor_geometry)(VirtViewerSession *session, GdkRectangle* monitors, guint nmonitors);
+    /* only called with the monitors which changed */
+    void (*apply_monitor_geometry)(VirtViewerSession *session, const VirtViewerLayoutMonitor *monitors, guint nmonitors);
 };
 
 GType virt_viewer_session_get_type(void);
@@ -107,6 +112,15 @@ void virt_viewer_session_add_display(VirtViewerSession *session,
 void virt_viewer_session_remove_display(VirtViewerSession *session,
                                         VirtViewerDisplay *display);
 void virt_viewer_session_clear_displays(VirtViewerSession *session);
+void virt_viewer_session_freeze_displays(VirtViewerSession *session);
+void virt_viewer_session_thaw_displays(VirtViewerSession *session);
+VirtViewerDisplay *virt_viewer_session_get_display(VirtViewerSession *session,
+                                                   guint nth);
+guint virt_viewer_session_get_max_nth(VirtViewerSession *session);
+void virt_viewer_session_reset_monitor_config(VirtViewerSession *session);
+gboolean virt_viewer_session_get_monitor_geometry(VirtViewerSession *session,
+                                                  guint nth,
+                                                  GdkRectangle *geometry);
 
 void virt_viewer_session_close(VirtViewerSession* session);
 gboolean virt_viewer_session_open_fd(VirtViewerSession* session, int fd);
@@ -114,6 +128,8 @@ gboolean virt_viewer_session_open_host(VirtViewerSession* session, const gchar *
 GObject* virt_viewer_session_get(VirtViewerSession* session);
 gboolean virt_viewer_session_channel_open_fd(VirtViewerSession* session,
                                              VirtViewerSessionChannel* channel, int fd);
+gint virt_viewer_session_channel_priority(VirtViewerSession* session,
+                                          VirtViewerSessionChannel* channel);
 gboolean virt_viewer_session_open_uri(VirtViewerSession *session, const gchar *uri, GError **error);
 
 void virt_viewer_session_set_auto_usbredir(VirtViewerSession* session, gboolean auto_usbredir);
@@ -127,6 +143,7 @@ void virt_viewer_session_smartcard_insert(VirtViewerSession *self);
 void virt_viewer_session_smartcard_remove(VirtViewerSession *self);
 VirtViewerApp* virt_viewer_session_get_app(VirtViewerSession *self);
 gchar* virt_viewer_session_get_uri(VirtViewerSession *self);
+void virt_viewer_session_set_uri(VirtViewerSession *self, const gchar *uri);
 void virt_viewer_session_set_file(VirtViewerSession *self, VirtViewerFile *file);
 VirtViewerFile* virt_viewer_session_get_file(VirtViewerSession *self);
 
@@ -0,0 +1,212 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "virt-glib-compat.h"
+#include "virt-viewer-timeline.h"
+#include "virt-viewer-trace.h"
+
+static const char * const phase_names[] = {
+    "libvirt",
+    "ssh",
+    "dns",
+    "tcp",
+    "handshake",
+    "auth",
+    "channels",
+    "first-frame",
+};
+G_STATIC_ASSERT(G_N_ELEMENTS(phase_names) == VIRT_VIEWER_PHASE_LAST);
+
+/* All times in microseconds on the monotonic clock, -1 when unset */
+static struct {
+    gboolean running;
+    gint64 origin;
+    gint64 total;
+    gint64 begin[VIRT_VIEWER_PHASE_LAST];
+    gint64 end[VIRT_VIEWER_PHASE_LAST];
+} timeline = { FALSE, 0, -1, { 0 }, { 0 } };
+
+G_LOCK_DEFINE_STATIC(timeline);
+
+void
+virt_viewer_timeline_start(void)
+{
+    int i;
+
+    G_LOCK(timeline);
+    for (i = 0 ; i < VIRT_VIEWER_PHASE_LAST ; i++) {
+        timeline.begin[i] = -1;
+        timeline.end[i] = -1;
+    }
+    timeline.origin = g_get_monotonic_time();
+    timeline.total = -1;
+    timeline.running = TRUE;
+    G_UNLOCK(timeline);
+}
+
+/* Only the first span of each phase is kept: later channels repeating
+ * the lookup or the connect, or another auth prompt, don't extend it */
+void
+virt_viewer_timeline_begin(VirtViewerPhase phase)
+{
+    g_return_if_fail(phase < VIRT_VIEWER_PHASE_LAST);
+
+    G_LOCK(timeline);
+    if (timeline.running && timeline.begin[phase] < 0) {
+        timeline.begin[phase] = g_get_monotonic_time() - timeline.origin;
+        virt_viewer_trace(VIRT_VIEWER_TRACE_PHASE_BEGIN, phase, 0);
+    }
+    G_UNLOCK(timeline);
+}
+
+void
+virt_viewer_timeline_end(VirtViewerPhase phase)
+{
+    g_return_if_fail(phase < VIRT_VIEWER_PHASE_LAST);
+
+    G_LOCK(timeline);
+    if (timeline.running && timeline.begin[phase] >= 0 && timeline.end[phase] < 0) {
+        timeline.end[phase] = g_get_monotonic_time() - timeline.origin;
+        virt_viewer_trace(VIRT_VIEWER_TRACE_PHASE_END, phase, 0);
+    }
+    G_UNLOCK(timeline);
+}
+
+void
+virt_viewer_timeline_mark(VirtViewerPhase phase)
+{
+    g_return_if_fail(phase < VIRT_VIEWER_PHASE_LAST);
+
+    G_LOCK(timeline);
+    if (timeline.running && timeline.begin[phase] < 0) {
+        timeline.begin[phase] = g_get_monotonic_time() - timeline.origin;
+        timeline.end[phase] = timeline.begin[phase];
+        virt_viewer_trace(VIRT_VIEWER_TRACE_PHASE_END, phase, 0);
+    }
+    G_UNLOCK(timeline);
+}
+
+/*
+ * Stops recording. Returns TRUE for the caller which actually ended the
+ * attempt, which is then expected to report it.
+ */
+gboolean
+virt_viewer_timeline_finish(void)
+{
+    gboolean ret;
+
+    G_LOCK(timeline);
+    ret = timeline.running;
+    if (ret) {
+        timeline.total = g_get_monotonic_time() - timeline.origin;
+        timeline.running = FALSE;
+    }
+    G_UNLOCK(timeline);
+
+    return ret;
+}
+
+gchar *
+virt_viewer_timeline_summary(void)
+{
+    GString *str = g_string_new("Connection timeline (ms):");
+    int i;
+
+    G_LOCK(timeline);
+    for (i = 0 ; i < VIRT_VIEWER_PHASE_LAST ; i++) {
+        if (timeline.begin[i] < 0)
+            continue;
+
+        if (timeline.end[i] < 0)
+            g_string_append_printf(str, "\n  %-12s %9.1f  (unfinished)", phase_names[i],
+                                   timeline.begin[i] / 1000.0);
+        else if (timeline.end[i] == timeline.begin[i])
+            g_string_append_printf(str, "\n  %-12s %9.1f", phase_names[i],
+                                   timeline.begin[i] / 1000.0);
+        else
+            g_string_append_printf(str, "\n  %-12s %9.1f %9.1f  (%.1f)", phase_names[i],
+                                   timeline.begin[i] / 1000.0,
+                                   timeline.end[i] / 1000.0,
+                                   (timeline.end[i] - timeline.begin[i]) / 1000.0);
+    }
+    if (timeline.total >= 0)
+        g_string_append_printf(str, "\n  %-12s %9.1f", "total", timeline.total / 1000.0);
+    G_UNLOCK(timeline);
+
+    return g_string_free(str, FALSE);
+}
+
+static void
+append_ms(GString *str, const char *key, gint64 usec)
+{
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    /* JSON wants a '.' whatever the locale is */
+    g_string_append_printf(str, "\"%s\":%s", key,
+                           g_ascii_formatd(buf, sizeof(buf), "%.3f", usec / 1000.0));
+}
+
+/* One line JSON object, suitable for appending to a log of attempts */
+gchar *
+virt_viewer_timeline_to_json(const gchar *result)
+{
+    GString *str = g_string_new("{");
+    gboolean first = TRUE;
+    int i;
+
+    g_return_val_if_fail(result != NULL, NULL);
+
+    g_string_append_printf(str, "\"result\":\"%s\",", result);
+
+    G_LOCK(timeline);
+    if (timeline.total >= 0) {
+        append_ms(str, "total_ms", timeline.total);
+        g_string_append_c(str, ',');
+    }
+    g_string_append(str, "\"phases\":{");
+    for (i = 0 ; i < VIRT_VIEWER_PHASE_LAST ; i++) {
+        if (timeline.begin[i] < 0)
+            continue;
+
+        g_string_append_printf(str, "%s\"%s\":{", first ? "" : ",", phase_names[i]);
+        append_ms(str, "start_ms", timeline.begin[i]);
+        if (timeline.end[i] >= 0) {
+            g_string_append_c(str, ',');
+            append_ms(str, "end_ms", timeline.end[i]);
+        }
+        g_string_append_c(str, '}');
+        first = FALSE;
+    }
+    G_UNLOCK(timeline);
+    g_string_append(str, "}}");
+
+    return g_string_free(str, FALSE);
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
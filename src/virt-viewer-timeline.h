@@ -0,0 +1,67 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_TIMELINE_H
+#define VIRT_VIEWER_TIMELINE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    VIRT_VIEWER_PHASE_LIBVIRT,     /* libvirt connection and domain lookup */
+    VIRT_VIEWER_PHASE_SSH,         /* ssh tunnel spawned until the session connects */
+    VIRT_VIEWER_PHASE_DNS,
+    VIRT_VIEWER_PHASE_TCP,
+    VIRT_VIEWER_PHASE_HANDSHAKE,   /* protocol handshake, including TLS and auth */
+    VIRT_VIEWER_PHASE_AUTH,        /* waiting for the user to enter credentials */
+    VIRT_VIEWER_PHASE_CHANNELS,    /* main channel up until the display channel */
+    VIRT_VIEWER_PHASE_FIRST_FRAME,
+
+    VIRT_VIEWER_PHASE_LAST
+} VirtViewerPhase;
+
+/*
+ * A process wide record of when each phase of the current connection
+ * attempt started and ended, on the monotonic clock. It may be updated
+ * from any thread; updates are ignored until virt_viewer_timeline_start()
+ * and after virt_viewer_timeline_finish().
+ */
+void virt_viewer_timeline_start(void);
+void virt_viewer_timeline_begin(VirtViewerPhase phase);
+void virt_viewer_timeline_end(VirtViewerPhase phase);
+void virt_viewer_timeline_mark(VirtViewerPhase phase);
+gboolean virt_viewer_timeline_finish(void);
+
+gchar *virt_viewer_timeline_summary(void);
+gchar *virt_viewer_timeline_to_json(const gchar *result);
+
+G_END_DECLS
+
+#endif /* VIRT_VIEWER_TIMELINE_H */
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
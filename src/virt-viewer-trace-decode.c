@@ -0,0 +1,142 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/*
+ * Turns a trace dump, as written on SIGUSR1 or on a crash, into a
+ * timeline with one event per line, oldest first.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "virt-viewer-trace.h"
+
+typedef gchar VirtViewerTraceName[VIRT_VIEWER_TRACE_NAME_SIZE];
+
+static void
+print_record(const VirtViewerTraceRecord *record, const VirtViewerTraceName *names,
+             gint64 origin, gint64 previous)
+{
+    const gchar *name = virt_viewer_trace_event_name(record->event);
+    guint n;
+
+    g_print("%12.3f %+10.3f  ", (record->time - origin) / 1000.0,
+            (record->time - previous) / 1000.0);
+    if (name)
+        g_print("%-22s", name);
+    else
+        g_print("event-%-16u", record->event);
+
+    for (n = 0 ; n < 2 ; n++) {
+        const gchar *arg = virt_viewer_trace_event_arg(record->event, n);
+        gint64 id = record->args[n];
+
+        if (arg && names && virt_viewer_trace_event_arg_is_name(record->event, n) &&
+            id > 0 && id <= VIRT_VIEWER_TRACE_NAMES)
+            g_print(" %s=\"%.*s\"", arg, VIRT_VIEWER_TRACE_NAME_SIZE, names[id - 1]);
+        else if (arg)
+            g_print(" %s=%" G_GINT64_FORMAT, arg, record->args[n]);
+        else if (!name && record->args[n])
+            g_print(" %" G_GINT64_FORMAT, record->args[n]);
+    }
+    g_print("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    const VirtViewerTraceHeader *header;
+    const VirtViewerTraceRecord *ring;
+    const VirtViewerTraceName *names = NULL;
+    gsize names_offset;
+    gchar *contents = NULL;
+    gsize length;
+    GError *error = NULL;
+    guint32 index, start, skipped = 0;
+    gint64 origin = 0, previous = 0;
+    gboolean first = TRUE;
+
+    if (argc != 2) {
+        g_printerr("Usage: %s TRACE-FILE\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!g_file_get_contents(argv[1], &contents, &length, &error)) {
+        g_printerr("%s\n", error->message);
+        g_clear_error(&error);
+        return EXIT_FAILURE;
+    }
+
+    header = (const VirtViewerTraceHeader *)contents;
+    if (length < sizeof(*header) ||
+        memcmp(header->magic, VIRT_VIEWER_TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->record_size != sizeof(VirtViewerTraceRecord) ||
+        header->records == 0 ||
+        length < sizeof(*header) + (gsize)header->records * header->record_size) {
+        g_printerr("%s: not a trace dump of this architecture\n", argv[1]);
+        g_free(contents);
+        return EXIT_FAILURE;
+    }
+    ring = (const VirtViewerTraceRecord *)(contents + sizeof(*header));
+
+    /* Older dumps have no name table, their name ids show as numbers */
+    names_offset = sizeof(*header) + (gsize)header->records * header->record_size;
+    if (length >= names_offset + VIRT_VIEWER_TRACE_NAMES * sizeof(VirtViewerTraceName))
+        names = (const VirtViewerTraceName *)(contents + names_offset);
+
+    g_print("# pid %u, %u events recorded, %u kept\n", header->pid, header->head,
+            MIN(header->head, header->records));
+
+    start = header->head > header->records ? header->head - header->records : 0;
+    for (index = start ; index != header->head ; index++) {
+        const VirtViewerTraceRecord *record = &ring[index % header->records];
+
+        /* Overwritten or still being written when the dump was taken */
+        if ((guint32)record->seq != index + 1) {
+            skipped++;
+            continue;
+        }
+
+        if (first) {
+            origin = previous = record->time;
+            first = FALSE;
+        }
+        print_record(record, names, origin, previous);
+        previous = record->time;
+    }
+
+    if (skipped)
+        g_print("# %u incomplete event(s) skipped\n", skipped);
+
+    g_free(contents);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,280 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "virt-glib-compat.h"
+#include "virt-viewer-trace.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#if GLIB_CHECK_VERSION(2,30,0)
+#define trace_fetch_and_add(atomic, val) g_atomic_int_add(atomic, val)
+#else
+#define trace_fetch_and_add(atomic, val) g_atomic_int_exchange_and_add(atomic, val)
+#endif
+
+/*
+ * Always on event trace: a fixed size ring of binary records, which
+ * any thread claims a slot of with a single atomic increment. Nothing
+ * is formatted until a dump is decoded by virt-viewer-trace-decode.
+ */
+
+static const struct {
+    const gchar *name;
+    const gchar *args[2];
+    guint name_args; /* bit n set when args[n] is a name id */
+} trace_events[] = {
+    { "none", { NULL, NULL }, 0 },
+    { "events-handle", { "fd", "events" }, 0 },
+    { "events-timeout", { "timer", NULL }, 0 },
+    { "display-allocate", { "width", "height" }, 0 },
+    { "display-request", { "width", "height" }, 0 },
+    { "display-desktop", { "width", "height" }, 0 },
+    { "display-hint", { "nth", "hint" }, 0 },
+    { "phase-begin", { "phase", NULL }, 0 },
+    { "phase-end", { "phase", NULL }, 0 },
+    { "session-connected", { NULL, NULL }, 0 },
+    { "session-disconnected", { NULL, NULL }, 0 },
+    { "reconnect", { "attempt", NULL }, 0 },
+    { "channel-request", { "type", "id" }, 0 },
+    { "channel-opened", { "type", "id" }, 0 },
+    { "display-child", { "width", "height" }, 0 },
+    { "main-loop-stall", { "ms", "source" }, 1 << 1 },
+    { "monitor-config", { "monitors", "changed" }, 0 },
+    { "display-flush", { "nth", "coalesced" }, 0 },
+    { "screenshot", { "encode-us", "bytes" }, 0 },
+};
+G_STATIC_ASSERT(G_N_ELEMENTS(trace_events) == VIRT_VIEWER_TRACE_LAST);
+G_STATIC_ASSERT((VIRT_VIEWER_TRACE_RECORDS & (VIRT_VIEWER_TRACE_RECORDS - 1)) == 0);
+
+static VirtViewerTraceRecord trace_ring[VIRT_VIEWER_TRACE_RECORDS];
+static volatile gint trace_head;
+static guint32 trace_pid;
+
+/* Written before their id is handed out, and never changed after */
+static gchar trace_names[VIRT_VIEWER_TRACE_NAMES][VIRT_VIEWER_TRACE_NAME_SIZE];
+static guint trace_n_names;
+G_LOCK_DEFINE_STATIC(trace_names);
+
+void
+virt_viewer_trace(VirtViewerTraceEvent event, gint64 arg0, gint64 arg1)
+{
+    guint32 index = (guint32)trace_fetch_and_add(&trace_head, 1);
+    VirtViewerTraceRecord *record = &trace_ring[index % VIRT_VIEWER_TRACE_RECORDS];
+
+    /* A dump taken meanwhile sees an unfinished record as empty */
+    g_atomic_int_set(&record->seq, 0);
+    record->time = g_get_monotonic_time();
+    record->event = event;
+    record->args[0] = arg0;
+    record->args[1] = arg1;
+    g_atomic_int_set(&record->seq, (gint32)(index + 1));
+}
+
+/*
+ * Returns the small id that stands for @name in records, giving it one
+ * the first time. Names are truncated to fit the table. Once the table
+ * is full, or for NULL, 0 is returned.
+ */
+guint32
+virt_viewer_trace_name_id(const gchar *name)
+{
+    guint32 id = 0;
+    guint i;
+
+    if (name == NULL)
+        return 0;
+
+    G_LOCK(trace_names);
+    for (i = 0 ; i < trace_n_names ; i++) {
+        if (strncmp(trace_names[i], name, VIRT_VIEWER_TRACE_NAME_SIZE - 1) == 0) {
+            id = i + 1;
+            break;
+        }
+    }
+    if (id == 0 && trace_n_names < VIRT_VIEWER_TRACE_NAMES) {
+        g_strlcpy(trace_names[trace_n_names], name, VIRT_VIEWER_TRACE_NAME_SIZE);
+        id = ++trace_n_names;
+    }
+    G_UNLOCK(trace_names);
+
+    return id;
+}
+
+const gchar *
+virt_viewer_trace_event_name(guint32 event)
+{
+    if (event >= VIRT_VIEWER_TRACE_LAST)
+        return NULL;
+    return trace_events[event].name;
+}
+
+const gchar *
+virt_viewer_trace_event_arg(guint32 event, guint n)
+{
+    if (event >= VIRT_VIEWER_TRACE_LAST || n >= 2)
+        return NULL;
+    return trace_events[event].args[n];
+}
+
+gboolean
+virt_viewer_trace_event_arg_is_name(guint32 event, guint n)
+{
+    if (event >= VIRT_VIEWER_TRACE_LAST || n >= 2)
+        return FALSE;
+    return (trace_events[event].name_args & (1 << n)) != 0;
+}
+
+static gboolean
+virt_viewer_trace_write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        p += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+/* Only uses async-signal-safe calls, it runs from signal handlers */
+static gboolean
+virt_viewer_trace_write_path(const char *path)
+{
+    VirtViewerTraceHeader header;
+    gboolean ret;
+    int fd;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0600)) < 0)
+        return FALSE;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, VIRT_VIEWER_TRACE_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(VirtViewerTraceRecord);
+    header.records = VIRT_VIEWER_TRACE_RECORDS;
+    header.head = (guint32)g_atomic_int_get(&trace_head);
+    header.pid = trace_pid;
+
+    ret = virt_viewer_trace_write_all(fd, &header, sizeof(header)) &&
+        virt_viewer_trace_write_all(fd, trace_ring, sizeof(trace_ring)) &&
+        virt_viewer_trace_write_all(fd, trace_names, sizeof(trace_names));
+    close(fd);
+
+    return ret;
+}
+
+gboolean
+virt_viewer_trace_dump(const gchar *path)
+{
+    g_return_val_if_fail(path != NULL, FALSE);
+
+    return virt_viewer_trace_write_path(path);
+}
+
+#ifdef G_OS_UNIX
+static char trace_path[4096];
+
+static const int trace_crash_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+static struct sigaction trace_crash_actions[G_N_ELEMENTS(trace_crash_signals)];
+
+static void
+virt_viewer_trace_dump_handler(int signum G_GNUC_UNUSED)
+{
+    int saved_errno = errno;
+
+    virt_viewer_trace_write_path(trace_path);
+    errno = saved_errno;
+}
+
+static void
+virt_viewer_trace_crash_handler(int signum)
+{
+    guint i;
+
+    virt_viewer_trace_write_path(trace_path);
+
+    /* Let the previous handler, or the default action, deal with it */
+    for (i = 0 ; i < G_N_ELEMENTS(trace_crash_signals) ; i++) {
+        if (trace_crash_signals[i] == signum)
+            sigaction(signum, &trace_crash_actions[i], NULL);
+    }
+    raise(signum);
+}
+#endif
+
+/*
+ * Dumps go to virt-viewer-trace-PID.bin in the user runtime directory,
+ * on SIGUSR1 and when the process crashes.
+ */
+void
+virt_viewer_trace_init(void)
+{
+#ifdef G_OS_UNIX
+    struct sigaction action;
+    gchar *name, *path;
+    guint i;
+#endif
+
+    trace_pid = getpid();
+
+#ifdef G_OS_UNIX
+    g_mkdir_with_parents(g_get_user_runtime_dir(), 0700);
+    name = g_strdup_printf("virt-viewer-trace-%u.bin", trace_pid);
+    path = g_build_filename(g_get_user_runtime_dir(), name, NULL);
+    g_strlcpy(trace_path, path, sizeof(trace_path));
+    g_free(path);
+    g_free(name);
+
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    action.sa_handler = virt_viewer_trace_dump_handler;
+    sigaction(SIGUSR1, &action, NULL);
+
+    action.sa_flags = 0;
+    action.sa_handler = virt_viewer_trace_crash_handler;
+    for (i = 0 ; i < G_N_ELEMENTS(trace_crash_signals) ; i++)
+        sigaction(trace_crash_signals[i], &action, &trace_crash_actions[i]);
+#endif
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
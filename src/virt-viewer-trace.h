@@ -0,0 +1,99 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#ifndef VIRT_VIEWER_TRACE_H
+#define VIRT_VIEWER_TRACE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Event ids are stored in dumps, only ever append to this list so that
+ * older dumps keep decoding.
+ */
+typedef enum {
+    VIRT_VIEWER_TRACE_NONE,
+    VIRT_VIEWER_TRACE_EVENTS_HANDLE,      /* fd, events */
+    VIRT_VIEWER_TRACE_EVENTS_TIMEOUT,     /* timer */
+    VIRT_VIEWER_TRACE_DISPLAY_ALLOCATE,   /* width, height */
+    VIRT_VIEWER_TRACE_DISPLAY_REQUEST,    /* width, height */
+    VIRT_VIEWER_TRACE_DISPLAY_DESKTOP,    /* width, height */
+    VIRT_VIEWER_TRACE_DISPLAY_HINT,       /* nth, show hint */
+    VIRT_VIEWER_TRACE_PHASE_BEGIN,        /* VirtViewerPhase */
+    VIRT_VIEWER_TRACE_PHASE_END,          /* VirtViewerPhase */
+    VIRT_VIEWER_TRACE_SESSION_CONNECTED,
+    VIRT_VIEWER_TRACE_SESSION_DISCONNECTED,
+    VIRT_VIEWER_TRACE_RECONNECT,          /* attempt */
+    VIRT_VIEWER_TRACE_CHANNEL_REQUEST,    /* spice channel type, id */
+    VIRT_VIEWER_TRACE_CHANNEL_OPENED,     /* spice channel type, id */
+    VIRT_VIEWER_TRACE_DISPLAY_CHILD,      /* width, height */
+    VIRT_VIEWER_TRACE_MAIN_LOOP_STALL,    /* ms, source name id */
+    VIRT_VIEWER_TRACE_MONITOR_CONFIG,     /* monitors, changed */
+    VIRT_VIEWER_TRACE_DISPLAY_FLUSH,      /* nth, changes coalesced */
+    VIRT_VIEWER_TRACE_SCREENSHOT,         /* encoding us, bytes */
+
+    VIRT_VIEWER_TRACE_LAST
+} VirtViewerTraceEvent;
+
+/* The on-disk format of a dump is the header followed by the ring and
+ * the name table, in host byte order. Name id n is entry n - 1 of the
+ * table, 0 means no name. */
+#define VIRT_VIEWER_TRACE_MAGIC "VVTRACE1"
+#define VIRT_VIEWER_TRACE_RECORDS 4096 /* a power of two */
+#define VIRT_VIEWER_TRACE_NAMES 64
+#define VIRT_VIEWER_TRACE_NAME_SIZE 48 /* including the nul */
+
+typedef struct {
+    gchar magic[8];
+    guint32 record_size;
+    guint32 records;
+    guint32 head;       /* number of records ever written */
+    guint32 pid;
+} VirtViewerTraceHeader;
+
+typedef struct {
+    gint64 time;        /* microseconds, monotonic clock */
+    gint32 seq;         /* index + 1, 0 while the record is being written */
+    guint32 event;
+    gint64 args[2];
+} VirtViewerTraceRecord;
+
+void virt_viewer_trace_init(void);
+void virt_viewer_trace(VirtViewerTraceEvent event, gint64 arg0, gint64 arg1);
+gboolean virt_viewer_trace_dump(const gchar *path);
+guint32 virt_viewer_trace_name_id(const gchar *name);
+
+const gchar *virt_viewer_trace_event_name(guint32 event);
+const gchar *virt_viewer_trace_event_arg(guint32 event, guint n);
+gboolean virt_viewer_trace_event_arg_is_name(guint32 event, guint n);
+
+G_END_DECLS
+
+#endif /* VIRT_VIEWER_TRACE_H */
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
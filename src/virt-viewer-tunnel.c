@@ -0,0 +1,211 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "virt-viewer-util.h"
+#include "virt-viewer-tunnel.h"
+
+/*
+ * A child carrying one display connection over its stdin and stdout,
+ * usually ssh. It is reaped by a child watch when it exits, and what
+ * it prints on stderr is kept to explain failures.
+ */
+struct _VirtViewerTunnel {
+    GPid pid;
+    VirtViewerTunnelExitFunc func; /* NULL once killed */
+    gpointer opaque;
+    GIOChannel *errors;
+    guint errors_watch;
+    GString *stderr_text;
+    GTimer *timer;
+};
+
+#define VIRT_VIEWER_TUNNEL_MAX_STDERR 4096
+
+static void
+virt_viewer_tunnel_read_stderr(VirtViewerTunnel *tunnel)
+{
+    char buf[1024];
+    ssize_t n;
+
+    while ((n = read(g_io_channel_unix_get_fd(tunnel->errors), buf, sizeof(buf))) > 0) {
+        DEBUG_LOG("tunnel[%d]: %.*s", (int)tunnel->pid, (int)n, buf);
+        if (tunnel->stderr_text->len < VIRT_VIEWER_TUNNEL_MAX_STDERR)
+            g_string_append_len(tunnel->stderr_text, buf,
+                                MIN((gsize)n, VIRT_VIEWER_TUNNEL_MAX_STDERR -
+                                    tunnel->stderr_text->len));
+    }
+}
+
+static gboolean
+virt_viewer_tunnel_stderr(GIOChannel *source G_GNUC_UNUSED,
+                          GIOCondition condition,
+                          gpointer opaque)
+{
+    VirtViewerTunnel *tunnel = opaque;
+
+    virt_viewer_tunnel_read_stderr(tunnel);
+
+    if (condition & (G_IO_HUP | G_IO_ERR)) {
+        tunnel->errors_watch = 0;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+virt_viewer_tunnel_free(VirtViewerTunnel *tunnel)
+{
+    if (tunnel->errors_watch)
+        g_source_remove(tunnel->errors_watch);
+    g_io_channel_unref(tunnel->errors);
+    g_string_free(tunnel->stderr_text, TRUE);
+    g_timer_destroy(tunnel->timer);
+    g_free(tunnel);
+}
+
+static void
+virt_viewer_tunnel_exited(GPid pid,
+                          gint status,
+                          gpointer opaque)
+{
+    VirtViewerTunnel *tunnel = opaque;
+
+    g_spawn_close_pid(pid);
+    virt_viewer_tunnel_read_stderr(tunnel);
+    g_strchomp(tunnel->stderr_text->str);
+    DEBUG_LOG("Tunnel %d exited with status %d after %.3f seconds",
+              (int)pid, status, g_timer_elapsed(tunnel->timer, NULL));
+
+    if (tunnel->func)
+        tunnel->func(tunnel, status, tunnel->stderr_text->str, tunnel->opaque);
+    virt_viewer_tunnel_free(tunnel);
+}
+
+/* Kills the child, its child watch still reaps it and frees the tunnel */
+void
+virt_viewer_tunnel_kill(VirtViewerTunnel *tunnel)
+{
+    g_return_if_fail(tunnel != NULL);
+
+    DEBUG_LOG("Killing tunnel %d", (int)tunnel->pid);
+    kill(tunnel->pid, SIGTERM);
+    tunnel->func = NULL;
+}
+
+/* Seconds since the child was started */
+gdouble
+virt_viewer_tunnel_get_elapsed(VirtViewerTunnel *tunnel)
+{
+    g_return_val_if_fail(tunnel != NULL, 0);
+
+    return g_timer_elapsed(tunnel->timer, NULL);
+}
+
+/* Runs @argv, searched in PATH, with our end of its stdin and stdout in @fd */
+VirtViewerTunnel *
+virt_viewer_tunnel_open(const char *const *argv,
+                        int *fd,
+                        VirtViewerTunnelExitFunc func,
+                        gpointer opaque)
+{
+    VirtViewerTunnel *tunnel;
+    int sv[2];
+    int errfd[2];
+    pid_t pid;
+
+    g_return_val_if_fail(argv != NULL && argv[0] != NULL, NULL);
+    g_return_val_if_fail(fd != NULL, NULL);
+
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        return NULL;
+
+    if (pipe(errfd) < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return NULL;
+    }
+
+    /* Later tunnels must not inherit our ends */
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+    fcntl(errfd[0], F_SETFD, FD_CLOEXEC);
+
+    pid = fork();
+    if (pid == -1) {
+        close(sv[0]);
+        close(sv[1]);
+        close(errfd[0]);
+        close(errfd[1]);
+        return NULL;
+    }
+
+    if (pid == 0) { /* child */
+        if (dup2(sv[1], 0) < 0 ||
+            dup2(sv[1], 1) < 0 ||
+            dup2(errfd[1], 2) < 0)
+            _exit(1);
+        close(sv[1]);
+        close(errfd[1]);
+        execvp(argv[0], (char *const*)argv);
+        _exit(1);
+    }
+    close(sv[1]);
+    close(errfd[1]);
+
+    tunnel = g_new0(VirtViewerTunnel, 1);
+    tunnel->pid = pid;
+    tunnel->func = func;
+    tunnel->opaque = opaque;
+    tunnel->timer = g_timer_new();
+    tunnel->stderr_text = g_string_new(NULL);
+    fcntl(errfd[0], F_SETFL, O_NONBLOCK);
+    tunnel->errors = g_io_channel_unix_new(errfd[0]);
+    g_io_channel_set_close_on_unref(tunnel->errors, TRUE);
+    tunnel->errors_watch = g_io_add_watch(tunnel->errors,
+                                          G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                          virt_viewer_tunnel_stderr,
+                                          tunnel);
+    g_child_watch_add(pid, virt_viewer_tunnel_exited, tunnel);
+
+    DEBUG_LOG("Started tunnel %d", (int)pid);
+    *fd = sv[0];
+    return tunnel;
+}
+
+#endif /* defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK) */
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
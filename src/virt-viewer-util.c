@@ -40,6 +40,7 @@
 #include <libxml/uri.h>
 
 #include "virt-viewer-util.h"
+#include "virt-viewer-trace.h"
 
 GQuark
 virt_viewer_error_quark(void)
@@ -305,6 +306,8 @@ void virt_viewer_util_init(const char *appname)
     textdomain(GETTEXT_PACKAGE);
 
     g_set_application_name(appname);
+
+    virt_viewer_trace_init();
 }
 
 static gchar *
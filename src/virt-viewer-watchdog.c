@@ -0,0 +1,372 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "virt-glib-compat.h"
+#include "virt-viewer-trace.h"
+#include "virt-viewer-watchdog.h"
+
+/*
+ * Main loop watchdog and dispatch profiler.
+ *
+ * The poll function of the default main context is wrapped, so that
+ * the time from poll returning until it is entered again, i.e. an
+ * iteration of the main loop, is known. A thread checks on it and
+ * reports iterations running past the threshold while they are still
+ * blocked.
+ *
+ * Sources added with virt_viewer_watchdog_idle_add_full() and
+ * virt_viewer_watchdog_timeout_add_full() are named, and their callback
+ * is timed and tells the watchdog what is running. Anything else, GDK
+ * events and the signal handlers run from them for instance, only shows
+ * up in the per iteration figures.
+ */
+
+/* Upper bounds in microseconds, the last bucket is for anything longer */
+static const gint64 bucket_limits[] = { 100, 1000, 10000, 100000, 1000000 };
+static const char * const bucket_names[] = { "<0.1", "<1", "<10", "<100", "<1000", ">=1000" };
+
+typedef struct {
+    const gchar *name; /* interned */
+    guint count;
+    gint64 total; /* us */
+    gint64 max;
+    guint buckets[G_N_ELEMENTS(bucket_names)];
+} VirtViewerWatchdogStats;
+
+G_STATIC_ASSERT(G_N_ELEMENTS(bucket_limits) + 1 == G_N_ELEMENTS(bucket_names));
+
+typedef struct {
+    const gchar *name; /* interned */
+    GSourceFunc function;
+    gpointer data;
+    GDestroyNotify notify;
+} VirtViewerWatchdogSource;
+
+static struct {
+    /* Main thread only */
+    gboolean running;
+    guint threshold; /* ms */
+    GMainContext *context;
+    GPollFunc poll;
+    GHashTable *stats; /* name -> VirtViewerWatchdogStats */
+    VirtViewerWatchdogStats iterations;
+    gint64 iteration_start;
+
+    /* Shared with the watchdog thread */
+    volatile gint generation; /* bumped by start and stop */
+    volatile gint dispatching;
+    volatile gint iteration;
+    volatile gint since; /* ms, when the iteration started */
+    volatile gint reported; /* iteration a stall was reported for */
+    gpointer volatile current; /* name of the source being dispatched */
+} watchdog;
+
+/* Wraps around after 24 days, only differences are used */
+static gint
+virt_viewer_watchdog_now(void)
+{
+    return (gint)((g_get_monotonic_time() / 1000) & G_MAXINT);
+}
+
+static void
+virt_viewer_watchdog_account(VirtViewerWatchdogStats *stats, gint64 elapsed)
+{
+    guint i;
+
+    for (i = 0 ; i < G_N_ELEMENTS(bucket_limits) ; i++) {
+        if (elapsed < bucket_limits[i])
+            break;
+    }
+    stats->buckets[i]++;
+    stats->count++;
+    stats->total += elapsed;
+    stats->max = MAX(stats->max, elapsed);
+}
+
+static gboolean
+virt_viewer_watchdog_source_dispatch(gpointer opaque)
+{
+    VirtViewerWatchdogSource *source = opaque;
+    VirtViewerWatchdogStats *stats;
+    gpointer previous;
+    gint64 start;
+    gboolean ret;
+
+    if (!watchdog.running)
+        return source->function(source->data);
+
+    /* Callbacks may nest, through gtk_dialog_run() for example */
+    previous = g_atomic_pointer_get(&watchdog.current);
+    g_atomic_pointer_set(&watchdog.current, (gpointer)source->name);
+    start = g_get_monotonic_time();
+
+    ret = source->function(source->data);
+
+    /* The profiler may have been stopped by the callback */
+    if (watchdog.stats) {
+        stats = g_hash_table_lookup(watchdog.stats, source->name);
+        if (!stats) {
+            stats = g_new0(VirtViewerWatchdogStats, 1);
+            stats->name = source->name;
+            g_hash_table_insert(watchdog.stats, (gpointer)stats->name, stats);
+        }
+        virt_viewer_watchdog_account(stats, g_get_monotonic_time() - start);
+    }
+    g_atomic_pointer_set(&watchdog.current, previous);
+
+    return ret;
+}
+
+static void
+virt_viewer_watchdog_source_free(gpointer opaque)
+{
+    VirtViewerWatchdogSource *source = opaque;
+
+    if (source->notify)
+        source->notify(source->data);
+    g_free(source);
+}
+
+static guint
+virt_viewer_watchdog_source_attach(GSource *source,
+                                   gint priority,
+                                   const gchar *name,
+                                   GSourceFunc function,
+                                   gpointer data,
+                                   GDestroyNotify notify)
+{
+    VirtViewerWatchdogSource *wrapper;
+    guint id;
+
+    wrapper = g_new0(VirtViewerWatchdogSource, 1);
+    wrapper->name = g_intern_string(name);
+    wrapper->function = function;
+    wrapper->data = data;
+    wrapper->notify = notify;
+
+    if (priority != G_PRIORITY_DEFAULT)
+        g_source_set_priority(source, priority);
+#if GLIB_CHECK_VERSION(2, 26, 0)
+    g_source_set_name(source, wrapper->name);
+#endif
+    g_source_set_callback(source, virt_viewer_watchdog_source_dispatch,
+                          wrapper, virt_viewer_watchdog_source_free);
+    id = g_source_attach(source, NULL);
+    g_source_unref(source);
+
+    return id;
+}
+
+/* Like g_idle_add_full(), with @name showing in the watchdog reports */
+guint
+virt_viewer_watchdog_idle_add_full(gint priority,
+                                   const gchar *name,
+                                   GSourceFunc function,
+                                   gpointer data,
+                                   GDestroyNotify notify)
+{
+    g_return_val_if_fail(name != NULL, 0);
+    g_return_val_if_fail(function != NULL, 0);
+
+    return virt_viewer_watchdog_source_attach(g_idle_source_new(), priority,
+                                              name, function, data, notify);
+}
+
+/* Like g_timeout_add_full(), with @name showing in the watchdog reports */
+guint
+virt_viewer_watchdog_timeout_add_full(gint priority,
+                                      guint interval,
+                                      const gchar *name,
+                                      GSourceFunc function,
+                                      gpointer data,
+                                      GDestroyNotify notify)
+{
+    g_return_val_if_fail(name != NULL, 0);
+    g_return_val_if_fail(function != NULL, 0);
+
+    return virt_viewer_watchdog_source_attach(g_timeout_source_new(interval), priority,
+                                              name, function, data, notify);
+}
+
+static gint
+virt_viewer_watchdog_poll(GPollFD *fds, guint nfds, gint timeout)
+{
+    gint ret;
+
+    if (watchdog.iteration_start) {
+        gint64 elapsed = g_get_monotonic_time() - watchdog.iteration_start;
+
+        virt_viewer_watchdog_account(&watchdog.iterations, elapsed);
+        if (g_atomic_int_get(&watchdog.reported) == g_atomic_int_get(&watchdog.iteration))
+            g_message("Main loop was blocked for %" G_GINT64_FORMAT " ms in total",
+                      elapsed / 1000);
+    }
+
+    g_atomic_int_set(&watchdog.dispatching, 0);
+    ret = watchdog.poll(fds, nfds, timeout);
+
+    watchdog.iteration_start = g_get_monotonic_time();
+    g_atomic_int_set(&watchdog.since, virt_viewer_watchdog_now());
+    g_atomic_int_inc(&watchdog.iteration);
+    g_atomic_int_set(&watchdog.dispatching, 1);
+
+    return ret;
+}
+
+static gpointer
+virt_viewer_watchdog_thread(gpointer opaque)
+{
+    gint generation = GPOINTER_TO_INT(opaque);
+    gulong period = MAX(watchdog.threshold / 4, 1) * 1000;
+
+    for (;;) {
+        const gchar *name;
+        gint iteration, elapsed;
+
+        g_usleep(period);
+
+        /* Stopped, or stopped and started again with a new thread */
+        if (g_atomic_int_get(&watchdog.generation) != generation)
+            break;
+
+        if (!g_atomic_int_get(&watchdog.dispatching))
+            continue;
+
+        iteration = g_atomic_int_get(&watchdog.iteration);
+        elapsed = (virt_viewer_watchdog_now() - g_atomic_int_get(&watchdog.since)) & G_MAXINT;
+        if (elapsed < (gint)watchdog.threshold ||
+            iteration == g_atomic_int_get(&watchdog.reported))
+            continue;
+
+        g_atomic_int_set(&watchdog.reported, iteration);
+        name = g_atomic_pointer_get(&watchdog.current);
+        virt_viewer_trace(VIRT_VIEWER_TRACE_MAIN_LOOP_STALL, elapsed,
+                          virt_viewer_trace_name_id(name));
+
+        g_message("Main loop blocked for %d ms, running %s", elapsed,
+                  name ? name : "an unnamed source (GDK events, signal handlers)");
+    }
+
+    return NULL;
+}
+
+void
+virt_viewer_watchdog_start(guint threshold)
+{
+    GThread *thread;
+    gint generation;
+
+    g_return_if_fail(threshold > 0);
+
+    if (watchdog.running)
+        return;
+
+    watchdog.threshold = threshold;
+    watchdog.context = g_main_context_default();
+    watchdog.stats = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    memset(&watchdog.iterations, 0, sizeof(watchdog.iterations));
+    watchdog.iteration_start = 0;
+    g_atomic_int_set(&watchdog.dispatching, 0);
+
+    watchdog.poll = g_main_context_get_poll_func(watchdog.context);
+    g_main_context_set_poll_func(watchdog.context, virt_viewer_watchdog_poll);
+
+    /* A thread left from an earlier run sees the change and exits */
+    generation = g_atomic_int_get(&watchdog.generation) + 1;
+    g_atomic_int_set(&watchdog.generation, generation);
+    thread = g_thread_new("main-loop-watchdog", virt_viewer_watchdog_thread,
+                          GINT_TO_POINTER(generation));
+    if (thread)
+        g_thread_unref(thread);
+    else
+        g_warning("Unable to start the main loop watchdog thread");
+
+    watchdog.running = TRUE;
+}
+
+static gint
+virt_viewer_watchdog_compare(gconstpointer a, gconstpointer b)
+{
+    const VirtViewerWatchdogStats *sa = a, *sb = b;
+
+    if (sa->total == sb->total)
+        return 0;
+    return sa->total > sb->total ? -1 : 1;
+}
+
+static void
+virt_viewer_watchdog_print(const gchar *name, const VirtViewerWatchdogStats *stats)
+{
+    guint i;
+
+    g_printerr("%-56s %8u %10.1f %8.1f", name, stats->count,
+               stats->total / 1000.0, stats->max / 1000.0);
+    for (i = 0 ; i < G_N_ELEMENTS(stats->buckets) ; i++)
+        g_printerr(" %7u", stats->buckets[i]);
+    g_printerr("\n");
+}
+
+/* Puts things back as they were and prints the dispatch profile */
+void
+virt_viewer_watchdog_stop(void)
+{
+    GList *stats, *l;
+    guint i;
+
+    if (!watchdog.running)
+        return;
+
+    watchdog.running = FALSE;
+    g_atomic_int_inc(&watchdog.generation);
+
+    g_main_context_set_poll_func(watchdog.context, watchdog.poll);
+
+    g_printerr("Main loop dispatch times in ms, by source:\n");
+    g_printerr("%-56s %8s %10s %8s", "", "count", "total", "max");
+    for (i = 0 ; i < G_N_ELEMENTS(bucket_names) ; i++)
+        g_printerr(" %7s", bucket_names[i]);
+    g_printerr("\n");
+
+    virt_viewer_watchdog_print("(whole main loop iterations)", &watchdog.iterations);
+
+    stats = g_list_sort(g_hash_table_get_values(watchdog.stats),
+                        virt_viewer_watchdog_compare);
+    for (l = stats; l; l = l->next) {
+        VirtViewerWatchdogStats *s = l->data;
+
+        virt_viewer_watchdog_print(s->name, s);
+    }
+    g_list_free(stats);
+
+    g_clear_pointer(&watchdog.stats, g_hash_table_unref);
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -39,6 +39,7 @@
 #include "virt-viewer-window.h"
 #include "virt-viewer-session.h"
 #include "virt-viewer-app.h"
+#include "virt-viewer-screenshot.h"
 #include "virt-viewer-util.h"
 #include "view/autoDrawer.h"
 
@@ -889,75 +890,24 @@ virt_viewer_window_menu_view_resize(GtkWidget *menu,
         virt_viewer_display_set_auto_resize(priv->display, priv->auto_resize);
 }
 
-static void add_if_writable (GdkPixbufFormat *data, GHashTable *formats)
+static void
+virt_viewer_window_screenshot_progress(goffset written,
+                                       gpointer opaque G_GNUC_UNUSED)
 {
-    if (gdk_pixbuf_format_is_writable(data)) {
-        gchar **extensions;
-        gchar **it;
-        extensions = gdk_pixbuf_format_get_extensions(data);
-        for (it = extensions; *it != NULL; it++) {
-            g_hash_table_insert(formats, g_strdup(*it), data);
-        }
-        g_strfreev(extensions);
-    }
-}
-
-static GHashTable *init_image_formats(void)
-{
-    GHashTable *format_map;
-    GSList *formats = gdk_pixbuf_get_formats();
-
-    format_map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
-    g_slist_foreach(formats, (GFunc)add_if_writable, format_map);
-    g_slist_free (formats);
-
-    return format_map;
-}
-
-static GdkPixbufFormat *get_image_format(const char *filename)
-{
-    static GOnce image_formats_once = G_ONCE_INIT;
-    const char *ext;
-
-    g_once(&image_formats_once, (GThreadFunc)init_image_formats, NULL);
-
-    ext = strrchr(filename, '.');
-    if (ext == NULL)
-        return NULL;
-
-    ext++; /* skip '.' */
-
-    return g_hash_table_lookup(image_formats_once.retval, ext);
+    DEBUG_LOG("screenshot: %" G_GOFFSET_FORMAT " bytes written", written);
 }
 
 static void
-virt_viewer_window_save_screenshot(VirtViewerWindow *self,
-                                   const char *file)
+virt_viewer_window_screenshot_done(const gchar *filename,
+                                   const GError *error,
+                                   gpointer opaque)
 {
-    VirtViewerWindowPrivate *priv = self->priv;
-    GdkPixbuf *pix = virt_viewer_display_get_pixbuf(VIRT_VIEWER_DISPLAY(priv->display));
-    GdkPixbufFormat *format = get_image_format(file);
-
-    if (format == NULL) {
-        g_debug("unknown file extension, falling back to png");
-        if (!g_str_has_suffix(file, ".png")) {
-            char *png_filename;
-            png_filename = g_strconcat(file, ".png", NULL);
-            gdk_pixbuf_save(pix, png_filename, "png", NULL,
-                            "tEXt::Generator App", PACKAGE, NULL);
-            g_free(png_filename);
-        } else {
-            gdk_pixbuf_save(pix, file, "png", NULL,
-                            "tEXt::Generator App", PACKAGE, NULL);
-        }
-    } else {
-        char *type = gdk_pixbuf_format_get_name(format);
-        g_debug("saving to %s", type);
-        gdk_pixbuf_save(pix, file, type, NULL, NULL);
-        g_free(type);
-    }
+    VirtViewerApp *app = opaque;
 
-    g_object_unref(pix);
+    if (error)
+        virt_viewer_app_simple_message_dialog(app, _("Unable to save screenshot to %s: %s"),
+                                              filename, error->message);
+    g_object_unref(app);
 }
 
 G_MODULE_EXPORT void
@@ -965,7 +915,9 @@ virt_viewer_window_menu_file_screenshot(GtkWidget *menu G_GNUC_UNUSED,
                                         VirtViewerWindow *self)
 {
     GtkWidget *dialog;
+    GtkWidget *all_displays = NULL;
     VirtViewerWindowPrivate *priv = self->priv;
+    VirtViewerSession *session;
     const char *image_dir;
 
     g_return_if_fail(priv->display != NULL);
@@ -984,11 +936,34 @@ virt_viewer_window_menu_file_screenshot(GtkWidget *menu G_GNUC_UNUSED,
         gtk_file_chooser_set_current_folder(GTK_FILE_CHOOSER (dialog), image_dir);
     gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER (dialog), _("Screenshot"));
 
+    session = virt_viewer_app_get_session(priv->app);
+    if (session && virt_viewer_screenshot_get_n_displays(session) > 1) {
+        all_displays = gtk_check_button_new_with_mnemonic(_("Capture _all displays"));
+        gtk_widget_show(all_displays);
+        gtk_file_chooser_set_extra_widget(GTK_FILE_CHOOSER(dialog), all_displays);
+    }
+
     if (gtk_dialog_run(GTK_DIALOG (dialog)) == GTK_RESPONSE_ACCEPT) {
         char *filename;
+        GdkPixbuf *pix = NULL;
 
         filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER (dialog));
-        virt_viewer_window_save_screenshot(self, filename);
+        /* the session may have been replaced while the dialog was up */
+        session = virt_viewer_app_get_session(priv->app);
+        if (session && all_displays &&
+            gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(all_displays)))
+            pix = virt_viewer_screenshot_stitch(session);
+        else if (priv->display)
+            pix = virt_viewer_display_get_pixbuf(VIRT_VIEWER_DISPLAY(priv->display));
+
+        /* only the frame buffer copy happens here, encoding is threaded */
+        if (pix) {
+            virt_viewer_screenshot_save_async(pix, filename, NULL,
+                                              virt_viewer_window_screenshot_progress,
+                                              virt_viewer_window_screenshot_done,
+                                              g_object_ref(priv->app));
+            g_object_unref(pix);
+        }
         g_free(filename);
     }
 
@@ -1302,6 +1277,10 @@ virt_viewer_window_show(VirtViewerWindow *self)
     if (self->priv->display)
         virt_viewer_display_set_enabled(self->priv->display, TRUE);
 
+    /* the display keeps receiving frames, it just never gets mapped */
+    if (virt_viewer_app_get_headless(self->priv->app))
+        return;
+
     gtk_widget_show(self->priv->window);
 
     if (self->priv->desktop_resize_pending) {
@@ -47,19 +47,36 @@
 #include "virt-viewer.h"
 #include "virt-viewer-app.h"
 #include "virt-viewer-events.h"
+#include "virt-viewer-graphics.h"
 #include "virt-viewer-auth.h"
+#include "virt-viewer-timeline.h"
 
 struct _VirtViewerPrivate {
     char *uri;
     virConnectPtr conn;
     virDomainPtr dom;
     char *domkey;
-    gboolean withEvents;
+    int domid;
+    gboolean hasuuid;
+    unsigned char domuuid[VIR_UUID_BUFLEN];
+    int eventID;
+    gboolean eventScoped;
+    gboolean noGraphicsFD;
     gboolean waitvm;
     gboolean reconnect;
+    gboolean eventthread;
+    guint connect_serial;
 };
 
+/* Seconds between keepalive probes, and unanswered probes before
+ * the libvirt connection is considered dead */
+#define VIRT_VIEWER_KEEPALIVE_INTERVAL 5
+#define VIRT_VIEWER_KEEPALIVE_COUNT 3
+
 G_DEFINE_TYPE (VirtViewer, virt_viewer, VIRT_VIEWER_TYPE_APP)
+
+/* Guards priv->dom, which channel fds are opened from in threads */
+G_LOCK_DEFINE_STATIC(domain);
 #define GET_PRIVATE(o)                                                        \
     (G_TYPE_INSTANCE_GET_PRIVATE ((o), VIRT_VIEWER_TYPE, VirtViewerPrivate))
 
@@ -68,6 +85,11 @@ static gboolean virt_viewer_open_connection(VirtViewerApp *self, int *fd);
 static void virt_viewer_deactivated(VirtViewerApp *self, gboolean connect_error);
 static gboolean virt_viewer_start(VirtViewerApp *self);
 static void virt_viewer_dispose (GObject *object);
+static void virt_viewer_domain_event_register(VirtViewer *self,
+                                              virConnectPtr conn,
+                                              virDomainPtr dom,
+                                              int *eventID,
+                                              gboolean *eventScoped);
 
 static void
 virt_viewer_get_property (GObject *object, guint property_id,
@@ -111,6 +133,40 @@ static void
 virt_viewer_init(VirtViewer *self)
 {
     self->priv = GET_PRIVATE(self);
+    self->priv->domid = -1;
+    self->priv->eventID = -1;
+}
+
+static void
+virt_viewer_set_domain(VirtViewer *self, virDomainPtr dom)
+{
+    VirtViewerPrivate *priv = self->priv;
+    virDomainPtr old;
+
+    if (dom)
+        virDomainRef(dom);
+
+    G_LOCK(domain);
+    old = priv->dom;
+    priv->dom = dom;
+    G_UNLOCK(domain);
+
+    if (old)
+        virDomainFree(old);
+}
+
+static virDomainPtr
+virt_viewer_get_domain(VirtViewer *self)
+{
+    virDomainPtr dom;
+
+    G_LOCK(domain);
+    dom = self->priv->dom;
+    if (dom)
+        virDomainRef(dom);
+    G_UNLOCK(domain);
+
+    return dom;
 }
 
 static void
@@ -119,13 +175,10 @@ virt_viewer_deactivated(VirtViewerApp *app, gboolean connect_error)
     VirtViewer *self = VIRT_VIEWER(app);
     VirtViewerPrivate *priv = self->priv;
 
-    if (priv->dom) {
-        virDomainFree(priv->dom);
-        priv->dom = NULL;
-    }
+    virt_viewer_set_domain(self, NULL);
 
     if (priv->reconnect) {
-        if (!priv->withEvents) {
+        if (priv->eventID < 0) {
             DEBUG_LOG("No domain events, falling back to polling");
             virt_viewer_app_start_reconnect_poll(app);
         }
@@ -181,44 +234,53 @@ virt_viewer_parse_uuid(const char *name,
 
 
 static virDomainPtr
-virt_viewer_lookup_domain(VirtViewer *self)
+virt_viewer_lookup_domain(virConnectPtr conn, const char *domkey)
 {
     char *end;
-    VirtViewerPrivate *priv = self->priv;
-    int id = strtol(priv->domkey, &end, 10);
+    int id = strtol(domkey, &end, 10);
     virDomainPtr dom = NULL;
     unsigned char uuid[16];
 
     if (id >= 0 && end && !*end) {
-        dom = virDomainLookupByID(priv->conn, id);
+        dom = virDomainLookupByID(conn, id);
     }
-    if (!dom && virt_viewer_parse_uuid(priv->domkey, uuid) == 0) {
-        dom = virDomainLookupByUUID(priv->conn, uuid);
+    if (!dom && virt_viewer_parse_uuid(domkey, uuid) == 0) {
+        dom = virDomainLookupByUUID(conn, uuid);
     }
     if (!dom) {
-        dom = virDomainLookupByName(priv->conn, priv->domkey);
+        dom = virDomainLookupByName(conn, domkey);
     }
     return dom;
 }
 
+/* Splits the domain key into its ID and UUID forms once, so that
+ * matching events doesn't have to parse it again */
+static void
+virt_viewer_parse_domkey(VirtViewer *self)
+{
+    char *end;
+    VirtViewerPrivate *priv = self->priv;
+    int id = strtol(priv->domkey, &end, 10);
+
+    priv->domid = (id >= 0 && end && !*end) ? id : -1;
+    priv->hasuuid = virt_viewer_parse_uuid(priv->domkey, priv->domuuid) == 0;
+}
+
 static int
 virt_viewer_matches_domain(VirtViewer *self,
                            virDomainPtr dom)
 {
-    char *end;
     const char *name;
     VirtViewerPrivate *priv = self->priv;
-    int id = strtol(priv->domkey, &end, 10);
-    unsigned char wantuuid[16];
-    unsigned char domuuid[16];
+    unsigned char domuuid[VIR_UUID_BUFLEN];
 
-    if (id >= 0 && end && !*end) {
-        if (virDomainGetID(dom) == id)
+    if (priv->domid >= 0) {
+        if (virDomainGetID(dom) == priv->domid)
             return 1;
     }
-    if (virt_viewer_parse_uuid(priv->domkey, wantuuid) == 0) {
+    if (priv->hasuuid) {
         virDomainGetUUID(dom, domuuid);
-        if (memcmp(wantuuid, domuuid, VIR_UUID_BUFLEN) == 0)
+        if (memcmp(priv->domuuid, domuuid, VIR_UUID_BUFLEN) == 0)
             return 1;
     }
 
@@ -229,49 +291,6 @@ virt_viewer_matches_domain(VirtViewer *self,
     return 0;
 }
 
-static char *
-virt_viewer_extract_xpath_string(const gchar *xmldesc,
-                                 const gchar *xpath)
-{
-    xmlDocPtr xml = NULL;
-    xmlParserCtxtPtr pctxt = NULL;
-    xmlXPathContextPtr ctxt = NULL;
-    xmlXPathObjectPtr obj = NULL;
-    char *port = NULL;
-
-    pctxt = xmlNewParserCtxt();
-    if (!pctxt || !pctxt->sax)
-        goto error;
-
-    xml = xmlCtxtReadDoc(pctxt, (const xmlChar *)xmldesc, "domain.xml", NULL,
-                         XML_PARSE_NOENT | XML_PARSE_NONET |
-                         XML_PARSE_NOWARNING);
-    if (!xml)
-        goto error;
-
-    ctxt = xmlXPathNewContext(xml);
-    if (!ctxt)
-        goto error;
-
-    obj = xmlXPathEval((const xmlChar *)xpath, ctxt);
-    if (!obj || obj->type != XPATH_STRING || !obj->stringval || !obj->stringval[0])
-        goto error;
-    if (!strcmp((const char*)obj->stringval, "-1"))
-        goto error;
-
-    port = g_strdup((const char*)obj->stringval);
-    xmlXPathFreeObject(obj);
-    obj = NULL;
-
- error:
-    xmlXPathFreeObject(obj);
-    xmlXPathFreeContext(ctxt);
-    xmlFreeDoc(xml);
-    xmlFreeParserCtxt(pctxt);
-    return port;
-}
-
-
 static gboolean
 virt_viewer_replace_host(const gchar *host)
 {
@@ -294,12 +313,13 @@ virt_viewer_replace_host(const gchar *host)
 
 static gboolean
 virt_viewer_extract_connect_info(VirtViewer *self,
-                                 virDomainPtr dom)
+                                 virDomainPtr dom,
+                                 const char *prefetched)
 {
-    char *type = NULL;
-    char *xpath = NULL;
+    VirtViewerGraphics *graphics;
+    GSList *devices = NULL;
     gboolean retval = FALSE;
-    char *xmldesc = virDomainGetXMLDesc(dom, 0);
+    char *xmldesc = prefetched ? g_strdup(prefetched) : virDomainGetXMLDesc(dom, 0);
     VirtViewerPrivate *priv = self->priv;
     VirtViewerApp *app = VIRT_VIEWER_APP(self);
     gchar *gport = NULL;
@@ -314,30 +334,27 @@ virt_viewer_extract_connect_info(VirtViewer *self,
 
     virt_viewer_app_free_connect_info(app);
 
-    if ((type = virt_viewer_extract_xpath_string(xmldesc, "string(/domain/devices/graphics/@type)")) == NULL) {
+    /* The first graphics device is the one we connect to */
+    devices = virt_viewer_graphics_extract(xmldesc);
+    graphics = devices ? devices->data : NULL;
+    if (!graphics || !graphics->type) {
         virt_viewer_app_simple_message_dialog(app, _("Cannot determine the graphic type for the guest %s"),
                                               priv->domkey);
         goto cleanup;
     }
+    DEBUG_LOG("Guest has %u graphics device(s)", g_slist_length(devices));
 
-    if (virt_viewer_app_create_session(app, type) < 0)
+    if (virt_viewer_app_create_session(app, graphics->type) < 0)
         goto cleanup;
 
-    xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@port)", type);
-    gport = virt_viewer_extract_xpath_string(xmldesc, xpath);
-    g_free(xpath);
-    if (g_str_equal(type, "spice")) {
-        xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@tlsPort)", type);
-        gtlsport = virt_viewer_extract_xpath_string(xmldesc, xpath);
-        g_free(xpath);
-    }
+    gport = g_strdup(graphics->port);
+    if (g_str_equal(graphics->type, "spice"))
+        gtlsport = g_strdup(graphics->tlsport);
 
     if (gport || gtlsport) {
-        xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@listen)", type);
-        ghost = virt_viewer_extract_xpath_string(xmldesc, xpath);
+        ghost = g_strdup(graphics->listen);
     } else {
-        xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@socket)", type);
-        if ((unixsock = virt_viewer_extract_xpath_string(xmldesc, xpath)) == NULL) {
+        if ((unixsock = g_strdup(graphics->socket)) == NULL) {
             virt_viewer_app_simple_message_dialog(app, _("Cannot determine the graphic address for the guest %s"),
                                                   priv->domkey);
             goto cleanup;
@@ -388,23 +405,20 @@ virt_viewer_extract_connect_info(VirtViewer *self,
     g_free(host);
     g_free(transport);
     g_free(user);
-    g_free(type);
-    g_free(xpath);
+    virt_viewer_graphics_list_free(devices);
     g_free(xmldesc);
     g_free(uri);
     return retval;
 }
 
 static gboolean
-virt_viewer_update_display(VirtViewer *self, virDomainPtr dom)
+virt_viewer_update_display(VirtViewer *self, virDomainPtr dom,
+                           const char *xmldesc)
 {
     VirtViewerPrivate *priv = self->priv;
     VirtViewerApp *app = VIRT_VIEWER_APP(self);
 
-    if (priv->dom)
-        virDomainFree(priv->dom);
-    priv->dom = dom;
-    virDomainRef(priv->dom);
+    virt_viewer_set_domain(self, dom);
 
     virt_viewer_app_trace(app, "Guest %s is running, determining display",
                           priv->domkey);
@@ -412,94 +426,315 @@ virt_viewer_update_display(VirtViewer *self, virDomainPtr dom)
     g_object_set(app, "title", virDomainGetName(dom), NULL);
 
     if (!virt_viewer_app_has_session(app)) {
-        if (!virt_viewer_extract_connect_info(self, dom))
+        if (!virt_viewer_extract_connect_info(self, dom, xmldesc))
             return FALSE;
     }
 
     return TRUE;
 }
 
+/* May be called from the app's channel threads */
 static gboolean
 virt_viewer_open_connection(VirtViewerApp *self G_GNUC_UNUSED, int *fd)
 {
-#if defined(HAVE_SOCKETPAIR)
+#if defined(HAVE_SOCKETPAIR) || defined(HAVE_VIRDOMAINOPENGRAPHICSFD)
     VirtViewer *viewer = VIRT_VIEWER(self);
-    VirtViewerPrivate *priv = viewer->priv;
+    virDomainPtr dom;
+#endif
+#if defined(HAVE_SOCKETPAIR)
     int pair[2];
 #endif
+    gboolean ret = TRUE;
+
     *fd = -1;
-#if defined(HAVE_SOCKETPAIR)
-    if (!priv->dom)
+#if defined(HAVE_SOCKETPAIR) || defined(HAVE_VIRDOMAINOPENGRAPHICSFD)
+    dom = virt_viewer_get_domain(viewer);
+    if (!dom)
         return TRUE;
+#endif
+#if defined(HAVE_VIRDOMAINOPENGRAPHICSFD)
+    /* Let libvirtd create the socket and hand us our end of it */
+    if (!viewer->priv->noGraphicsFD) {
+        virErrorPtr err;
+
+        *fd = virDomainOpenGraphicsFD(dom, 0,
+                                      VIR_DOMAIN_OPEN_GRAPHICS_SKIPAUTH);
+        if (*fd >= 0)
+            goto cleanup;
 
-    if (socketpair(PF_UNIX, SOCK_STREAM, 0, pair) < 0)
-        return FALSE;
+        err = virGetLastError();
+        DEBUG_LOG("Error %s", err && err->message ? err->message : "Unknown");
+        if (err && err->code == VIR_ERR_NO_SUPPORT)
+            viewer->priv->noGraphicsFD = TRUE;
+    }
+#endif
+#if defined(HAVE_SOCKETPAIR)
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        ret = FALSE;
+        goto cleanup;
+    }
 
-    if (virDomainOpenGraphics(priv->dom, 0, pair[0],
+    if (virDomainOpenGraphics(dom, 0, pair[0],
                               VIR_DOMAIN_OPEN_GRAPHICS_SKIPAUTH) < 0) {
         virErrorPtr err = virGetLastError();
         DEBUG_LOG("Error %s", err && err->message ? err->message : "Unknown");
         close(pair[0]);
         close(pair[1]);
-        return TRUE;
+        goto cleanup;
     }
     close(pair[0]);
     *fd = pair[1];
 #endif
-    return TRUE;
+
+#if defined(HAVE_SOCKETPAIR) || defined(HAVE_VIRDOMAINOPENGRAPHICSFD)
+ cleanup:
+    virDomainFree(dom);
+#endif
+    return ret;
 }
 
-static int
-virt_viewer_domain_event(virConnectPtr conn G_GNUC_UNUSED,
-                         virDomainPtr dom,
-                         int event,
-                         int detail G_GNUC_UNUSED,
-                         void *opaque)
+typedef struct {
+    VirtViewer *self;
+    virDomainPtr dom;
+} VirtViewerDomainStarted;
+
+static void
+virt_viewer_domain_started(VirtViewer *self, virDomainPtr dom)
 {
-    VirtViewer *self = opaque;
     VirtViewerApp *app = VIRT_VIEWER_APP(self);
+    VirtViewerPrivate *priv = self->priv;
     GError *error = NULL;
 
-    DEBUG_LOG("Got domain event %d %d", event, detail);
+    if (!virt_viewer_app_is_active(app))
+        virt_viewer_timeline_start();
+    virt_viewer_update_display(self, dom, NULL);
 
-    if (!virt_viewer_matches_domain(self, dom))
-        return 0;
+    /* With --wait the guest may only turn up now, through the
+     * subscription to every guest: narrow it down to this one */
+    if (priv->conn)
+        virt_viewer_domain_event_register(self, priv->conn, dom,
+                                          &priv->eventID, &priv->eventScoped);
+    virt_viewer_app_activate(app, &error);
+    if (error) {
+        /* we may want to consolidate error reporting in
+           app_activate() instead */
+        g_warning("%s", error->message);
+        g_clear_error(&error);
+    }
+
+    /* The display may not be listening yet, retry without waiting
+     * for the backoff */
+    if (!virt_viewer_app_is_active(app))
+        virt_viewer_app_wake_reconnect_poll(app);
+}
 
+static gboolean
+virt_viewer_domain_started_idle(gpointer opaque)
+{
+    VirtViewerDomainStarted *data = opaque;
+
+    virt_viewer_domain_started(data->self, data->dom);
+
+    virDomainFree(data->dom);
+    g_object_unref(data->self);
+    g_free(data);
+    return FALSE;
+}
+
+static void
+virt_viewer_domain_lifecycle(VirtViewer *self,
+                             virDomainPtr dom,
+                             int event)
+{
     switch (event) {
     case VIR_DOMAIN_EVENT_STOPPED:
         //virt_viewer_deactivate(self);
         break;
 
     case VIR_DOMAIN_EVENT_STARTED:
-        virt_viewer_update_display(self, dom);
-        virt_viewer_app_activate(app, &error);
-        if (error) {
-            /* we may want to consolidate error reporting in
-               app_activate() instead */
-            g_warning("%s", error->message);
-            g_clear_error(&error);
+        if (virt_viewer_events_is_threaded()) {
+            /* Running on the libvirt event thread, the UI work has
+             * to happen in the main loop */
+            VirtViewerDomainStarted *data = g_new0(VirtViewerDomainStarted, 1);
+            data->self = g_object_ref(self);
+            data->dom = dom;
+            virDomainRef(dom);
+            g_idle_add(virt_viewer_domain_started_idle, data);
+        } else {
+            virt_viewer_domain_started(self, dom);
         }
         break;
     }
+}
 
+/* Subscribed to every guest on the connection, until ours is known */
+static int
+virt_viewer_domain_event(virConnectPtr conn G_GNUC_UNUSED,
+                         virDomainPtr dom,
+                         int event,
+                         int detail G_GNUC_UNUSED,
+                         void *opaque)
+{
+    VirtViewer *self = opaque;
+
+    if (!virt_viewer_matches_domain(self, dom))
+        return 0;
+
+    DEBUG_LOG("Got domain event %d %d", event, detail);
+    virt_viewer_domain_lifecycle(self, dom, event);
+    return 0;
+}
+
+/* Subscribed to our guest only, libvirt has done the filtering */
+static int
+virt_viewer_domain_event_scoped(virConnectPtr conn G_GNUC_UNUSED,
+                                virDomainPtr dom,
+                                int event,
+                                int detail G_GNUC_UNUSED,
+                                void *opaque)
+{
+    DEBUG_LOG("Got domain event %d %d", event, detail);
+    virt_viewer_domain_lifecycle(opaque, dom, event);
     return 0;
 }
 
+static void
+virt_viewer_cancel_connect(VirtViewer *self)
+{
+    VirtViewerPrivate *priv = self->priv;
+
+    if (!virt_viewer_app_get_connecting(VIRT_VIEWER_APP(self)))
+        return;
+
+    /* The worker can't be interrupted in the middle of an RPC, its
+     * result is discarded when it reaches the main loop instead */
+    DEBUG_LOG("Cancelling pending libvirt connection");
+    priv->connect_serial++;
+    virt_viewer_app_set_connecting(VIRT_VIEWER_APP(self), FALSE);
+}
+
+static gboolean
+virt_viewer_conn_closed(gpointer opaque)
+{
+    VirtViewer *self = opaque;
+    VirtViewerApp *app = VIRT_VIEWER_APP(self);
+    VirtViewerPrivate *priv = self->priv;
+
+    virt_viewer_cancel_connect(self);
+    if (priv->conn) {
+        virConnectClose(priv->conn);
+        priv->conn = NULL;
+    }
+    priv->eventID = -1;
+    priv->eventScoped = FALSE;
+
+    virt_viewer_app_start_reconnect_poll(app);
+    return FALSE;
+}
+
 static void
 virt_viewer_conn_event(virConnectPtr conn G_GNUC_UNUSED,
                        int reason,
                        void *opaque)
 {
     VirtViewer *self = opaque;
-    VirtViewerApp *app = VIRT_VIEWER_APP(self);
-    VirtViewerPrivate *priv = self->priv;
 
     DEBUG_LOG("Got connection event %d", reason);
 
-    virConnectClose(priv->conn);
-    priv->conn = NULL;
+    if (virt_viewer_events_is_threaded())
+        g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, virt_viewer_conn_closed,
+                        g_object_ref(self), g_object_unref);
+    else
+        virt_viewer_conn_closed(self);
+}
+
+/* State of an initial connect, owned by the worker thread until it
+ * is handed back to the main loop by virt_viewer_connect_done() */
+typedef struct {
+    VirtViewer *self;
+    guint serial;
+    gboolean quit_on_error;
+    GTimer *timer;
 
-    virt_viewer_app_start_reconnect_poll(app);
+    gchar *uri;
+    gchar *domkey;
+    int oflags;
+
+    virConnectPtr conn;
+    gboolean opened;
+    int eventID;
+    gboolean eventScoped;
+    virDomainPtr dom;
+    gboolean has_uuid;
+    char uuid_string[VIR_UUID_STRING_BUFLEN];
+    gboolean has_info;
+    virDomainInfo info;
+    char *xmldesc;
+} VirtViewerConnectJob;
+
+typedef struct {
+    VirtViewer *self;
+    guint serial;
+    gchar *status;
+} VirtViewerConnectStatus;
+
+/*
+ * Subscribes to the lifecycle events of @dom, or of every guest on
+ * the connection while @dom is not known yet. An existing unscoped
+ * subscription is replaced once the guest has been found.
+ *
+ * libvirt filters scoped events by UUID, so transient guests, which
+ * may come back under the same name with a new UUID, stay unscoped.
+ */
+static void
+virt_viewer_domain_event_register(VirtViewer *self,
+                                  virConnectPtr conn,
+                                  virDomainPtr dom,
+                                  int *eventID,
+                                  gboolean *eventScoped)
+{
+    int id;
+
+    if (*eventID >= 0 && (*eventScoped || !dom))
+        return;
+
+    if (dom && virDomainIsPersistent(dom) == 1) {
+        id = virConnectDomainEventRegisterAny(conn, dom,
+                                              VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                              VIR_DOMAIN_EVENT_CALLBACK(virt_viewer_domain_event_scoped),
+                                              self, NULL);
+        if (id >= 0) {
+            if (*eventID >= 0)
+                virConnectDomainEventDeregisterAny(conn, *eventID);
+            *eventID = id;
+            *eventScoped = TRUE;
+            return;
+        }
+        DEBUG_LOG("Unable to subscribe to events of guest %s only",
+                  virDomainGetName(dom));
+    }
+
+    if (*eventID >= 0)
+        return;
+
+    *eventID = virConnectDomainEventRegisterAny(conn, NULL,
+                                                VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                                VIR_DOMAIN_EVENT_CALLBACK(virt_viewer_domain_event),
+                                                self, NULL);
+    *eventScoped = FALSE;
+    if (*eventID < 0)
+        DEBUG_LOG("Unable to subscribe to domain events");
+}
+
+static void
+virt_viewer_domain_event_deregister(VirtViewer *self G_GNUC_UNUSED,
+                                    virConnectPtr conn,
+                                    int eventID)
+{
+    if (eventID >= 0)
+        virConnectDomainEventDeregisterAny(conn, eventID);
+    virConnectUnregisterCloseCallback(conn,
+                                      virt_viewer_conn_event);
 }
 
 static void
@@ -508,90 +743,298 @@ virt_viewer_dispose (GObject *object)
     VirtViewer *self = VIRT_VIEWER(object);
     VirtViewerPrivate *priv = self->priv;
 
-    if (priv->withEvents)
-        virConnectDomainEventDeregister(priv->conn,
-                                        virt_viewer_domain_event);
-    virConnectUnregisterCloseCallback(priv->conn,
-                                      virt_viewer_conn_event);
-    if (priv->dom)
-        virDomainFree(priv->dom);
+    virt_viewer_cancel_connect(self);
+    if (priv->conn)
+        virt_viewer_domain_event_deregister(self, priv->conn, priv->eventID);
+    virt_viewer_set_domain(self, NULL);
     if (priv->conn)
         virConnectClose(priv->conn);
     G_OBJECT_CLASS(virt_viewer_parent_class)->dispose (object);
 }
 
-static int virt_viewer_connect(VirtViewerApp *app);
+static gboolean
+virt_viewer_connect_status_idle(gpointer opaque)
+{
+    VirtViewerConnectStatus *data = opaque;
+
+    if (data->serial == data->self->priv->connect_serial)
+        virt_viewer_app_show_status(VIRT_VIEWER_APP(data->self), "%s", data->status);
+
+    g_object_unref(data->self);
+    g_free(data->status);
+    g_free(data);
+    return FALSE;
+}
+
+static void
+virt_viewer_connect_job_status(VirtViewerConnectJob *job,
+                               const gchar *status)
+{
+    VirtViewerConnectStatus *data = g_new0(VirtViewerConnectStatus, 1);
+
+    data->self = g_object_ref(job->self);
+    data->serial = job->serial;
+    data->status = g_strdup(status);
+    g_idle_add(virt_viewer_connect_status_idle, data);
+}
+
+static void
+virt_viewer_connect_job_free(VirtViewerConnectJob *job)
+{
+    if (job->dom)
+        virDomainFree(job->dom);
+    if (job->conn)
+        virConnectClose(job->conn);
+    g_timer_destroy(job->timer);
+    g_free(job->xmldesc);
+    g_free(job->uri);
+    g_free(job->domkey);
+    g_object_unref(job->self);
+    g_free(job);
+}
+
+static void
+virt_viewer_connect_failed(VirtViewerConnectJob *job)
+{
+    if (job->quit_on_error)
+        virt_viewer_app_main_quit(VIRT_VIEWER_APP(job->self), EXIT_FAILURE);
+}
 
 static gboolean
-virt_viewer_initial_connect(VirtViewerApp *app, GError **error)
+virt_viewer_connect_done(gpointer opaque)
 {
-    virDomainPtr dom = NULL;
-    virDomainInfo info;
-    gboolean ret = FALSE;
-    VirtViewer *self = VIRT_VIEWER(app);
+    VirtViewerConnectJob *job = opaque;
+    VirtViewer *self = job->self;
+    VirtViewerApp *app = VIRT_VIEWER_APP(self);
     VirtViewerPrivate *priv = self->priv;
-    char uuid_string[VIR_UUID_STRING_BUFLEN];
+    GError *error = NULL;
+    gboolean ret, failed = TRUE;
+
+    if (job->serial != priv->connect_serial) {
+        failed = FALSE;
+        DEBUG_LOG("Discarding cancelled libvirt connection");
+        if (job->opened) {
+            virt_viewer_domain_event_deregister(self, job->conn, job->eventID);
+        } else if (job->conn && job->conn == priv->conn) {
+            /* The subscription may have been narrowed to the guest */
+            priv->eventID = job->eventID;
+            priv->eventScoped = job->eventScoped;
+        }
+        goto cleanup;
+    }
+    virt_viewer_app_set_connecting(app, FALSE);
 
-    DEBUG_LOG("initial connect");
+    virt_viewer_timeline_end(VIRT_VIEWER_PHASE_LIBVIRT);
+    virt_viewer_app_trace(app, "Guest %s resolved in %.3f seconds",
+                          priv->domkey, g_timer_elapsed(job->timer, NULL));
 
-    if (!priv->conn &&
-        virt_viewer_connect(app) < 0) {
+    if (job->conn) {
+        priv->eventID = job->eventID;
+        priv->eventScoped = job->eventScoped;
+    }
+
+    if (job->opened) {
+        priv->conn = job->conn;
+        job->conn = NULL;
+        priv->noGraphicsFD = FALSE;
+
+        if (priv->eventID < 0 &&
+            !virt_viewer_app_is_active(app)) {
+            DEBUG_LOG("No domain events, falling back to polling");
+            virt_viewer_app_start_reconnect_poll(app);
+        }
+    } else if (!priv->conn) {
+        virt_viewer_app_simple_message_dialog(app, _("Unable to connect to libvirt with URI %s"),
+                                              priv->uri ? priv->uri : _("[none]"));
         virt_viewer_app_show_status(app, _("Waiting for libvirt to start"));
-        goto done;
+        virt_viewer_connect_failed(job);
+        goto cleanup;
     }
 
-    virt_viewer_app_show_status(app, _("Finding guest domain"));
-    dom = virt_viewer_lookup_domain(self);
-    if (!dom) {
+    if (!job->dom) {
         if (priv->waitvm) {
             virt_viewer_app_show_status(app, _("Waiting for guest domain to be created"));
             virt_viewer_app_trace(app, "Guest %s does not yet exist, waiting for it to be created",
                                   priv->domkey);
-            goto done;
         } else {
             virt_viewer_app_simple_message_dialog(app, _("Cannot find guest domain %s"),
                                                   priv->domkey);
             DEBUG_LOG("Cannot find guest %s", priv->domkey);
-            goto cleanup;
+            virt_viewer_connect_failed(job);
         }
+        goto cleanup;
     }
 
-    if (virDomainGetUUIDString(dom, uuid_string) < 0) {
+    if (!job->has_uuid) {
         DEBUG_LOG("Couldn't get uuid from libvirt");
     } else {
-        virt_viewer_app_set_uuid_string(app, uuid_string);
+        virt_viewer_app_set_uuid_string(app, job->uuid_string);
     }
 
-    virt_viewer_app_show_status(app, _("Checking guest domain status"));
-    if (virDomainGetInfo(dom, &info) < 0) {
+    if (!job->has_info) {
         DEBUG_LOG("Cannot get guest state");
+        virt_viewer_connect_failed(job);
         goto cleanup;
     }
 
-    if (info.state == VIR_DOMAIN_SHUTOFF) {
+    if (job->info.state == VIR_DOMAIN_SHUTOFF) {
         virt_viewer_app_show_status(app, _("Waiting for guest domain to start"));
+        goto cleanup;
+    }
+
+    ret = virt_viewer_update_display(self, job->dom, job->xmldesc);
+    if (ret)
+        ret = VIRT_VIEWER_APP_CLASS(virt_viewer_parent_class)->initial_connect(app, &error);
+    if (error) {
+        g_warning("%s", error->message);
+        g_clear_error(&error);
+    }
+    if (ret) {
+        failed = FALSE;
     } else {
-        ret = virt_viewer_update_display(self, dom);
-        if (ret)
-            ret = VIRT_VIEWER_APP_CLASS(virt_viewer_parent_class)->initial_connect(app, error);
-        if (!ret) {
-            if (priv->waitvm) {
-                virt_viewer_app_show_status(app, _("Waiting for guest domain to start server"));
-                virt_viewer_app_trace(app, "Guest %s has not activated its display yet, waiting for it to start",
-                                      priv->domkey);
-            } else {
-                DEBUG_LOG("Failed to activate viewer");
-                goto cleanup;
-            }
+        if (priv->waitvm) {
+            virt_viewer_app_show_status(app, _("Waiting for guest domain to start server"));
+            virt_viewer_app_trace(app, "Guest %s has not activated its display yet, waiting for it to start",
+                                  priv->domkey);
+        } else {
+            DEBUG_LOG("Failed to activate viewer");
+            virt_viewer_connect_failed(job);
         }
     }
 
- done:
-    ret = TRUE;
  cleanup:
-    if (dom)
-        virDomainFree(dom);
-    return ret;
+    if (failed)
+        virt_viewer_app_reconnect_failed(app);
+    virt_viewer_connect_job_free(job);
+    return FALSE;
+}
+
+static int virt_viewer_auth_libvirt_credentials(virConnectCredentialPtr cred,
+                                                unsigned int ncred,
+                                                void *cbdata);
+
+static gpointer
+virt_viewer_connect_thread(gpointer opaque)
+{
+    VirtViewerConnectJob *job = opaque;
+    int cred_types[] =
+        { VIR_CRED_AUTHNAME, VIR_CRED_PASSPHRASE };
+    virConnectAuth auth_libvirt = {
+        .credtype = cred_types,
+        .ncredtype = ARRAY_CARDINALITY(cred_types),
+        .cb = virt_viewer_auth_libvirt_credentials,
+        .cbdata = job->self,
+    };
+
+    if (!job->conn) {
+        DEBUG_LOG("connecting ...");
+        job->conn = virConnectOpenAuth(job->uri,
+                                       //virConnectAuthPtrDefault,
+                                       &auth_libvirt,
+                                       job->oflags);
+        if (!job->conn)
+            goto done;
+        job->opened = TRUE;
+        DEBUG_LOG("Connected to libvirt after %.3f seconds",
+                  g_timer_elapsed(job->timer, NULL));
+
+        /* Notice a dead link within about a keepalive interval
+         * times count, rather than when the TCP stack gives up */
+        if (virConnectSetKeepAlive(job->conn,
+                                   VIRT_VIEWER_KEEPALIVE_INTERVAL,
+                                   VIRT_VIEWER_KEEPALIVE_COUNT) < 0)
+            DEBUG_LOG("Unable to enable keepalive on libvirt connection");
+
+        if (virConnectRegisterCloseCallback(job->conn,
+                                            virt_viewer_conn_event,
+                                            job->self,
+                                            NULL) < 0) {
+            DEBUG_LOG("Unable to register close callback on libvirt connection");
+        }
+    }
+
+    virt_viewer_connect_job_status(job, _("Finding guest domain"));
+    job->dom = virt_viewer_lookup_domain(job->conn, job->domkey);
+    virt_viewer_domain_event_register(job->self, job->conn, job->dom,
+                                      &job->eventID, &job->eventScoped);
+    if (!job->dom)
+        goto done;
+
+    if (virDomainGetUUIDString(job->dom, job->uuid_string) == 0)
+        job->has_uuid = TRUE;
+
+    virt_viewer_connect_job_status(job, _("Checking guest domain status"));
+    if (virDomainGetInfo(job->dom, &job->info) < 0)
+        goto done;
+    job->has_info = TRUE;
+
+    /* Fetch the graphics configuration while still off the main loop */
+    if (job->info.state != VIR_DOMAIN_SHUTOFF)
+        job->xmldesc = virDomainGetXMLDesc(job->dom, 0);
+
+ done:
+    g_idle_add(virt_viewer_connect_done, job);
+    return NULL;
+}
+
+static gboolean
+virt_viewer_connect(VirtViewerApp *app, gboolean quit_on_error)
+{
+    VirtViewer *self = VIRT_VIEWER(app);
+    VirtViewerPrivate *priv = self->priv;
+    VirtViewerConnectJob *job;
+    GThread *thread;
+
+    if (virt_viewer_app_get_connecting(app))
+        return TRUE;
+
+    virt_viewer_timeline_start();
+    virt_viewer_timeline_begin(VIRT_VIEWER_PHASE_LIBVIRT);
+
+    job = g_new0(VirtViewerConnectJob, 1);
+    job->self = g_object_ref(self);
+    job->serial = ++priv->connect_serial;
+    job->quit_on_error = quit_on_error;
+    job->timer = g_timer_new();
+    job->uri = g_strdup(priv->uri);
+    job->domkey = g_strdup(priv->domkey);
+    job->eventID = -1;
+    if (!virt_viewer_app_get_attach(app))
+        job->oflags |= VIR_CONNECT_RO;
+
+    if (priv->conn) {
+        job->conn = priv->conn;
+        virConnectRef(job->conn);
+        job->eventID = priv->eventID;
+        job->eventScoped = priv->eventScoped;
+        virt_viewer_app_show_status(app, _("Finding guest domain"));
+    } else {
+        virt_viewer_app_trace(app, "Opening connection to libvirt with URI %s",
+                              priv->uri ? priv->uri : "<null>");
+        virt_viewer_app_show_status(app, _("Connecting to libvirt"));
+    }
+
+    thread = g_thread_new("libvirt-connect", virt_viewer_connect_thread, job);
+    if (!thread) {
+        g_warning("Unable to start the libvirt connection thread");
+        priv->connect_serial++;
+        virt_viewer_connect_job_free(job);
+        return FALSE;
+    }
+    /* Nothing ever joins the worker */
+    g_thread_unref(thread);
+
+    virt_viewer_app_set_connecting(app, TRUE);
+    return TRUE;
+}
+
+static gboolean
+virt_viewer_initial_connect(VirtViewerApp *app, GError **error G_GNUC_UNUSED)
+{
+    DEBUG_LOG("initial connect");
+
+    /* Results are reported asynchronously by virt_viewer_connect_done() */
+    return virt_viewer_connect(app, FALSE);
 }
 
 static void
@@ -603,137 +1046,126 @@ virt_viewer_error_func (void *data G_GNUC_UNUSED,
 
 
 
-static int
-virt_viewer_auth_libvirt_credentials(virConnectCredentialPtr cred,
-                                     unsigned int ncred,
-                                     void *cbdata)
+typedef struct {
+    VirtViewer *self;
+    virConnectCredentialPtr cred;
+    unsigned int ncred;
+    int ret;
+    GAsyncQueue *reply;
+} VirtViewerAuthRequest;
+
+static void
+virt_viewer_auth_libvirt_credentials_cb(gboolean ok,
+                                        const gchar *username,
+                                        const gchar *password,
+                                        gpointer opaque)
 {
-    char **username = NULL, **password = NULL;
-    VirtViewer *app = cbdata;
+    VirtViewerAuthRequest *req = opaque;
     int i;
-    int ret = -1;
 
-    DEBUG_LOG("Got libvirt credential request for %d credential(s)", ncred);
+    req->ret = ok ? 0 : -1;
 
-    for (i = 0 ; i < ncred ; i++) {
-        switch (cred[i].type) {
-        case VIR_CRED_USERNAME:
+    for (i = 0 ; ok && i < req->ncred ; i++) {
+        virConnectCredentialPtr cred = &req->cred[i];
+
+        switch (cred->type) {
         case VIR_CRED_AUTHNAME:
-            username = &cred[i].result;
+        case VIR_CRED_USERNAME:
+            cred->result = g_strdup(username);
             break;
         case VIR_CRED_PASSPHRASE:
-            password = &cred[i].result;
+            cred->result = g_strdup(password);
             break;
         default:
-            DEBUG_LOG("Unsupported libvirt credential %d", cred[i].type);
-            return -1;
+            continue;
         }
-    }
 
-    if (username || password) {
-        VirtViewerWindow *vwin = virt_viewer_app_get_main_window(VIRT_VIEWER_APP(app));
-        GtkWindow *win = virt_viewer_window_get_window(vwin);
-        ret = virt_viewer_auth_collect_credentials(win,
-                                                   "libvirt",
-                                                   app->priv->uri,
-                                                   username, password);
-        if (ret < 0)
-            goto cleanup;
-    } else {
-        ret = 0;
+        if (cred->result)
+            cred->resultlen = strlen(cred->result);
+        else
+            cred->resultlen = 0;
+        DEBUG_LOG("Got '%s' %d %d", cred->result, cred->resultlen, cred->type);
     }
 
-    for (i = 0 ; i < ncred ; i++) {
-        switch (cred[i].type) {
-        case VIR_CRED_AUTHNAME:
+    DEBUG_LOG("Return %d", req->ret);
+    g_async_queue_push(req->reply, req);
+}
+
+/* Shows the prompt, the connection thread gets its answer from the
+ * response callback while the main loop keeps running */
+static gboolean
+virt_viewer_auth_libvirt_credentials_idle(gpointer opaque)
+{
+    VirtViewerAuthRequest *req = opaque;
+    gboolean want_username = FALSE, want_password = FALSE;
+    int i;
+
+    DEBUG_LOG("Got libvirt credential request for %d credential(s)", req->ncred);
+
+    for (i = 0 ; i < req->ncred ; i++) {
+        switch (req->cred[i].type) {
         case VIR_CRED_USERNAME:
+        case VIR_CRED_AUTHNAME:
+            want_username = TRUE;
+            break;
         case VIR_CRED_PASSPHRASE:
-            if (cred[i].result)
-                cred[i].resultlen = strlen(cred[i].result);
-            else
-                cred[i].resultlen = 0;
-            DEBUG_LOG("Got '%s' %d %d", cred[i].result, cred[i].resultlen, cred[i].type);
+            want_password = TRUE;
             break;
+        default:
+            DEBUG_LOG("Unsupported libvirt credential %d", req->cred[i].type);
+            req->ret = -1;
+            g_async_queue_push(req->reply, req);
+            return FALSE;
         }
     }
 
- cleanup:
-    DEBUG_LOG("Return %d", ret);
-    return ret;
+    if (want_username || want_password) {
+        virt_viewer_auth_collect_credentials_async(VIRT_VIEWER_APP(req->self),
+                                                   "libvirt",
+                                                   req->self->priv->uri,
+                                                   want_username, want_password,
+                                                   virt_viewer_auth_libvirt_credentials_cb,
+                                                   req);
+    } else {
+        req->ret = 0;
+        g_async_queue_push(req->reply, req);
+    }
+
+    return FALSE;
 }
 
+/* Called by virConnectOpenAuth() on the connection thread: the
+ * prompt is shown from the main loop while the worker waits */
 static int
-virt_viewer_connect(VirtViewerApp *app)
+virt_viewer_auth_libvirt_credentials(virConnectCredentialPtr cred,
+                                     unsigned int ncred,
+                                     void *cbdata)
 {
-    VirtViewer *self = VIRT_VIEWER(app);
-    VirtViewerPrivate *priv = self->priv;
-    int cred_types[] =
-        { VIR_CRED_AUTHNAME, VIR_CRED_PASSPHRASE };
-    virConnectAuth auth_libvirt = {
-        .credtype = cred_types,
-        .ncredtype = ARRAY_CARDINALITY(cred_types),
-        .cb = virt_viewer_auth_libvirt_credentials,
-        .cbdata = app,
+    VirtViewerAuthRequest req = {
+        .self = cbdata,
+        .cred = cred,
+        .ncred = ncred,
+        .ret = -1,
+        .reply = g_async_queue_new(),
     };
-    int oflags = 0;
-    GError *error = NULL;
-
-    if (!virt_viewer_app_get_attach(app))
-        oflags |= VIR_CONNECT_RO;
-
-    DEBUG_LOG("connecting ...");
-
-    virt_viewer_app_trace(app, "Opening connection to libvirt with URI %s",
-                          priv->uri ? priv->uri : "<null>");
-    priv->conn = virConnectOpenAuth(priv->uri,
-                                    //virConnectAuthPtrDefault,
-                                    &auth_libvirt,
-                                    oflags);
-    if (!priv->conn) {
-        virt_viewer_app_simple_message_dialog(app, _("Unable to connect to libvirt with URI %s"),
-                                              priv->uri ? priv->uri : _("[none]"));
-        return -1;
-    }
-
-    if (!virt_viewer_app_initial_connect(app, &error)) {
-        if (error)
-            g_warning("%s", error->message);
-        g_clear_error(&error);
-        return -1;
-    }
-
-    if (virConnectDomainEventRegister(priv->conn,
-                                      virt_viewer_domain_event,
-                                      self,
-                                      NULL) < 0)
-        priv->withEvents = FALSE;
-    else
-        priv->withEvents = TRUE;
 
-    if (!priv->withEvents &&
-        !virt_viewer_app_is_active(app)) {
-        DEBUG_LOG("No domain events, falling back to polling");
-        virt_viewer_app_start_reconnect_poll(app);
-    }
+    g_idle_add(virt_viewer_auth_libvirt_credentials_idle, &req);
+    g_async_queue_pop(req.reply);
+    g_async_queue_unref(req.reply);
 
-    if (virConnectRegisterCloseCallback(priv->conn,
-                                        virt_viewer_conn_event,
-                                        self,
-                                        NULL) < 0) {
-        DEBUG_LOG("Unable to register close callback on libvirt connection");
-    }
-
-    return 0;
+    return req.ret;
 }
 
 static gboolean
 virt_viewer_start(VirtViewerApp *app)
 {
-    virt_viewer_events_register();
+    virt_viewer_events_register(VIRT_VIEWER(app)->priv->eventthread);
 
     virSetErrorFunc(NULL, virt_viewer_error_func);
 
-    if (virt_viewer_connect(app) < 0)
+    /* The window is shown straight away, connection progress is
+     * reported in it as the guest is being looked up */
+    if (!virt_viewer_connect(app, TRUE))
         return FALSE;
 
     return VIRT_VIEWER_APP_CLASS(virt_viewer_parent_class)->start(app);
@@ -745,7 +1177,8 @@ virt_viewer_new(const char *uri,
                 gboolean direct,
                 gboolean attach,
                 gboolean waitvm,
-                gboolean reconnect)
+                gboolean reconnect,
+                gboolean eventthread)
 {
     VirtViewer *self;
     VirtViewerApp *app;
@@ -767,8 +1200,10 @@ virt_viewer_new(const char *uri,
     /* should probably be properties instead */
     priv->uri = g_strdup(uri);
     priv->domkey = g_strdup(name);
+    virt_viewer_parse_domkey(self);
     priv->waitvm = waitvm;
     priv->reconnect = reconnect;
+    priv->eventthread = eventthread;
 
     return self;
 }
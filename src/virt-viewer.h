@@ -54,7 +54,8 @@ virt_viewer_new(const char *uri,
                 gboolean direct,
                 gboolean attach,
                 gboolean waitvm,
-                gboolean reconnect);
+                gboolean reconnect,
+                gboolean eventthread);
 
 G_END_DECLS
 
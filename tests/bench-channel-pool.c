@@ -0,0 +1,223 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "virt-glib-compat.h"
+#include "virt-viewer-channel-pool.h"
+
+/*
+ * The channel pool against a virDomainOpenGraphics or ssh spawn taking
+ * OPEN_DELAY per channel fd. The channels of a SPICE session asking
+ * for their fd together must be served at the same time, not one
+ * after another. Those that are kept waiting must be served by
+ * priority, so that the display channel is not queued behind audio
+ * and usbredir.
+ */
+
+gboolean doDebug = FALSE;
+
+#define OPEN_DELAY 50 /* ms */
+#define POOL_THREADS 4
+
+/* The SPICE priorities, as virt_viewer_session_channel_priority() has them */
+enum {
+    PRIORITY_MAIN,
+    PRIORITY_DISPLAY,
+    PRIORITY_INPUTS,
+    PRIORITY_CURSOR,
+    PRIORITY_OTHER,
+};
+
+static gint started;
+static gint hold = TRUE;
+
+static gboolean
+open_cb(int *fd, gpointer opaque G_GNUC_UNUSED)
+{
+    g_atomic_int_inc(&started);
+    g_usleep(OPEN_DELAY * 1000);
+    *fd = -1;
+    return TRUE;
+}
+
+/* Keeps the only thread busy until released */
+static gboolean
+open_hold_cb(int *fd, gpointer opaque)
+{
+    if (g_atomic_int_get(&started) == 0) {
+        g_atomic_int_inc(&started);
+        while (g_atomic_int_get(&hold))
+            g_usleep(1000);
+        *fd = -1;
+        return TRUE;
+    }
+
+    return open_cb(fd, opaque);
+}
+
+typedef struct {
+    GSList *done; /* requests, last done first */
+    guint remaining;
+    gdouble first_display; /* s, since the first request */
+} TestResults;
+
+static void
+done_cb(gpointer request,
+        gboolean ret,
+        int fd,
+        gpointer opaque)
+{
+    TestResults *results = opaque;
+
+    g_assert(ret);
+    g_assert_cmpint(fd, ==, -1);
+    if (GPOINTER_TO_INT(request) == PRIORITY_DISPLAY && results->first_display == 0)
+        results->first_display = g_test_timer_elapsed();
+    results->done = g_slist_prepend(results->done, request);
+    results->remaining--;
+}
+
+static void
+wait_done(TestResults *results)
+{
+    while (results->remaining)
+        g_main_context_iteration(NULL, TRUE);
+    results->done = g_slist_reverse(results->done);
+}
+
+/* As spice-gtk announces them: main first, then the others at once */
+static const gint announced[] = {
+    PRIORITY_MAIN,
+    PRIORITY_OTHER, /* playback */
+    PRIORITY_OTHER, /* record */
+    PRIORITY_OTHER, /* usbredir */
+    PRIORITY_OTHER, /* usbredir */
+    PRIORITY_OTHER, /* smartcard */
+    PRIORITY_INPUTS,
+    PRIORITY_CURSOR,
+    PRIORITY_DISPLAY,
+};
+
+static void
+test_channel_pool_priority(void)
+{
+    TestResults results = { NULL, 0, 0 };
+    VirtViewerChannelPool *pool;
+    gint expected[] = {
+        PRIORITY_MAIN,
+        PRIORITY_DISPLAY,
+        PRIORITY_INPUTS,
+        PRIORITY_CURSOR,
+        PRIORITY_OTHER,
+        PRIORITY_OTHER,
+        PRIORITY_OTHER,
+        PRIORITY_OTHER,
+        PRIORITY_OTHER,
+    };
+    GSList *l;
+    guint i;
+
+    started = 0;
+    hold = TRUE;
+    pool = virt_viewer_channel_pool_new(1, open_hold_cb, done_cb, &results);
+    g_assert(pool != NULL);
+
+    /* The first request holds the thread while the others queue up */
+    g_test_timer_start();
+    virt_viewer_channel_pool_push(pool, GINT_TO_POINTER(-1), PRIORITY_OTHER);
+    results.remaining++;
+    while (g_atomic_int_get(&started) == 0)
+        g_usleep(1000);
+    for (i = 0; i < G_N_ELEMENTS(announced); i++) {
+        virt_viewer_channel_pool_push(pool, GINT_TO_POINTER(announced[i]), announced[i]);
+        results.remaining++;
+    }
+    g_atomic_int_set(&hold, FALSE);
+    wait_done(&results);
+
+    g_assert_cmpint(GPOINTER_TO_INT(results.done->data), ==, -1);
+    for (i = 0, l = results.done->next; l; i++, l = l->next)
+        g_assert_cmpint(GPOINTER_TO_INT(l->data), ==, expected[i]);
+    g_assert_cmpuint(i, ==, G_N_ELEMENTS(expected));
+
+    g_slist_free(results.done);
+    virt_viewer_channel_pool_free(pool);
+}
+
+static void
+bench_channel_pool_concurrent(void)
+{
+    TestResults results = { NULL, 0, 0 };
+    VirtViewerChannelPool *pool;
+    gdouble elapsed;
+    guint i;
+
+    pool = virt_viewer_channel_pool_new(POOL_THREADS, open_cb, done_cb, &results);
+    g_assert(pool != NULL);
+
+    g_test_timer_start();
+    for (i = 0; i < G_N_ELEMENTS(announced); i++) {
+        virt_viewer_channel_pool_push(pool, GINT_TO_POINTER(announced[i]), announced[i]);
+        results.remaining++;
+    }
+    wait_done(&results);
+    elapsed = g_test_timer_elapsed();
+
+    g_test_message("%u channels in %.0f ms, display after %.0f ms, %u ms each one at a time",
+                   (guint)G_N_ELEMENTS(announced), elapsed * 1000,
+                   results.first_display * 1000,
+                   (guint)G_N_ELEMENTS(announced) * OPEN_DELAY);
+    if (g_test_perf())
+        g_test_minimized_result(results.first_display * 1000,
+                                "%.0f ms until the display channel has its fd",
+                                results.first_display * 1000);
+
+    /* One at a time, the display would be served last */
+    g_assert_cmpfloat(elapsed * 1000, <, G_N_ELEMENTS(announced) * OPEN_DELAY / 2);
+    g_assert_cmpfloat(results.first_display * 1000, <,
+                      (G_N_ELEMENTS(announced) - 1) * OPEN_DELAY);
+
+    g_slist_free(results.done);
+    virt_viewer_channel_pool_free(pool);
+}
+
+int
+main(int argc, char **argv)
+{
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_thread_init(NULL);
+#endif
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/channel-pool/priority", test_channel_pool_priority);
+    g_test_add_func("/channel-pool/concurrent", bench_channel_pool_concurrent);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
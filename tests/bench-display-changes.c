@@ -0,0 +1,288 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <gtk/gtk.h>
+
+#include "virt-viewer-session.h"
+#include "virt-viewer-display.h"
+
+/*
+ * UPDATES guest monitor configurations over NDISPLAYS displays, each
+ * setting the hint and the size of every display several times as the
+ * SPICE session does. Every setter call that changes a value would
+ * have emitted a signal on its own; once the main loop runs, a display
+ * must have emitted at most one "notify::show-hint" and one
+ * "display-desktop-resize" per configuration, and none when the values
+ * went back to what was last announced. "-m perf" reports how many
+ * signals were saved.
+ *
+ * The app and file types are only property types of the session, the
+ * display's, and are stood in for here. So is the protocol display.
+ */
+
+gboolean doDebug = FALSE;
+
+#define NDISPLAYS 4
+#define UPDATES 100
+#define DESKTOP_WIDTH 1024
+#define DESKTOP_HEIGHT 768
+
+G_DEFINE_TYPE(VirtViewerApp, virt_viewer_app, G_TYPE_OBJECT)
+
+static void
+virt_viewer_app_class_init(VirtViewerAppClass *klass G_GNUC_UNUSED)
+{
+}
+
+static void
+virt_viewer_app_init(VirtViewerApp *self G_GNUC_UNUSED)
+{
+}
+
+G_DEFINE_TYPE(VirtViewerFile, virt_viewer_file, G_TYPE_OBJECT)
+
+static void
+virt_viewer_file_class_init(VirtViewerFileClass *klass G_GNUC_UNUSED)
+{
+}
+
+static void
+virt_viewer_file_init(VirtViewerFile *self G_GNUC_UNUSED)
+{
+}
+
+typedef struct {
+    VirtViewerDisplay parent;
+} TestDisplay;
+
+typedef struct {
+    VirtViewerDisplayClass parent_class;
+} TestDisplayClass;
+
+GType test_display_get_type(void);
+
+G_DEFINE_TYPE(TestDisplay, test_display, VIRT_VIEWER_TYPE_DISPLAY)
+
+static void
+test_display_close(VirtViewerDisplay *display G_GNUC_UNUSED)
+{
+}
+
+static void
+test_display_class_init(TestDisplayClass *klass)
+{
+    VirtViewerDisplayClass *display_class = VIRT_VIEWER_DISPLAY_CLASS(klass);
+
+    display_class->close = test_display_close;
+}
+
+static void
+test_display_init(TestDisplay *self G_GNUC_UNUSED)
+{
+}
+
+typedef struct {
+    guint hints;
+    guint resizes;
+} TestCounts;
+
+static TestCounts emitted[NDISPLAYS];
+/* The signals the same setter calls emitted before coalescing */
+static guint uncoalesced;
+
+static void
+hint_notified(GObject *display G_GNUC_UNUSED,
+              GParamSpec *pspec G_GNUC_UNUSED,
+              gpointer opaque)
+{
+    TestCounts *counts = opaque;
+
+    counts->hints++;
+}
+
+static void
+desktop_resized(VirtViewerDisplay *display G_GNUC_UNUSED,
+                gpointer opaque)
+{
+    TestCounts *counts = opaque;
+
+    counts->resizes++;
+}
+
+static void
+set_show_hint(VirtViewerDisplay *display, guint mask, gboolean enable)
+{
+    guint hint = virt_viewer_display_get_show_hint(display);
+
+    virt_viewer_display_set_show_hint(display, mask, enable);
+    if (virt_viewer_display_get_show_hint(display) != hint)
+        uncoalesced++;
+}
+
+static void
+set_enabled(VirtViewerDisplay *display, gboolean enabled)
+{
+    set_show_hint(display, VIRT_VIEWER_DISPLAY_SHOW_HINT_SET, TRUE);
+    set_show_hint(display, VIRT_VIEWER_DISPLAY_SHOW_HINT_DISABLED, !enabled);
+}
+
+static void
+set_desktop_size(VirtViewerDisplay *display, guint width, guint height)
+{
+    guint w, h;
+
+    virt_viewer_display_get_desktop_size(display, &w, &h);
+    virt_viewer_display_set_desktop_size(display, width, height);
+    if (w != width || h != height)
+        uncoalesced++;
+}
+
+static void
+flush(void)
+{
+    while (g_main_context_iteration(NULL, FALSE))
+        ;
+}
+
+static void
+counts_reset(void)
+{
+    guint i;
+
+    for (i = 0; i < NDISPLAYS; i++)
+        emitted[i].hints = emitted[i].resizes = 0;
+    uncoalesced = 0;
+}
+
+/*
+ * As a monitors update does: the display goes away and comes back,
+ * its surface is resized to the previous size then the new one, and it
+ * gets ready again.
+ */
+static void
+monitors_update(VirtViewerDisplay *display, guint width)
+{
+    set_show_hint(display, VIRT_VIEWER_DISPLAY_SHOW_HINT_READY, FALSE);
+    set_enabled(display, FALSE);
+    set_desktop_size(display, 640, 480);
+    set_enabled(display, TRUE);
+    set_desktop_size(display, width - 1, DESKTOP_HEIGHT);
+    set_desktop_size(display, width, DESKTOP_HEIGHT);
+    set_show_hint(display, VIRT_VIEWER_DISPLAY_SHOW_HINT_READY, TRUE);
+}
+
+static void
+bench_display_changes(void)
+{
+    VirtViewerDisplay *displays[NDISPLAYS];
+    guint i, n, hints = 0, resizes = 0;
+
+    for (i = 0; i < NDISPLAYS; i++) {
+        displays[i] = g_object_new(test_display_get_type(), "nth-display", i, NULL);
+        g_object_ref_sink(displays[i]);
+        g_signal_connect(displays[i], "notify::show-hint",
+                         G_CALLBACK(hint_notified), &emitted[i]);
+        g_signal_connect(displays[i], "display-desktop-resize",
+                         G_CALLBACK(desktop_resized), &emitted[i]);
+        set_desktop_size(displays[i], DESKTOP_WIDTH, DESKTOP_HEIGHT);
+        set_enabled(displays[i], TRUE);
+        set_show_hint(displays[i], VIRT_VIEWER_DISPLAY_SHOW_HINT_READY, TRUE);
+    }
+    flush();
+    for (i = 0; i < NDISPLAYS; i++) {
+        g_assert_cmpuint(emitted[i].hints, ==, 1);
+        g_assert_cmpuint(emitted[i].resizes, ==, 1);
+    }
+
+    counts_reset();
+    for (n = 1; n <= UPDATES; n++) {
+        for (i = 0; i < NDISPLAYS; i++)
+            monitors_update(displays[i], DESKTOP_WIDTH + n);
+
+        /* Nothing is said before the configuration is complete */
+        for (i = 0; i < NDISPLAYS; i++) {
+            g_assert_cmpuint(emitted[i].hints, ==, 0);
+            g_assert_cmpuint(emitted[i].resizes, ==, 0);
+        }
+        flush();
+
+        for (i = 0; i < NDISPLAYS; i++) {
+            guint w, h;
+
+            /* The hint is back to what was announced, the size is new */
+            g_assert_cmpuint(emitted[i].hints, ==, 0);
+            g_assert_cmpuint(emitted[i].resizes, ==, 1);
+            virt_viewer_display_get_desktop_size(displays[i], &w, &h);
+            g_assert_cmpuint(w, ==, DESKTOP_WIDTH + n);
+            resizes += emitted[i].resizes;
+            emitted[i].resizes = 0;
+        }
+    }
+
+    /* A hint change which sticks is announced once */
+    for (i = 0; i < NDISPLAYS; i++) {
+        set_show_hint(displays[i], VIRT_VIEWER_DISPLAY_SHOW_HINT_READY, FALSE);
+        set_enabled(displays[i], FALSE);
+    }
+    flush();
+    for (i = 0; i < NDISPLAYS; i++) {
+        g_assert_cmpuint(emitted[i].hints, ==, 1);
+        g_assert_cmpuint(emitted[i].resizes, ==, 0);
+        g_assert(!virt_viewer_display_get_enabled(displays[i]));
+        hints += emitted[i].hints;
+    }
+
+    g_test_message("%u setter changes, %u hint notifications, %u desktop resizes",
+                   uncoalesced, hints, resizes);
+    if (g_test_perf())
+        g_test_minimized_result(hints + resizes,
+                                "%u signals emitted for %u changes",
+                                hints + resizes, uncoalesced);
+    g_assert_cmpuint(uncoalesced, ==, (UPDATES * 7 + 2) * NDISPLAYS);
+    g_assert_cmpuint(hints + resizes, ==, (UPDATES + 1) * NDISPLAYS);
+
+    for (i = 0; i < NDISPLAYS; i++) {
+        gtk_widget_destroy(GTK_WIDGET(displays[i]));
+        g_object_unref(displays[i]);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    /* The displays are widgets */
+    if (gtk_init_check(&argc, &argv))
+        g_test_add_func("/display-changes/coalesce", bench_display_changes);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,243 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "virt-viewer-app.h"
+#include "virt-viewer-file.h"
+#include "virt-viewer-display-menu.h"
+
+/*
+ * NDISPLAYS guest monitors, each with its window and its "Displays"
+ * menu, toggling readiness one after another. Every toggle updates all
+ * the menus through the model, as if updates were not coalesced. The
+ * menus must keep their items, only changing their state, and must not
+ * call the toggled handler meanwhile. "-m perf" reports the time one
+ * update of all menus takes.
+ *
+ * The app and file types are only property types of the session, the
+ * display's, and are stood in for here. So is the protocol display,
+ * which is not selectable until ready, like a SPICE display without
+ * an agent.
+ */
+
+gboolean doDebug = FALSE;
+
+#define NDISPLAYS 16
+#define ROUNDS 50
+
+G_DEFINE_TYPE(VirtViewerApp, virt_viewer_app, G_TYPE_OBJECT)
+
+static void
+virt_viewer_app_class_init(VirtViewerAppClass *klass G_GNUC_UNUSED)
+{
+}
+
+static void
+virt_viewer_app_init(VirtViewerApp *self G_GNUC_UNUSED)
+{
+}
+
+G_DEFINE_TYPE(VirtViewerFile, virt_viewer_file, G_TYPE_OBJECT)
+
+static void
+virt_viewer_file_class_init(VirtViewerFileClass *klass G_GNUC_UNUSED)
+{
+}
+
+static void
+virt_viewer_file_init(VirtViewerFile *self G_GNUC_UNUSED)
+{
+}
+
+typedef struct {
+    VirtViewerDisplay parent;
+} TestDisplay;
+
+typedef struct {
+    VirtViewerDisplayClass parent_class;
+} TestDisplayClass;
+
+GType test_display_get_type(void);
+
+G_DEFINE_TYPE(TestDisplay, test_display, VIRT_VIEWER_TYPE_DISPLAY)
+
+static gboolean
+test_display_selectable(VirtViewerDisplay *display G_GNUC_UNUSED)
+{
+    return FALSE;
+}
+
+static void
+test_display_class_init(TestDisplayClass *klass)
+{
+    VirtViewerDisplayClass *display_class = VIRT_VIEWER_DISPLAY_CLASS(klass);
+
+    display_class->selectable = test_display_selectable;
+}
+
+static void
+test_display_init(TestDisplay *self G_GNUC_UNUSED)
+{
+}
+
+typedef struct {
+    VirtViewerDisplay *displays[NDISPLAYS];
+    gboolean visible[NDISPLAYS]; /* windows */
+    GtkWidget *menus[NDISPLAYS];
+    guint toggled;
+} TestMenus;
+
+static void
+toggled_cb(GtkCheckMenuItem *item G_GNUC_UNUSED, TestMenus *test)
+{
+    test->toggled++;
+}
+
+static void
+update_menus(TestMenus *test)
+{
+    GArray *model = virt_viewer_display_menu_model_new();
+    guint i;
+
+    /* Like the app's window table, in no particular order */
+    for (i = 0; i < NDISPLAYS; i++) {
+        guint nth = (i * 7) % NDISPLAYS;
+
+        virt_viewer_display_menu_model_add(model, nth, test->visible[nth],
+                                           test->displays[nth]);
+    }
+    virt_viewer_display_menu_model_sort(model);
+
+    for (i = 0; i < NDISPLAYS; i++)
+        virt_viewer_display_menu_update(GTK_MENU_SHELL(test->menus[i]), model,
+                                        G_CALLBACK(toggled_cb), test);
+
+    g_array_unref(model);
+}
+
+static gboolean
+is_ready(VirtViewerDisplay *display)
+{
+    return (virt_viewer_display_get_show_hint(display) & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY) != 0;
+}
+
+/* The items are those of @items, in monitor order, matching the state */
+static void
+check_menu(TestMenus *test, GtkWidget *menu, GList *items)
+{
+    GList *children = gtk_container_get_children(GTK_CONTAINER(menu));
+    GList *l, *m;
+    gint nth;
+
+    for (l = children, m = items, nth = 0; l && m; l = l->next, m = m->next, nth++) {
+        GtkWidget *item = l->data;
+        gboolean sensitive = test->visible[nth] || is_ready(test->displays[nth]);
+
+        g_assert(item == m->data);
+        g_assert_cmpint(GPOINTER_TO_INT(g_object_get_data(G_OBJECT(item), "nth")), ==, nth);
+        g_assert_cmpint(gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(item)), ==,
+                        test->visible[nth]);
+        g_assert_cmpint(gtk_widget_get_sensitive(item), ==, sensitive);
+    }
+    g_assert(l == NULL && m == NULL);
+    g_assert_cmpint(nth, ==, NDISPLAYS);
+
+    g_list_free(children);
+}
+
+static void
+bench_display_menu_readiness(void)
+{
+    TestMenus test;
+    GList *items[NDISPLAYS];
+    gdouble elapsed = 0;
+    guint i, round, updates = 0;
+
+    memset(&test, 0, sizeof(test));
+    for (i = 0; i < NDISPLAYS; i++) {
+        test.displays[i] = g_object_new(test_display_get_type(), "nth-display", i, NULL);
+        g_object_ref_sink(test.displays[i]);
+        virt_viewer_display_set_enabled(test.displays[i], TRUE);
+        test.menus[i] = gtk_menu_new();
+    }
+    test.visible[0] = TRUE;
+
+    update_menus(&test);
+    for (i = 0; i < NDISPLAYS; i++) {
+        items[i] = gtk_container_get_children(GTK_CONTAINER(test.menus[i]));
+        check_menu(&test, test.menus[i], items[i]);
+    }
+
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < NDISPLAYS; i++) {
+            virt_viewer_display_set_show_hint(test.displays[i],
+                                              VIRT_VIEWER_DISPLAY_SHOW_HINT_READY,
+                                              !is_ready(test.displays[i]));
+            /* A window shown or hidden along the way */
+            if (round % 2)
+                test.visible[i] = !test.visible[i];
+            g_test_timer_start();
+            update_menus(&test);
+            elapsed += g_test_timer_elapsed();
+            updates++;
+        }
+        for (i = 0; i < NDISPLAYS; i++)
+            check_menu(&test, test.menus[i], items[i]);
+    }
+
+    g_test_message("%u updates of %u menus, %.1f us each",
+                   updates, NDISPLAYS, elapsed * 1000000 / updates);
+    if (g_test_perf())
+        g_test_minimized_result(elapsed * 1000000 / updates,
+                                "%.1f us per update of %u menus with %u items",
+                                elapsed * 1000000 / updates, NDISPLAYS, NDISPLAYS);
+    g_assert_cmpuint(test.toggled, ==, 0);
+
+    for (i = 0; i < NDISPLAYS; i++) {
+        g_list_free(items[i]);
+        gtk_widget_destroy(test.menus[i]);
+        g_object_unref(test.displays[i]);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    /* Menus and displays are widgets */
+    if (gtk_init_check(&argc, &argv))
+        g_test_add_func("/display-menu/readiness", bench_display_menu_readiness);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
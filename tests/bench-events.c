@@ -0,0 +1,176 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+#include <libvirt/libvirt.h>
+
+#include "virt-viewer-events.h"
+
+/*
+ * Cost per add, update and remove of libvirt handles and timeouts in
+ * the event bridge, through the public libvirt API. Records are not
+ * armed, so only the registry is measured. A normal run checks that
+ * removed records are freed in a single batch; "-m perf" registers up
+ * to 100k of them and reports how much the per-operation cost grows.
+ */
+
+gboolean doDebug = FALSE;
+
+#define SMOKE_RECORDS 1000
+#define PERF_RECORDS 100000
+
+enum {
+    OP_ADD,
+    OP_UPDATE,
+    OP_REMOVE,
+    OP_LAST
+};
+
+static const gchar *op_names[OP_LAST] = { "add", "update", "remove" };
+
+static guint freed;
+static int pipe_fds[2];
+
+static void
+count_free(void *opaque G_GNUC_UNUSED)
+{
+    freed++;
+}
+
+static void
+handle_cb(int watch G_GNUC_UNUSED, int fd G_GNUC_UNUSED,
+          int events G_GNUC_UNUSED, void *opaque G_GNUC_UNUSED)
+{
+    g_assert_not_reached();
+}
+
+static void
+timeout_cb(int timer G_GNUC_UNUSED, void *opaque G_GNUC_UNUSED)
+{
+    g_assert_not_reached();
+}
+
+/* Nanoseconds per operation in @ns, for @n handles or timeouts */
+static void
+bench_registry_run(gboolean timeouts, guint n, gdouble *ns)
+{
+    int *ids = g_new(int, n);
+    guint i;
+
+    freed = 0;
+
+    g_test_timer_start();
+    for (i = 0; i < n; i++) {
+        if (timeouts)
+            ids[i] = virEventAddTimeout(-1, timeout_cb, NULL, count_free);
+        else
+            ids[i] = virEventAddHandle(pipe_fds[0], 0, handle_cb, NULL, count_free);
+        g_assert_cmpint(ids[i], >, 0);
+    }
+    ns[OP_ADD] = g_test_timer_elapsed() * 1e9 / n;
+
+    /* Still disabled: only the lookup is done */
+    g_test_timer_start();
+    for (i = 0; i < n; i++) {
+        if (timeouts)
+            virEventUpdateTimeout(ids[i], -1);
+        else
+            virEventUpdateHandle(ids[i], 0);
+    }
+    ns[OP_UPDATE] = g_test_timer_elapsed() * 1e9 / n;
+
+    g_test_timer_start();
+    for (i = 0; i < n; i++) {
+        int ret;
+
+        if (timeouts)
+            ret = virEventRemoveTimeout(ids[i]);
+        else
+            ret = virEventRemoveHandle(ids[i]);
+        g_assert_cmpint(ret, ==, 0);
+    }
+    ns[OP_REMOVE] = g_test_timer_elapsed() * 1e9 / n;
+
+    /* Nothing is freed under libvirt's feet, then all at once */
+    g_assert_cmpuint(freed, ==, 0);
+    g_main_context_iteration(NULL, FALSE);
+    g_assert_cmpuint(freed, ==, n);
+
+    g_free(ids);
+}
+
+static void
+bench_registry(gconstpointer data)
+{
+    gboolean timeouts = GPOINTER_TO_INT(data);
+    const gchar *what = timeouts ? "timeouts" : "handles";
+    gdouble small[OP_LAST], large[OP_LAST];
+    guint op;
+
+    if (!g_test_perf()) {
+        bench_registry_run(timeouts, SMOKE_RECORDS, small);
+        return;
+    }
+
+    bench_registry_run(timeouts, SMOKE_RECORDS, small);
+    bench_registry_run(timeouts, PERF_RECORDS, large);
+    for (op = 0; op < OP_LAST; op++) {
+        g_test_minimized_result(large[op] / small[op],
+                                "%s %s: %.0f ns per op with %u, %.0f ns with %u",
+                                op_names[op], what,
+                                small[op], SMOKE_RECORDS,
+                                large[op], PERF_RECORDS);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    ret = pipe(pipe_fds);
+    g_assert_cmpint(ret, ==, 0);
+    virt_viewer_events_register(FALSE);
+
+    g_test_add_data_func("/events/registry/handles", GINT_TO_POINTER(FALSE),
+                         bench_registry);
+    g_test_add_data_func("/events/registry/timeouts", GINT_TO_POINTER(TRUE),
+                         bench_registry);
+
+    ret = g_test_run();
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
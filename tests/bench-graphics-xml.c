@@ -0,0 +1,156 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "virt-viewer-graphics.h"
+
+/*
+ * Extracting the graphics devices from a 1 MB domain XML, as done on
+ * every attach and reconnect. The devices come after thousands of
+ * disks. A normal run parses it once and checks what was found;
+ * "-m perf" keeps parsing for a few seconds and reports the time per
+ * parse.
+ */
+
+#define XML_SIZE (1024 * 1024)
+#define PERF_SECONDS 2.0
+
+static gchar *
+domain_xml_new(void)
+{
+    GString *xml = g_string_new("<domain type='kvm'>\n"
+                                "  <name>bench</name>\n"
+                                "  <memory unit='KiB'>1048576</memory>\n"
+                                "  <os><type arch='x86_64'>hvm</type></os>\n"
+                                "  <devices>\n");
+    guint i;
+
+    for (i = 0; xml->len < XML_SIZE; i++) {
+        g_string_append_printf(xml,
+                               "    <disk type='file' device='disk'>\n"
+                               "      <driver name='qemu' type='qcow2' cache='none'/>\n"
+                               "      <source file='/var/lib/libvirt/images/disk%u.qcow2'/>\n"
+                               "      <target dev='vd%u' bus='virtio'/>\n"
+                               "      <address type='pci' domain='0x0000' bus='0x%02x'"
+                               " slot='0x%02x' function='0x0'/>\n"
+                               "    </disk>\n",
+                               i, i, (i / 32) % 256, i % 32);
+    }
+    g_string_append(xml,
+                    "    <graphics type='spice' port='5900' tlsPort='-1' autoport='yes'"
+                    " listen='127.0.0.1'>\n"
+                    "      <listen type='address' address='127.0.0.1'/>\n"
+                    "    </graphics>\n"
+                    "    <graphics type='vnc' socket='/run/libvirt/qemu/bench.vnc'/>\n"
+                    "  </devices>\n"
+                    "</domain>\n");
+
+    return g_string_free(xml, FALSE);
+}
+
+static void
+check_graphics(GSList *devices)
+{
+    VirtViewerGraphics *graphics;
+
+    g_assert_cmpuint(g_slist_length(devices), ==, 2);
+
+    graphics = devices->data;
+    g_assert_cmpstr(graphics->type, ==, "spice");
+    g_assert_cmpstr(graphics->port, ==, "5900");
+    g_assert(graphics->tlsport == NULL);
+    g_assert_cmpstr(graphics->listen, ==, "127.0.0.1");
+    g_assert(graphics->socket == NULL);
+
+    graphics = devices->next->data;
+    g_assert_cmpstr(graphics->type, ==, "vnc");
+    g_assert(graphics->port == NULL);
+    g_assert_cmpstr(graphics->socket, ==, "/run/libvirt/qemu/bench.vnc");
+}
+
+static void
+bench_graphics_xml(void)
+{
+    gchar *xml = domain_xml_new();
+    guint parses = 0;
+    gdouble elapsed;
+
+    g_test_timer_start();
+    do {
+        GSList *devices = virt_viewer_graphics_extract(xml);
+
+        check_graphics(devices);
+        virt_viewer_graphics_list_free(devices);
+        parses++;
+        elapsed = g_test_timer_elapsed();
+    } while (g_test_perf() && elapsed < PERF_SECONDS);
+
+    if (g_test_perf())
+        g_test_minimized_result(elapsed * 1000 / parses,
+                                "%.2f ms per parse of %" G_GSIZE_FORMAT " bytes",
+                                elapsed * 1000 / parses, strlen(xml));
+
+    g_free(xml);
+}
+
+/* Ports libvirt did not allocate yet, and no devices at all */
+static void
+test_graphics_xml_unset(void)
+{
+    GSList *devices;
+    VirtViewerGraphics *graphics;
+
+    devices = virt_viewer_graphics_extract("<domain><devices>"
+                                           "<graphics type='spice' port='-1' tlsPort=''/>"
+                                           "</devices></domain>");
+    g_assert_cmpuint(g_slist_length(devices), ==, 1);
+    graphics = devices->data;
+    g_assert_cmpstr(graphics->type, ==, "spice");
+    g_assert(graphics->port == NULL);
+    g_assert(graphics->tlsport == NULL);
+    virt_viewer_graphics_list_free(devices);
+
+    g_assert(virt_viewer_graphics_extract("<domain><devices/></domain>") == NULL);
+    g_assert(virt_viewer_graphics_extract("<network/>") == NULL);
+    g_assert(virt_viewer_graphics_extract(NULL) == NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/graphics-xml/1mb", bench_graphics_xml);
+    g_test_add_func("/graphics-xml/unset", test_graphics_xml_unset);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,149 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "virt-viewer-raw-image.h"
+
+/*
+ * Frames per second for each screenshot format, on a 1920x1080 frame
+ * that looks roughly like a desktop: flat panels, a gradient
+ * wallpaper and a noisy photo. PNG through gdk-pixbuf is the
+ * baseline. A normal run encodes each format once, as a smoke test;
+ * "-m perf" keeps encoding for a few seconds and reports the rate.
+ */
+
+#define FRAME_WIDTH 1920
+#define FRAME_HEIGHT 1080
+#define PERF_SECONDS 2.0
+
+static GdkPixbuf *
+frame_new(gboolean alpha)
+{
+    GdkPixbuf *pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, alpha, 8,
+                                       FRAME_WIDTH, FRAME_HEIGHT);
+    gint n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+    gint x, y;
+
+    g_assert(pixbuf != NULL);
+    for (y = 0; y < FRAME_HEIGHT; y++) {
+        guchar *p = gdk_pixbuf_get_pixels(pixbuf) +
+            (gsize)y * gdk_pixbuf_get_rowstride(pixbuf);
+
+        for (x = 0; x < FRAME_WIDTH; x++, p += n_channels) {
+            if (y < 32 || x < 64) {
+                /* Panels */
+                p[0] = 0x30;
+                p[1] = 0x30;
+                p[2] = 0x38;
+            } else if (x >= 1200 && x < 1840 && y >= 200 && y < 680) {
+                /* Photo */
+                p[0] = g_test_rand_int_range(0, 256);
+                p[1] = g_test_rand_int_range(0, 256);
+                p[2] = g_test_rand_int_range(0, 256);
+            } else {
+                /* Wallpaper */
+                p[0] = x * 255 / FRAME_WIDTH;
+                p[1] = y * 255 / FRAME_HEIGHT;
+                p[2] = 0x80;
+            }
+            if (alpha)
+                p[3] = 0xff;
+        }
+    }
+
+    return pixbuf;
+}
+
+static gboolean
+count_write(const gchar *buf G_GNUC_UNUSED, gsize count,
+            GError **error G_GNUC_UNUSED, gpointer opaque)
+{
+    *(gsize *)opaque += count;
+    return TRUE;
+}
+
+static void
+bench_format(gconstpointer data)
+{
+    const gchar *type = data;
+    GdkPixbuf *pixbuf = frame_new(FALSE);
+    GError *error = NULL;
+    gsize size = 0;
+    guint frames = 0;
+    gdouble elapsed;
+
+    g_test_timer_start();
+    do {
+        gboolean ok;
+
+        size = 0;
+        if (virt_viewer_raw_image_lookup(type))
+            ok = virt_viewer_raw_image_save_to_callback(pixbuf, count_write, &size,
+                                                        type, &error);
+        else
+            ok = gdk_pixbuf_save_to_callback(pixbuf, count_write, &size,
+                                             type, &error, NULL);
+        g_assert_no_error(error);
+        g_assert(ok);
+        g_assert_cmpuint(size, >, 0);
+        frames++;
+        elapsed = g_test_timer_elapsed();
+    } while (g_test_perf() && elapsed < PERF_SECONDS);
+
+    if (g_test_perf())
+        g_test_maximized_result(frames / elapsed,
+                                "%s: %.1f frames per second, %" G_GSIZE_FORMAT " bytes per frame",
+                                type, frames / elapsed, size);
+
+    g_object_unref(pixbuf);
+}
+
+int
+main(int argc, char **argv)
+{
+    static const gchar *types[] = { "png", "ppm", "pam", "bgrx", "qoi" };
+    guint i;
+
+#if !GLIB_CHECK_VERSION(2, 35, 0)
+    g_type_init();
+#endif
+    g_test_init(&argc, &argv, NULL);
+
+    for (i = 0; i < G_N_ELEMENTS(types); i++) {
+        gchar *path = g_strdup_printf("/raw-image/fps/%s", types[i]);
+
+        g_test_add_data_func(path, types[i], bench_format);
+        g_free(path);
+    }
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
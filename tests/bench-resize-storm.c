@@ -0,0 +1,250 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <gtk/gtk.h>
+
+#include "virt-glib-compat.h"
+#include "virt-viewer-session.h"
+#include "virt-viewer-display.h"
+
+/*
+ * Dragging a window edge: the display is allocated a new size every
+ * STORM_STEP for STORM_TIME, emitting monitor-geometry-changed each
+ * time as the SPICE display does. The session must coalesce these
+ * into at most one apply_monitor_geometry() per interval, and the last
+ * one must carry the final size.
+ *
+ * virt-viewer-session.c and virt-viewer-display.c are linked on their
+ * own. The app and file types are only property types there and are
+ * stood in for here. So are the protocol session and display.
+ */
+
+gboolean doDebug = FALSE;
+
+#define STORM_TIME 1000 /* ms */
+#define STORM_STEP 5 /* ms */
+/* VIRT_VIEWER_SESSION_MONITOR_CONFIG_INTERVAL */
+#define MONITOR_CONFIG_INTERVAL 250 /* ms */
+#define NDISPLAYS 2
+#define DESKTOP_WIDTH 1024
+#define DESKTOP_HEIGHT 768
+
+G_DEFINE_TYPE(VirtViewerApp, virt_viewer_app, G_TYPE_OBJECT)
+
+static void
+virt_viewer_app_class_init(VirtViewerAppClass *klass G_GNUC_UNUSED)
+{
+}
+
+static void
+virt_viewer_app_init(VirtViewerApp *self G_GNUC_UNUSED)
+{
+}
+
+G_DEFINE_TYPE(VirtViewerFile, virt_viewer_file, G_TYPE_OBJECT)
+
+static void
+virt_viewer_file_class_init(VirtViewerFileClass *klass G_GNUC_UNUSED)
+{
+}
+
+static void
+virt_viewer_file_init(VirtViewerFile *self G_GNUC_UNUSED)
+{
+}
+
+/* Counts what would be sent to the guest */
+typedef struct {
+    VirtViewerSession parent;
+    guint applied;
+    guint monitors;
+} TestSession;
+
+typedef struct {
+    VirtViewerSessionClass parent_class;
+} TestSessionClass;
+
+GType test_session_get_type(void);
+
+G_DEFINE_TYPE(TestSession, test_session, VIRT_VIEWER_TYPE_SESSION)
+
+static void
+test_session_apply_monitor_geometry(VirtViewerSession *session,
+                                    const VirtViewerLayoutMonitor *monitors G_GNUC_UNUSED,
+                                    guint nmonitors)
+{
+    TestSession *self = (TestSession *)session;
+
+    self->applied++;
+    self->monitors += nmonitors;
+}
+
+static void
+test_session_class_init(TestSessionClass *klass)
+{
+    VirtViewerSessionClass *session_class = VIRT_VIEWER_SESSION_CLASS(klass);
+
+    session_class->apply_monitor_geometry = test_session_apply_monitor_geometry;
+}
+
+static void
+test_session_init(TestSession *self G_GNUC_UNUSED)
+{
+}
+
+typedef struct {
+    VirtViewerDisplay parent;
+} TestDisplay;
+
+typedef struct {
+    VirtViewerDisplayClass parent_class;
+} TestDisplayClass;
+
+GType test_display_get_type(void);
+
+G_DEFINE_TYPE(TestDisplay, test_display, VIRT_VIEWER_TYPE_DISPLAY)
+
+static void
+test_display_close(VirtViewerDisplay *display G_GNUC_UNUSED)
+{
+}
+
+static void
+test_display_class_init(TestDisplayClass *klass)
+{
+    VirtViewerDisplayClass *display_class = VIRT_VIEWER_DISPLAY_CLASS(klass);
+
+    display_class->close = test_display_close;
+}
+
+static void
+test_display_init(TestDisplay *self G_GNUC_UNUSED)
+{
+}
+
+/* Runs the main loop for @ms */
+static void
+run_for(guint ms)
+{
+    gint64 deadline = g_get_monotonic_time() + ms * 1000;
+
+    while (g_get_monotonic_time() < deadline) {
+        while (g_main_context_iteration(NULL, FALSE))
+            ;
+        g_usleep(1000);
+    }
+}
+
+/* As virt_viewer_display_spice_size_allocate() does */
+static void
+allocate(VirtViewerDisplay *display, guint width)
+{
+    virt_viewer_display_set_desktop_size(display, width, DESKTOP_HEIGHT);
+    g_signal_emit_by_name(display, "monitor-geometry-changed", NULL);
+}
+
+static void
+bench_resize_storm(void)
+{
+    TestSession *session = g_object_new(test_session_get_type(), NULL);
+    VirtViewerDisplay *displays[NDISPLAYS];
+    GtkWidget *windows[NDISPLAYS];
+    GdkRectangle geometry;
+    gint64 start;
+    guint i, width = DESKTOP_WIDTH, allocations = 0;
+    gboolean applied;
+
+    for (i = 0; i < NDISPLAYS; i++) {
+        displays[i] = g_object_new(test_display_get_type(),
+                                   "nth-display", i,
+                                   "session", session,
+                                   NULL);
+        /* The geometry is that of the desktop, at the window position */
+        virt_viewer_display_set_auto_resize(displays[i], FALSE);
+        virt_viewer_display_set_desktop_size(displays[i], DESKTOP_WIDTH, DESKTOP_HEIGHT);
+        virt_viewer_display_set_enabled(displays[i], TRUE);
+        windows[i] = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+        gtk_container_add(GTK_CONTAINER(windows[i]), GTK_WIDGET(displays[i]));
+        virt_viewer_session_add_display(VIRT_VIEWER_SESSION(session), displays[i]);
+    }
+
+    /* The initial configuration, of every monitor */
+    allocate(displays[0], width);
+    run_for(MONITOR_CONFIG_INTERVAL + 50);
+    g_assert_cmpuint(session->applied, ==, 1);
+    g_assert_cmpuint(session->monitors, ==, NDISPLAYS);
+    session->applied = 0;
+    session->monitors = 0;
+
+    /* Long enough after it for the first change to go at once */
+    start = g_get_monotonic_time();
+    while (g_get_monotonic_time() - start < STORM_TIME * 1000) {
+        allocate(displays[0], ++width);
+        allocations++;
+        while (g_main_context_iteration(NULL, FALSE))
+            ;
+        g_usleep(STORM_STEP * 1000);
+    }
+    run_for(MONITOR_CONFIG_INTERVAL + 50);
+
+    g_test_message("%u allocations, %u monitor configurations sent with %u monitors",
+                   allocations, session->applied, session->monitors);
+    if (g_test_perf())
+        g_test_minimized_result(session->applied,
+                                "%u monitor configurations for %u allocations",
+                                session->applied, allocations);
+
+    g_assert_cmpuint(session->applied, >=, STORM_TIME / MONITOR_CONFIG_INTERVAL / 2);
+    g_assert_cmpuint(session->applied, <=, STORM_TIME / MONITOR_CONFIG_INTERVAL + 2);
+    g_assert_cmpuint(session->monitors, <=, session->applied * NDISPLAYS);
+
+    applied = virt_viewer_session_get_monitor_geometry(VIRT_VIEWER_SESSION(session), 0, &geometry);
+    g_assert(applied);
+    g_assert_cmpint(geometry.width, ==, width);
+    g_assert_cmpint(geometry.height, ==, DESKTOP_HEIGHT);
+
+    virt_viewer_session_clear_displays(VIRT_VIEWER_SESSION(session));
+    for (i = 0; i < NDISPLAYS; i++)
+        gtk_widget_destroy(windows[i]);
+    g_object_unref(session);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    /* The displays are widgets in windows */
+    if (gtk_init_check(&argc, &argv))
+        g_test_add_func("/resize-storm/monitor-config", bench_resize_storm);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
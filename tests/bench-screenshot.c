@@ -0,0 +1,254 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <glib/gstdio.h>
+
+#include "virt-glib-compat.h"
+#include "virt-viewer-app.h"
+#include "virt-viewer-file.h"
+#include "virt-viewer-screenshot.h"
+
+/*
+ * How long the main loop is blocked while a 4K frame is saved as PNG.
+ * A timer firing every TICK_INTERVAL stands in for input and redraws,
+ * the longest gap between two ticks is the blocking time. Saving with
+ * gdk_pixbuf_save() from the main loop, as screenshots were, is the
+ * baseline; through virt_viewer_screenshot_save_async() the loop must
+ * never be blocked for MAX_GAP. "-m perf" reports both.
+ *
+ * The app and file types are only property types of the session,
+ * which the screenshot module links with, and are stood in for here.
+ */
+
+gboolean doDebug = FALSE;
+
+#define FRAME_WIDTH 3840
+#define FRAME_HEIGHT 2160
+#define TICK_INTERVAL 5 /* ms */
+#define MAX_GAP 100 /* ms */
+
+G_DEFINE_TYPE(VirtViewerApp, virt_viewer_app, G_TYPE_OBJECT)
+
+static void
+virt_viewer_app_class_init(VirtViewerAppClass *klass G_GNUC_UNUSED)
+{
+}
+
+static void
+virt_viewer_app_init(VirtViewerApp *self G_GNUC_UNUSED)
+{
+}
+
+G_DEFINE_TYPE(VirtViewerFile, virt_viewer_file, G_TYPE_OBJECT)
+
+static void
+virt_viewer_file_class_init(VirtViewerFileClass *klass G_GNUC_UNUSED)
+{
+}
+
+static void
+virt_viewer_file_init(VirtViewerFile *self G_GNUC_UNUSED)
+{
+}
+
+/* A desktop with a noisy photo in its lower right, slow to compress */
+static GdkPixbuf *
+frame_new(void)
+{
+    GdkPixbuf *pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8,
+                                       FRAME_WIDTH, FRAME_HEIGHT);
+    guint32 seed = 1;
+    gint x, y;
+
+    g_assert(pixbuf != NULL);
+    for (y = 0; y < FRAME_HEIGHT; y++) {
+        guchar *p = gdk_pixbuf_get_pixels(pixbuf) +
+            (gsize)y * gdk_pixbuf_get_rowstride(pixbuf);
+
+        for (x = 0; x < FRAME_WIDTH; x++, p += 3) {
+            if (x >= FRAME_WIDTH / 3 && y >= FRAME_HEIGHT / 3) {
+                seed = seed * 1103515245 + 12345;
+                p[0] = seed >> 24;
+                p[1] = seed >> 16;
+                p[2] = seed >> 8;
+            } else {
+                p[0] = 0x20 + y * 0x80 / FRAME_HEIGHT;
+                p[1] = 0x40;
+                p[2] = 0x60 + x * 0x80 / FRAME_WIDTH;
+            }
+        }
+    }
+
+    return pixbuf;
+}
+
+typedef struct {
+    GMainLoop *loop;
+    GdkPixbuf *frame;
+    gchar *path;
+    gint64 last_tick;
+    gint64 max_gap;
+    guint ticks;
+    goffset progress;
+    gboolean saved;
+} TestSave;
+
+static gboolean
+tick_cb(gpointer opaque)
+{
+    TestSave *save = opaque;
+    gint64 now = g_get_monotonic_time();
+
+    if (save->last_tick && now - save->last_tick > save->max_gap)
+        save->max_gap = now - save->last_tick;
+    save->last_tick = now;
+    save->ticks++;
+
+    return TRUE;
+}
+
+/* As the save dialog did before, in the main loop */
+static gboolean
+save_sync_cb(gpointer opaque)
+{
+    TestSave *save = opaque;
+    GError *error = NULL;
+
+    save->saved = gdk_pixbuf_save(save->frame, save->path, "png", &error, NULL);
+    g_assert_no_error(error);
+    g_main_loop_quit(save->loop);
+
+    return FALSE;
+}
+
+static void
+save_progress_cb(goffset written, gpointer opaque)
+{
+    TestSave *save = opaque;
+
+    g_assert_cmpint(written, >=, save->progress);
+    save->progress = written;
+}
+
+static void
+save_done_cb(const gchar *filename,
+             const GError *error,
+             gpointer opaque)
+{
+    TestSave *save = opaque;
+
+    g_assert_no_error((GError *)error);
+    g_assert_cmpstr(filename, ==, save->path);
+    save->saved = TRUE;
+    g_main_loop_quit(save->loop);
+}
+
+static gboolean
+save_async_cb(gpointer opaque)
+{
+    TestSave *save = opaque;
+
+    virt_viewer_screenshot_save_async(save->frame, save->path, NULL,
+                                      save_progress_cb, save_done_cb, save);
+
+    return FALSE;
+}
+
+/* The longest the main loop went without a tick while @frame was saved */
+static gint64
+run_save(GdkPixbuf *frame, GSourceFunc save_func)
+{
+    TestSave save = { NULL, frame, NULL, 0, 0, 0, 0, FALSE };
+    guint tick;
+    gint width, height;
+    GdkPixbufFormat *format;
+
+    save.loop = g_main_loop_new(NULL, FALSE);
+    save.path = g_build_filename(g_get_tmp_dir(), "bench-screenshot.png", NULL);
+    tick = g_timeout_add(TICK_INTERVAL, tick_cb, &save);
+    g_timeout_add(5 * TICK_INTERVAL, save_func, &save);
+
+    g_main_loop_run(save.loop);
+    /* A last tick after the save, to see the gap it left */
+    tick_cb(&save);
+    g_source_remove(tick);
+    g_assert(save.saved);
+    g_assert_cmpuint(save.ticks, >, 1);
+
+    format = gdk_pixbuf_get_file_info(save.path, &width, &height);
+    g_assert(format != NULL);
+    g_assert_cmpint(width, ==, FRAME_WIDTH);
+    g_assert_cmpint(height, ==, FRAME_HEIGHT);
+
+    g_unlink(save.path);
+    g_free(save.path);
+    g_main_loop_unref(save.loop);
+
+    return save.max_gap;
+}
+
+static void
+bench_screenshot_blocking(void)
+{
+    GdkPixbuf *frame = frame_new();
+    gint64 sync_gap, async_gap;
+
+    sync_gap = run_save(frame, save_sync_cb);
+    async_gap = run_save(frame, save_async_cb);
+
+    g_test_message("main loop blocked %" G_GINT64_FORMAT " ms saving in place, %"
+                   G_GINT64_FORMAT " ms saving from the worker",
+                   sync_gap / 1000, async_gap / 1000);
+    if (g_test_perf())
+        g_test_minimized_result(async_gap / 1000.0,
+                                "%.1f ms blocked saving a %dx%d frame, %.1f ms in place",
+                                async_gap / 1000.0, FRAME_WIDTH, FRAME_HEIGHT,
+                                sync_gap / 1000.0);
+    g_assert_cmpint(async_gap / 1000, <, MAX_GAP);
+
+    g_object_unref(frame);
+}
+
+int
+main(int argc, char **argv)
+{
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_thread_init(NULL);
+#endif
+#if !GLIB_CHECK_VERSION(2, 35, 0)
+    g_type_init();
+#endif
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/screenshot/blocking", bench_screenshot_blocking);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
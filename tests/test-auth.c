@@ -0,0 +1,341 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "virt-viewer-app.h"
+#include "virt-viewer-auth.h"
+
+/*
+ * The credentials prompt must leave the main loop running: a timeout
+ * keeps firing while the dialog is up, and the answer arrives through
+ * the callback once the dialog is answered from that timeout.
+ *
+ * virt-viewer-auth.c is linked on its own, the app, window and UI
+ * loading functions it uses are stood in for here.
+ */
+
+gboolean doDebug = FALSE;
+
+static gboolean test_headless;
+static gint test_quit_status = -1;
+static GtkBuilder *test_builder; /* of the last prompt, owned by it */
+
+G_DEFINE_TYPE(VirtViewerApp, virt_viewer_app, G_TYPE_OBJECT)
+
+static void
+virt_viewer_app_class_init(VirtViewerAppClass *klass G_GNUC_UNUSED)
+{
+}
+
+static void
+virt_viewer_app_init(VirtViewerApp *self G_GNUC_UNUSED)
+{
+}
+
+gboolean
+virt_viewer_app_get_headless(VirtViewerApp *self G_GNUC_UNUSED)
+{
+    return test_headless;
+}
+
+VirtViewerWindow *
+virt_viewer_app_get_main_window(VirtViewerApp *self G_GNUC_UNUSED)
+{
+    return NULL;
+}
+
+GtkWindow *
+virt_viewer_window_get_window(VirtViewerWindow *window G_GNUC_UNUSED)
+{
+    return NULL;
+}
+
+void
+virt_viewer_app_simple_message_dialog(VirtViewerApp *self G_GNUC_UNUSED,
+                                      const char *fmt G_GNUC_UNUSED, ...)
+{
+}
+
+void
+virt_viewer_app_main_quit(VirtViewerApp *self G_GNUC_UNUSED, gint status)
+{
+    test_quit_status = status;
+}
+
+GtkBuilder *
+virt_viewer_util_load_ui(const char *name)
+{
+    gchar *path = g_build_filename(TOP_SRCDIR, "src", name, NULL);
+    GError *error = NULL;
+
+    test_builder = gtk_builder_new();
+    gtk_builder_add_from_file(test_builder, path, &error);
+    g_assert_no_error(error);
+    g_free(path);
+
+    return test_builder;
+}
+
+#ifdef HAVE_GTK_VNC
+VirtViewerApp *
+virt_viewer_session_get_app(VirtViewerSession *self G_GNUC_UNUSED)
+{
+    return NULL;
+}
+
+VirtViewerFile *
+virt_viewer_session_get_file(VirtViewerSession *self G_GNUC_UNUSED)
+{
+    return NULL;
+}
+
+gboolean
+virt_viewer_file_is_set(VirtViewerFile *self G_GNUC_UNUSED, const gchar *key G_GNUC_UNUSED)
+{
+    return FALSE;
+}
+
+gchar *
+virt_viewer_file_get_username(VirtViewerFile *self G_GNUC_UNUSED)
+{
+    return NULL;
+}
+
+gchar *
+virt_viewer_file_get_password(VirtViewerFile *self G_GNUC_UNUSED)
+{
+    return NULL;
+}
+#endif
+
+#define TICK_INTERVAL 10 /* ms */
+#define TICKS_BEFORE_ANSWER 5
+
+typedef struct {
+    GMainLoop *loop;
+    guint ticks;
+    gint response; /* given at TICKS_BEFORE_ANSWER, 0 to destroy the dialog */
+    guint calls;
+    guint ticks_at_call;
+    gboolean ok;
+    gchar *username;
+    gchar *password;
+} TestPrompt;
+
+static gboolean
+test_tick(gpointer opaque)
+{
+    TestPrompt *test = opaque;
+    GtkWidget *dialog;
+
+    if (++test->ticks < TICKS_BEFORE_ANSWER)
+        return TRUE;
+
+    g_assert_cmpuint(test->calls, ==, 0);
+    dialog = GTK_WIDGET(gtk_builder_get_object(test_builder, "auth"));
+    g_assert(gtk_widget_get_visible(dialog));
+    if (test->response == 0) {
+        gtk_widget_destroy(dialog);
+    } else {
+        gtk_entry_set_text(GTK_ENTRY(gtk_builder_get_object(test_builder, "cred-username")),
+                           "alice");
+        gtk_entry_set_text(GTK_ENTRY(gtk_builder_get_object(test_builder, "cred-password")),
+                           "secret");
+        gtk_dialog_response(GTK_DIALOG(dialog), test->response);
+    }
+
+    return FALSE;
+}
+
+static void
+test_callback(gboolean ok, const gchar *username, const gchar *password,
+              gpointer opaque)
+{
+    TestPrompt *test = opaque;
+
+    test->calls++;
+    test->ticks_at_call = test->ticks;
+    test->ok = ok;
+    test->username = g_strdup(username);
+    test->password = g_strdup(password);
+    if (test->loop)
+        g_main_loop_quit(test->loop);
+}
+
+static void
+test_prompt_run(TestPrompt *test, gboolean want_username)
+{
+    VirtViewerApp *app = g_object_new(VIRT_VIEWER_TYPE_APP, NULL);
+
+    test->loop = g_main_loop_new(NULL, FALSE);
+    g_timeout_add(TICK_INTERVAL, test_tick, test);
+    virt_viewer_auth_collect_credentials_async(app, "SPICE", "localhost:5900",
+                                               want_username, TRUE,
+                                               test_callback, test);
+    g_assert_cmpuint(test->calls, ==, 0);
+    g_main_loop_run(test->loop);
+
+    /* Nothing else may turn up */
+    while (g_main_context_iteration(NULL, FALSE));
+    g_assert_cmpuint(test->calls, ==, 1);
+    g_assert_cmpuint(test->ticks_at_call, ==, TICKS_BEFORE_ANSWER);
+
+    g_main_loop_unref(test->loop);
+    g_object_unref(app);
+}
+
+static void
+test_prompt_clear(TestPrompt *test)
+{
+    g_free(test->username);
+    g_free(test->password);
+}
+
+static void
+test_auth_async_ok(void)
+{
+    TestPrompt test = { .response = GTK_RESPONSE_OK };
+
+    test_prompt_run(&test, TRUE);
+    g_assert(test.ok);
+    g_assert_cmpstr(test.username, ==, "alice");
+    g_assert_cmpstr(test.password, ==, "secret");
+    test_prompt_clear(&test);
+}
+
+/* Only what was asked for comes back */
+static void
+test_auth_async_password_only(void)
+{
+    TestPrompt test = { .response = GTK_RESPONSE_OK };
+
+    test_prompt_run(&test, FALSE);
+    g_assert(test.ok);
+    g_assert(test.username == NULL);
+    g_assert_cmpstr(test.password, ==, "secret");
+    test_prompt_clear(&test);
+}
+
+static void
+test_auth_async_cancel(void)
+{
+    TestPrompt test = { .response = GTK_RESPONSE_CANCEL };
+
+    test_prompt_run(&test, TRUE);
+    g_assert(!test.ok);
+    g_assert(test.username == NULL);
+    g_assert(test.password == NULL);
+    test_prompt_clear(&test);
+}
+
+/* The dialog going away unanswered, with its parent for instance */
+static void
+test_auth_async_destroy(void)
+{
+    TestPrompt test = { .response = 0 };
+
+    test_prompt_run(&test, TRUE);
+    g_assert(!test.ok);
+    test_prompt_clear(&test);
+}
+
+/* The blocking variant runs a nested loop, sources keep dispatching */
+static void
+test_auth_blocking(void)
+{
+    VirtViewerApp *app = g_object_new(VIRT_VIEWER_TYPE_APP, NULL);
+    TestPrompt test = { .response = GTK_RESPONSE_OK };
+    gchar *username = NULL, *password = NULL;
+    gint ret;
+
+    g_timeout_add(TICK_INTERVAL, test_tick, &test);
+    ret = virt_viewer_auth_collect_credentials(app, "VNC", NULL, &username, &password);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert_cmpuint(test.ticks, ==, TICKS_BEFORE_ANSWER);
+    g_assert_cmpstr(username, ==, "alice");
+    g_assert_cmpstr(password, ==, "secret");
+
+    g_free(username);
+    g_free(password);
+    g_object_unref(app);
+}
+
+/* Nobody can answer: no dialog, the app quits, the prompt fails later */
+static void
+test_auth_headless(void)
+{
+    VirtViewerApp *app = g_object_new(VIRT_VIEWER_TYPE_APP, NULL);
+    TestPrompt test = { .loop = NULL };
+
+    test_headless = TRUE;
+    test_quit_status = -1;
+    test_builder = NULL;
+    virt_viewer_auth_collect_credentials_async(app, "SPICE", "localhost:5900",
+                                               TRUE, TRUE, test_callback, &test);
+    g_assert_cmpint(test_quit_status, ==, EXIT_FAILURE);
+    g_assert_cmpuint(test.calls, ==, 0);
+
+    while (g_main_context_iteration(NULL, FALSE));
+    g_assert_cmpuint(test.calls, ==, 1);
+    g_assert(!test.ok);
+    g_assert(test_builder == NULL);
+
+    test_headless = FALSE;
+    test_prompt_clear(&test);
+    g_object_unref(app);
+}
+
+int
+main(int argc, char **argv)
+{
+    gboolean display;
+
+#if !GLIB_CHECK_VERSION(2, 35, 0)
+    g_type_init();
+#endif
+    g_test_init(&argc, &argv, NULL);
+    display = gtk_init_check(&argc, &argv);
+
+    g_test_add_func("/auth/headless", test_auth_headless);
+    /* The dialog tests need a display */
+    if (display) {
+        g_test_add_func("/auth/async/ok", test_auth_async_ok);
+        g_test_add_func("/auth/async/password-only", test_auth_async_password_only);
+        g_test_add_func("/auth/async/cancel", test_auth_async_cancel);
+        g_test_add_func("/auth/async/destroy", test_auth_async_destroy);
+        g_test_add_func("/auth/blocking", test_auth_blocking);
+    }
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
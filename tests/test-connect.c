@@ -0,0 +1,404 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <gio/gio.h>
+
+#include "virt-viewer-connect.h"
+
+/*
+ * Direct TCP connections against loopback listeners. An address that
+ * drops connection requests is stood in for by a listener whose accept
+ * queue is full: nobody accepts from it, so further SYNs are dropped
+ * and connecting to it hangs like to a blackholed route.
+ */
+
+gboolean doDebug = FALSE;
+
+#define BLACKHOLE_MAX_CLIENTS 16
+#define BLACKHOLE_PROBE 100 /* ms */
+
+static socklen_t
+test_loopback_addr(int family, guint16 port, struct sockaddr_storage *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    if (family == AF_INET6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)addr;
+
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_addr = in6addr_loopback;
+        sin6->sin6_port = htons(port);
+        return sizeof(*sin6);
+    } else {
+        struct sockaddr_in *sin = (struct sockaddr_in *)addr;
+
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        sin->sin_port = htons(port);
+        return sizeof(*sin);
+    }
+}
+
+/* A loopback listener on *@port, any port if 0; -1 if it is taken */
+static int
+test_listen(int family, guint16 *port, int backlog)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = test_loopback_addr(family, *port, &addr);
+    int fd = socket(family, SOCK_STREAM, 0);
+    int on = 1;
+    int ret;
+
+    g_assert_cmpint(fd, >=, 0);
+    /* The other family may listen on the same port */
+    if (family == AF_INET6)
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&addr, addrlen) < 0) {
+        close(fd);
+        return -1;
+    }
+    ret = listen(fd, backlog);
+    g_assert_cmpint(ret, ==, 0);
+    ret = getsockname(fd, (struct sockaddr *)&addr, &addrlen);
+    g_assert_cmpint(ret, ==, 0);
+    if (family == AF_INET6)
+        *port = ntohs(((struct sockaddr_in6 *)&addr)->sin6_port);
+    else
+        *port = ntohs(((struct sockaddr_in *)&addr)->sin_port);
+
+    return fd;
+}
+
+/*
+ * Connects to the listener on @port until a connection hangs. Returns
+ * the clients, to be closed with test_blackhole_free(), or NULL if the
+ * kernel kept accepting them.
+ */
+static GSList *
+test_blackhole(int family, guint16 port)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen = test_loopback_addr(family, port, &addr);
+    GSList *clients = NULL, *l;
+    guint i;
+
+    for (i = 0; i < BLACKHOLE_MAX_CLIENTS; i++) {
+        struct pollfd pfd;
+        int fd = socket(family, SOCK_STREAM, 0);
+        int ret;
+
+        g_assert_cmpint(fd, >=, 0);
+        clients = g_slist_prepend(clients, GINT_TO_POINTER(fd));
+        ret = fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        g_assert_cmpint(ret, ==, 0);
+        if (connect(fd, (struct sockaddr *)&addr, addrlen) == 0)
+            continue;
+        g_assert_cmpint(errno, ==, EINPROGRESS);
+
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, BLACKHOLE_PROBE) == 0)
+            return clients;
+    }
+
+    for (l = clients; l; l = l->next)
+        close(GPOINTER_TO_INT(l->data));
+    g_slist_free(clients);
+
+    return NULL;
+}
+
+static void
+test_blackhole_free(GSList *clients)
+{
+    GSList *l;
+
+    for (l = clients; l; l = l->next)
+        close(GPOINTER_TO_INT(l->data));
+    g_slist_free(clients);
+}
+
+typedef struct {
+    GMainLoop *loop;
+    guint calls;
+    int fd;
+    GError *error;
+} TestConnect;
+
+static void
+test_connected(int fd, const GError *error, gpointer opaque)
+{
+    TestConnect *test = opaque;
+
+    test->calls++;
+    test->fd = fd;
+    test->error = error ? g_error_copy(error) : NULL;
+    g_main_loop_quit(test->loop);
+}
+
+/* Returns how long it took, in seconds */
+static gdouble
+test_connect_run(TestConnect *test, const gchar *host, guint16 port, guint timeout)
+{
+    gchar *portstr = g_strdup_printf("%u", port);
+
+    memset(test, 0, sizeof(*test));
+    test->fd = -1;
+    test->loop = g_main_loop_new(NULL, FALSE);
+
+    g_test_timer_start();
+    virt_viewer_connect_tcp_async(host, portstr, timeout, test_connected, test);
+    g_main_loop_run(test->loop);
+    g_assert_cmpuint(test->calls, ==, 1);
+
+    g_main_loop_unref(test->loop);
+    g_free(portstr);
+
+    return g_test_timer_elapsed();
+}
+
+static void
+test_connect_clear(TestConnect *test)
+{
+    if (test->fd >= 0)
+        close(test->fd);
+    g_clear_error(&test->error);
+}
+
+static void
+test_connect_parse_uri(void)
+{
+    static const struct {
+        const gchar *uri;
+        const gchar *host;
+        const gchar *port;
+    } tests[] = {
+        { "spice://example.com:5900", "example.com", "5900" },
+        { "spice://example.com/?port=5901", "example.com", "5901" },
+        { "vnc://192.168.0.1:5902", "192.168.0.1", "5902" },
+        { "vnc://[::1]:5903/", "::1", "5903" },
+        /* Left to the session */
+        { "spice://example.com?port=5900&tls-port=5901", NULL, NULL },
+        { "spice://example.com?tls-port=5901", NULL, NULL },
+        { "spice://example.com:5900?password=secret", NULL, NULL },
+        { "spice://user@example.com:5900", NULL, NULL },
+        { "vnc://example.com:5900/path", NULL, NULL },
+        { "vnc://example.com?port=5900", NULL, NULL },
+        { "vnc://example.com", NULL, NULL },
+        { "spice://example.com?port=", NULL, NULL },
+        { "spice://example.com?port=5900x", NULL, NULL },
+        { "spice://example.com?port=65536", NULL, NULL },
+        { "ovirt://example.com/vm", NULL, NULL },
+        { "example.com:5900", NULL, NULL },
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(tests); i++) {
+        gchar *host = NULL, *port = NULL;
+        gboolean ok = virt_viewer_connect_parse_uri(tests[i].uri, &host, &port);
+
+        g_test_message("%s", tests[i].uri);
+        g_assert_cmpint(ok, ==, tests[i].host != NULL);
+        g_assert_cmpstr(host, ==, tests[i].host);
+        g_assert_cmpstr(port, ==, tests[i].port);
+        g_free(host);
+        g_free(port);
+    }
+}
+
+static void
+test_connect_ipv4(void)
+{
+    TestConnect test;
+    guint16 port = 0;
+    int listener = test_listen(AF_INET, &port, 1);
+    int fd;
+
+    g_assert_cmpint(listener, >=, 0);
+    test_connect_run(&test, "127.0.0.1", port, 5);
+    g_assert_no_error(test.error);
+    g_assert_cmpint(test.fd, >=, 0);
+    fd = accept(listener, NULL, NULL);
+    g_assert_cmpint(fd, >=, 0);
+
+    close(fd);
+    close(listener);
+    test_connect_clear(&test);
+}
+
+static void
+test_connect_refused(void)
+{
+    TestConnect test;
+    guint16 port = 0;
+    int listener = test_listen(AF_INET, &port, 1);
+
+    /* Nothing listens on the port any more */
+    g_assert_cmpint(listener, >=, 0);
+    close(listener);
+
+    test_connect_run(&test, "127.0.0.1", port, 5);
+    g_assert_cmpint(test.fd, ==, -1);
+    g_assert(test.error != NULL);
+    g_assert(!g_error_matches(test.error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT));
+    test_connect_clear(&test);
+}
+
+static void
+test_connect_timeout(void)
+{
+    TestConnect test;
+    guint16 port = 0;
+    int listener = test_listen(AF_INET, &port, 0);
+    GSList *clients = test_blackhole(AF_INET, port);
+    gdouble elapsed;
+
+    if (!clients) {
+        g_test_message("Unable to fill the accept queue, skipping");
+        close(listener);
+        return;
+    }
+
+    elapsed = test_connect_run(&test, "127.0.0.1", port, 1);
+    g_assert_cmpint(test.fd, ==, -1);
+    g_assert_error(test.error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT);
+    g_assert_cmpfloat(elapsed, <, 5.0);
+
+    test_connect_clear(&test);
+    test_blackhole_free(clients);
+    close(listener);
+}
+
+/*
+ * "localhost" resolving to both ::1 and 127.0.0.1, the first family
+ * the resolver gives is blackholed: the other one must be tried after
+ * the attempt delay and win, long before the timeout.
+ */
+static void
+test_connect_fallback(gconstpointer data)
+{
+    int blackholed = GPOINTER_TO_INT(data);
+    int other = blackholed == AF_INET6 ? AF_INET : AF_INET6;
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    TestConnect test;
+    guint16 port = 0;
+    int hole, listener, fd, ret;
+    GSList *clients;
+    gdouble elapsed;
+
+    hole = test_listen(blackholed, &port, 0);
+    g_assert_cmpint(hole, >=, 0);
+    listener = test_listen(other, &port, 1);
+    clients = test_blackhole(blackholed, port);
+    if (listener < 0 || !clients) {
+        g_test_message("Unable to blackhole port %u, skipping", port);
+        test_blackhole_free(clients);
+        if (listener >= 0)
+            close(listener);
+        close(hole);
+        return;
+    }
+
+    elapsed = test_connect_run(&test, "localhost", port, 10);
+    g_assert_no_error(test.error);
+    g_assert_cmpint(test.fd, >=, 0);
+    g_assert_cmpfloat(elapsed, <, 5.0);
+    ret = getpeername(test.fd, (struct sockaddr *)&addr, &addrlen);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert_cmpint(addr.ss_family, ==, other);
+    fd = accept(listener, NULL, NULL);
+    g_assert_cmpint(fd, >=, 0);
+
+    close(fd);
+    test_connect_clear(&test);
+    test_blackhole_free(clients);
+    close(listener);
+    close(hole);
+}
+
+/* The family "localhost" resolves to first, if it also resolves to the other */
+static int
+test_localhost_dual_stack(void)
+{
+    GResolver *resolver = g_resolver_get_default();
+    GList *addresses = g_resolver_lookup_by_name(resolver, "localhost", NULL, NULL);
+    gboolean inet = FALSE, inet6 = FALSE;
+    int first = 0;
+    GList *l;
+
+    for (l = addresses; l; l = l->next) {
+        GSocketFamily family = g_inet_address_get_family(l->data);
+        int af = family == G_SOCKET_FAMILY_IPV6 ? AF_INET6 : AF_INET;
+
+        if (!first)
+            first = af;
+        if (af == AF_INET6)
+            inet6 = TRUE;
+        else
+            inet = TRUE;
+    }
+    g_resolver_free_addresses(addresses);
+    g_object_unref(resolver);
+
+    return inet && inet6 ? first : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int family;
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_thread_init(NULL);
+#endif
+#if !GLIB_CHECK_VERSION(2, 35, 0)
+    g_type_init();
+#endif
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/connect/parse-uri", test_connect_parse_uri);
+    g_test_add_func("/connect/ipv4", test_connect_ipv4);
+    g_test_add_func("/connect/refused", test_connect_refused);
+    g_test_add_func("/connect/timeout", test_connect_timeout);
+    /* Falling back needs a second address family */
+    if ((family = test_localhost_dual_stack()))
+        g_test_add_data_func("/connect/fallback", GINT_TO_POINTER(family),
+                             test_connect_fallback);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
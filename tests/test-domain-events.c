@@ -0,0 +1,177 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <libvirt/libvirt.h>
+#include <glib/gstdio.h>
+
+#include "virt-viewer-events.h"
+
+/*
+ * Lifecycle events on a host with OTHER_GUESTS guests besides the
+ * viewed one, dispatched through the event bridge. A subscription
+ * scoped to the viewed guest, as virt-viewer makes once it knows it,
+ * must not be called for any of the others; the connection-wide one
+ * it replaces is called for every single event.
+ */
+
+gboolean doDebug = FALSE;
+
+#define OTHER_GUESTS 5000
+#define VIEWED_GUEST "viewed"
+
+typedef struct {
+    guint viewed;
+    guint others;
+} TestCounts;
+
+static int
+lifecycle_cb(virConnectPtr conn G_GNUC_UNUSED,
+             virDomainPtr dom,
+             int event G_GNUC_UNUSED,
+             int detail G_GNUC_UNUSED,
+             void *opaque)
+{
+    TestCounts *counts = opaque;
+
+    if (g_str_equal(virDomainGetName(dom), VIEWED_GUEST))
+        counts->viewed++;
+    else
+        counts->others++;
+    return 0;
+}
+
+/* A test driver host description with the viewed guest last */
+static gchar *
+host_new(void)
+{
+    GString *xml = g_string_new("<node>\n");
+    gchar *path;
+    gboolean ok;
+    guint i;
+
+    for (i = 0; i <= OTHER_GUESTS; i++) {
+        g_string_append(xml, "  <domain type='test'>\n");
+        if (i < OTHER_GUESTS)
+            g_string_append_printf(xml, "    <name>guest%u</name>\n", i);
+        else
+            g_string_append(xml, "    <name>" VIEWED_GUEST "</name>\n");
+        g_string_append(xml,
+                        "    <memory>8192</memory>\n"
+                        "    <os><type>hvm</type></os>\n"
+                        "  </domain>\n");
+    }
+    g_string_append(xml, "</node>\n");
+
+    path = g_build_filename(g_get_tmp_dir(), "test-domain-events.xml", NULL);
+    ok = g_file_set_contents(path, xml->str, xml->len, NULL);
+    g_assert(ok);
+    g_string_free(xml, TRUE);
+
+    return path;
+}
+
+static void
+test_domain_events_scoped(void)
+{
+    TestCounts scoped = { 0, 0 }, all = { 0, 0 };
+    virConnectPtr conn;
+    virDomainPtr dom;
+    gchar *path = host_new();
+    gchar *uri = g_strdup_printf("test://%s", path);
+    int scoped_id, all_id, ret;
+    guint i;
+
+    if (!(conn = virConnectOpen(uri))) {
+        g_test_message("No libvirt test driver, skipping");
+        goto cleanup;
+    }
+    dom = virDomainLookupByName(conn, VIEWED_GUEST);
+    g_assert(dom != NULL);
+
+    scoped_id = virConnectDomainEventRegisterAny(conn, dom,
+                                                 VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                                 VIR_DOMAIN_EVENT_CALLBACK(lifecycle_cb),
+                                                 &scoped, NULL);
+    g_assert_cmpint(scoped_id, >=, 0);
+    all_id = virConnectDomainEventRegisterAny(conn, NULL,
+                                              VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                              VIR_DOMAIN_EVENT_CALLBACK(lifecycle_cb),
+                                              &all, NULL);
+    g_assert_cmpint(all_id, >=, 0);
+
+    for (i = 0; i < OTHER_GUESTS; i++) {
+        gchar *name = g_strdup_printf("guest%u", i);
+        virDomainPtr other = virDomainLookupByName(conn, name);
+
+        g_assert(other != NULL);
+        ret = virDomainSuspend(other);
+        g_assert_cmpint(ret, ==, 0);
+        ret = virDomainResume(other);
+        g_assert_cmpint(ret, ==, 0);
+        virDomainFree(other);
+        g_free(name);
+    }
+
+    /* Events arrive in order, this one comes last */
+    ret = virDomainSuspend(dom);
+    g_assert_cmpint(ret, ==, 0);
+    while (scoped.viewed == 0)
+        g_main_context_iteration(NULL, TRUE);
+
+    g_test_message("Scoped: %u calls for other guests, connection-wide: %u",
+                   scoped.others, all.others);
+    g_assert_cmpuint(scoped.viewed, ==, 1);
+    g_assert_cmpuint(scoped.others, ==, 0);
+    g_assert_cmpuint(all.viewed, ==, 1);
+    g_assert_cmpuint(all.others, ==, 2 * OTHER_GUESTS);
+
+    virConnectDomainEventDeregisterAny(conn, scoped_id);
+    virConnectDomainEventDeregisterAny(conn, all_id);
+    virDomainFree(dom);
+    virConnectClose(conn);
+
+ cleanup:
+    g_unlink(path);
+    g_free(uri);
+    g_free(path);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    virt_viewer_events_register(FALSE);
+
+    g_test_add_func("/domain-events/scoped", test_domain_events_scoped);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
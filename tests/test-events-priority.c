@@ -0,0 +1,200 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+#include <libvirt/libvirt.h>
+
+#include "virt-glib-compat.h"
+#include "virt-viewer-events.h"
+
+/*
+ * libvirt sources against a saturated main loop: a source that is
+ * always ready and takes LOAD_SLICE per dispatch stands in for input
+ * or redraws. Above it, a libvirt timer standing in for the keepalive
+ * must keep firing with bounded latency. Moved below it, through
+ * virt_viewer_events_set_priority(), it must not fire at all.
+ */
+
+gboolean doDebug = FALSE;
+
+#define TICK_INTERVAL 10 /* ms */
+#define MAX_LATENCY 50 /* ms, between ticks */
+#define LOAD_SLICE 1 /* ms */
+#define RUN_TIME 300 /* ms */
+
+/* Input and libvirt socket traffic, redraws, as GTK has them */
+#define PRIORITY_INPUT G_PRIORITY_DEFAULT
+#define PRIORITY_REDRAW (G_PRIORITY_HIGH_IDLE + 20)
+
+static guint dispatches;
+static gint64 last_dispatch;
+static gint64 max_gap;
+
+static void
+dispatch_count(void)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (last_dispatch && now - last_dispatch > max_gap)
+        max_gap = now - last_dispatch;
+    last_dispatch = now;
+    dispatches++;
+}
+
+static void
+dispatch_reset(void)
+{
+    dispatches = 0;
+    last_dispatch = 0;
+    max_gap = 0;
+}
+
+static void
+tick_cb(int timer G_GNUC_UNUSED, void *opaque G_GNUC_UNUSED)
+{
+    dispatch_count();
+}
+
+static void
+readable_cb(int watch G_GNUC_UNUSED, int fd G_GNUC_UNUSED,
+            int events G_GNUC_UNUSED, void *opaque G_GNUC_UNUSED)
+{
+    /* Not drained, the pipe stays readable */
+    dispatch_count();
+}
+
+static gboolean
+load_cb(gpointer opaque G_GNUC_UNUSED)
+{
+    g_usleep(LOAD_SLICE * 1000);
+    return TRUE;
+}
+
+static gboolean
+quit_cb(gpointer opaque)
+{
+    g_main_loop_quit(opaque);
+    return FALSE;
+}
+
+/* Runs the main loop for RUN_TIME with the load at @priority */
+static void
+run_saturated(gint priority)
+{
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    GSource *stop = g_timeout_source_new(RUN_TIME);
+    guint load = g_idle_add_full(priority, load_cb, NULL, NULL);
+
+    /* Above everything, or it would be starved as well */
+    g_source_set_priority(stop, G_PRIORITY_HIGH - 100);
+    g_source_set_callback(stop, quit_cb, loop, NULL);
+    g_source_attach(stop, NULL);
+
+    dispatch_reset();
+    g_main_loop_run(loop);
+
+    g_source_destroy(stop);
+    g_source_unref(stop);
+    g_source_remove(load);
+    g_main_loop_unref(loop);
+}
+
+static void
+test_events_priority_control(void)
+{
+    gint priority = virt_viewer_events_get_priority(VIRT_VIEWER_EVENTS_PRIORITY_CONTROL);
+    int timer = virEventAddTimeout(TICK_INTERVAL, tick_cb, NULL, NULL);
+    int ret;
+
+    g_assert_cmpint(timer, >, 0);
+    g_assert_cmpint(priority, <, PRIORITY_INPUT);
+
+    run_saturated(PRIORITY_INPUT);
+    g_test_message("%u ticks, longest gap %" G_GINT64_FORMAT " ms",
+                   dispatches, max_gap / 1000);
+    g_assert_cmpuint(dispatches, >=, RUN_TIME / TICK_INTERVAL / 2);
+    g_assert_cmpint(max_gap / 1000, <, MAX_LATENCY);
+
+    /* Applies to the running timer too */
+    virt_viewer_events_set_priority(VIRT_VIEWER_EVENTS_PRIORITY_CONTROL, G_PRIORITY_LOW);
+    run_saturated(PRIORITY_INPUT);
+    g_assert_cmpuint(dispatches, ==, 0);
+
+    virt_viewer_events_set_priority(VIRT_VIEWER_EVENTS_PRIORITY_CONTROL, priority);
+    run_saturated(PRIORITY_INPUT);
+    g_assert_cmpuint(dispatches, >, 0);
+
+    ret = virEventRemoveTimeout(timer);
+    g_assert_cmpint(ret, ==, 0);
+}
+
+static void
+test_events_priority_io(void)
+{
+    gint priority = virt_viewer_events_get_priority(VIRT_VIEWER_EVENTS_PRIORITY_IO);
+    int fds[2];
+    int watch, ret;
+
+    ret = pipe(fds);
+    g_assert_cmpint(ret, ==, 0);
+    ret = write(fds[1], "x", 1);
+    g_assert_cmpint(ret, ==, 1);
+    watch = virEventAddHandle(fds[0], VIR_EVENT_HANDLE_READABLE, readable_cb, NULL, NULL);
+    g_assert_cmpint(watch, >, 0);
+    g_assert_cmpint(priority, <, PRIORITY_REDRAW);
+
+    run_saturated(PRIORITY_REDRAW);
+    g_assert_cmpuint(dispatches, >, 0);
+    g_assert_cmpint(max_gap / 1000, <, MAX_LATENCY);
+
+    virt_viewer_events_set_priority(VIRT_VIEWER_EVENTS_PRIORITY_IO, G_PRIORITY_LOW);
+    run_saturated(PRIORITY_REDRAW);
+    g_assert_cmpuint(dispatches, ==, 0);
+
+    virt_viewer_events_set_priority(VIRT_VIEWER_EVENTS_PRIORITY_IO, priority);
+    ret = virEventRemoveHandle(watch);
+    g_assert_cmpint(ret, ==, 0);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    virt_viewer_events_register(FALSE);
+
+    g_test_add_func("/events/priority/control", test_events_priority_control);
+    g_test_add_func("/events/priority/io", test_events_priority_io);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
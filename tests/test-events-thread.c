@@ -0,0 +1,200 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <libvirt/libvirt.h>
+
+#include "virt-glib-compat.h"
+#include "virt-viewer-events.h"
+
+/*
+ * With --event-thread, libvirt timers and domain events keep being
+ * dispatched while the main loop is stuck. The main thread here never
+ * iterates its loop during a test. The test driver has no keepalive,
+ * a libvirt timer firing every TICK_INTERVAL stands in for it and
+ * must never go quiet for KEEPALIVE_GAP.
+ */
+
+gboolean doDebug = FALSE;
+
+#define TICK_INTERVAL 10 /* ms */
+#define KEEPALIVE_GAP 250 /* ms */
+#define BUSY_TIME 500 /* ms */
+#define FLOOD_CYCLES 200 /* suspend/resume pairs */
+#define FLOOD_TIMEOUT 5000 /* ms */
+
+static GThread *main_thread;
+
+/* Written from the event thread */
+G_LOCK_DEFINE_STATIC(ticks);
+static guint ticks;
+static gint64 last_tick;
+static gint64 max_gap;
+static gboolean tick_on_main_thread;
+
+static void
+tick_cb(int timer G_GNUC_UNUSED, void *opaque G_GNUC_UNUSED)
+{
+    gint64 now = g_get_monotonic_time();
+
+    G_LOCK(ticks);
+    if (last_tick && now - last_tick > max_gap)
+        max_gap = now - last_tick;
+    last_tick = now;
+    ticks++;
+    if (g_thread_self() == main_thread)
+        tick_on_main_thread = TRUE;
+    G_UNLOCK(ticks);
+}
+
+static int
+tick_start(void)
+{
+    int timer;
+
+    G_LOCK(ticks);
+    ticks = 0;
+    last_tick = 0;
+    max_gap = 0;
+    tick_on_main_thread = FALSE;
+    G_UNLOCK(ticks);
+
+    timer = virEventAddTimeout(TICK_INTERVAL, tick_cb, NULL, NULL);
+    g_assert_cmpint(timer, >, 0);
+
+    return timer;
+}
+
+static void
+tick_stop(int timer)
+{
+    int ret = virEventRemoveTimeout(timer);
+
+    g_assert_cmpint(ret, ==, 0);
+
+    G_LOCK(ticks);
+    g_test_message("%u ticks, longest gap %" G_GINT64_FORMAT " ms",
+                   ticks, max_gap / 1000);
+    g_assert(!tick_on_main_thread);
+    g_assert_cmpuint(ticks, >, 0);
+    g_assert_cmpint(max_gap / 1000, <, KEEPALIVE_GAP);
+    G_UNLOCK(ticks);
+}
+
+/* The main thread is busy, not running its loop at all */
+static void
+test_events_thread_busy(void)
+{
+    int timer = tick_start();
+
+    g_usleep(BUSY_TIME * 1000);
+
+    G_LOCK(ticks);
+    g_assert_cmpuint(ticks, >=, BUSY_TIME / TICK_INTERVAL / 4);
+    G_UNLOCK(ticks);
+    tick_stop(timer);
+}
+
+static gint lifecycle_events;
+static gboolean lifecycle_on_main_thread;
+
+static int
+lifecycle_cb(virConnectPtr conn G_GNUC_UNUSED,
+             virDomainPtr dom G_GNUC_UNUSED,
+             int event G_GNUC_UNUSED,
+             int detail G_GNUC_UNUSED,
+             void *opaque G_GNUC_UNUSED)
+{
+    if (g_thread_self() == main_thread)
+        lifecycle_on_main_thread = TRUE;
+    g_atomic_int_inc(&lifecycle_events);
+    return 0;
+}
+
+/* Domain events flood in from the test driver meanwhile */
+static void
+test_events_thread_flood(void)
+{
+    virConnectPtr conn;
+    virDomainPtr dom;
+    gint64 deadline;
+    int timer, callback, ret;
+    guint i;
+
+    if (!(conn = virConnectOpen("test:///default"))) {
+        g_test_message("No libvirt test driver, skipping");
+        return;
+    }
+    dom = virDomainLookupByName(conn, "test");
+    g_assert(dom != NULL);
+    callback = virConnectDomainEventRegisterAny(conn, NULL,
+                                                VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                                VIR_DOMAIN_EVENT_CALLBACK(lifecycle_cb),
+                                                NULL, NULL);
+    g_assert_cmpint(callback, >=, 0);
+
+    timer = tick_start();
+    for (i = 0; i < FLOOD_CYCLES; i++) {
+        ret = virDomainSuspend(dom);
+        g_assert_cmpint(ret, ==, 0);
+        ret = virDomainResume(dom);
+        g_assert_cmpint(ret, ==, 0);
+    }
+
+    deadline = g_get_monotonic_time() + FLOOD_TIMEOUT * 1000;
+    while (g_atomic_int_get(&lifecycle_events) < 2 * FLOOD_CYCLES &&
+           g_get_monotonic_time() < deadline)
+        g_usleep(TICK_INTERVAL * 1000);
+    g_assert_cmpint(g_atomic_int_get(&lifecycle_events), ==, 2 * FLOOD_CYCLES);
+    g_assert(!lifecycle_on_main_thread);
+    tick_stop(timer);
+
+    virConnectDomainEventDeregisterAny(conn, callback);
+    virDomainFree(dom);
+    virConnectClose(conn);
+}
+
+int
+main(int argc, char **argv)
+{
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_thread_init(NULL);
+#endif
+    g_test_init(&argc, &argv, NULL);
+
+    main_thread = g_thread_self();
+    virt_viewer_events_register(TRUE);
+    g_assert(virt_viewer_events_is_threaded());
+
+    g_test_add_func("/events/thread/busy", test_events_thread_busy);
+    g_test_add_func("/events/thread/flood", test_events_thread_flood);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,413 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+
+#include "virt-glib-compat.h"
+
+/*
+ * remote-viewer --headless --capture-dir against a minimal RFB server,
+ * which serves a single 64x48 frame with the raw encoding and no
+ * authentication. A capture of it must turn up in the directory.
+ */
+
+#define REMOTE_VIEWER TOP_BUILDDIR "/src/remote-viewer"
+#define FRAME_WIDTH 64
+#define FRAME_HEIGHT 48
+#define CAPTURE_TIMEOUT 30 /* s */
+
+static gboolean
+rfb_read(int fd, void *buf, gsize len)
+{
+    guint8 *p = buf;
+
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        p += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+rfb_write(int fd, const void *buf, gsize len)
+{
+    const guint8 *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        p += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+rfb_skip(int fd, gsize len)
+{
+    guint8 buf[256];
+
+    while (len > 0) {
+        gsize n = MIN(len, sizeof(buf));
+        if (!rfb_read(fd, buf, n))
+            return FALSE;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+static void
+put_be16(guint8 *p, guint16 v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void
+put_be32(guint8 *p, guint32 v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* A full frame of vertical stripes, in the client's pixel format */
+static gboolean
+rfb_send_frame(int fd, guint bytes_per_pixel)
+{
+    guint8 header[16];
+    guint8 *pixels;
+    gsize len = (gsize)FRAME_WIDTH * FRAME_HEIGHT * bytes_per_pixel;
+    gsize i;
+    gboolean ret;
+
+    header[0] = 0; /* FramebufferUpdate */
+    header[1] = 0;
+    put_be16(header + 2, 1);
+    put_be16(header + 4, 0);
+    put_be16(header + 6, 0);
+    put_be16(header + 8, FRAME_WIDTH);
+    put_be16(header + 10, FRAME_HEIGHT);
+    put_be32(header + 12, 0); /* raw */
+
+    pixels = g_malloc(len);
+    for (i = 0; i < len; i++)
+        pixels[i] = (i / bytes_per_pixel) % 8 < 4 ? 0xff : 0x00;
+    ret = rfb_write(fd, header, sizeof(header)) && rfb_write(fd, pixels, len);
+    g_free(pixels);
+
+    return ret;
+}
+
+static void
+rfb_serve(int fd)
+{
+    static const guint8 security[] = { 1, 1 }; /* one type, None */
+    static const guint8 result[] = { 0, 0, 0, 0 };
+    guint8 version[12], buf[32], init[24 + 4] = { 0 };
+    guint bytes_per_pixel = 4;
+
+    if (!rfb_write(fd, "RFB 003.008\n", 12) ||
+        !rfb_read(fd, version, sizeof(version)) ||
+        !rfb_write(fd, security, sizeof(security)) ||
+        !rfb_read(fd, buf, 1) ||
+        !rfb_write(fd, result, sizeof(result)) ||
+        !rfb_read(fd, buf, 1)) /* ClientInit */
+        return;
+
+    put_be16(init, FRAME_WIDTH);
+    put_be16(init + 2, FRAME_HEIGHT);
+    init[4] = 32;   /* bits per pixel */
+    init[5] = 24;   /* depth */
+    init[6] = 0;    /* little endian */
+    init[7] = 1;    /* true color */
+    put_be16(init + 8, 255);
+    put_be16(init + 10, 255);
+    put_be16(init + 12, 255);
+    init[14] = 16;
+    init[15] = 8;
+    init[16] = 0;
+    put_be32(init + 20, 4);
+    memcpy(init + 24, "test", 4);
+    if (!rfb_write(fd, init, sizeof(init)))
+        return;
+
+    for (;;) {
+        if (!rfb_read(fd, buf, 1))
+            return;
+
+        switch (buf[0]) {
+        case 0: /* SetPixelFormat */
+            if (!rfb_read(fd, buf, 19))
+                return;
+            bytes_per_pixel = MAX(buf[3] / 8, 1);
+            break;
+        case 2: /* SetEncodings */
+            if (!rfb_read(fd, buf, 3) ||
+                !rfb_skip(fd, 4 * (((guint)buf[1] << 8) | buf[2])))
+                return;
+            break;
+        case 3: /* FramebufferUpdateRequest */
+            if (!rfb_read(fd, buf, 9))
+                return;
+            /* Nothing ever changes, incremental requests are left be */
+            if (!buf[0] && !rfb_send_frame(fd, bytes_per_pixel))
+                return;
+            break;
+        case 4: /* KeyEvent */
+            if (!rfb_skip(fd, 7))
+                return;
+            break;
+        case 5: /* PointerEvent */
+            if (!rfb_skip(fd, 5))
+                return;
+            break;
+        case 6: /* ClientCutText */
+            if (!rfb_read(fd, buf, 7) ||
+                !rfb_skip(fd, ((guint32)buf[3] << 24) | ((guint32)buf[4] << 16) |
+                          ((guint32)buf[5] << 8) | buf[6]))
+                return;
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+static gpointer
+rfb_thread(gpointer opaque)
+{
+    int listener = GPOINTER_TO_INT(opaque);
+    int fd;
+
+    /* Serve connections one after the other until the test is over */
+    while ((fd = accept(listener, NULL, NULL)) >= 0) {
+        rfb_serve(fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static int
+rfb_listen(guint16 *port)
+{
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int ret;
+
+    g_assert_cmpint(fd, >=, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ret = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    g_assert_cmpint(ret, ==, 0);
+    ret = listen(fd, 1);
+    g_assert_cmpint(ret, ==, 0);
+    ret = getsockname(fd, (struct sockaddr *)&addr, &addrlen);
+    g_assert_cmpint(ret, ==, 0);
+    *port = ntohs(addr.sin_port);
+
+    return fd;
+}
+
+/* The path of the first capture in @dir, or NULL */
+static gchar *
+find_capture(const gchar *dir)
+{
+    GDir *d = g_dir_open(dir, 0, NULL);
+    const gchar *name;
+    gchar *path = NULL;
+
+    if (d == NULL)
+        return NULL;
+    while (path == NULL && (name = g_dir_read_name(d)) != NULL) {
+        if (g_str_has_prefix(name, "display") && g_str_has_suffix(name, ".ppm"))
+            path = g_build_filename(dir, name, NULL);
+    }
+    g_dir_close(d);
+
+    return path;
+}
+
+static void
+remove_dir(const gchar *dir)
+{
+    GDir *d = g_dir_open(dir, 0, NULL);
+    const gchar *name;
+
+    if (d != NULL) {
+        while ((name = g_dir_read_name(d)) != NULL) {
+            gchar *path = g_build_filename(dir, name, NULL);
+            g_unlink(path);
+            g_free(path);
+        }
+        g_dir_close(d);
+    }
+    g_rmdir(dir);
+}
+
+static void
+test_headless_capture(void)
+{
+    gchar *dir, *uri, *path = NULL, *contents = NULL, *header;
+    gchar *argv[] = { (gchar *)REMOTE_VIEWER, (gchar *)"--headless",
+                      (gchar *)"--capture-dir", NULL,
+                      (gchar *)"--capture-interval", (gchar *)"1",
+                      (gchar *)"--capture-format", (gchar *)"ppm",
+                      NULL, NULL };
+    GError *error = NULL;
+    GThread *thread;
+    GPid pid;
+    gsize length;
+    guint16 port;
+    gint i, listener, status;
+    gchar *created;
+    gboolean ok;
+    pid_t ret;
+
+    listener = rfb_listen(&port);
+    thread = g_thread_new("rfb", rfb_thread, GINT_TO_POINTER(listener));
+
+    dir = g_build_filename(g_get_tmp_dir(), "test-headless-capture-XXXXXX", NULL);
+    created = mkdtemp(dir);
+    g_assert(created != NULL);
+    uri = g_strdup_printf("vnc://127.0.0.1:%u", port);
+    argv[3] = dir;
+    argv[8] = uri;
+
+    g_spawn_async(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &pid, &error);
+    g_assert_no_error(error);
+
+    for (i = 0; i < CAPTURE_TIMEOUT * 10 && path == NULL; i++) {
+        g_usleep(G_USEC_PER_SEC / 10);
+        path = find_capture(dir);
+    }
+
+    kill(pid, SIGTERM);
+    ret = waitpid(pid, &status, 0);
+    g_assert_cmpint(ret, ==, pid);
+    g_spawn_close_pid(pid);
+
+    g_assert(path != NULL);
+    /* The file may still be being written when it is first seen */
+    header = g_strdup_printf("P6\n%d %d\n255\n", FRAME_WIDTH, FRAME_HEIGHT);
+    for (i = 0; i < 50; i++) {
+        g_free(contents);
+        ok = g_file_get_contents(path, &contents, &length, NULL);
+        g_assert(ok);
+        if (length >= strlen(header) + FRAME_WIDTH * FRAME_HEIGHT * 3)
+            break;
+        g_usleep(G_USEC_PER_SEC / 10);
+    }
+    g_assert_cmpuint(length, ==, strlen(header) + FRAME_WIDTH * FRAME_HEIGHT * 3);
+    g_assert(memcmp(contents, header, strlen(header)) == 0);
+    /* The stripes: four white pixels then four black ones */
+    g_assert_cmpint((guchar)contents[strlen(header)], ==, 0xff);
+    g_assert_cmpint((guchar)contents[strlen(header) + 4 * 3], ==, 0x00);
+
+    /* Wakes the server thread up from accept() */
+    shutdown(listener, SHUT_RDWR);
+    close(listener);
+    g_thread_unref(thread);
+
+    remove_dir(dir);
+    g_free(header);
+    g_free(contents);
+    g_free(path);
+    g_free(uri);
+    g_free(dir);
+}
+
+/* A format nothing can write is refused before connecting */
+static void
+test_headless_capture_bad_format(void)
+{
+    gchar *argv[] = { (gchar *)REMOTE_VIEWER, (gchar *)"--headless",
+                      (gchar *)"--capture-dir", (gchar *)"unused",
+                      (gchar *)"--capture-format", (gchar *)"foo",
+                      (gchar *)"vnc://127.0.0.1:1", NULL };
+    gchar *err = NULL;
+    GError *error = NULL;
+    gint status;
+
+    g_spawn_sync(NULL, argv, NULL, G_SPAWN_STDOUT_TO_DEV_NULL,
+                 NULL, NULL, NULL, &err, &status, &error);
+    g_assert_no_error(error);
+    g_assert(!WIFEXITED(status) || WEXITSTATUS(status) != 0);
+    g_assert(strstr(err, "Unknown capture format: foo") != NULL);
+    g_assert(!g_file_test("unused", G_FILE_TEST_EXISTS));
+
+    g_free(err);
+}
+
+int
+main(int argc, char **argv)
+{
+    gboolean display;
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+    g_thread_init(NULL);
+#endif
+    g_test_init(&argc, &argv, NULL);
+    display = gtk_init_check(&argc, &argv);
+    signal(SIGPIPE, SIG_IGN);
+
+    g_test_add_func("/headless-capture/bad-format", test_headless_capture_bad_format);
+    /* remote-viewer needs a display even when it shows nothing */
+    if (display)
+        g_test_add_func("/headless-capture/vnc", test_headless_capture);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,136 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <gtk/gtk.h>
+#include <glib/gstdio.h>
+
+/*
+ * virt-viewer against a libvirt that takes CONNECT_DELAY to answer:
+ * the "ext" transport runs a stand-in that only sleeps. The main loop
+ * watchdog reports on standard error any stall longer than a quarter
+ * of the delay, there must be none while the connection is pending.
+ */
+
+#define VIRT_VIEWER TOP_BUILDDIR "/src/virt-viewer"
+#define CONNECT_DELAY 3 /* s */
+#define OBSERVE_TIME 2 /* s, while still connecting */
+#define WATCHDOG_THRESHOLD "750" /* ms */
+
+static gchar *
+read_all(int fd)
+{
+    GString *str = g_string_new(NULL);
+    gchar buf[1024];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            break;
+        g_string_append_len(str, buf, n);
+    }
+
+    return g_string_free(str, FALSE);
+}
+
+static void
+test_initial_connect_responsive(void)
+{
+    gchar *dir, *standin, *marker, *script, *uri, *log;
+    gchar *argv[] = { (gchar *)VIRT_VIEWER,
+                      (gchar *)"--main-loop-watchdog", (gchar *)WATCHDOG_THRESHOLD,
+                      (gchar *)"--connect", NULL, (gchar *)"test", NULL };
+    GError *error = NULL;
+    GPid pid;
+    gint errfd, status;
+    gchar *created;
+    gboolean ok;
+    pid_t ret;
+
+    dir = g_build_filename(g_get_tmp_dir(), "test-initial-connect-XXXXXX", NULL);
+    created = mkdtemp(dir);
+    g_assert(created != NULL);
+    standin = g_build_filename(dir, "libvirt", NULL);
+    marker = g_build_filename(dir, "connecting", NULL);
+    script = g_strdup_printf("#!/bin/sh\ntouch '%s'\nexec sleep %d\n", marker, CONNECT_DELAY);
+    ok = g_file_set_contents(standin, script, -1, NULL);
+    g_assert(ok);
+    g_chmod(standin, 0700);
+    uri = g_strdup_printf("test+ext:///default?command=%s", standin);
+    argv[4] = uri;
+
+    g_spawn_async_with_pipes(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD,
+                             NULL, NULL, &pid, NULL, NULL, &errfd, &error);
+    g_assert_no_error(error);
+
+    g_usleep(OBSERVE_TIME * G_USEC_PER_SEC);
+    kill(pid, SIGTERM);
+    log = read_all(errfd);
+    close(errfd);
+    ret = waitpid(pid, &status, 0);
+    g_assert_cmpint(ret, ==, pid);
+    g_spawn_close_pid(pid);
+
+    /* The connection was pending all along */
+    g_assert(g_file_test(marker, G_FILE_TEST_EXISTS));
+    g_test_message("%s", log);
+    g_assert(strstr(log, "Main loop blocked") == NULL);
+
+    g_unlink(marker);
+    g_unlink(standin);
+    g_rmdir(dir);
+    g_free(log);
+    g_free(uri);
+    g_free(script);
+    g_free(marker);
+    g_free(standin);
+    g_free(dir);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    /* virt-viewer needs a display */
+    if (gtk_init_check(&argc, &argv))
+        g_test_add_func("/initial-connect/responsive", test_initial_connect_responsive);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
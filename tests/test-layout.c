@@ -0,0 +1,343 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "virt-viewer-layout.h"
+
+static void
+rect_set(GdkRectangle *rect, gint x, gint y, gint width, gint height)
+{
+    rect->x = x;
+    rect->y = y;
+    rect->width = width;
+    rect->height = height;
+}
+
+static void
+set_preferred(VirtViewerLayout *layout, guint nth,
+              gint x, gint y, gint width, gint height)
+{
+    GdkRectangle rect;
+
+    rect_set(&rect, x, y, width, height);
+    virt_viewer_layout_set_preferred(layout, nth, &rect);
+}
+
+static const VirtViewerLayoutMonitor *
+find_change(const VirtViewerLayoutMonitor *changes, guint nchanges, guint nth)
+{
+    guint i;
+
+    for (i = 0; i < nchanges; i++) {
+        if (changes[i].nth == nth)
+            return &changes[i];
+    }
+
+    return NULL;
+}
+
+static void
+assert_change(const VirtViewerLayoutMonitor *changes, guint nchanges, guint nth,
+              gint x, gint y, gint width, gint height)
+{
+    const VirtViewerLayoutMonitor *change = find_change(changes, nchanges, nth);
+
+    g_assert(change != NULL);
+    g_assert_cmpint(change->geometry.x, ==, x);
+    g_assert_cmpint(change->geometry.y, ==, y);
+    g_assert_cmpint(change->geometry.width, ==, width);
+    g_assert_cmpint(change->geometry.height, ==, height);
+}
+
+static void
+assert_applied(VirtViewerLayout *layout, guint nth,
+               gint x, gint y, gint width, gint height)
+{
+    GdkRectangle rect;
+    gboolean applied;
+
+    applied = virt_viewer_layout_get_applied(layout, nth, &rect);
+    g_assert(applied);
+    g_assert_cmpint(rect.x, ==, x);
+    g_assert_cmpint(rect.y, ==, y);
+    g_assert_cmpint(rect.width, ==, width);
+    g_assert_cmpint(rect.height, ==, height);
+}
+
+/* Four monitors in a square, with the client's offsets and gaps */
+static void
+test_layout_grid(void)
+{
+    VirtViewerLayout *layout = virt_viewer_layout_new();
+    const VirtViewerLayoutMonitor *changes;
+    guint nchanges;
+
+    set_preferred(layout, 0, 100, 100, 800, 600);
+    set_preferred(layout, 1, 920, 100, 1024, 768);
+    set_preferred(layout, 2, 100, 880, 800, 600);
+    set_preferred(layout, 3, 920, 880, 640, 480);
+
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 4);
+    assert_change(changes, nchanges, 0, 0, 0, 800, 600);
+    assert_change(changes, nchanges, 1, 800, 0, 1024, 768);
+    /* The second row starts below the tallest monitor of the first */
+    assert_change(changes, nchanges, 2, 0, 768, 800, 600);
+    assert_change(changes, nchanges, 3, 800, 768, 640, 480);
+
+    /* Unaligned, the client geometry goes through as is */
+    changes = virt_viewer_layout_update(layout, FALSE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 4);
+    assert_change(changes, nchanges, 0, 100, 100, 800, 600);
+    assert_change(changes, nchanges, 3, 920, 880, 640, 480);
+
+    virt_viewer_layout_free(layout);
+}
+
+/* Windows side by side at different heights still make a single row */
+static void
+test_layout_row(void)
+{
+    VirtViewerLayout *layout = virt_viewer_layout_new();
+    const VirtViewerLayoutMonitor *changes;
+    guint nchanges;
+
+    /* Given out of order, with a gap and an overlap */
+    set_preferred(layout, 0, 1900, 40, 800, 600);
+    set_preferred(layout, 1, 0, 0, 1024, 768);
+    set_preferred(layout, 2, 1000, 200, 640, 480);
+
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 3);
+    assert_change(changes, nchanges, 1, 0, 0, 1024, 768);
+    assert_change(changes, nchanges, 2, 1024, 0, 640, 480);
+    assert_change(changes, nchanges, 0, 1664, 0, 800, 600);
+
+    virt_viewer_layout_free(layout);
+}
+
+static void
+test_layout_disabled(void)
+{
+    VirtViewerLayout *layout = virt_viewer_layout_new();
+    const VirtViewerLayoutMonitor *changes;
+    guint nchanges;
+
+    set_preferred(layout, 0, 0, 0, 800, 600);
+    set_preferred(layout, 1, 0, 0, 0, 0);
+    set_preferred(layout, 2, 800, 0, 800, 600);
+    /* Monitor 3 is never set, only the highest one in use matters */
+
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 3);
+    assert_change(changes, nchanges, 0, 0, 0, 800, 600);
+    /* Disabled ones are reported as empty, and take no room */
+    assert_change(changes, nchanges, 1, 0, 0, 0, 0);
+    assert_change(changes, nchanges, 2, 800, 0, 800, 600);
+    g_assert(find_change(changes, nchanges, 3) == NULL);
+
+    set_preferred(layout, 1, 800, 0, 640, 480);
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 2);
+    assert_change(changes, nchanges, 1, 800, 0, 640, 480);
+    assert_change(changes, nchanges, 2, 1440, 0, 800, 600);
+
+    set_preferred(layout, 1, 0, 0, 0, 0);
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 2);
+    assert_change(changes, nchanges, 1, 0, 0, 0, 0);
+    assert_change(changes, nchanges, 2, 800, 0, 800, 600);
+
+    virt_viewer_layout_free(layout);
+}
+
+static void
+test_layout_removed(void)
+{
+    VirtViewerLayout *layout = virt_viewer_layout_new();
+    const VirtViewerLayoutMonitor *changes;
+    GdkRectangle rect;
+    gboolean applied;
+    guint nchanges;
+
+    set_preferred(layout, 0, 0, 0, 800, 600);
+    set_preferred(layout, 1, 800, 0, 800, 600);
+    set_preferred(layout, 2, 1600, 0, 800, 600);
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 3);
+
+    virt_viewer_layout_remove(layout, 1);
+    applied = virt_viewer_layout_get_applied(layout, 1, &rect);
+    g_assert(!applied);
+
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 2);
+    assert_change(changes, nchanges, 1, 0, 0, 0, 0);
+    assert_change(changes, nchanges, 2, 800, 0, 800, 600);
+
+    /* Removing one that isn't there is a no-op */
+    virt_viewer_layout_remove(layout, 1);
+    virt_viewer_layout_remove(layout, 42);
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 0);
+
+    virt_viewer_layout_free(layout);
+}
+
+/* Repeated updates only report what changed since */
+static void
+test_layout_minimal_diff(void)
+{
+    VirtViewerLayout *layout = virt_viewer_layout_new();
+    const VirtViewerLayoutMonitor *changes;
+    guint nchanges;
+
+    set_preferred(layout, 0, 0, 0, 800, 600);
+    set_preferred(layout, 1, 800, 0, 800, 600);
+    set_preferred(layout, 2, 0, 600, 800, 600);
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 3);
+
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 0);
+
+    /* Setting the same geometry again changes nothing */
+    set_preferred(layout, 1, 800, 0, 800, 600);
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 0);
+
+    /* Moving the window alone is absorbed by aligning */
+    set_preferred(layout, 1, 850, 0, 800, 600);
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 0);
+
+    /* Resizing the last of a row leaves the others be */
+    set_preferred(layout, 1, 850, 0, 1024, 600);
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 1);
+    assert_change(changes, nchanges, 1, 800, 0, 1024, 600);
+    assert_applied(layout, 1, 800, 0, 1024, 600);
+
+    /* Making the first row taller moves the second one down */
+    set_preferred(layout, 0, 0, 0, 800, 700);
+    set_preferred(layout, 2, 0, 700, 800, 600);
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 2);
+    assert_change(changes, nchanges, 0, 0, 0, 800, 700);
+    assert_change(changes, nchanges, 2, 0, 700, 800, 600);
+
+    virt_viewer_layout_free(layout);
+}
+
+static void
+test_layout_forget_applied(void)
+{
+    VirtViewerLayout *layout = virt_viewer_layout_new();
+    const VirtViewerLayoutMonitor *changes;
+    GdkRectangle rect;
+    gboolean applied;
+    guint nchanges;
+
+    set_preferred(layout, 0, 0, 0, 800, 600);
+    set_preferred(layout, 1, 800, 0, 640, 480);
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 2);
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 0);
+
+    virt_viewer_layout_forget_applied(layout);
+    applied = virt_viewer_layout_get_applied(layout, 0, &rect);
+    g_assert(!applied);
+    applied = virt_viewer_layout_get_applied(layout, 1, &rect);
+    g_assert(!applied);
+
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, 2);
+    assert_change(changes, nchanges, 0, 0, 0, 800, 600);
+    assert_change(changes, nchanges, 1, 800, 0, 640, 480);
+    assert_applied(layout, 1, 800, 0, 640, 480);
+
+    virt_viewer_layout_free(layout);
+}
+
+#define N_HEADS 16
+#define N_UPDATES 10000
+
+/* A window resized on a 4x4 wall of heads, as fast as the client goes */
+static void
+test_layout_16_heads(void)
+{
+    VirtViewerLayout *layout = virt_viewer_layout_new();
+    const VirtViewerLayoutMonitor *changes;
+    guint nchanges, i;
+    gdouble elapsed;
+
+    for (i = 0; i < N_HEADS; i++)
+        set_preferred(layout, i, (i % 4) * 1920, (i / 4) * 1080, 1920, 1080);
+    changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+    g_assert_cmpuint(nchanges, ==, N_HEADS);
+    assert_change(changes, nchanges, 15, 3 * 1920, 3 * 1080, 1920, 1080);
+
+    g_test_timer_start();
+    for (i = 0; i < N_UPDATES; i++) {
+        set_preferred(layout, 5, 1920, 1080, 1920 + 8 * ((i + 1) % 2), 1080);
+        changes = virt_viewer_layout_update(layout, TRUE, &nchanges);
+        /* Head 5 and the two right of it in its row */
+        g_assert_cmpuint(nchanges, ==, 3);
+        g_assert(find_change(changes, nchanges, 4) == NULL);
+        g_assert(find_change(changes, nchanges, 9) == NULL);
+    }
+    elapsed = g_test_timer_elapsed();
+
+    assert_applied(layout, 7, 3 * 1920, 1080, 1920, 1080);
+    g_test_message("%d updates of %d heads in %.3f s", N_UPDATES, N_HEADS, elapsed);
+    /* Way above what it takes, this only catches going quadratic or worse */
+    g_assert_cmpfloat(elapsed, <, 5.0);
+
+    virt_viewer_layout_free(layout);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/layout/grid", test_layout_grid);
+    g_test_add_func("/layout/row", test_layout_row);
+    g_test_add_func("/layout/disabled", test_layout_disabled);
+    g_test_add_func("/layout/removed", test_layout_removed);
+    g_test_add_func("/layout/minimal-diff", test_layout_minimal_diff);
+    g_test_add_func("/layout/forget-applied", test_layout_forget_applied);
+    g_test_add_func("/layout/16-heads", test_layout_16_heads);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
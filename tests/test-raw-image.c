@@ -0,0 +1,561 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "virt-viewer-raw-image.h"
+
+/*
+ * The raw image encoders, checked by decoding what they write. The
+ * decoders here are written from the format specifications, not from
+ * the encoders.
+ */
+
+static GdkPixbuf *
+image_new(gboolean alpha, gint width, gint height)
+{
+    GdkPixbuf *pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, alpha, 8, width, height);
+
+    g_assert(pixbuf != NULL);
+    /* Padding must never end up in the output */
+    memset(gdk_pixbuf_get_pixels(pixbuf), 0xaa,
+           (gsize)gdk_pixbuf_get_rowstride(pixbuf) * height);
+
+    return pixbuf;
+}
+
+static void
+image_set(GdkPixbuf *pixbuf, gint x, gint y,
+          guchar r, guchar g, guchar b, guchar a)
+{
+    guchar *p = gdk_pixbuf_get_pixels(pixbuf) +
+        (gsize)y * gdk_pixbuf_get_rowstride(pixbuf) +
+        (gsize)x * gdk_pixbuf_get_n_channels(pixbuf);
+
+    p[0] = r;
+    p[1] = g;
+    p[2] = b;
+    if (gdk_pixbuf_get_has_alpha(pixbuf))
+        p[3] = a;
+}
+
+static void
+image_fill(GdkPixbuf *pixbuf, guchar r, guchar g, guchar b, guchar a)
+{
+    gint x, y;
+
+    for (y = 0; y < gdk_pixbuf_get_height(pixbuf); y++)
+        for (x = 0; x < gdk_pixbuf_get_width(pixbuf); x++)
+            image_set(pixbuf, x, y, r, g, b, a);
+}
+
+/* The pixels as packed RGBA, opaque without an alpha channel */
+static guchar *
+image_rgba(GdkPixbuf *pixbuf)
+{
+    gint width = gdk_pixbuf_get_width(pixbuf);
+    gint height = gdk_pixbuf_get_height(pixbuf);
+    gint n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+    guchar *rgba = g_malloc((gsize)width * height * 4);
+    guchar *q = rgba;
+    gint x, y;
+
+    for (y = 0; y < height; y++) {
+        const guchar *p = gdk_pixbuf_get_pixels(pixbuf) +
+            (gsize)y * gdk_pixbuf_get_rowstride(pixbuf);
+
+        for (x = 0; x < width; x++, p += n_channels, q += 4) {
+            q[0] = p[0];
+            q[1] = p[1];
+            q[2] = p[2];
+            q[3] = n_channels == 4 ? p[3] : 255;
+        }
+    }
+
+    return rgba;
+}
+
+static gboolean
+encode_write(const gchar *buf, gsize count, GError **error G_GNUC_UNUSED, gpointer opaque)
+{
+    g_byte_array_append(opaque, (const guint8 *)buf, count);
+    return TRUE;
+}
+
+static GByteArray *
+encode(GdkPixbuf *pixbuf, const gchar *type)
+{
+    GByteArray *data = g_byte_array_new();
+    GError *error = NULL;
+    gboolean ok;
+
+    ok = virt_viewer_raw_image_save_to_callback(pixbuf, encode_write, data,
+                                                type, &error);
+    g_assert_no_error(error);
+    g_assert(ok);
+
+    return data;
+}
+
+static guint32
+read_be32(const guint8 *p)
+{
+    return (guint32)p[0] << 24 | (guint32)p[1] << 16 | (guint32)p[2] << 8 | p[3];
+}
+
+static guint32
+read_le32(const guint8 *p)
+{
+    return (guint32)p[3] << 24 | (guint32)p[2] << 16 | (guint32)p[1] << 8 | p[0];
+}
+
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING_SIZE 8
+
+static guchar *
+decode_qoi(const GByteArray *data, guint *width, guint *height, guint *channels)
+{
+    static const guint8 padding[QOI_PADDING_SIZE] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    const guint8 *p = data->data + QOI_HEADER_SIZE;
+    const guint8 *end = data->data + data->len - QOI_PADDING_SIZE;
+    guint8 index[64][4], px[4] = { 0, 0, 0, 255 };
+    guchar *rgba, *q;
+    guint run = 0;
+    gsize i, n;
+
+    g_assert_cmpuint(data->len, >=, QOI_HEADER_SIZE + QOI_PADDING_SIZE);
+    g_assert(memcmp(data->data, "qoif", 4) == 0);
+    *width = read_be32(data->data + 4);
+    *height = read_be32(data->data + 8);
+    *channels = data->data[12];
+    g_assert(*channels == 3 || *channels == 4);
+    g_assert_cmpuint(data->data[13], ==, 0);
+    g_assert(memcmp(end, padding, QOI_PADDING_SIZE) == 0);
+
+    memset(index, 0, sizeof(index));
+    n = (gsize)*width * *height;
+    rgba = q = g_malloc(n * 4 + 1);
+    for (i = 0; i < n; i++, q += 4) {
+        if (run > 0) {
+            run--;
+        } else {
+            guint8 op;
+
+            g_assert(p < end);
+            op = *p++;
+            if (op == 0xfe) {
+                g_assert(p + 3 <= end);
+                memcpy(px, p, 3);
+                p += 3;
+            } else if (op == 0xff) {
+                g_assert(p + 4 <= end);
+                memcpy(px, p, 4);
+                p += 4;
+            } else if ((op & 0xc0) == 0x00) {
+                memcpy(px, index[op], 4);
+            } else if ((op & 0xc0) == 0x40) {
+                px[0] += ((op >> 4) & 3) - 2;
+                px[1] += ((op >> 2) & 3) - 2;
+                px[2] += (op & 3) - 2;
+            } else if ((op & 0xc0) == 0x80) {
+                gint vg = (op & 0x3f) - 32;
+
+                g_assert(p < end);
+                px[0] += vg - 8 + (*p >> 4);
+                px[1] += vg;
+                px[2] += vg - 8 + (*p & 0xf);
+                p++;
+            } else {
+                run = op & 0x3f;
+            }
+            memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64], px, 4);
+        }
+        memcpy(q, px, 4);
+    }
+    /* A run must not go past the last pixel */
+    g_assert_cmpuint(run, ==, 0);
+    g_assert(p == end);
+
+    return rgba;
+}
+
+static const guint8 *
+skip_header(const GByteArray *data, const gchar *header)
+{
+    gsize len = strlen(header);
+
+    g_assert_cmpuint(data->len, >=, len);
+    g_assert(memcmp(data->data, header, len) == 0);
+
+    return data->data + len;
+}
+
+static guchar *
+decode_ppm(const GByteArray *data, guint width, guint height)
+{
+    gchar *header = g_strdup_printf("P6\n%u %u\n255\n", width, height);
+    const guint8 *p = skip_header(data, header);
+    gsize i, n = (gsize)width * height;
+    guchar *rgba = g_malloc(n * 4 + 1);
+
+    g_assert_cmpuint(data->len - (p - data->data), ==, n * 3);
+    for (i = 0; i < n; i++, p += 3) {
+        memcpy(rgba + i * 4, p, 3);
+        rgba[i * 4 + 3] = 255;
+    }
+    g_free(header);
+
+    return rgba;
+}
+
+static guchar *
+decode_pam(const GByteArray *data, guint width, guint height, guint channels)
+{
+    gchar *header = g_strdup_printf("P7\nWIDTH %u\nHEIGHT %u\nDEPTH %u\nMAXVAL 255\n"
+                                    "TUPLTYPE %s\nENDHDR\n", width, height, channels,
+                                    channels == 4 ? "RGB_ALPHA" : "RGB");
+    const guint8 *p = skip_header(data, header);
+    gsize i, n = (gsize)width * height;
+    guchar *rgba = g_malloc(n * 4 + 1);
+
+    g_assert_cmpuint(data->len - (p - data->data), ==, n * channels);
+    for (i = 0; i < n; i++, p += channels) {
+        memcpy(rgba + i * 4, p, channels);
+        if (channels == 3)
+            rgba[i * 4 + 3] = 255;
+    }
+    g_free(header);
+
+    return rgba;
+}
+
+static guchar *
+decode_bgrx(const GByteArray *data, guint width, guint height)
+{
+    const guint8 *p = data->data + 16;
+    gsize i, n = (gsize)width * height;
+    guchar *rgba = g_malloc(n * 4 + 1);
+
+    g_assert_cmpuint(data->len, ==, 16 + n * 4);
+    g_assert(memcmp(data->data, "BGRx", 4) == 0);
+    g_assert_cmpuint(read_le32(data->data + 4), ==, width);
+    g_assert_cmpuint(read_le32(data->data + 8), ==, height);
+    g_assert_cmpuint(read_le32(data->data + 12), ==, width * 4);
+    for (i = 0; i < n; i++, p += 4) {
+        rgba[i * 4 + 0] = p[2];
+        rgba[i * 4 + 1] = p[1];
+        rgba[i * 4 + 2] = p[0];
+        rgba[i * 4 + 3] = 255;
+    }
+
+    return rgba;
+}
+
+static void
+assert_pixels(const guchar *got, const guchar *expected, gsize n, gboolean alpha)
+{
+    gsize i;
+
+    for (i = 0; i < n; i++) {
+        if (memcmp(got + i * 4, expected + i * 4, alpha ? 4 : 3) != 0) {
+            g_test_message("pixel %" G_GSIZE_FORMAT " differs", i);
+            g_assert_not_reached();
+        }
+    }
+}
+
+/* Encodes @pixbuf in every format and checks it decodes back */
+static void
+check_round_trip(GdkPixbuf *pixbuf)
+{
+    guint width = gdk_pixbuf_get_width(pixbuf);
+    guint height = gdk_pixbuf_get_height(pixbuf);
+    guint channels = gdk_pixbuf_get_n_channels(pixbuf);
+    gsize n = (gsize)width * height;
+    guchar *expected = image_rgba(pixbuf);
+    guint w, h, c;
+    GByteArray *data;
+    guchar *got;
+
+    data = encode(pixbuf, "qoi");
+    got = decode_qoi(data, &w, &h, &c);
+    g_assert_cmpuint(w, ==, width);
+    g_assert_cmpuint(h, ==, height);
+    g_assert_cmpuint(c, ==, channels);
+    assert_pixels(got, expected, n, TRUE);
+    g_free(got);
+    g_byte_array_unref(data);
+
+    data = encode(pixbuf, "ppm");
+    got = decode_ppm(data, width, height);
+    assert_pixels(got, expected, n, FALSE);
+    g_free(got);
+    g_byte_array_unref(data);
+
+    data = encode(pixbuf, "pam");
+    got = decode_pam(data, width, height, channels);
+    assert_pixels(got, expected, n, TRUE);
+    g_free(got);
+    g_byte_array_unref(data);
+
+    data = encode(pixbuf, "bgrx");
+    got = decode_bgrx(data, width, height);
+    assert_pixels(got, expected, n, FALSE);
+    g_free(got);
+    g_byte_array_unref(data);
+
+    g_free(expected);
+}
+
+static void
+test_raw_image_lookup(void)
+{
+    GdkPixbuf *pixbuf = image_new(FALSE, 1, 1);
+    GError *error = NULL;
+    gboolean ok;
+
+    g_assert_cmpstr(virt_viewer_raw_image_lookup("QOI"), ==, "qoi");
+    g_assert_cmpstr(virt_viewer_raw_image_lookup("bgrx"), ==, "bgrx");
+    g_assert(virt_viewer_raw_image_lookup("png") == NULL);
+
+    ok = virt_viewer_raw_image_save_to_callback(pixbuf, encode_write, NULL,
+                                                "png", &error);
+    g_assert(!ok);
+    g_assert_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_UNKNOWN_TYPE);
+    g_clear_error(&error);
+
+    g_object_unref(pixbuf);
+}
+
+/* Noise, smooth gradients and flat areas, with and without alpha */
+static void
+test_raw_image_round_trip(void)
+{
+    static const gint sizes[][2] = { { 1, 1 }, { 3, 2 }, { 17, 9 }, { 64, 3 }, { 130, 7 } };
+    guint i, alpha, kind;
+
+    for (i = 0; i < G_N_ELEMENTS(sizes); i++) {
+        for (alpha = 0; alpha < 2; alpha++) {
+            for (kind = 0; kind < 3; kind++) {
+                gint width = sizes[i][0], height = sizes[i][1];
+                GdkPixbuf *pixbuf = image_new(alpha, width, height);
+                gint x, y;
+
+                for (y = 0; y < height; y++) {
+                    for (x = 0; x < width; x++) {
+                        if (kind == 0)
+                            image_set(pixbuf, x, y,
+                                      g_test_rand_int_range(0, 256),
+                                      g_test_rand_int_range(0, 256),
+                                      g_test_rand_int_range(0, 256),
+                                      g_test_rand_int_range(0, 256));
+                        else if (kind == 1)
+                            /* Small steps, DIFF and LUMA, wrapping around */
+                            image_set(pixbuf, x, y, 250 + x, y * 3, 128 - x * 20,
+                                      x % 5 == 0 ? 255 : 254);
+                        else
+                            /* Flat areas, runs and index hits */
+                            image_set(pixbuf, x, y, (x / 4) % 2 ? 200 : 10, 20, 30,
+                                      y % 2 ? 255 : 0);
+                    }
+                }
+                check_round_trip(pixbuf);
+                g_object_unref(pixbuf);
+            }
+        }
+    }
+}
+
+/* A run is not cut at the end of a row */
+static void
+test_raw_image_qoi_run_across_rows(void)
+{
+    GdkPixbuf *pixbuf = image_new(FALSE, 7, 5);
+    GByteArray *data;
+    const guint8 *ops;
+
+    image_fill(pixbuf, 10, 20, 30, 255);
+    data = encode(pixbuf, "qoi");
+    ops = data->data + QOI_HEADER_SIZE;
+
+    /* The first pixel, then the other 34 in a single run */
+    g_assert_cmpuint(data->len, ==, QOI_HEADER_SIZE + 4 + 1 + QOI_PADDING_SIZE);
+    g_assert_cmpuint(ops[0], ==, 0xfe);
+    g_assert_cmpuint(ops[4], ==, 0xc0 | (34 - 1));
+
+    check_round_trip(pixbuf);
+    g_byte_array_unref(data);
+    g_object_unref(pixbuf);
+}
+
+/* Runs are at most 62 long, 63 and 64 would be the RGB and RGBA tags */
+static void
+test_raw_image_qoi_run_62(void)
+{
+    static const struct {
+        gint width, height;
+        guint nops;
+        guint8 runs[2];
+    } cases[] = {
+        { 63, 1, 1, { 0xc0 | 61 } },
+        { 64, 1, 2, { 0xc0 | 61, 0xc0 | 0 } },
+        { 40, 2, 2, { 0xc0 | 61, 0xc0 | 16 } },
+        { 25, 5, 2, { 0xc0 | 61, 0xc0 | 61 } },
+    };
+    guint i, j;
+
+    for (i = 0; i < G_N_ELEMENTS(cases); i++) {
+        GdkPixbuf *pixbuf = image_new(FALSE, cases[i].width, cases[i].height);
+        GByteArray *data;
+        const guint8 *ops;
+
+        image_fill(pixbuf, 10, 20, 30, 255);
+        data = encode(pixbuf, "qoi");
+        ops = data->data + QOI_HEADER_SIZE;
+
+        g_assert_cmpuint(data->len, ==,
+                         QOI_HEADER_SIZE + 4 + cases[i].nops + QOI_PADDING_SIZE);
+        g_assert_cmpuint(ops[0], ==, 0xfe);
+        for (j = 0; j < cases[i].nops; j++) {
+            g_assert_cmpuint(ops[4 + j], <, 0xfe);
+            g_assert_cmpuint(ops[4 + j] & 0xc0, ==, 0xc0);
+            if (j < G_N_ELEMENTS(cases[i].runs) && cases[i].runs[j])
+                g_assert_cmpuint(ops[4 + j], ==, cases[i].runs[j]);
+        }
+
+        check_round_trip(pixbuf);
+        g_byte_array_unref(data);
+        g_object_unref(pixbuf);
+    }
+}
+
+#define QOI_HASH(r, g, b, a) (((r) * 3 + (g) * 5 + (b) * 7 + (a) * 11) % 64)
+
+/* Alpha changes need RGBA, DIFF and LUMA keep the previous alpha */
+static void
+test_raw_image_qoi_alpha(void)
+{
+    GdkPixbuf *pixbuf = image_new(TRUE, 5, 1);
+    GByteArray *data;
+    const guint8 *ops;
+
+    image_set(pixbuf, 0, 0, 1, 2, 3, 255);
+    image_set(pixbuf, 1, 0, 1, 2, 3, 128);
+    image_set(pixbuf, 2, 0, 1, 2, 3, 255);
+    image_set(pixbuf, 3, 0, 1, 2, 3, 128);
+    image_set(pixbuf, 4, 0, 2, 2, 3, 128);
+    data = encode(pixbuf, "qoi");
+    ops = data->data + QOI_HEADER_SIZE;
+
+    g_assert_cmpuint(data->len, ==, QOI_HEADER_SIZE + 2 + 5 + 1 + 1 + 1 + QOI_PADDING_SIZE);
+    /* From the implicit opaque black: vg 2, vg_r -1, vg_b 1 */
+    g_assert_cmpuint(ops[0], ==, 0x80 | (2 + 32));
+    g_assert_cmpuint(ops[1], ==, (-1 + 8) << 4 | (1 + 8));
+    g_assert_cmpuint(ops[2], ==, 0xff);
+    g_assert_cmpuint(ops[6], ==, 128);
+    g_assert_cmpuint(ops[7], ==, QOI_HASH(1, 2, 3, 255));
+    g_assert_cmpuint(ops[8], ==, QOI_HASH(1, 2, 3, 128));
+    /* Same alpha as the previous pixel, so a DIFF with vr 1 */
+    g_assert_cmpuint(ops[9], ==, 0x40 | 3 << 4 | 2 << 2 | 2);
+
+    check_round_trip(pixbuf);
+    g_byte_array_unref(data);
+    g_object_unref(pixbuf);
+}
+
+/* The index starts zeroed, so transparent black is an index hit at once */
+static void
+test_raw_image_qoi_transparent(void)
+{
+    GdkPixbuf *pixbuf = image_new(TRUE, 3, 3);
+    GByteArray *data;
+
+    image_fill(pixbuf, 0, 0, 0, 0);
+    data = encode(pixbuf, "qoi");
+
+    g_assert_cmpuint(data->len, ==, QOI_HEADER_SIZE + 1 + 1 + QOI_PADDING_SIZE);
+    g_assert_cmpuint(data->data[QOI_HEADER_SIZE], ==, 0x00);
+    g_assert_cmpuint(data->data[QOI_HEADER_SIZE + 1], ==, 0xc0 | (8 - 1));
+
+    check_round_trip(pixbuf);
+    g_byte_array_unref(data);
+    g_object_unref(pixbuf);
+}
+
+/* Two colors taking turns: each is written once, then found in the index */
+static void
+test_raw_image_qoi_index(void)
+{
+    GdkPixbuf *pixbuf = image_new(FALSE, 9, 4);
+    GByteArray *data;
+    guint i, n = 9 * 4;
+    gint x, y;
+
+    g_assert_cmpuint(QOI_HASH(200, 10, 90, 255), !=, QOI_HASH(15, 180, 60, 255));
+    for (y = 0; y < 4; y++)
+        for (x = 0; x < 9; x++) {
+            if ((y * 9 + x) % 2)
+                image_set(pixbuf, x, y, 15, 180, 60, 255);
+            else
+                image_set(pixbuf, x, y, 200, 10, 90, 255);
+        }
+    data = encode(pixbuf, "qoi");
+
+    g_assert_cmpuint(data->len, ==, QOI_HEADER_SIZE + 4 + 4 + (n - 2) + QOI_PADDING_SIZE);
+    for (i = 2; i < n; i++) {
+        guint8 op = data->data[QOI_HEADER_SIZE + 8 + i - 2];
+
+        g_assert_cmpuint(op, ==, i % 2 ? QOI_HASH(15, 180, 60, 255) : QOI_HASH(200, 10, 90, 255));
+    }
+
+    check_round_trip(pixbuf);
+    g_byte_array_unref(data);
+    g_object_unref(pixbuf);
+}
+
+int
+main(int argc, char **argv)
+{
+#if !GLIB_CHECK_VERSION(2, 35, 0)
+    g_type_init();
+#endif
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/raw-image/lookup", test_raw_image_lookup);
+    g_test_add_func("/raw-image/round-trip", test_raw_image_round_trip);
+    g_test_add_func("/raw-image/qoi/run-across-rows", test_raw_image_qoi_run_across_rows);
+    g_test_add_func("/raw-image/qoi/run-62", test_raw_image_qoi_run_62);
+    g_test_add_func("/raw-image/qoi/alpha", test_raw_image_qoi_alpha);
+    g_test_add_func("/raw-image/qoi/transparent", test_raw_image_qoi_transparent);
+    g_test_add_func("/raw-image/qoi/index", test_raw_image_qoi_index);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
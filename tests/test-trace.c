@@ -0,0 +1,113 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "virt-viewer-trace.h"
+
+static void
+test_trace_name_id(void)
+{
+    gchar long_name[VIRT_VIEWER_TRACE_NAME_SIZE + 10];
+    guint32 a, b;
+
+    g_assert_cmpuint(virt_viewer_trace_name_id(NULL), ==, 0);
+
+    a = virt_viewer_trace_name_id("open pending channels");
+    b = virt_viewer_trace_name_id("monitor config");
+    g_assert_cmpuint(a, >, 0);
+    g_assert_cmpuint(b, >, 0);
+    g_assert_cmpuint(a, !=, b);
+    g_assert_cmpuint(virt_viewer_trace_name_id("open pending channels"), ==, a);
+
+    /* Names too long for the table share the id of their prefix */
+    memset(long_name, 'x', sizeof(long_name) - 1);
+    long_name[sizeof(long_name) - 1] = '\0';
+    a = virt_viewer_trace_name_id(long_name);
+    long_name[sizeof(long_name) - 2] = 'y';
+    g_assert_cmpuint(virt_viewer_trace_name_id(long_name), ==, a);
+}
+
+/* A stall record names its source through the table after the ring */
+static void
+test_trace_dump_names(void)
+{
+    const VirtViewerTraceHeader *header;
+    const VirtViewerTraceRecord *ring, *record;
+    const gchar *names;
+    gchar *path, *contents;
+    gsize length;
+    guint32 id;
+    gboolean ok;
+
+    id = virt_viewer_trace_name_id("screenshot done");
+    virt_viewer_trace(VIRT_VIEWER_TRACE_MAIN_LOOP_STALL, 250, id);
+
+    path = g_build_filename(g_get_tmp_dir(), "test-trace.bin", NULL);
+    ok = virt_viewer_trace_dump(path);
+    g_assert(ok);
+    ok = g_file_get_contents(path, &contents, &length, NULL);
+    g_assert(ok);
+    g_unlink(path);
+
+    g_assert_cmpuint(length, ==, sizeof(VirtViewerTraceHeader) +
+                     VIRT_VIEWER_TRACE_RECORDS * sizeof(VirtViewerTraceRecord) +
+                     VIRT_VIEWER_TRACE_NAMES * VIRT_VIEWER_TRACE_NAME_SIZE);
+    header = (const VirtViewerTraceHeader *)contents;
+    g_assert(memcmp(header->magic, VIRT_VIEWER_TRACE_MAGIC, sizeof(header->magic)) == 0);
+    g_assert_cmpuint(header->head, >, 0);
+
+    ring = (const VirtViewerTraceRecord *)(contents + sizeof(*header));
+    record = &ring[(header->head - 1) % VIRT_VIEWER_TRACE_RECORDS];
+    g_assert_cmpuint(record->event, ==, VIRT_VIEWER_TRACE_MAIN_LOOP_STALL);
+    g_assert_cmpint(record->args[0], ==, 250);
+    g_assert_cmpint(record->args[1], ==, id);
+    g_assert(virt_viewer_trace_event_arg_is_name(record->event, 1));
+    g_assert(!virt_viewer_trace_event_arg_is_name(record->event, 0));
+
+    names = (const gchar *)(ring + VIRT_VIEWER_TRACE_RECORDS);
+    g_assert_cmpstr(names + (id - 1) * VIRT_VIEWER_TRACE_NAME_SIZE, ==, "screenshot done");
+
+    g_free(contents);
+    g_free(path);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/trace/name-id", test_trace_name_id);
+    g_test_add_func("/trace/dump-names", test_trace_dump_names);
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,214 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * Virt Viewer: A virtual machine console viewer
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "virt-glib-compat.h"
+#include "virt-viewer-tunnel.h"
+
+/*
+ * Tunnels opened and closed over and over, as a --reconnect kiosk
+ * does with its ssh tunnels. A shell printing on stderr, then copying
+ * its input back, stands in for ssh. Half the cycles close the
+ * connection and let the child exit, the others kill it the way a
+ * session going away does. After SOAK_CYCLES the process must have
+ * neither more children, zombie or not, nor more descriptors than
+ * after the first one.
+ */
+
+gboolean doDebug = FALSE;
+
+#define SOAK_CYCLES 1000
+#define REAP_TIMEOUT 5000 /* ms */
+#define STANDIN_BANNER "tunnel ready"
+
+#if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
+
+static const char *const standin[] = {
+    "sh", "-c", "echo '" STANDIN_BANNER "' >&2; exec cat", NULL
+};
+
+static guint exits;
+
+static void
+exited_cb(VirtViewerTunnel *tunnel,
+          gint status,
+          const gchar *errors,
+          gpointer opaque)
+{
+    g_assert(tunnel != NULL);
+    g_assert(opaque == &exits);
+    g_assert(WIFEXITED(status));
+    g_assert_cmpint(WEXITSTATUS(status), ==, 0);
+    g_assert_cmpstr(errors, ==, STANDIN_BANNER);
+    exits++;
+}
+
+/* -1 without /proc */
+static gint
+count_dir(const gchar *path)
+{
+    GDir *dir = g_dir_open(path, 0, NULL);
+    gint n = 0;
+
+    if (!dir)
+        return -1;
+    while (g_dir_read_name(dir))
+        n++;
+    g_dir_close(dir);
+
+    return n;
+}
+
+static gint
+count_children(void)
+{
+    GDir *dir = g_dir_open("/proc", 0, NULL);
+    const gchar *name;
+    gint n = 0;
+
+    if (!dir)
+        return -1;
+    while ((name = g_dir_read_name(dir))) {
+        gchar *path, *stat, *end;
+        long ppid;
+
+        if (!g_ascii_isdigit(name[0]))
+            continue;
+        path = g_build_filename("/proc", name, "stat", NULL);
+        /* "pid (comm) state ppid ...", comm may contain anything */
+        if (g_file_get_contents(path, &stat, NULL, NULL)) {
+            if ((end = strrchr(stat, ')')) != NULL &&
+                strlen(end) > 4) {
+                ppid = strtol(end + 4, NULL, 10);
+                if (ppid == getpid())
+                    n++;
+            }
+            g_free(stat);
+        }
+        g_free(path);
+    }
+    g_dir_close(dir);
+
+    return n;
+}
+
+/* Runs the main loop until the child watches reaped down to @children */
+static void
+reap(gint children)
+{
+    gint64 deadline = g_get_monotonic_time() + REAP_TIMEOUT * 1000;
+
+    while (count_children() > children &&
+           g_get_monotonic_time() < deadline) {
+        while (g_main_context_iteration(NULL, FALSE))
+            ;
+        g_usleep(1000);
+    }
+    g_assert_cmpint(count_children(), ==, children);
+}
+
+static void
+cycle(guint i, gint children)
+{
+    VirtViewerTunnel *tunnel;
+    gchar c = 'x';
+    int fd = -1;
+    ssize_t n;
+
+    tunnel = virt_viewer_tunnel_open(standin, &fd, exited_cb, &exits);
+    g_assert(tunnel != NULL);
+    g_assert_cmpint(fd, >=, 0);
+
+    /* Connected through the child */
+    n = write(fd, &c, 1);
+    g_assert_cmpint(n, ==, 1);
+    c = 0;
+    n = read(fd, &c, 1);
+    g_assert_cmpint(n, ==, 1);
+    g_assert_cmpint(c, ==, 'x');
+
+    if (i % 2)
+        virt_viewer_tunnel_kill(tunnel);
+    close(fd);
+
+    reap(children);
+}
+
+static void
+test_tunnel_soak(void)
+{
+    gint children, fds;
+    gdouble elapsed;
+    guint i;
+
+    children = count_children();
+    if (children < 0) {
+        g_test_message("No /proc, skipping");
+        return;
+    }
+
+    /* The first child watch sets up what the loop needs to reap */
+    cycle(0, children);
+    fds = count_dir("/proc/self/fd");
+    g_assert_cmpint(fds, >, 0);
+
+    g_test_timer_start();
+    for (i = 1; i < SOAK_CYCLES; i++) {
+        cycle(i, children);
+        if (i % 100 == 0)
+            g_assert_cmpint(count_dir("/proc/self/fd"), ==, fds);
+    }
+    elapsed = g_test_timer_elapsed();
+    g_test_message("%u cycles, %.2f ms each", SOAK_CYCLES, elapsed * 1000 / SOAK_CYCLES);
+
+    g_assert_cmpint(count_children(), ==, children);
+    g_assert_cmpint(count_dir("/proc/self/fd"), ==, fds);
+    /* Killed tunnels don't report their exit */
+    g_assert_cmpuint(exits, ==, SOAK_CYCLES / 2);
+}
+
+#endif /* defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK) */
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+#if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
+    g_test_add_func("/tunnel/soak", test_tunnel_soak);
+#endif
+
+    return g_test_run();
+}
+
+/*
+ * Local variables:
+ *  c-indent-level: 4
+ *  c-basic-offset: 4
+ *  indent-tabs-mode: nil
+ * End:
+ */